@@ -15,8 +15,177 @@ namespace minibm {
     Device_CanAutodetectDisplayMode = 1 ///< This device can autodetect the input display mode.
   };
 
+  //! \enum DeviceEvent
+  //! \brief Device events passed to the device notification callback.
+  enum DeviceEvent: uint32_t {
+    DeviceEvent_Arrived = 1,       ///< A new device was connected and added to the device table.
+    DeviceEvent_Removed = 2,       ///< A device was disconnected and removed from the device table.
+    DeviceEvent_SignalLost = 3,    ///< A capturing device lost its input signal. Sent as the first frame without one arrives.
+    DeviceEvent_SignalRestored = 4 ///< A capturing device's input signal came back.
+  };
+
+  //! \enum FrameFlags
+  //! \brief Bitflags that can exist for a captured frame.
+  enum FrameFlags: uint32_t {
+    Frame_FormatChanged = 1, ///< The input format changed since the previous frame. Size and timing may differ from it.
+    Frame_Duplicate = 2,     ///< The frame is identical to the previous one. Only set with the dedupe=flag capture option.
+    Frame_Black = 4,         ///< The frame is black. Only set with black analysis enabled.
+    Frame_Clipped = 8,       ///< The frame has too many pixels outside legal luma range. Only set with clipping analysis enabled.
+    Frame_Frozen = 16,       ///< The input has been frozen for a while. Only set with freeze analysis enabled.
+    Frame_Downscaled = 32,   ///< The frame was converted at half width and height, by the downscale degrade step.
+    Frame_Decimated = 64,    ///< The frame before this one was dropped by the decimate degrade step.
+    Frame_Deferred = 128,    ///< The frame was only converted once it was picked up, by the skip degrade step.
+    Frame_NoSignal = 256     ///< The input had no signal. The picture is what the nosignal capture option says, if any.
+  };
+
+  //! \enum AnalysisFlags
+  //! \brief Per-frame statistics that can be enabled with the analysis capture option.
+  enum AnalysisFlags: uint32_t {
+    Analysis_Histogram = 1, ///< Luma histogram.
+    Analysis_Black = 2,     ///< Black pixel count.
+    Analysis_Clipping = 4,  ///< Clipped pixel counts.
+    Analysis_Freeze = 8     ///< Frozen frame count.
+  };
+
+  //! \enum PixelFormat
+  //! \brief Pixel formats that captured frames can be delivered in, chosen with the output capture option.
+  //!        Values are four character codes. BGRA matches the DeckLink code, the rest follow Linux DRM codes.
+  enum PixelFormat: uint32_t {
+    Pixel_BGRA = 'BGRA',    ///< 8 bits per channel, in B, G, R, A byte order.
+    Pixel_RGB10A2 = 'AB30', ///< 32 bits per pixel, with 10-bit R in the low bits, then G and B, and 2 bits of alpha on top.
+    Pixel_RGBA64 = 'AB48',  ///< 16 bits per channel, in R, G, B, A order.
+    Pixel_P010 = 'P010'     ///< Limited range 4:2:0 YUV in 16-bit words with 10 significant high bits. A plane of luma
+                            ///< is followed by a half-height plane of interleaved Cb and Cr, with the same rowbytes.
+  };
+
+  //! \enum TensorLayout
+  //! \brief Element layouts of the tensor that get_frames_batch can fill in.
+  //!        The tensor is frames x height x width x channels, densely packed.
+  enum TensorLayout: uint32_t {
+    Tensor_None = 0,
+    Tensor_RGB8 = 1,   ///< 3 bytes per pixel.
+    Tensor_BGR8 = 2,   ///< 3 bytes per pixel.
+    Tensor_RGBA8 = 3,  ///< 4 bytes per pixel.
+    Tensor_BGRA8 = 4,  ///< 4 bytes per pixel, same as the frames themselves.
+    Tensor_RGBF32 = 5, ///< 3 floats per pixel, scaled to 0..1.
+    Tensor_BGRF32 = 6  ///< 3 floats per pixel, scaled to 0..1.
+  };
+
+  //! \struct FrameAnalysis
+  //! \brief Statistics of a captured frame, gathered while converting it.
+  //!        Luma statistics are only available when the input is 8-bit YUV.
+  struct FrameAnalysis {
+    uint32_t flags;          ///< Statistics present in this structure. \see AnalysisFlags
+    uint32_t pixels;         ///< Number of pixels the luma statistics cover.
+    uint32_t black;          ///< Pixels with luma at or below the black level.
+    uint32_t clippedlow;     ///< Pixels with luma below the legal minimum of 16.
+    uint32_t clippedhigh;    ///< Pixels with luma above the legal maximum of 235.
+    uint32_t frozen;         ///< Number of consecutive frames up to this one identical to the one before them.
+    uint32_t histogram[256]; ///< Number of pixels for each 8-bit luma code value.
+  };
+
+  //! \enum SnapshotFormat
+  //! \brief Image formats that snapshots can be encoded in.
+  enum SnapshotFormat: uint32_t {
+    Snapshot_None = 0,
+    Snapshot_JPEG = 1, ///< Baseline JFIF with 4:2:0 chroma.
+    Snapshot_QOI = 2   ///< Lossless QOI, see https://qoiformat.org/
+  };
+
+  //! \struct SnapshotInfo
+  //! \brief Details of an encoded snapshot.
+  struct SnapshotInfo {
+    uint32_t format;    ///< Image format. \see SnapshotFormat
+    uint32_t width;     ///< Image width in pixels.
+    uint32_t height;    ///< Image height in pixels.
+    uint32_t index;     ///< Index of the frame the snapshot was taken from.
+    int64_t timestamp;  ///< Stream time of that frame, in timescale units.
+    int64_t timescale;  ///< Time scale of timestamp, in units per second.
+    uint32_t size;      ///< Size of the encoded image in bytes.
+  };
+
+  //! \struct FrameInfo
+  //! \brief Details of a captured frame.
+  struct FrameInfo {
+    uint32_t width;       ///< Frame width in pixels.
+    uint32_t height;      ///< Frame height in pixels.
+    uint32_t rowbytes;    ///< Bytes per row of pixels, or per row of each plane for planar formats.
+    uint32_t pixelformat; ///< Pixel format. \see PixelFormat
+    uint32_t index;       ///< Frame index since the start of capture.
+    uint32_t flags;       ///< Frame flags. \see FrameFlags
+    uint8_t* buffer;      ///< Pointer to the pixel data, or null if the frame has no picture.
+    int64_t timestamp;    ///< Stream time of the frame, in timescale units.
+    int64_t duration;     ///< Duration of the frame, in timescale units.
+    int64_t timescale;    ///< Time scale of timestamp and duration, in units per second.
+    uint32_t tilesize;    ///< Tile width and height in pixels, or 0 if change tracking is off.
+    uint32_t tilecolumns; ///< Number of tile columns.
+    uint32_t tilerows;    ///< Number of tile rows.
+    const uint8_t* tiles; ///< Bitmap of tiles that changed since the previously returned frame, or null.
+                          ///< Tile (x, y) is bit n % 8 of byte n / 8, where n = y * tilecolumns + x.
+    const FrameAnalysis* analysis; ///< Frame statistics, or null if analysis is off.
+  };
+
+  // DLPack tensor ABI (https://github.com/dmlc/dlpack), declared here so that we don't depend on dlpack.h.
+  // These are layout compatible with its DLManagedTensor and can be cast to it.
+
+  enum DLDeviceType: int32_t {
+    kDLCPU = 1
+  };
+
+  struct DLDevice {
+    DLDeviceType device_type;
+    int32_t device_id;
+  };
+
+  enum DLDataTypeCode: uint8_t {
+    kDLInt = 0,
+    kDLUInt = 1,
+    kDLFloat = 2
+  };
+
+  struct DLDataType {
+    uint8_t code;
+    uint8_t bits;
+    uint16_t lanes;
+  };
+
+  struct DLTensor {
+    void* data;
+    DLDevice device;
+    int32_t ndim;
+    DLDataType dtype;
+    int64_t* shape;
+    int64_t* strides; ///< In elements, not bytes.
+    uint64_t byte_offset;
+  };
+
+  //! \struct DLManagedTensor
+  //! \brief A tensor along with the means to free it. Whoever ends up owning it must call deleter once done.
+  struct DLManagedTensor {
+    DLTensor dl_tensor;
+    void* manager_ctx;
+    void( *deleter )( DLManagedTensor* self );
+  };
+
 # define MINIBM_CALL __stdcall
 
+  //! \typedef fn_device_notify
+  //! \brief Device notification callback. Called from a library-internal thread. Signal events come from
+  //!        the capture callback thread, so they must be handled quickly and without calling back into the library.
+  //! \param event      The event that happened. \see DeviceEvent
+  //! \param device_id  Persistent unique ID of the device in question.
+  //! \param generation Device table generation after the change.
+  //! \param userdata   The userdata pointer given to set_device_notify.
+  typedef void( MINIBM_CALL* fn_device_notify )(
+    uint32_t event, int64_t device_id, uint32_t generation, void* userdata );
+
+  //! \typedef fn_frame_notify
+  //! \brief Frame notification callback. Called from the capture callback thread, so it must return quickly
+  //!        and must not call back into the library. Wake up a consumer to fetch the frame instead.
+  //! \param index    Index of the frame that became available, or 0 when the capture stops.
+  //! \param userdata The userdata pointer given to set_frame_notify.
+  typedef void( MINIBM_CALL* fn_frame_notify )( uint32_t index, void* userdata );
+
 #ifdef MINIBM_STATIC
 
   extern "C" {
@@ -32,12 +201,37 @@ namespace minibm {
     //! \fn uint32_t __stdcall get_devices();
     //! \brief Get the number of available Blackmagic devices.
     //! \returns The number of devices.
+    //!          Device indices are valid until the device table generation changes.
+    //!          The table can be refreshed from any thread while others use it.
     uint32_t MINIBM_CALL get_devices();
 
+    //! \fn uint32_t __stdcall get_device_generation();
+    //! \brief Get the current device table generation.
+    //!        The generation is bumped whenever a device arrives or is removed.
+    //!        Call get_devices again to refresh device indices when it changes.
+    //! \returns The device table generation.
+    uint32_t MINIBM_CALL get_device_generation();
+
+    //! \fn void __stdcall set_device_notify( fn_device_notify callback, void* userdata );
+    //! \brief Sets a callback that is called whenever a device arrives or is removed.
+    //! \param callback Callback function, or null to disable notifications.
+    //! \param userdata Opaque pointer that is passed to the callback.
+    void MINIBM_CALL set_device_notify( fn_device_notify callback, void* userdata );
+
+    //! \fn void __stdcall set_frame_notify( fn_frame_notify callback, void* userdata );
+    //! \brief Sets a callback that is called whenever the ongoing capture has a new frame available,
+    //!        for consumers that would rather not park a thread in get_frame_blocking.
+    //!        Once this returns, the previous callback is no longer being called.
+    //! \param callback Callback function, or null to disable notifications.
+    //! \param userdata Opaque pointer that is passed to the callback.
+    void MINIBM_CALL set_frame_notify( fn_frame_notify callback, void* userdata );
+
     //! \fn void __stdcall set_options( const char* library_options );
     //! \brief Sets a global options string for the library.
     //! \param library_options A properly formatted options string.
     //!                        Can be empty or null if no extra options are needed.
+    //!                        Options are merged into the ones set previously,
+    //!                        and apply to an ongoing capture where possible.
     void MINIBM_CALL set_options( const char* library_options );
 
     //! \fn bool __stdcall get_device( uint32_t index, char* out_name, uint32_t namelen, int64_t* out_id, uint32_t* out_displaymodecount, uint32_t* out_flags );
@@ -45,7 +239,8 @@ namespace minibm {
     //! \param       index                 Zero-based index of the target device.
     //! \param [out] out_name              Pointer to a buffer where the device name will be copied.
     //! \param       namelen               Length of the buffer pointed to by out_name.
-    //! \param [out] out_id                Pointer to a variable that will receive the persistent unique device ID.
+    //! \param [out] out_id                Pointer to a variable that will receive the unique device ID. It is the
+    //!                                    persistent ID where the device has one, and otherwise only stays the same while the device is present.
     //! \param [out] out_displaymodecount  Pointer to a variable that will receive the number of available display modes on the device.
     //! \param [out] out_flags             Pointer to a variable that will receive the device flags. \see DeviceFlags
     //! \returns True if it succeeds, false if it fails.
@@ -71,21 +266,43 @@ namespace minibm {
 
     //! \fn bool __stdcall start_capture_single( uint32_t index, uint32_t modecode, const char* source );
     //! \brief Starts capturing on a single Blackmagic device.
+    //!        If the device was prepared with prepare_capture in the same mode, it goes live straight from standby,
+    //!        and the options it was prepared with stay in effect.
     //! \param index           Zero-based index of the target device.
     //! \param modecode        The unique code of the display mode to use. Can be found by enumerating get_device_displaymode.
     //! \param capture_options A properly formatted string of extra options on how the capture should behave.
     //!                        Can be empty or null if no extra options are needed.
-    //! \returns True if it succeeds, false if it fails.
+    //! \returns True if it succeeds, false if it fails. If it failed for lack of memory, get_last_error tells why.
     bool MINIBM_CALL start_capture_single(
       uint32_t index, uint32_t modecode, const char* capture_options );
 
+    //! \fn bool __stdcall prepare_capture( uint32_t index, uint32_t modecode, const char* capture_options );
+    //! \brief Puts a device in warm standby, so that start_capture_single on it later only has to start delivering
+    //!        frames. The input is started and its buffers are set up, but frames are discarded until then.
+    //!        Calling this on the device of the ongoing capture in its mode puts it back in standby as it is, ending the capture but
+    //!        keeping the input running. Any number of devices can be in standby at once.
+    //! \param index           Zero-based index of the target device.
+    //! \param modecode        The unique code of the display mode to use.
+    //! \param capture_options Options for the capture, as with start_capture_single. Can be empty or null.
+    //! \returns True if it succeeds, false if it fails.
+    bool MINIBM_CALL prepare_capture(
+      uint32_t index, uint32_t modecode, const char* capture_options );
+
+    //! \fn bool __stdcall release_standby( uint32_t index );
+    //! \brief Stops a device that is in standby.
+    //! \param index Zero-based index of the target device.
+    //! \returns True if it succeeds, false if the device wasn't in standby.
+    bool MINIBM_CALL release_standby( uint32_t index );
+
     //! \fn bool __stdcall get_frame_bgra32_blocking( uint32_t* out_width, uint32_t* out_height, uint8_t** out_buffer, uint32_t* out_index );
     //! \brief Get a single frame from the currently ongoing capture.
     //!        The call might block until a new frame is available.
     //!        It does not have to be called with any exact timing.
     //!        It will always return the latest received frame, and never the same frame twice.
     //!        The frame index can be used to figure out the number of possibly skipped frames.
-    //!        The image format is always 32-bit BGRA.
+    //!        The image format is always 32-bit BGRA. If the capture was started with a different
+    //!        output format, such as rgb10, rgba64 or p010, the call fails right away without
+    //!        taking a frame, so a failure can also mean that rather than a stopped capture.
     //! \param [out] out_width  Pointer to a variable that will receive the frame width in pixels.
     //! \param [out] out_height Pointer to a variable that will receive the frame height in pixels.
     //! \param [out] out_buffer Pointer to a variable that will receive a pointer to the data buffer.
@@ -97,12 +314,208 @@ namespace minibm {
       uint32_t* out_width, uint32_t* out_height, uint8_t** out_buffer,
       uint32_t* out_index );
 
+    //! \fn bool __stdcall get_frame_blocking( FrameInfo* out_frame, uint32_t timeout_ms );
+    //! \brief Get a single frame from the currently ongoing capture, along with its details.
+    //!        Works like get_frame_bgra32_blocking, but will give up after a timeout.
+    //! \param [out] out_frame  Pointer to a structure that will receive the frame details.
+    //!              The buffer and data in it will be valid until the next get_frame call or stopped capture.
+    //! \param       timeout_ms Maximum time to wait for a new frame in milliseconds, or 0xFFFFFFFF to wait indefinitely.
+    //! \returns True if a frame was returned, false on timeout or if there is no ongoing capture.
+    bool MINIBM_CALL get_frame_blocking( FrameInfo* out_frame, uint32_t timeout_ms );
+
+    //! \fn uint32_t __stdcall get_frames_batch( uint32_t max_frames, uint32_t timeout_ms, FrameInfo* out_frames, uint32_t tensor_layout, void* out_tensor, uint64_t tensor_length );
+    //! \brief Get several consecutive frames from the ongoing capture at once. Needs the queue capture option,
+    //!        without which this returns at most one frame like get_frame_blocking.
+    //!        Waits until max_frames are queued or the timeout passes, and then returns the oldest queued frames.
+    //!        A batch stops early at a change of frame size.
+    //! \param       max_frames    Maximum number of frames to return. Capped at the queue size.
+    //! \param       timeout_ms    Maximum time to wait for max_frames in milliseconds, or 0xFFFFFFFF to wait indefinitely.
+    //! \param [out] out_frames    Pointer to an array of at least max_frames structures that will receive the frame details.
+    //!              The buffers and data in them will be valid until the next get_frame call or stopped capture.
+    //! \param       tensor_layout Layout to fill out_tensor in, or Tensor_None. Needs bgra output. \see TensorLayout
+    //! \param [out] out_tensor    Pointer to a buffer that will receive the frames as one contiguous tensor. Can be null.
+    //! \param       tensor_length Length of the tensor buffer in bytes. The batch is capped at the number of frames that fit.
+    //! \returns The number of frames returned, or 0 on timeout, if there is no ongoing capture, if no frame fits the tensor,
+    //!          or if tensor_layout is not a TensorLayout value.
+    uint32_t MINIBM_CALL get_frames_batch( uint32_t max_frames, uint32_t timeout_ms, FrameInfo* out_frames,
+      uint32_t tensor_layout, void* out_tensor, uint64_t tensor_length );
+
+    //! \fn uint64_t __stdcall acquire_frame( FrameInfo* out_frame, uint32_t timeout_ms );
+    //! \brief Get a single frame from the ongoing capture under a lease, so that it stays valid until released
+    //!        rather than until the next get_frame call. Works like get_frame_blocking, but the frame is moved into
+    //!        one of the frames of the pool capture option without copying. Up to that many frames can be leased or
+    //!        exported with get_frame_dlpack at once. When all of them are out, this waits for one to be released.
+    //! \param [out] out_frame  Pointer to a structure that will receive the frame details. Can be null.
+    //! \param       timeout_ms Maximum time to wait in milliseconds, or 0xFFFFFFFF to wait indefinitely.
+    //! \returns The lease handle, or 0 on timeout or if there is no ongoing capture.
+    uint64_t MINIBM_CALL acquire_frame( FrameInfo* out_frame, uint32_t timeout_ms );
+
+    //! \fn bool __stdcall release_frame( uint64_t lease );
+    //! \brief Releases a leased frame back to the pool. The frame must not be used afterwards.
+    //!        Leases may outlive the capture they came from.
+    //! \param lease Lease handle from acquire_frame.
+    //! \returns True if it succeeds, false if the lease is unknown or was already released.
+    bool MINIBM_CALL release_frame( uint64_t lease );
+
+    //! \fn uint32_t __stdcall open_consumer( const char* consumer_options );
+    //! \brief Opens a consumer of the ongoing capture, with a frame cursor of its own. Needs the fanout capture option.
+    //!        Every consumer gets every frame it keeps up with out of one set of shared frames, without extra
+    //!        conversions or copies, so that several consumers don't take frames from each other.
+    //!        Consumers are closed when a new capture starts.
+    //! \param consumer_options Options for this consumer. Can be empty or null.
+    //!                         rate=<fps> delivers frames at a rate of its own, like the capture option.
+    //! \returns The consumer handle, or 0 if there is no ongoing capture or it has no fan-out ring.
+    uint32_t MINIBM_CALL open_consumer( const char* consumer_options );
+
+    //! \fn bool __stdcall get_consumer_frame( uint32_t consumer, FrameInfo* out_frame, uint32_t timeout_ms );
+    //! \brief Gets the next frame for a consumer. If the consumer fell behind the fan-out ring,
+    //!        this is the oldest frame still in it, and the frames in between count as dropped.
+    //! \param       consumer   Consumer handle from open_consumer.
+    //! \param [out] out_frame  Pointer to a structure that will receive the frame details.
+    //!              The buffer and data in it will be valid until the next get_consumer_frame call for the same
+    //!              consumer, or until the consumer is closed. The frame isn't overwritten meanwhile.
+    //! \param       timeout_ms Maximum time to wait for a new frame in milliseconds, or 0xFFFFFFFF to wait indefinitely.
+    //! \returns True if a frame was returned, false on timeout, for an unknown consumer or if there is no ongoing capture.
+    bool MINIBM_CALL get_consumer_frame( uint32_t consumer, FrameInfo* out_frame, uint32_t timeout_ms );
+
+    //! \fn void __stdcall close_consumer( uint32_t consumer );
+    //! \brief Closes a consumer, letting go of the frame it was holding.
+    //! \param consumer Consumer handle from open_consumer.
+    void MINIBM_CALL close_consumer( uint32_t consumer );
+
+    //! \fn DLManagedTensor* __stdcall get_frame_dlpack( FrameInfo* out_frame, uint32_t timeout_ms );
+    //! \brief Get a single frame from the ongoing capture as a DLPack tensor that owns it, so that the frame
+    //!        stays valid for exactly as long as the tensor lives, with no copying. Works like get_frame_blocking,
+    //!        but the frame is moved into one of a pool of frames set up with the pool capture option, and the
+    //!        tensor's deleter returns it there. The tensor may outlive the capture.
+    //!        BGRA frames are height x width x 4 bytes, rgba64 frames height x width x 4 uint16s, rgb10 frames
+    //!        height x width uint32s, and p010 frames (height + chroma rows) x width uint16s.
+    //! \param [out] out_frame  Pointer to a structure that will receive the frame details. Can be null.
+    //! \param       timeout_ms Maximum time to wait for a new frame in milliseconds, or 0xFFFFFFFF to wait indefinitely.
+    //! \returns The tensor, or null on timeout or if there is no ongoing capture.
+    DLManagedTensor* MINIBM_CALL get_frame_dlpack( FrameInfo* out_frame, uint32_t timeout_ms );
+
     //! \fn void __stdcall stop_capture_single();
     //! \brief Stop capturing on a single Blackmagic device.
     void MINIBM_CALL stop_capture_single();
 
+    //! \fn bool __stdcall start_capture_group( const uint32_t* indices, uint32_t count, uint32_t modecode, const char* capture_options );
+    //! \brief Starts capturing on several devices together, for getting frames captured at the same instant from
+    //!        all of them with get_frame_set. Frames are timed by each card's hardware reference clock, mapped onto
+    //!        the host clock, or by when they arrived if a card has none. Only one group can capture at a time, and
+    //!        its devices can't be captured on otherwise meanwhile.
+    //! \param indices         Zero-based indices of the target devices.
+    //! \param count           Number of devices in indices.
+    //! \param modecode        The unique code of the display mode to use on every device.
+    //! \param capture_options Options for every device's capture, as with start_capture_single. Can be empty or null.
+    //!                        The group.tolerance and group.incomplete options control how frames are matched.
+    //! \returns True if it succeeds, false if it fails.
+    bool MINIBM_CALL start_capture_group(
+      const uint32_t* indices, uint32_t count, uint32_t modecode, const char* capture_options );
+
+    //! \fn uint32_t __stdcall get_frame_set( FrameInfo* out_frames, uint32_t count, uint32_t timeout_ms );
+    //! \brief Get a set of frames from the capture group, one per device, captured within the tolerance of the same
+    //!        instant. Sets are formed around the latest instant that every device has a frame for. Whether a set
+    //!        that some device has no frame for is skipped or delivered anyway depends on group.incomplete.
+    //!        The frames stay valid until the next call.
+    //! \param [out] out_frames Array receiving the frames, in the order the devices were given to start_capture_group.
+    //!                         Frames missing from the set are zeroed, with a null buffer.
+    //! \param       count      Number of elements in out_frames.
+    //! \param       timeout_ms Maximum time to wait in milliseconds, or 0xFFFFFFFF to wait indefinitely.
+    //! \returns The number of frames in the set, or 0 on timeout or if there is no capture group.
+    //!          With group.incomplete=drop, a set is only returned with a frame for every device, and
+    //!          sets thrown away are not counted as matched in the device statistics.
+    uint32_t MINIBM_CALL get_frame_set( FrameInfo* out_frames, uint32_t count, uint32_t timeout_ms );
+
+    //! \fn void __stdcall stop_capture_group();
+    //! \brief Stops capturing on the capture group.
+    void MINIBM_CALL stop_capture_group();
+
+    //! \fn uint32_t __stdcall get_stats( char* out_buffer, uint32_t buffer_length );
+    //! \brief Fills a buffer with a JSON document of library and per-device runtime statistics.
+    //! \param [out] out_buffer    Pointer to a buffer that will receive the JSON document. Can be null to only query the length.
+    //! \param       buffer_length Length of the buffer in bytes.
+    //! \returns The full JSON length in bytes, including the terminating null.
+    //!          If this is larger than buffer_length, the output was truncated.
+    uint32_t MINIBM_CALL get_stats( char* out_buffer, uint32_t buffer_length );
+
+    //! \fn uint32_t __stdcall get_trace( char* out_buffer, uint32_t buffer_length );
+    //! \brief Fills a buffer with the recorded per-frame trace as a Chrome trace event JSON document, which can be
+    //!        opened in chrome://tracing or Perfetto. Tracing is turned on and off with the trace library option.
+    //!        If the buffer is too small, the same trace is returned by the next call on this thread.
+    //! \param [out] out_buffer    Pointer to a buffer that will receive the JSON document. Can be null to only query the length.
+    //! \param       buffer_length Length of the buffer in bytes.
+    //! \returns The full JSON length in bytes, including the terminating null.
+    //!          If this is larger than buffer_length, the output was truncated.
+    uint32_t MINIBM_CALL get_trace( char* out_buffer, uint32_t buffer_length );
+
+    //! \fn uint32_t __stdcall get_last_error( char* out_buffer, uint32_t buffer_length );
+    //! \brief Fills a buffer with the reason the last start_capture_single, prepare_capture or start_capture_group
+    //!        call on this thread failed, if it was for memory not being available within the memory.budget library
+    //!        option or at all. Empty if the last call failed for any other reason, or didn't fail.
+    //! \param [out] out_buffer    Pointer to a buffer that will receive the reason. Can be null to only query the length.
+    //! \param       buffer_length Length of the buffer in bytes.
+    //! \returns The full length of the reason in bytes, including the terminating null.
+    //!          If this is larger than buffer_length, the output was truncated.
+    uint32_t MINIBM_CALL get_last_error( char* out_buffer, uint32_t buffer_length );
+
+    //! \fn uint32_t __stdcall check_kernels();
+    //! \brief Runs every variant of the pixel kernels that this processor can run on generated images,
+    //!        and compares their results against the plain C++ reference implementation.
+    //!        Which variants were checked and which ones differed is shown under kernels in the stats.
+    //! \returns The number of variants whose results differ from the reference. Zero if all match.
+    uint32_t MINIBM_CALL check_kernels();
+
+    //! \fn uint32_t __stdcall get_snapshot( uint8_t* out_buffer, uint32_t buffer_length, SnapshotInfo* out_info );
+    //! \brief Gets the latest encoded snapshot of the ongoing capture. Snapshots are enabled with the snapshot capture option.
+    //!        If the buffer is null or too small, the snapshot is kept aside for the next call on the same thread,
+    //!        so that the size returned here is the one that the next call will fill in.
+    //! \param [out] out_buffer    Pointer to a buffer that will receive the encoded image. Can be null to only query the size.
+    //! \param       buffer_length Length of the buffer in bytes.
+    //! \param [out] out_info      Pointer to a structure that will receive the snapshot details. Can be null.
+    //! \returns The size of the encoded image in bytes, or 0 if there is no snapshot.
+    //!          If this is larger than buffer_length, nothing was copied.
+    uint32_t MINIBM_CALL get_snapshot( uint8_t* out_buffer, uint32_t buffer_length, SnapshotInfo* out_info );
+
+    //! \fn uint32_t __stdcall get_history_frame( uint32_t index, uint8_t* out_buffer, uint32_t buffer_length, FrameInfo* out_frame );
+    //! \brief Converts a past frame of the ongoing capture into a BGRA buffer. Frames are kept in their native format
+    //!        with the history capture option, and only converted when asked for here.
+    //! \param       index         Index of the frame, as reported in FrameInfo::index.
+    //! \param [out] out_buffer    Pointer to a buffer that will receive the BGRA pixels. Can be null to only query the size.
+    //! \param       buffer_length Length of the buffer in bytes.
+    //! \param [out] out_frame     Pointer to a structure that will receive the frame details. Can be null.
+    //!              Its buffer is out_buffer if the frame was converted, or null otherwise.
+    //! \returns The size of the converted frame in bytes, or 0 if the frame is not in the history or conversion failed.
+    //!          If this is larger than buffer_length, nothing was converted.
+    uint32_t MINIBM_CALL get_history_frame( uint32_t index, uint8_t* out_buffer, uint32_t buffer_length, FrameInfo* out_frame );
+
+    //! \fn bool __stdcall find_history_frame( int64_t timestamp, int64_t timescale, uint32_t* out_index );
+    //! \brief Finds the frame in the history of the ongoing capture with the stream time nearest to a timestamp.
+    //! \param       timestamp Stream time to look for, as in FrameInfo::timestamp.
+    //! \param       timescale Time scale of timestamp, as in FrameInfo::timescale.
+    //! \param [out] out_index Pointer to a variable that will receive the index of the frame.
+    //! \returns True if a frame was found, false if the history is empty or disabled.
+    bool MINIBM_CALL find_history_frame( int64_t timestamp, int64_t timescale, uint32_t* out_index );
+
+    //! \fn bool __stdcall pin_history_frame( uint32_t index );
+    //! \brief Keeps a frame in the history from being overwritten until it is unpinned, for example while
+    //!        assembling a clip around an event. Pins nest. While every frame is pinned, new frames are not recorded.
+    //! \param index Index of the frame, as reported in FrameInfo::index.
+    //! \returns True if it succeeds, false if the frame is not in the history.
+    bool MINIBM_CALL pin_history_frame( uint32_t index );
+
+    //! \fn bool __stdcall unpin_history_frame( uint32_t index );
+    //! \brief Releases a pin taken with pin_history_frame.
+    //! \param index Index of the frame, as reported in FrameInfo::index.
+    //! \returns True if it succeeds, false if the frame is not in the history or wasn't pinned.
+    bool MINIBM_CALL unpin_history_frame( uint32_t index );
+
     //! \fn int __stdcall get_json_length();
     //! \brief Gets the length of the needed buffer for JSON output.
+    //!        The document is cached per device table generation, and the snapshot measured here
+    //!        is the one that the next get_json call on the same thread will return. It also
+    //!        brings the device table to that generation, so the "id" values in the document
+    //!        are valid device indices for start_capture_single and the like.
     //! \returns The JSON length in bytes.
     int MINIBM_CALL get_json_length();
 
@@ -112,6 +525,9 @@ namespace minibm {
     //! \param       buffer_length Length of the buffer in bytes.
     void MINIBM_CALL get_json(char *out_buffer, uint32_t buffer_length);
 
+    //! \fn bool __stdcall read_frame_bgra32_blocking( uint8_t* buffer, uint32_t len );
+    //! \brief Copies a frame from get_frame_bgra32_blocking into buffer, which must be exactly
+    //!        width * height * 4 bytes long. Fails the same way for output formats other than BGRA.
     bool MINIBM_CALL read_frame_bgra32_blocking(uint8_t *buffer, uint32_t len)
 
   }
@@ -127,6 +543,14 @@ namespace minibm {
 
   typedef uint32_t( MINIBM_CALL* fn_get_devices )();
 
+  typedef uint32_t( MINIBM_CALL* fn_get_device_generation )();
+
+  typedef void( MINIBM_CALL* fn_set_device_notify )(
+    fn_device_notify callback, void* userdata );
+
+  typedef void( MINIBM_CALL* fn_set_frame_notify )(
+    fn_frame_notify callback, void* userdata );
+
   typedef void( MINIBM_CALL* fn_set_options )(
     const char* library_options );
 
@@ -142,12 +566,71 @@ namespace minibm {
   typedef bool( MINIBM_CALL* fn_start_capture_single )(
     uint32_t index, uint32_t modecode, const char* capture_options );
 
+  typedef bool( MINIBM_CALL* fn_prepare_capture )(
+    uint32_t index, uint32_t modecode, const char* capture_options );
+
+  typedef bool( MINIBM_CALL* fn_release_standby )( uint32_t index );
+
   typedef bool( MINIBM_CALL* fn_get_frame_bgra32_blocking )(
     uint32_t* out_width, uint32_t* out_height, uint8_t** out_buffer,
     uint32_t* out_index );
 
+  typedef bool( MINIBM_CALL* fn_get_frame_blocking )(
+    FrameInfo* out_frame, uint32_t timeout_ms );
+
+  typedef uint32_t( MINIBM_CALL* fn_get_frames_batch )(
+    uint32_t max_frames, uint32_t timeout_ms, FrameInfo* out_frames,
+    uint32_t tensor_layout, void* out_tensor, uint64_t tensor_length );
+
+  typedef uint64_t( MINIBM_CALL* fn_acquire_frame )(
+    FrameInfo* out_frame, uint32_t timeout_ms );
+
+  typedef bool( MINIBM_CALL* fn_release_frame )( uint64_t lease );
+
+  typedef uint32_t( MINIBM_CALL* fn_open_consumer )( const char* consumer_options );
+
+  typedef bool( MINIBM_CALL* fn_get_consumer_frame )(
+    uint32_t consumer, FrameInfo* out_frame, uint32_t timeout_ms );
+
+  typedef void( MINIBM_CALL* fn_close_consumer )( uint32_t consumer );
+
+  typedef DLManagedTensor*( MINIBM_CALL* fn_get_frame_dlpack )(
+    FrameInfo* out_frame, uint32_t timeout_ms );
+
   typedef void( MINIBM_CALL* fn_stop_capture_single )();
 
+  typedef bool( MINIBM_CALL* fn_start_capture_group )(
+    const uint32_t* indices, uint32_t count, uint32_t modecode, const char* capture_options );
+
+  typedef uint32_t( MINIBM_CALL* fn_get_frame_set )(
+    FrameInfo* out_frames, uint32_t count, uint32_t timeout_ms );
+
+  typedef void( MINIBM_CALL* fn_stop_capture_group )();
+
+  typedef uint32_t( MINIBM_CALL* fn_get_stats )(
+    char* out_buffer, uint32_t buffer_length );
+
+  typedef uint32_t( MINIBM_CALL* fn_get_trace )(
+    char* out_buffer, uint32_t buffer_length );
+
+  typedef uint32_t( MINIBM_CALL* fn_get_last_error )(
+    char* out_buffer, uint32_t buffer_length );
+
+  typedef uint32_t( MINIBM_CALL* fn_check_kernels )();
+
+  typedef uint32_t( MINIBM_CALL* fn_get_snapshot )(
+    uint8_t* out_buffer, uint32_t buffer_length, SnapshotInfo* out_info );
+
+  typedef uint32_t( MINIBM_CALL* fn_get_history_frame )(
+    uint32_t index, uint8_t* out_buffer, uint32_t buffer_length, FrameInfo* out_frame );
+
+  typedef bool( MINIBM_CALL* fn_find_history_frame )(
+    int64_t timestamp, int64_t timescale, uint32_t* out_index );
+
+  typedef bool( MINIBM_CALL* fn_pin_history_frame )( uint32_t index );
+
+  typedef bool( MINIBM_CALL* fn_unpin_history_frame )( uint32_t index );
+
   typedef int(MINIBM_CALL* fn_get_json_length)();
 
   typedef void(MINIBM_CALL* fn_get_json)(
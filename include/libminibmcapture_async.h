@@ -0,0 +1,225 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+// Header-only C++20 coroutine layer over the frame functions of the C API.
+// Works with both the static and the dynamically imported API, since it is
+// handed the two functions it needs rather than calling them by name.
+
+#include "libminibmcapture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <vector>
+
+namespace minibm {
+
+  namespace async {
+
+    //! \enum FrameStatus
+    //! \brief Outcome of awaiting a frame.
+    enum class FrameStatus {
+      Ready,     ///< A frame was fetched.
+      Cancelled, ///< The stop token was triggered before a frame arrived.
+      Stopped,   ///< The capture stopped before a frame arrived.
+      Missed     ///< A frame arrived, but something else took it with a direct get_frame call first.
+    };
+
+    //! \struct FrameResult
+    //! \brief Result of co_await FrameSource::next_frame().
+    struct FrameResult {
+      FrameStatus status;
+      FrameInfo frame; ///< Valid if status is Ready. Its buffer stays valid until the next frame is fetched.
+      explicit operator bool() const { return ( status == FrameStatus::Ready ); }
+    };
+
+    using SetFrameNotifyFunction = void( MINIBM_CALL* )( fn_frame_notify callback, void* userdata );
+    using GetFrameFunction = bool( MINIBM_CALL* )( FrameInfo* out_frame, uint32_t timeout_ms );
+
+    //! \class FrameSource
+    //! \brief Lets coroutines wait for frames of the ongoing capture without blocking a thread.
+    //!        Every coroutine waiting when a frame arrives is resumed on its own executor, and they
+    //!        all get that same frame, which is fetched once by whichever of them resumes first.
+    //!        Takes over the frame notify callback for as long as it exists, and must outlive its waiters.
+    //! \code
+    //!   FrameSource source( &set_frame_notify, &get_frame_blocking );
+    //!   auto result = co_await source.next_frame( executor, stop_token );
+    //! \endcode
+    class FrameSource {
+    private:
+      struct Waiter {
+        std::coroutine_handle<> handle_;
+        std::function<void( std::coroutine_handle<> )> schedule_;
+        FrameStatus status_ = FrameStatus::Cancelled;
+        uint32_t index_ = 0;
+        uint32_t after_ = 0; //!< Newest frame already fetched when it registered. Only newer ones wake it.
+        std::atomic<bool> armed_ = false; //!< Set by whichever of suspending and completing happens last.
+      };
+
+      struct Cancel {
+        FrameSource* source_;
+        Waiter* waiter_;
+        void operator()() const { source_->cancel( waiter_ ); }
+      };
+
+      SetFrameNotifyFunction setNotify_;
+      GetFrameFunction getFrame_;
+      std::mutex waitLock_;
+      std::vector<Waiter*> waiters_;
+      // Fetching calls into the library, so it has a lock of its own that the
+      // notify callback never takes, or stopping a capture could deadlock on it
+      std::mutex fetchLock_;
+      FrameInfo current_ = {};
+      std::atomic<uint32_t> fetched_ = 0; //!< Index of current_, readable without fetchLock_.
+      std::atomic<bool> restarted_ = false;
+
+      //! Resumes the waiter on its executor, unless it is still on its way to suspending,
+      //! in which case it will notice and carry on without suspending. The waiter must
+      //! not be touched after this, as it might already be gone.
+      static void complete( Waiter* waiter )
+      {
+        if ( waiter->armed_.exchange( true ) )
+          waiter->schedule_( waiter->handle_ );
+      }
+
+      static void MINIBM_CALL notify( uint32_t index, void* userdata )
+      {
+        auto source = static_cast<FrameSource*>( userdata );
+        if ( !index )
+          source->restarted_ = true;
+
+        std::vector<Waiter*> ready;
+        {
+          std::lock_guard<std::mutex> lock( source->waitLock_ );
+          // A frame can be fetched before its own notification comes in. Waiters that
+          // registered after that have either had it already or are waiting for a newer one.
+          auto& waiters = source->waiters_;
+          auto waking = std::partition( waiters.begin(), waiters.end(), [index]( Waiter* waiter ) {
+            return ( index && waiter->after_ >= index );
+          } );
+          ready.assign( waking, waiters.end() );
+          waiters.erase( waking, waiters.end() );
+          for ( auto waiter : ready )
+          {
+            waiter->status_ = ( index ? FrameStatus::Ready : FrameStatus::Stopped );
+            waiter->index_ = index;
+          }
+        }
+        for ( auto waiter : ready )
+          complete( waiter );
+      }
+
+      void add( Waiter* waiter )
+      {
+        std::lock_guard<std::mutex> lock( waitLock_ );
+        // Until the next fetch, current_ may still be from the capture that stopped
+        waiter->after_ = ( restarted_ ? 0 : fetched_.load() );
+        waiters_.push_back( waiter );
+      }
+
+      void cancel( Waiter* waiter )
+      {
+        {
+          std::lock_guard<std::mutex> lock( waitLock_ );
+          auto it = std::find( waiters_.begin(), waiters_.end(), waiter );
+          if ( it == waiters_.end() )
+            return;
+          waiters_.erase( it );
+          waiter->status_ = FrameStatus::Cancelled;
+        }
+        complete( waiter );
+      }
+
+      FrameResult fetch( uint32_t index )
+      {
+        std::lock_guard<std::mutex> lock( fetchLock_ );
+
+        // Indices start over with a new capture
+        if ( restarted_.exchange( false ) )
+          current_ = {};
+        if ( current_.index < index )
+        {
+          FrameInfo frame;
+          if ( getFrame_( &frame, 0 ) )
+            current_ = frame;
+        }
+        fetched_ = current_.index;
+        if ( current_.index < index )
+          return { FrameStatus::Missed, {} };
+        return { FrameStatus::Ready, current_ };
+      }
+
+    public:
+      //! \class Awaiter
+      //! \brief What next_frame returns. Meant to be co_awaited right away.
+      class Awaiter {
+        friend class FrameSource;
+      private:
+        FrameSource& source_;
+        std::stop_token stop_;
+        Waiter waiter_;
+        std::optional<std::stop_callback<Cancel>> cancel_;
+        Awaiter( FrameSource& source, std::function<void( std::coroutine_handle<> )> schedule, std::stop_token stop ):
+          source_( source ), stop_( std::move( stop ) )
+        {
+          waiter_.schedule_ = std::move( schedule );
+        }
+      public:
+        Awaiter( const Awaiter& ) = delete;
+        Awaiter& operator=( const Awaiter& ) = delete;
+        bool await_ready() const { return stop_.stop_requested(); }
+        bool await_suspend( std::coroutine_handle<> handle )
+        {
+          waiter_.handle_ = handle;
+          source_.add( &waiter_ );
+          // Runs the cancellation right here if a stop was requested since await_ready
+          if ( stop_.stop_possible() )
+            cancel_.emplace( stop_, Cancel { &source_, &waiter_ } );
+          return !waiter_.armed_.exchange( true );
+        }
+        FrameResult await_resume()
+        {
+          cancel_.reset();
+          if ( waiter_.status_ != FrameStatus::Ready )
+            return { waiter_.status_, {} };
+          return source_.fetch( waiter_.index_ );
+        }
+      };
+
+      FrameSource( SetFrameNotifyFunction setNotify, GetFrameFunction getFrame ):
+        setNotify_( setNotify ), getFrame_( getFrame )
+      {
+        setNotify_( &FrameSource::notify, this );
+      }
+
+      ~FrameSource()
+      {
+        setNotify_( nullptr, nullptr );
+      }
+
+      FrameSource( const FrameSource& ) = delete;
+      FrameSource& operator=( const FrameSource& ) = delete;
+
+      //! Waits for the next frame. The awaiting coroutine is resumed through executor.post( fn ),
+      //! where fn is a callable taking no arguments, so it continues wherever the executor runs it.
+      //! No thread is blocked meanwhile. Triggering stop resumes it with FrameStatus::Cancelled.
+      template <typename Executor>
+      Awaiter next_frame( Executor& executor, std::stop_token stop = {} )
+      {
+        return Awaiter( *this, [&executor]( std::coroutine_handle<> handle ) {
+          executor.post( [handle]() { handle.resume(); } );
+        }, std::move( stop ) );
+      }
+    };
+
+  }
+
+}
@@ -0,0 +1,51 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+
+namespace minibm {
+
+  class Options;
+  class JsonWriter;
+
+  //! What a buffer is for, as memory is accounted by.
+  enum MemoryCategory {
+    Memory_Input = 0, //!< The driver's input frames, and our copies of source frames.
+    Memory_Output,    //!< Converted frames, be they latest, queued, shared or exported.
+    Memory_History,   //!< Frames kept in their native format by the history option.
+    Memory_Encoder,   //!< Frames copied and scaled for snapshot encoding.
+    Memory_Count
+  };
+
+  //! Sets the reason the last call on this thread failed, for get_last_error.
+  void setLastError( const string& reason );
+  const string& lastError();
+
+  //! Library-wide accounting of frame buffer memory, against an optional budget.
+  //! Buffers charge their capacity when they grow and refund it when freed, so that
+  //! anything over the budget is refused up front, rather than the system running dry.
+  namespace budget {
+
+    //! Charges bytes to category. Returns false and sets the last error if that would go over the budget.
+    bool charge( MemoryCategory category, size_t bytes );
+    void refund( MemoryCategory category, size_t bytes );
+    //! Moves bytes already charged from one category to another.
+    void transfer( MemoryCategory from, MemoryCategory to, size_t bytes );
+    //! Records a charged allocation that the system itself failed. Sets the last error.
+    void allocationFailed( MemoryCategory category, size_t bytes );
+
+    //! Number of allocations refused or failed so far, and the reason for the last one.
+    uint32_t refusals();
+    string lastRefusal();
+
+    //! Reads the memory.budget library option.
+    void configure( const Options& options );
+    void writeStats( JsonWriter& json );
+
+  }
+
+}
@@ -0,0 +1,46 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+#include "options.h"
+
+namespace minibm {
+
+  class JsonWriter;
+
+  //! Picks frames for a lower output frame rate by their stream timestamps.
+  //! Output ticks are laid out at exactly the target rate from the first frame on, and each
+  //! tick takes the input frame nearest to it, so the choice doesn't depend on when anyone
+  //! happens to wake up. A frame nearest to several ticks is still only delivered once, so
+  //! a target above the input rate delivers every frame rather than repeating any.
+  class CadenceSelector {
+  private:
+    int64_t num_ = 0; //!< Target rate numerator, or 0 to take every frame.
+    int64_t den_ = 1;
+    int64_t start_ = -1; //!< Stream time of tick 0, or -1 to start over with the next frame.
+    int64_t scale_ = 0;
+    int64_t tick_ = 0; //!< Next tick not yet given a frame.
+    int64_t lastTime_ = 0;
+    uint32_t spanFrames_ = 0; //!< Frames selected since tick 0.
+    uint32_t selected_ = 0;
+    uint32_t skipped_ = 0;
+    uint32_t mergedTicks_ = 0; //!< Ticks left without a frame of their own, merged into the frame of the tick before them.
+    int64_t errorSum_ = 0; //!< Microseconds
+    int64_t maxError_ = 0; //!< Microseconds
+    inline int64_t tickTime( int64_t tick ) const { return start_ + tick * scale_ * den_ / num_; }
+  public:
+    //! Reads the rate option, given as frames per second, such as "10", "29.97" or "30000/1001".
+    void configure( const Options& options );
+    inline bool enabled() const { return ( num_ > 0 ); }
+    //! Lays the ticks out again from the next frame on, such as after a format change.
+    inline void restart() { start_ = -1; }
+    //! Decides whether the frame with the given stream time and duration, in scale units, is delivered.
+    bool select( int64_t time, int64_t duration, int64_t scale );
+    void writeStats( JsonWriter& json ) const;
+  };
+
+}
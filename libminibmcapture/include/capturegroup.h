@@ -0,0 +1,80 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+#include "utils.h"
+#include "options.h"
+
+#include "decklink_api/DeckLinkAPIVersion.h"
+#include "DeckLinkAPI_h.h"
+
+namespace minibm {
+
+  class DecklinkDevice;
+  class OutputVideoFrame;
+  class JsonWriter;
+
+  //! What to do with a frame set that some devices have no frame for.
+  enum IncompletePolicy {
+    Incomplete_Drop = 0, //!< Throw the set away and wait for the next one.
+    Incomplete_Partial   //!< Deliver the set with the missing frames left out.
+  };
+
+  //! One device of a capture group, with its alignment statistics.
+  struct GroupMember {
+    DecklinkDevice* device_ = nullptr;
+    uint32_t matched_ = 0; //!< Delivered sets this device had a frame in.
+    uint32_t missed_ = 0; //!< Sets this device had no frame for within the tolerance.
+    int64_t lastSkew_ = 0; //!< Microseconds from the set's time to this device's frame.
+    int64_t maxSkew_ = 0; //!< Largest absolute skew, in microseconds.
+    int64_t skewSum_ = 0; //!< Sum of absolute skews, for the mean.
+    int64_t setSkew_ = 0; //!< Skew of this device's frame in the set being formed, counted once the set is delivered.
+  };
+
+  //! Several devices capturing together, whose frames are matched into sets by the time
+  //! they were captured at. Frame times come from each card's hardware reference clock,
+  //! mapped onto the host clock, so that devices on different cards can be compared.
+  //! Each device queues its frames, and a set is formed around the latest time that
+  //! every device has a frame for, taking each device's frame nearest to it.
+  class CaptureGroup {
+  private:
+    vector<GroupMember> members_;
+    vector<HANDLE> events_;
+    int64_t tolerance_ = 0; //!< Microseconds
+    IncompletePolicy incomplete_ = Incomplete_Drop;
+    atomic<bool> stopped_ = false;
+    RWLock lock_; //!< Held by whoever is forming a set.
+    RWLock statsLock_;
+    uint32_t sets_ = 0;
+    uint32_t incompleteSets_ = 0; //!< Sets delivered with frames missing.
+    uint32_t droppedSets_ = 0; //!< Sets thrown away for having frames missing.
+  public:
+    //! Starts devices in displayMode with options, first in standby and then all live at once.
+    //! Reads the group.tolerance and group.incomplete options. Stops them all again on failure.
+    //! Up to MAXIMUM_WAIT_OBJECTS devices can be grouped.
+    bool start( const vector<DecklinkDevice*>& devices, BMDDisplayMode displayMode, const Options& options );
+    inline bool contains( DecklinkDevice* device ) const
+    {
+      return std::any_of( members_.begin(), members_.end(), [device]( const GroupMember& member ) {
+        return ( member.device_ == device );
+      } );
+    }
+    inline size_t size() const { return members_.size(); }
+    //! Waits up to timeout for a set of frames, and fills out_frames with one per device,
+    //! in the order the devices were given in. Missing frames are left null.
+    //! Returns the number of frames in the set, or 0 on timeout or if the group was stopped.
+    //! With Incomplete_Drop, a set is only ever returned complete.
+    //! The frames stay valid until the next call.
+    size_t getFrameSet( vector<OutputVideoFrame*>& out_frames, uint32_t timeout );
+    void stop();
+    void writeStats( JsonWriter& json );
+    ~CaptureGroup();
+  };
+
+  using CaptureGroupPtr = shared_ptr<CaptureGroup>;
+
+}
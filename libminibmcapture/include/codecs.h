@@ -0,0 +1,46 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+#include "threads.h"
+
+namespace minibm {
+
+  namespace codecs {
+
+    //! Box-filters BGRA pixels down to width x height, which must not exceed the source size.
+    void scaleBGRA( const uint8_t* source, size_t sourceRowBytes, long sourceWidth, long sourceHeight,
+      uint8_t* destination, long width, long height );
+
+    //! Encodes BGRA pixels as a QOI image, appending to out. Alpha is dropped.
+    void encodeQOI( const uint8_t* bgra, size_t rowBytes, long width, long height, vector<uint8_t>& out );
+
+    //! Baseline JFIF encoder with 4:2:0 chroma subsampling.
+    //! The image is split into horizontal bands separated by restart markers,
+    //! which are encoded in parallel when given a worker pool.
+    class JpegEncoder {
+    private:
+      int quality_ = 0;
+      uint8_t lumaQuant_[64];
+      uint8_t chromaQuant_[64];
+      float lumaScale_[64];
+      float chromaScale_[64];
+      void encodeBand( const uint8_t* bgra, size_t rowBytes, long width, long height,
+        long firstRow, long lastRow, vector<uint8_t>& out ) const;
+    public:
+      explicit JpegEncoder( int quality = 75 ) { setQuality( quality ); }
+      //! Sets the quality from 1 to 100, as in the IJG reference encoder.
+      void setQuality( int quality );
+      inline int quality() const { return quality_; }
+      //! Appends a complete JFIF file to out. Pool can be null to encode on the calling thread only.
+      void encode( const uint8_t* bgra, size_t rowBytes, long width, long height,
+        vector<uint8_t>& out, WorkerPool* pool ) const;
+    };
+
+  }
+
+}
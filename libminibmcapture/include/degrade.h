@@ -0,0 +1,101 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+#include "utils.h"
+#include "options.h"
+
+namespace minibm {
+
+  class JsonWriter;
+
+  //! Ways of shedding load, applied in the order they are configured in.
+  enum DegradeStep {
+    Degrade_Skip = 0,  //!< Don't convert frames that would only overwrite an unread one, until they are picked up.
+    Degrade_Downscale, //!< Convert at half width and height.
+    Degrade_Decimate   //!< Drop every other frame before conversion.
+  };
+
+  //! Steps down through the configured degradation steps when the capture callback can't keep up,
+  //! and back up once it has been comfortably keeping up for a while. The callback is judged
+  //! overloaded by its share of the frame time spent busy, by gaps in stream time that mean the
+  //! driver dropped frames, and by consumers leaving most frames unread.
+  class DegradePolicy {
+  private:
+    struct Decision {
+      int64_t time_; //!< Host time, microseconds
+      size_t from_;
+      size_t to_;
+      const char* reason_;
+      double load_;
+    };
+    vector<DegradeStep> steps_;
+    size_t level_ = 0; //!< Number of steps in effect.
+    double high_ = 0.85; //!< Load above which to step down.
+    double low_ = 0.5; //!< Load below which a window counts as calm.
+    uint32_t window_ = 30; //!< Frames per evaluation.
+    uint32_t hold_ = 4; //!< Calm windows needed in a row to step back up.
+    uint32_t frames_ = 0;
+    int64_t busy_ = 0; //!< Microseconds spent in the callback this window.
+    int64_t period_ = 0; //!< Frame duration in microseconds.
+    uint32_t driverDrops_ = 0;
+    uint32_t unread_ = 0;
+    uint32_t calmWindows_ = 0;
+    int64_t lastTime_ = -1;
+    int64_t lastScale_ = 0;
+    uint32_t phase_ = 0; //!< Alternates for decimation.
+    bool decimated_ = false; //!< Whether the previous frame was dropped by decimation.
+    double lastLoad_ = 0.0;
+    uint32_t escalations_ = 0;
+    uint32_t recoveries_ = 0;
+    uint32_t totalDriverDrops_ = 0;
+    uint32_t deferredFrames_ = 0;
+    uint32_t downscaledFrames_ = 0;
+    uint32_t decimatedFrames_ = 0;
+    std::deque<Decision> decisions_; //!< The most recent level changes.
+    void change( size_t level, const char* reason );
+  public:
+    //! Reads the degrade options. Starts from full quality.
+    void configure( const Options& options );
+    inline bool enabled() const { return !steps_.empty(); }
+    //! Whether step is currently in effect.
+    inline bool active( DegradeStep step ) const
+    {
+      for ( size_t i = 0; i < level_; ++i )
+        if ( steps_[i] == step )
+          return true;
+      return false;
+    }
+    //! Called with the stream timing of every timed frame before anything is spent on it.
+    //! Returns false if the frame is to be dropped by decimation. Sets out_flags to the FrameFlags
+    //! that describe what was done.
+    bool admit( int64_t time, int64_t duration, int64_t scale, uint32_t& out_flags );
+    //! Called once a callback is done, with the microseconds it was busy and whether the frame
+    //! it delivered overwrote one nobody had read.
+    void account( int64_t busy, bool overwroteUnread );
+    inline void noteDeferred() { deferredFrames_++; }
+    inline void noteDownscaled() { downscaledFrames_++; }
+    void writeStats( JsonWriter& json ) const;
+
+    //! Accounts for the time a callback is busy, however it returns.
+    class Timer {
+    private:
+      DegradePolicy& policy_;
+      int64_t start_;
+    public:
+      bool unread_ = false;
+      //! start is when the callback was entered, so that waiting for the lock counts too.
+      Timer( DegradePolicy& policy, int64_t start ): policy_( policy ), start_( policy.enabled() ? start : 0 ) {}
+      ~Timer()
+      {
+        if ( start_ )
+          policy_.account( timeMicroseconds() - start_, unread_ );
+      }
+    };
+  };
+
+}
@@ -0,0 +1,69 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+#include "utils.h"
+
+#include "decklink_api/DeckLinkAPIVersion.h"
+#include "DeckLinkAPI_h.h"
+
+namespace minibm {
+
+  class JsonWriter;
+
+  //! One past frame, kept in the format it arrived in.
+  struct HistorySlot {
+    AlignedBuffer buffer_;
+    long width_ = 0;
+    long height_ = 0;
+    long rowBytes_ = 0;
+    BMDPixelFormat pixelFormat_ = bmdFormat8BitYUV;
+    uint32_t index_ = 0; //!< Capture frame index, or 0 if the slot is empty.
+    uint32_t flags_ = 0; //!< FrameFlags
+    BMDTimeValue streamTime_ = 0;
+    BMDTimeValue streamDuration_ = 0;
+    BMDTimeScale timeScale_ = 0;
+    uint32_t pins_ = 0;
+    uint32_t readers_ = 0;
+    bool writing_ = false;
+  };
+
+  //! Ring of the most recent source frames, preallocated up front.
+  //! Frames are copied in by the capture callback and read back on demand, and
+  //! neither side holds the lock while copying, so they never stall each other.
+  //! Slots that are pinned or being read are skipped over when storing.
+  class FrameHistory {
+  private:
+    vector<unique_ptr<HistorySlot>> slots_;
+    size_t next_ = 0;
+    RWLock lock_;
+    ConditionVariable released_; //!< Signaled when a slot stops being read or written while configuring_.
+    bool configuring_ = false;
+    uint32_t stored_ = 0;
+    uint32_t overruns_ = 0; //!< Frames that couldn't be stored because every slot was in use.
+    HistorySlot* findSlot( uint32_t index );
+  public:
+    //! Sets up count slots with room for frames of up to reserveBytes, placed on NUMA node unless it is -1.
+    //! Drops all stored frames and pins. Waits for frames being read or stored to be let go first,
+    //! and turns away new readers meanwhile.
+    void configure( size_t count, size_t reserveBytes, int node );
+    inline bool enabled() const { return !slots_.empty(); }
+    void store( IDeckLinkVideoInputFrame* frame, uint32_t index, uint32_t flags,
+      BMDTimeValue streamTime, BMDTimeValue streamDuration, BMDTimeScale timeScale );
+    //! Finds the stored frame with the stream time nearest to timestamp, given in timescale units.
+    bool find( int64_t timestamp, int64_t timescale, uint32_t& out_index );
+    //! Locks the frame with index for reading, or returns null if it isn't stored or the ring is being reconfigured.
+    //! Must be paired with a call to release.
+    const HistorySlot* acquire( uint32_t index );
+    void release( const HistorySlot* slot );
+    //! Keeps the frame with index from being overwritten until unpinned. Pins nest.
+    bool pin( uint32_t index );
+    bool unpin( uint32_t index );
+    void writeStats( JsonWriter& json );
+  };
+
+}
@@ -0,0 +1,140 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+
+#include <charconv>
+#include <type_traits>
+
+namespace minibm {
+
+  //! Single-pass JSON writer appending straight into a string.
+  //! Separators are tracked with a bit per nesting level, so nothing is
+  //! allocated besides the output itself.
+  class JsonWriter {
+  private:
+    string& out_;
+    uint64_t hasItems_ = 0;
+    int depth_ = 0;
+    bool afterKey_ = false;
+    inline void separate()
+    {
+      if ( afterKey_ )
+      {
+        afterKey_ = false;
+        return;
+      }
+      if ( depth_ > 0 )
+      {
+        const uint64_t bit = ( 1ull << ( depth_ - 1 ) );
+        if ( hasItems_ & bit )
+          out_.push_back( ',' );
+        hasItems_ |= bit;
+      }
+    }
+    inline void open( char c )
+    {
+      separate();
+      out_.push_back( c );
+      depth_++;
+      hasItems_ &= ~( 1ull << ( depth_ - 1 ) );
+    }
+    inline void close( char c )
+    {
+      depth_--;
+      out_.push_back( c );
+    }
+    template <typename T>
+    inline void number( T value )
+    {
+      char buffer[32];
+      auto res = std::to_chars( buffer, buffer + sizeof( buffer ), value );
+      out_.append( buffer, res.ptr );
+    }
+    void escaped( const char* str, size_t length )
+    {
+      static const char hex[] = "0123456789abcdef";
+      out_.push_back( '"' );
+      size_t run = 0;
+      for ( size_t i = 0; i < length; ++i )
+      {
+        auto c = static_cast<unsigned char>( str[i] );
+        if ( c >= 0x20 && c != '"' && c != '\\' )
+          continue;
+        out_.append( str + run, i - run );
+        run = i + 1;
+        out_.push_back( '\\' );
+        switch ( c )
+        {
+          case '"': out_.push_back( '"' ); break;
+          case '\\': out_.push_back( '\\' ); break;
+          case '\n': out_.push_back( 'n' ); break;
+          case '\r': out_.push_back( 'r' ); break;
+          case '\t': out_.push_back( 't' ); break;
+          default:
+            out_.append( "u00", 3 );
+            out_.push_back( hex[c >> 4] );
+            out_.push_back( hex[c & 0xF] );
+        }
+      }
+      out_.append( str + run, length - run );
+      out_.push_back( '"' );
+    }
+  public:
+    explicit JsonWriter( string& out ): out_( out ) {}
+    inline JsonWriter& beginObject() { open( '{' ); return *this; }
+    inline JsonWriter& endObject() { close( '}' ); return *this; }
+    inline JsonWriter& beginArray() { open( '[' ); return *this; }
+    inline JsonWriter& endArray() { close( ']' ); return *this; }
+    inline JsonWriter& key( const char* name )
+    {
+      separate();
+      escaped( name, strlen( name ) );
+      out_.push_back( ':' );
+      afterKey_ = true;
+      return *this;
+    }
+    inline JsonWriter& value( const string& str )
+    {
+      separate();
+      escaped( str.c_str(), str.length() );
+      return *this;
+    }
+    inline JsonWriter& value( const char* str )
+    {
+      separate();
+      escaped( str, strlen( str ) );
+      return *this;
+    }
+    inline JsonWriter& value( bool b )
+    {
+      separate();
+      b ? out_.append( "true", 4 ) : out_.append( "false", 5 );
+      return *this;
+    }
+    inline JsonWriter& value( double d )
+    {
+      separate();
+      number( d );
+      return *this;
+    }
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    inline JsonWriter& value( T i )
+    {
+      separate();
+      number( i );
+      return *this;
+    }
+    template <typename T>
+    inline JsonWriter& member( const char* name, T val )
+    {
+      key( name );
+      return value( val );
+    }
+  };
+
+}
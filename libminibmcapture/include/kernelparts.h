@@ -0,0 +1,331 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <immintrin.h>
+#include "kernels.h"
+
+// Pieces shared by the kernel variants, which live in translation units of their own
+// so that each can be built for its instruction set. Everything here has internal
+// linkage, so that the linker can't pick a copy built for an instruction set the
+// processor doesn't have. For the same reason the variants are built without the
+// precompiled header, and nothing here may use std templates such as std::min, whose
+// inline instantiations are merged across translation units.
+
+namespace minibm {
+
+  namespace kernels {
+
+    // Fingerprint: each row is consumed in 64-byte stripes of eight 64-bit lanes.
+    // Every lane accumulates lo32(k) * hi32(k) + w, where w is the data word and
+    // k is w xor a key that advances with every stripe, making the result depend
+    // on the stripe's position. Accumulators are scrambled between rows.
+
+    static const size_t c_fpStripe = 64;
+    static const size_t c_fpLanes = 8;
+
+    alignas( 64 ) static const uint64_t c_fpKeys[c_fpLanes] = {
+      0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+      0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull
+    };
+
+    alignas( 64 ) static const uint64_t c_fpSteps[c_fpLanes] = {
+      0x9e3779b185ebca87ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull, 0x85ebca77c2b2ae63ull,
+      0x27d4eb2f165667c5ull, 0x9e3779b185ebca87ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull
+    };
+
+    static const uint64_t c_fpPrime = 0x9fb21c651e98df25ull;
+
+    static inline uint64_t fmix64( uint64_t h )
+    {
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ull;
+      h ^= h >> 33;
+      return h;
+    }
+
+    static inline void fpInit( uint64_t* acc )
+    {
+      for ( size_t i = 0; i < c_fpLanes; ++i )
+        acc[i] = c_fpKeys[c_fpLanes - 1 - i];
+    }
+
+    static inline void fpStripe( uint64_t* acc, uint64_t* key, const uint8_t* data )
+    {
+      for ( size_t i = 0; i < c_fpLanes; ++i )
+      {
+        uint64_t w;
+        memcpy( &w, data + i * 8, 8 );
+        uint64_t k = w ^ key[i];
+        acc[i] += ( k & 0xFFFFFFFFull ) * ( k >> 32 ) + w;
+        key[i] += c_fpSteps[i];
+      }
+    }
+
+    static inline void fpRowEnd( uint64_t* acc, uint64_t* key, const uint8_t* row, size_t rowBytes )
+    {
+      auto tail = rowBytes % c_fpStripe;
+      if ( tail )
+      {
+        alignas( 64 ) uint8_t padded[c_fpStripe] = { 0 };
+        memcpy( padded, row + rowBytes - tail, tail );
+        fpStripe( acc, key, padded );
+      }
+      for ( size_t i = 0; i < c_fpLanes; ++i )
+      {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] *= c_fpPrime;
+      }
+    }
+
+    static inline uint64_t fpFinish( const uint64_t* acc, size_t rowBytes, long height, long rowStep )
+    {
+      uint64_t h = fmix64( rowBytes ^ ( static_cast<uint64_t>( height ) << 32 ) ^ static_cast<uint64_t>( rowStep ) );
+      for ( size_t i = 0; i < c_fpLanes; ++i )
+        h = fmix64( h ^ acc[i] ) + c_fpPrime;
+      return h;
+    }
+
+    // Tile diff: spans of each row are compared until a difference is found, after which
+    // the tile is known to be changed and the rest of its rows are skipped. Any row in a
+    // tile row with changes is copied over to previous, since not all of it was compared.
+
+    template <bool( *Equal )( const uint8_t*, const uint8_t*, size_t )>
+    static inline void tileDiffRows( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+      const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks )
+    {
+      tileHeight = ( tileHeight > 1 ? tileHeight : 1 );
+      for ( long y0 = 0; y0 < height; y0 += tileHeight )
+      {
+        auto rowMarks = marks + ( y0 / tileHeight ) * columns;
+        auto y1 = ( y0 + tileHeight < height ? y0 + tileHeight : height );
+        bool dirty = false;
+        for ( long y = y0; y < y1; ++y )
+        {
+          auto cur = current + y * rowBytes;
+          auto prev = previous + y * rowBytes;
+          for ( uint32_t x = 0; x < columns; ++x )
+          {
+            if ( rowMarks[x] )
+              continue;
+            if ( !Equal( cur + spans[x].begin_, prev + spans[x].begin_, spans[x].end_ - spans[x].begin_ ) )
+              rowMarks[x] = 1;
+          }
+          if ( !dirty )
+            for ( uint32_t x = 0; x < columns && !dirty; ++x )
+              dirty = ( rowMarks[x] != 0 );
+          if ( dirty )
+            memcpy( prev, cur, rowBytes );
+        }
+      }
+    }
+
+    // UYVY to BGRA: inputs are offset and scaled by 2^7, and multiplied with coefficients
+    // scaled by 2^9 keeping the high 16 bits, which lands the result in 8-bit units.
+    // This is what _mm_mulhi_epi16 does, and the scalar reference mirrors it exactly.
+
+    struct YuvCoefficients {
+      int16_t y_;
+      int16_t rv_;
+      int16_t gu_;
+      int16_t gv_;
+      int16_t bu_;
+    };
+
+    static const YuvCoefficients c_rec601 = { 596, 817, -201, -416, 1033 };
+    static const YuvCoefficients c_rec709 = { 596, 918, -109, -273, 1081 };
+
+    //! Counteracts the truncation of the high multiplies.
+    static const int c_yuvRounding = 1;
+
+    static inline int mulhi16( int a, int b )
+    {
+      return ( a * b ) >> 16;
+    }
+
+    static inline uint8_t saturate8( int value )
+    {
+      return static_cast<uint8_t>( value < 0 ? 0 : value > 255 ? 255 : value );
+    }
+
+    static inline void yuvToBGRA( int y, int u, int v, const YuvCoefficients& c, uint8_t* out )
+    {
+      auto ys = mulhi16( ( y - 16 ) * 128, c.y_ ) + c_yuvRounding;
+      auto u7 = ( u - 128 ) * 128;
+      auto v7 = ( v - 128 ) * 128;
+      out[0] = saturate8( ys + mulhi16( u7, c.bu_ ) );
+      out[1] = saturate8( ys + mulhi16( u7, c.gu_ ) + mulhi16( v7, c.gv_ ) );
+      out[2] = saturate8( ys + mulhi16( v7, c.rv_ ) );
+      out[3] = 0xFF;
+    }
+
+    // A class's inline members are merged across translation units like templates are,
+    // so this one is kept local to each of them.
+    namespace {
+
+      //! Histograms are spread over several tables so that runs of the same value,
+      //! which are common, don't serialize on a single counter.
+      struct SplitHistogram {
+        uint32_t tables_[4][256];
+        SplitHistogram() { memset( tables_, 0, sizeof( tables_ ) ); }
+        inline void add( const uint8_t* uyvy )
+        {
+          tables_[0][uyvy[1]]++;
+          tables_[1][uyvy[3]]++;
+          tables_[2][uyvy[5]]++;
+          tables_[3][uyvy[7]]++;
+        }
+        void collect( uint32_t* out ) const
+        {
+          for ( size_t i = 0; i < 256; ++i )
+            out[i] = tables_[0][i] + tables_[1][i] + tables_[2][i] + tables_[3][i];
+        }
+      };
+
+    }
+
+    static inline void levelsFromHistogram( const LumaThresholds& thresholds, LumaStats& stats )
+    {
+      stats.black_ = stats.clippedLow_ = stats.clippedHigh_ = 0;
+      for ( size_t i = 0; i < 256; ++i )
+      {
+        if ( i <= thresholds.black_ )
+          stats.black_ += stats.histogram_[i];
+        if ( i <= thresholds.clipLow_ )
+          stats.clippedLow_ += stats.histogram_[i];
+        if ( i >= thresholds.clipHigh_ )
+          stats.clippedHigh_ += stats.histogram_[i];
+      }
+    }
+
+    //! Instantiates kernel for the given statistics, so that disabled ones compile out.
+    template <template <uint32_t> class Kernel>
+    static inline void dispatchLumaStats( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height, bool rec709,
+      uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats )
+    {
+      auto& c = ( rec709 ? c_rec709 : c_rec601 );
+      if ( statsFlags & LumaStats_Histogram )
+      {
+        Kernel<LumaStats_Histogram>::run( source, sourceRowBytes, destination, destinationRowBytes, width, height, c, thresholds, stats );
+        levelsFromHistogram( thresholds, stats );
+      }
+      else if ( statsFlags & LumaStats_Levels )
+        Kernel<LumaStats_Levels>::run( source, sourceRowBytes, destination, destinationRowBytes, width, height, c, thresholds, stats );
+      else
+        Kernel<0>::run( source, sourceRowBytes, destination, destinationRowBytes, width, height, c, thresholds, stats );
+    }
+
+    // 10-bit to RGB: limited range inputs are offset and multiplied in pairs with coefficients
+    // scaled by 2^7, accumulating in 32 bits the way _mm_madd_epi16 does, which lands the
+    // result in full range 16-bit units. 10-bit outputs keep the rounded top 10 bits of that.
+
+    struct Yuv10Coefficients {
+      int16_t y_;
+      int16_t rv_;
+      int16_t gu_;
+      int16_t gv_;
+      int16_t bu_;
+    };
+
+    static const Yuv10Coefficients c_rec601x10 = { 9576, 13126, -3222, -6686, 16590 };
+    static const Yuv10Coefficients c_rec709x10 = { 9576, 14744, -1754, -4383, 17372 };
+
+    static const int c_yuv10Rounding = 64;
+
+    //! v210 packs six pixels into 16 bytes, and rows are padded to 48 pixels.
+    static const long c_v210Chunk = 48;
+
+    static inline uint16_t clamp16( int value )
+    {
+      return static_cast<uint16_t>( value < 0 ? 0 : value > 65535 ? 65535 : value );
+    }
+
+    static inline uint32_t top10( uint16_t value )
+    {
+      return ( value + 32 < 65535 ? value + 32 : 65535 ) >> 6;
+    }
+
+    static inline void yuv10ToRGB16( int y, int u, int v, const Yuv10Coefficients& c, uint16_t* out )
+    {
+      auto ys = ( y - 64 ) * c.y_;
+      auto u0 = u - 512;
+      auto v0 = v - 512;
+      out[0] = clamp16( ( ys + v0 * c.rv_ + c_yuv10Rounding ) >> 7 );
+      out[1] = clamp16( ( ys + u0 * c.gu_ + v0 * c.gv_ + c_yuv10Rounding ) >> 7 );
+      out[2] = clamp16( ( ys + u0 * c.bu_ + c_yuv10Rounding ) >> 7 );
+    }
+
+    static inline uint16_t expand10( int value )
+    {
+      return clamp16( ( ( value - 64 ) * c_rec709x10.y_ + c_yuv10Rounding ) >> 7 );
+    }
+
+    template <RgbLayout Layout>
+    static inline void storeRGB16( const uint16_t* rgb, uint8_t* out )
+    {
+      if constexpr ( Layout == Rgb_A64 )
+      {
+        const uint16_t pixel[4] = { rgb[0], rgb[1], rgb[2], 0xFFFF };
+        memcpy( out, pixel, 8 );
+      }
+      else
+      {
+        uint32_t pixel = top10( rgb[0] ) | ( top10( rgb[1] ) << 10 ) | ( top10( rgb[2] ) << 20 ) | 0xC0000000u;
+        memcpy( out, &pixel, 4 );
+      }
+    }
+
+    static inline size_t rgbPixelBytes( RgbLayout layout )
+    {
+      return ( layout == Rgb_A64 ? 8 : 4 );
+    }
+
+    //! Unpacks blocks of six v210 pixels into separate luma and 4:2:2 chroma arrays.
+    static inline void unpackV210( const uint8_t* source, long blocks, int16_t* y, int16_t* u, int16_t* v )
+    {
+      for ( long i = 0; i < blocks; ++i, y += 6, u += 3, v += 3 )
+      {
+        uint32_t w[4];
+        memcpy( w, source + i * 16, 16 );
+        u[0] = static_cast<int16_t>( w[0] & 0x3FF );
+        y[0] = static_cast<int16_t>( ( w[0] >> 10 ) & 0x3FF );
+        v[0] = static_cast<int16_t>( ( w[0] >> 20 ) & 0x3FF );
+        y[1] = static_cast<int16_t>( w[1] & 0x3FF );
+        u[1] = static_cast<int16_t>( ( w[1] >> 10 ) & 0x3FF );
+        y[2] = static_cast<int16_t>( ( w[1] >> 20 ) & 0x3FF );
+        v[1] = static_cast<int16_t>( w[2] & 0x3FF );
+        y[3] = static_cast<int16_t>( ( w[2] >> 10 ) & 0x3FF );
+        u[2] = static_cast<int16_t>( ( w[2] >> 20 ) & 0x3FF );
+        y[4] = static_cast<int16_t>( w[3] & 0x3FF );
+        v[2] = static_cast<int16_t>( ( w[3] >> 10 ) & 0x3FF );
+        y[5] = static_cast<int16_t>( ( w[3] >> 20 ) & 0x3FF );
+      }
+    }
+
+    //! Unpacks a v210 row one chunk at a time, calling fn( x, count, y, u, v ) for each.
+    template <typename Fn>
+    static inline void forV210Chunks( const uint8_t* row, long width, Fn&& fn )
+    {
+      alignas( 16 ) int16_t y[c_v210Chunk];
+      alignas( 16 ) int16_t u[c_v210Chunk / 2];
+      alignas( 16 ) int16_t v[c_v210Chunk / 2];
+      for ( long x = 0; x < width; x += c_v210Chunk )
+      {
+        auto count = ( width - x < c_v210Chunk ? width - x : c_v210Chunk );
+        unpackV210( row + ( x / 6 ) * 16, ( count + 5 ) / 6, y, u, v );
+        fn( x, count, y, u, v );
+      }
+    }
+
+  }
+
+}
@@ -0,0 +1,180 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+// Included without the precompiled header by the kernel variants built for other
+// instruction sets, so this sticks to plain C types.
+#include <cstdint>
+#include <cstddef>
+
+namespace minibm {
+
+  class Options;
+  class JsonWriter;
+
+  namespace kernels {
+
+    //! Fast 64-bit fingerprint of an image, for telling identical frames apart.
+    //! Hashes every rowStep'th row of height rows, rowBytes bytes each.
+    //! This is not a cryptographic hash, but it does depend on byte positions
+    //! both within and across rows, so moved content changes the result.
+    uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep );
+
+    //! Byte range of one tile column within a row.
+    struct TileSpan {
+      uint32_t begin_;
+      uint32_t end_;
+    };
+
+    //! Compares current against previous, tile by tile, and sets the byte in marks for
+    //! every tile that differs. marks holds columns bytes per tile row, and bytes that are
+    //! already set are not compared again. Rows of previous are updated to match current
+    //! where needed, so that it can be compared against the next frame.
+    void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+      const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks );
+
+    //! Luma statistics that can be gathered while converting.
+    enum LumaStatsFlags: uint32_t {
+      LumaStats_Histogram = 1, //!< Fill in the histogram. Black and clipped counts are derived from it.
+      LumaStats_Levels = 2     //!< Count black and clipped pixels without a histogram.
+    };
+
+    //! 8-bit luma code values that pixels are counted against, inclusive.
+    struct LumaThresholds {
+      uint8_t black_ = 32;
+      uint8_t clipLow_ = 15;
+      uint8_t clipHigh_ = 236;
+    };
+
+    struct LumaStats {
+      uint32_t black_;
+      uint32_t clippedLow_;
+      uint32_t clippedHigh_;
+      uint32_t histogram_[256];
+    };
+
+    //! Converts 8-bit 4:2:2 UYVY to BGRA, expanding limited range with BT.601 or BT.709
+    //! coefficients. Luma statistics selected by statsFlags are gathered into stats in the
+    //! same pass, and stats is left untouched if statsFlags is 0.
+    void uyvyToBGRA( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height, bool rec709,
+      uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats );
+
+    //! Packed RGB layouts for high bit depth output.
+    enum RgbLayout {
+      Rgb_10A2, //!< 32 bits per pixel, with 10-bit R in the low bits, then G and B, and 2 bits of alpha on top.
+      Rgb_A64   //!< 16 bits per channel, in R, G, B, A order.
+    };
+
+    //! Converts 10-bit 4:2:2 v210 to full range RGB in layout, expanding limited range
+    //! with BT.601 or BT.709 coefficients.
+    void v210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height, bool rec709, RgbLayout layout );
+
+    //! Converts limited range 10-bit r210 to full range RGB in layout.
+    void r210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height, RgbLayout layout );
+
+    //! Converts v210 to P010: a plane of 16-bit luma followed by a plane of interleaved 16-bit
+    //! Cb and Cr at half height, both with destinationRowBytes per row. Chroma of each pair of
+    //! rows is averaged. Values keep their limited range, in the high 10 bits of each word.
+    void v210ToP010( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height );
+
+    //! Element layout of a tensor filled from BGRA frames.
+    struct TensorFormat {
+      uint32_t channels_ = 3; //!< 3 or 4. Alpha is dropped with 3.
+      bool rgb_ = true;       //!< R, G, B order instead of B, G, R.
+      bool float_ = false;    //!< 32-bit floats scaled to 0..1 instead of bytes.
+    };
+
+    inline size_t tensorPixelBytes( const TensorFormat& format )
+    {
+      return format.channels_ * ( format.float_ ? sizeof( float ) : 1 );
+    }
+
+    //! Converts BGRA into one densely packed height x width x channels image of a tensor.
+    void bgraToTensor( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      long width, long height, const TensorFormat& format );
+
+    //! Reference implementations, which the vectorized ones must match bit for bit.
+    //! The functions above call the variant picked for this processor.
+    namespace scalar {
+      uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep );
+      void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+        const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks );
+      void uyvyToBGRA( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709,
+        uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats );
+      void v210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709, RgbLayout layout );
+      void r210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, RgbLayout layout );
+      void v210ToP010( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height );
+      void bgraToTensor( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        long width, long height, const TensorFormat& format );
+    }
+
+    namespace sse2 {
+      uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep );
+      void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+        const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks );
+      void uyvyToBGRA( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709,
+        uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats );
+      void v210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709, RgbLayout layout );
+      void r210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, RgbLayout layout );
+      void v210ToP010( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height );
+      void bgraToTensor( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        long width, long height, const TensorFormat& format );
+    }
+
+    namespace avx2 {
+      uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep );
+      void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+        const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks );
+      void uyvyToBGRA( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709,
+        uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats );
+      void v210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709, RgbLayout layout );
+    }
+
+    namespace avx512 {
+      uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep );
+      void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+        const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks );
+    }
+
+    //! Instruction set levels that kernel variants are written for, in order of preference.
+    enum KernelLevel {
+      Level_Scalar = 0,
+      Level_SSE2,
+      Level_AVX2,
+      Level_AVX512, //!< AVX-512F and BW.
+      Level_Count
+    };
+
+    //! The best level this processor and OS support, as found with CPUID.
+    KernelLevel supportedLevel();
+
+    //! Reads the kernels library option, which caps the level to pick variants from, for
+    //! comparing them against each other. Each kernel gets its best variant within the cap.
+    void configure( const Options& options );
+
+    //! Runs every variant that this processor can run on generated images, and compares
+    //! the results against the scalar reference. Returns the number of variants that differ.
+    uint32_t selfTest();
+
+    void writeStats( JsonWriter& json );
+
+  }
+
+}
@@ -7,6 +7,14 @@
 
 #include "pch.h"
 #include "utils.h"
+#include "options.h"
+#include "threads.h"
+#include "kernels.h"
+#include "snapshot.h"
+#include "history.h"
+#include "cadence.h"
+#include "degrade.h"
+#include "capturegroup.h"
 #include "libminibmcapture.h"
 
 #include "decklink_api/DeckLinkAPIVersion.h"
@@ -23,49 +31,143 @@ namespace minibm {
 
   extern Globals g_globals;
 
-  class BGRA32VideoFrame: public IDeckLinkVideoFrame {
+  //! Frame flags that are carried over to the next frame if nobody picked up the frame they were set on.
+  const uint32_t c_stickyFrameFlags = Frame_FormatChanged;
+
+  //! Converted frame in one of the output pixel formats.
+  class OutputVideoFrame: public IDeckLinkVideoFrame {
   private:
     long width_;
     long height_;
     BMDFrameFlags flags_;
-    vector<uint8_t> buffer_;
+    PixelFormat format_ = Pixel_BGRA;
+    AlignedBuffer buffer_;
     atomic<uint32_t> refCount_;
   public:
-    BGRA32VideoFrame(): width_( 0 ), height_( 0 ), flags_( 0 ), refCount_( 1 ) {}
-    BGRA32VideoFrame( long width, long height, BMDFrameFlags flags ):
+    uint32_t index_ = 0; //!< Capture frame index.
+    uint32_t frameFlags_ = 0; //!< FrameFlags
+    uint64_t fingerprint_ = 0; //!< Fingerprint of the source frame the contents were converted from, or 0 if unknown.
+    uint32_t sourceIndex_ = 0; //!< Index of the frame the contents were converted from, 0 if unknown, or c_slateIndex.
+    static const uint32_t c_slateIndex = UINT32_MAX; //!< sourceIndex_ of a frame filled with the no-signal slate.
+    BMDTimeValue streamTime_ = 0;
+    BMDTimeValue streamDuration_ = 0;
+    BMDTimeScale timeScale_ = 0;
+    int64_t referenceTime_ = 0; //!< Host time in microseconds the frame was captured at, with reference timing on.
+    uint32_t tileSize_ = 0; //!< Tile size in pixels, or 0 if tiles_ isn't in use.
+    uint32_t tileColumns_ = 0;
+    uint32_t tileRows_ = 0;
+    vector<uint8_t> tiles_; //!< Bitmap of tiles changed since the previously returned frame.
+    FrameAnalysis analysis_ = {};
+    static long rowBytes( PixelFormat format, long width )
+    {
+      switch ( format )
+      {
+        case Pixel_RGBA64: return width * 8;
+        case Pixel_P010: return ( ( width + 1 ) & ~1L ) * 2;
+        default: return width * 4;
+      }
+    }
+    static size_t bufferSize( PixelFormat format, long width, long height )
+    {
+      // P010 chroma is a second plane of half height
+      auto rows = ( format == Pixel_P010 ? height + ( height + 1 ) / 2 : height );
+      return static_cast<size_t>( rowBytes( format, width ) ) * rows;
+    }
+    OutputVideoFrame(): width_( 0 ), height_( 0 ), flags_( 0 ), refCount_( 1 ) {}
+    OutputVideoFrame( long width, long height, BMDFrameFlags flags ):
       width_( width ), height_( height ), flags_( flags ), refCount_( 1 )
     {
-      buffer_.resize( width_ * height_ * 4 );
+      buffer_.resize( bufferSize( format_, width_, height_ ) );
+    }
+    //! Changes the pixel format. Contents are invalid until the next resize.
+    inline void setFormat( PixelFormat format )
+    {
+      format_ = format;
+      width_ = height_ = 0;
+    }
+    inline PixelFormat format() const { return format_; }
+    //! Preallocates room for frames of up to width * height pixels.
+    inline void reserve( long width, long height )
+    {
+      buffer_.reserve( bufferSize( format_, width, height ) );
     }
+    //! Leaves the frame as it was if the buffer can't grow.
     inline void resize( long width, long height )
     {
+      buffer_.resize( bufferSize( format_, width, height ) );
       width_ = width;
       height_ = height;
-      buffer_.resize( width_ * height_ * 4 );
     }
     inline void match( IDeckLinkVideoFrame* other )
     {
       if ( width_ != other->GetWidth() || height_ != other->GetHeight() )
         resize( other->GetWidth(), other->GetHeight() );
     }
-    inline const vector<uint8_t>& buffer() const { return buffer_; }
-    void swap( BGRA32VideoFrame& other )
+    //! Sets the NUMA node the frame should live on, or -1 for any. Contents are invalid until the next resize.
+    inline void setNode( int node ) { buffer_.setNode( node ); }
+    inline const AlignedBuffer& buffer() const { return buffer_; }
+    inline void prefault() { buffer_.prefault(); }
+    //! Frees the buffer. Contents are invalid until the next resize.
+    inline void freeBuffer()
+    {
+      buffer_.clear();
+      width_ = height_ = 0;
+    }
+    inline uint8_t* data() const { return buffer_.data(); }
+    //! Makes this a copy of other, for when other can't be given away by swapping.
+    void copyFrom( const OutputVideoFrame& other )
+    {
+      buffer_.resize( bufferSize( other.format_, other.width_, other.height_ ) );
+      format_ = other.format_;
+      width_ = other.width_;
+      height_ = other.height_;
+      memcpy( buffer_.data(), other.buffer_.data(), buffer_.size() );
+      index_ = other.index_;
+      frameFlags_ = other.frameFlags_;
+      fingerprint_ = other.fingerprint_;
+      sourceIndex_ = other.sourceIndex_;
+      streamTime_ = other.streamTime_;
+      streamDuration_ = other.streamDuration_;
+      timeScale_ = other.timeScale_;
+      referenceTime_ = other.referenceTime_;
+      tileSize_ = other.tileSize_;
+      tileColumns_ = other.tileColumns_;
+      tileRows_ = other.tileRows_;
+      tiles_ = other.tiles_;
+      analysis_ = other.analysis_;
+    }
+    void swap( OutputVideoFrame& other )
     {
       std::swap( width_, other.width_ );
       std::swap( height_, other.height_ );
+      std::swap( format_, other.format_ );
+      std::swap( index_, other.index_ );
+      std::swap( frameFlags_, other.frameFlags_ );
+      std::swap( fingerprint_, other.fingerprint_ );
+      std::swap( sourceIndex_, other.sourceIndex_ );
+      std::swap( streamTime_, other.streamTime_ );
+      std::swap( streamDuration_, other.streamDuration_ );
+      std::swap( timeScale_, other.timeScale_ );
+      std::swap( referenceTime_, other.referenceTime_ );
+      std::swap( tileSize_, other.tileSize_ );
+      std::swap( tileColumns_, other.tileColumns_ );
+      std::swap( tileRows_, other.tileRows_ );
+      tiles_.swap( other.tiles_ );
+      std::swap( analysis_, other.analysis_ );
       buffer_.swap( other.buffer_ );
     }
     // IDeckLinkVideoFrame
     virtual long STDMETHODCALLTYPE GetWidth() { return width_; }
     virtual long STDMETHODCALLTYPE GetHeight() { return height_; }
-    virtual long STDMETHODCALLTYPE GetRowBytes() { return width_ * 4; }
+    virtual long STDMETHODCALLTYPE GetRowBytes() { return rowBytes( format_, width_ ); }
     virtual HRESULT STDMETHODCALLTYPE GetBytes( void** buffer )
     {
       *buffer = reinterpret_cast<void*>( buffer_.data() );
       return S_OK;
     }
     virtual BMDFrameFlags STDMETHODCALLTYPE GetFlags() { return flags_; }
-    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat() { return BMDPixelFormat::bmdFormat8BitBGRA; }
+    //! Only BGRA is a real DeckLink format, so the SDK can only convert into frames in that.
+    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat() { return static_cast<BMDPixelFormat>( format_ ); }
     virtual HRESULT STDMETHODCALLTYPE GetAncillaryData( IDeckLinkVideoFrameAncillary** ancillary ) { return E_NOTIMPL; }
     virtual HRESULT STDMETHODCALLTYPE GetTimecode( BMDTimecodeFormat format, IDeckLinkTimecode** timecode ) { return E_NOTIMPL; }
     // IUnknown
@@ -94,7 +196,77 @@ namespace minibm {
     }
   };
 
+  //! Non-owning frame over memory we manage ourselves, for handing it to the SDK converter.
+  //! Lives on the stack for the duration of a conversion, so reference counting is a no-op.
+  class VideoFrameView: public IDeckLinkVideoFrame {
+  private:
+    long width_;
+    long height_;
+    long rowBytes_;
+    BMDPixelFormat format_;
+    uint8_t* data_;
+  public:
+    VideoFrameView( long width, long height, long rowBytes, BMDPixelFormat format, uint8_t* data ):
+      width_( width ), height_( height ), rowBytes_( rowBytes ), format_( format ), data_( data ) {}
+    // IDeckLinkVideoFrame
+    virtual long STDMETHODCALLTYPE GetWidth() { return width_; }
+    virtual long STDMETHODCALLTYPE GetHeight() { return height_; }
+    virtual long STDMETHODCALLTYPE GetRowBytes() { return rowBytes_; }
+    virtual HRESULT STDMETHODCALLTYPE GetBytes( void** buffer )
+    {
+      *buffer = reinterpret_cast<void*>( data_ );
+      return S_OK;
+    }
+    virtual BMDFrameFlags STDMETHODCALLTYPE GetFlags() { return bmdFrameFlagDefault; }
+    virtual BMDPixelFormat STDMETHODCALLTYPE GetPixelFormat() { return format_; }
+    virtual HRESULT STDMETHODCALLTYPE GetAncillaryData( IDeckLinkVideoFrameAncillary** ancillary ) { return E_NOTIMPL; }
+    virtual HRESULT STDMETHODCALLTYPE GetTimecode( BMDTimecodeFormat format, IDeckLinkTimecode** timecode ) { return E_NOTIMPL; }
+    // IUnknown
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID* ppv )
+    {
+      if ( !ppv )
+        return E_INVALIDARG;
+      if ( iid == IID_IUnknown || iid == IID_IDeckLinkVideoFrame )
+      {
+        *ppv = this;
+        return S_OK;
+      }
+      return E_NOINTERFACE;
+    }
+    virtual ULONG STDMETHODCALLTYPE AddRef() { return 1; }
+    virtual ULONG STDMETHODCALLTYPE Release() { return 1; }
+  };
+
+  class JsonWriter;
+
+  //! Allocates the driver's input frames, so that they count against the memory budget.
+  //! Released buffers are kept for reuse until the driver decommits.
+  class InputAllocator: public IDeckLinkMemoryAllocator {
+  private:
+    LONG refCount_;
+    RWLock lock_;
+    vector<uint8_t*> free_; //!< Released blocks, each starting with its size.
+    bool committed_ = false;
+    uint32_t allocated_ = 0; //!< Buffers currently handed out.
+    uint32_t refused_ = 0;
+    void freeBlock( uint8_t* block );
+  public:
+    InputAllocator(): refCount_( 1 ) {}
+    void writeStats( JsonWriter& json );
+    ~InputAllocator();
+    // IDeckLinkMemoryAllocator
+    virtual HRESULT STDMETHODCALLTYPE AllocateBuffer( unsigned int bufferSize, void** allocatedBuffer );
+    virtual HRESULT STDMETHODCALLTYPE ReleaseBuffer( void* buffer );
+    virtual HRESULT STDMETHODCALLTYPE Commit();
+    virtual HRESULT STDMETHODCALLTYPE Decommit();
+    // IUnknown
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID* ppv );
+    virtual ULONG STDMETHODCALLTYPE AddRef();
+    virtual ULONG STDMETHODCALLTYPE Release();
+  };
+
   class DecklinkDevice;
+  struct ExportedFrame;
 
   using DecklinkDeviceVector = vector<DecklinkDevice*>;
 
@@ -133,30 +305,160 @@ namespace minibm {
 
   using DisplayModeVector = vector<DisplayMode>;
 
-  class DecklinkCapture {
+  //! Immutable JSON capabilities document for one device table generation.
+  struct CapabilitiesDocument {
+    uint32_t generation_;
+    string json_;
+  };
+
+  using CapabilitiesPtr = shared_ptr<const CapabilitiesDocument>;
+
+  class DecklinkCapture: public IDeckLinkDeviceNotificationCallback {
     friend class DecklinkDevice;
   private:
     DecklinkDeviceVector devices_;
     DecklinkDevice* currentCaptureDevice_ = nullptr;
+    DecklinkDeviceVector standbyDevices_; //!< Devices prepared to go live, each holding a reference.
+    CaptureGroupPtr group_;
     IDeckLinkVideoConversion* converter_ = nullptr;
+    IDeckLinkDiscovery* discovery_ = nullptr;
+    atomic<uint32_t> generation_;
+    fn_device_notify notifyCallback_ = nullptr;
+    void* notifyUserdata_ = nullptr;
+    fn_frame_notify frameCallback_ = nullptr;
+    void* frameUserdata_ = nullptr;
     RWLock lock_;
+    RWLock notifyLock_;
+    RWLock frameNotifyLock_;
+    CapabilitiesPtr capabilities_;
+    RWLock capabilitiesLock_;
+    std::map<uint64_t, ExportedFrame*> leases_;
+    uint64_t nextLease_ = 1;
+    RWLock leasesLock_;
+    Options options_;
+    ThreadPolicy threadPolicies_[ThreadRole_Count];
+    RWLock optionsLock_;
+    WorkerPool workers_;
+    RWLock workersLock_; //!< Serializes starting and resizing workers_, which can't be done under optionsLock_.
+    size_t workerCount() const;
     void iterateDevices();
+    bool addDevice( IDeckLink* decklink, int64_t& out_id );
+    bool removeDevice( IDeckLink* decklink, int64_t& out_id );
+    void notify( DeviceEvent event, int64_t id );
+    //! Called by the capturing device whenever a frame becomes available, and with 0 when capture stops.
+    void notifyFrame( uint32_t index );
     bool convertFrame( IDeckLinkVideoFrame* source, IDeckLinkVideoFrame* destination );
+  protected:
+    // IUnknown
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID* ppv );
+    virtual ULONG STDMETHODCALLTYPE AddRef();
+    virtual ULONG STDMETHODCALLTYPE Release();
+    // IDeckLinkDeviceNotificationCallback
+    virtual HRESULT STDMETHODCALLTYPE DeckLinkDeviceArrived( IDeckLink* decklink );
+    virtual HRESULT STDMETHODCALLTYPE DeckLinkDeviceRemoved( IDeckLink* decklink );
   public:
     static const string& getVersion();
     DecklinkCapture();
     ~DecklinkCapture();
     bool initialize();
-    inline const DecklinkDeviceVector& getDevices() const
-    {
-      return devices_;
-    }
-    bool startCaptureSingle( DecklinkDevice* device, BMDDisplayMode displayMode );
-    bool getFrameBlocking( BGRA32VideoFrame** out_frame, uint32_t& out_index );
+    //! Copies the current device table into out_devices, adding a reference to each
+    //! device. The caller must release them. Returns the table generation.
+    uint32_t getDevices( DecklinkDeviceVector& out_devices );
+    inline uint32_t getGeneration() const { return generation_.load(); }
+    void setNotifyCallback( fn_device_notify callback, void* userdata );
+    void setFrameCallback( fn_frame_notify callback, void* userdata );
+    //! Returns the capabilities document for the current device table generation,
+    //! building it only if the table has changed since it was last built.
+    CapabilitiesPtr getCapabilities();
+    //! Merges library-wide options, and applies them to an ongoing capture where possible.
+    void setOptions( const char* options );
+    //! Resolves the library-wide policy for role with capture-specific overrides applied.
+    ThreadPolicy getThreadPolicy( ThreadRole role, const Options& overrides );
+    //! Writes a JSON document of library and device runtime statistics into out.
+    void getStats( string& out );
+    //! Returns the worker pool, starting it if it isn't running yet.
+    WorkerPool* getWorkerPool();
+    //! Returns the latest snapshot of the ongoing capture, if any.
+    SnapshotPtr getSnapshot();
+    //! See DecklinkDevice::getHistoryFrame.
+    uint32_t getHistoryFrame( uint32_t index, uint8_t* buffer, uint32_t length, FrameInfo* out_frame );
+    bool findHistoryFrame( int64_t timestamp, int64_t timescale, uint32_t& out_index );
+    bool pinHistoryFrame( uint32_t index, bool pin );
+    //! Starts capturing on device. If device was prepared in displayMode, goes live from standby
+    //! with the options it was prepared with.
+    bool startCaptureSingle( DecklinkDevice* device, BMDDisplayMode displayMode, const Options& options );
+    //! Puts device in standby, ready for startCaptureSingle. The ongoing capture, if on device, stays in
+    //! standby rather than stopping. Any number of devices can be in standby at once.
+    bool prepareCapture( DecklinkDevice* device, BMDDisplayMode displayMode, const Options& options );
+    //! Stops a device that is in standby.
+    bool releaseStandby( DecklinkDevice* device );
+    //! With bgraOnly, fails without taking a frame if the capture's output isn't BGRA.
+    bool getFrameBlocking( OutputVideoFrame** out_frame, uint32_t timeout, bool bgraOnly = false );
+    //! See DecklinkDevice::exportFrame.
+    ExportedFrame* exportFrame( uint32_t timeout );
+    //! Exports a frame and keeps track of it under a lease handle until releaseLease. Returns 0 on failure.
+    uint64_t acquireLease( uint32_t timeout, ExportedFrame** out_frame );
+    bool releaseLease( uint64_t lease );
+    //! See DecklinkDevice::openConsumer.
+    uint32_t openConsumer( const Options& options );
+    bool getConsumerFrame( uint32_t id, OutputVideoFrame** out_frame, uint32_t timeout );
+    void closeConsumer( uint32_t id );
+    //! Gets a batch of frames from the ongoing capture, and fills tensorOut with them if tensor is given.
+    size_t getFramesBatch( size_t max, uint32_t timeout, const kernels::TensorFormat* tensor,
+      uint8_t* tensorOut, uint64_t tensorLength, OutputVideoFrame** out_frames );
     void stopCaptureSingle();
+    //! Starts capturing on devices together, as a group whose frames are matched by capture time.
+    //! Only one group can be capturing at a time.
+    bool startCaptureGroup( const DecklinkDeviceVector& devices, BMDDisplayMode displayMode, const Options& options );
+    //! See CaptureGroup::getFrameSet.
+    size_t getFrameSet( vector<OutputVideoFrame*>& out_frames, uint32_t timeout );
+    void stopCaptureGroup();
     void shutdown();
   };
 
+  //! Converted frame in the fan-out ring, shared by every consumer reading it.
+  struct SharedFrame {
+    OutputVideoFrame frame_;
+    uint32_t refs_ = 0; //!< Consumers currently holding the frame. It isn't overwritten while held.
+  };
+
+  //! Reader of the fan-out ring with a cursor of its own.
+  struct Consumer {
+    uint32_t id_ = 0;
+    uint32_t cursor_ = 0; //!< Index of the last frame this consumer got or passed over.
+    SharedFrame* held_ = nullptr; //!< Frame returned by the last get, held until the next one.
+    CadenceSelector cadence_;
+    uint32_t delivered_ = 0;
+    uint32_t dropped_ = 0; //!< Frames that were gone from the ring before this consumer got to them.
+    uint32_t skipped_ = 0; //!< Frames passed over to keep to the consumer's own rate.
+    uint32_t lag_ = 0; //!< How many frames behind the newest one the last returned frame was.
+    uint32_t maxLag_ = 0;
+  };
+
+  //! Frame handed out as a DLPack tensor, kept apart from the device's own frames until the tensor is deleted.
+  struct ExportedFrame {
+    DLManagedTensor tensor_ = {};
+    int64_t shape_[3] = {};
+    int64_t strides_[3] = {};
+    OutputVideoFrame frame_;
+    DecklinkDevice* device_ = nullptr;
+    uint32_t generation_ = 0; //!< Pool generation the frame was set up for.
+  };
+
+  //! What to do with frames that are identical to the previous one.
+  enum DedupeMode {
+    Dedupe_Off = 0, //!< Don't fingerprint frames at all.
+    Dedupe_Flag,    //!< Deliver duplicates with Frame_Duplicate set, skipping conversion where possible.
+    Dedupe_Drop     //!< Suppress duplicates before conversion.
+  };
+
+  //! What frames without an input signal are delivered as. They are never converted themselves.
+  enum NoSignalPolicy {
+    NoSignal_Hold = 0, //!< The last frame that had a signal, or the slate until one has.
+    NoSignal_Slate,    //!< A frame of a single color.
+    NoSignal_Status    //!< No picture at all, only the frame flags.
+  };
+
   class DecklinkDevice: public IDeckLinkInputCallback {
     friend class DecklinkCapture;
   private:
@@ -164,20 +466,165 @@ namespace minibm {
     IDeckLinkProfileAttributes* attributes_ = nullptr;
     IDeckLinkConfiguration* config_ = nullptr;
     IDeckLinkInput* input_ = nullptr;
+    InputAllocator* allocator_ = nullptr;
     bool applyDetectedMode_ = false;
     RWLock lock_;
+    RWLock restartLock_; //!< Held over a format change restart, so stopCapture can't land in the middle of one.
     DecklinkCapture* owner_;
-    BGRA32VideoFrame frame_;
-    BGRA32VideoFrame storedFrame_;
+    OutputVideoFrame frame_;
+    OutputVideoFrame storedFrame_;
     Event newFrameEvent_;
     atomic<uint32_t> frameIndex_;
-    uint32_t lastReturnedFrameIndex_;
+    uint32_t lastReturnedFrameIndex_ = 0;
+    uint32_t pendingFlags_ = 0; //!< FrameFlags to set on the next frame
+    int64_t formatChangeTime_ = 0;
+    uint32_t formatChanges_ = 0;
+    int64_t lastFormatChangeLatency_ = 0;
+    int64_t maxFormatChangeLatency_ = 0;
+    DedupeMode dedupeMode_ = Dedupe_Off;
+    long dedupeRowStep_ = 1;
+    uint64_t lastFingerprint_ = 0; //!< Full fingerprint of the last frame, or 0 if it wasn't taken.
+    uint64_t lastSampledFingerprint_ = 0; //!< Fingerprint of the last frame's sampled rows, when dedupeRowStep_ is above 1.
+    uint32_t duplicateFrames_ = 0;
+    atomic<uint32_t> memoryDrops_ = 0; //!< Frames dropped for memory being refused mid-capture.
+    uint32_t suppressedFrames_ = 0;
+    long tileSize_ = 0; //!< Tile size in pixels, or 0 to not track changed tiles.
+    vector<kernels::TileSpan> tileSpans_;
+    vector<uint8_t> tileMarks_;
+    AlignedBuffer previousFrame_; //!< Copy of the last source frame, to compare against.
+    long previousWidth_ = 0;
+    long previousHeight_ = 0;
+    long previousRowBytes_ = 0;
+    BMDPixelFormat previousFormat_ = static_cast<BMDPixelFormat>( 0 );
+    uint64_t changedTiles_ = 0;
+    uint64_t totalTiles_ = 0;
+    uint32_t analysisFlags_ = 0; //!< AnalysisFlags
+    kernels::LumaThresholds lumaThresholds_;
+    kernels::LumaStats lumaStats_ = {};
+    double blackRatio_ = 0.98;
+    double clipRatio_ = 0.01;
+    uint32_t freezeFrames_ = 5;
+    uint32_t frozenCount_ = 0;
+    uint32_t blackFrames_ = 0;
+    uint32_t clippedFrames_ = 0;
+    uint32_t frozenFrames_ = 0;
+    PixelFormat outputFormat_ = Pixel_BGRA;
+    AlignedBuffer intermediate_; //!< v210 copy of sources that the high bit depth kernels can't take directly.
+    vector<unique_ptr<OutputVideoFrame>> queue_; //!< Ring of frames waiting to be picked up, with the queue option.
+    size_t queueHead_ = 0;
+    size_t queueCount_ = 0;
+    uint32_t queueDrops_ = 0;
+    vector<unique_ptr<OutputVideoFrame>> batch_; //!< Frames handed out by the last getFramesBatch call.
+    atomic<size_t> batchWanted_ = 1; //!< Number of queued frames a waiting consumer needs to be woken up.
+    vector<unique_ptr<SharedFrame>> shared_; //!< Fan-out ring of converted frames, with the fanout option.
+    uint32_t sharedOverruns_ = 0; //!< Frames that couldn't be published because every slot was held.
+    vector<unique_ptr<Consumer>> consumers_; //!< Consumer 0 stands in for the plain get functions.
+    uint32_t nextConsumerId_ = 1;
+    ConditionVariable consumerWake_;
+    static const uint32_t c_defaultPoolSize = 2; //!< Frames that can be exported at once without the pool option.
+    vector<unique_ptr<ExportedFrame>> pool_; //!< Free frames for exporting, set up with the pool option.
+    uint32_t poolGeneration_ = 0; //!< Bumped when the pool is set up again, so that older frames are let go on return.
+    uint32_t poolSize_ = 0; //!< Most frames that can be handed out at once.
+    uint32_t poolAllocated_ = 0; //!< Frames of this generation allocated so far, up to poolSize_.
+    long poolWidth_ = 0; //!< Largest frame size pooled frames are allocated for.
+    long poolHeight_ = 0;
+    size_t poolTileBytes_ = 0;
+    uint32_t poolOutstanding_ = 0;
+    uint32_t poolPeak_ = 0; //!< Most frames handed out at once.
+    uint32_t poolExhausted_ = 0; //!< Exports that found every pooled frame handed out, and had to wait for one.
+    uint32_t poolTimeouts_ = 0; //!< Exports that gave up waiting for a pooled frame.
+    int64_t poolWaitTime_ = 0; //!< Microseconds spent waiting for pooled frames in total.
+    RWLock poolLock_;
+    ConditionVariable poolWake_;
+    CadenceSelector cadence_;
+    SnapshotStage snapshots_;
+    FrameHistory history_;
+    int deviceNode_ = -1; //!< NUMA node the card is attached to, or -1 if unknown.
+    int numaNode_ = -1; //!< NUMA node buffers are placed on, or -1 for none.
+    bool pinToNode_ = false; //!< Whether the callback thread is kept on numaNode_ too, which takes the numa option being given.
+    uint32_t localConversions_ = 0; //!< Frames converted while running on numaNode_.
+    uint32_t remoteConversions_ = 0; //!< Frames converted while running on some other node.
+    uint64_t remoteBytes_ = 0; //!< Source and output bytes touched by remote conversions.
+    BMDDisplayMode requestedMode_ = bmdModeUnknown; //!< Mode the capture was started in, before any detected changes.
+    bool standby_ = false; //!< Input is running with everything set up, but frames are discarded.
+    uint32_t standbyFrames_ = 0; //!< Frames discarded while in standby.
+    bool warmStart_ = false; //!< Whether the capture went live from standby.
+    int64_t startTime_ = 0; //!< When the capture was asked to go live, until its first frame arrives.
+    int64_t lastStartLatency_ = 0; //!< Microseconds from being asked to go live to the first frame.
+    int64_t maxStartLatency_ = 0;
+    bool referenceTiming_ = false; //!< Whether frames get referenceTime_, for matching them against other devices.
+    bool hardwareClock_ = false; //!< Whether the card's reference clock could be read, or frames are timed on arrival.
+    int64_t clockOffset_ = 0; //!< Hardware reference clock minus host clock, in microseconds.
+    int64_t clockSyncTime_ = 0; //!< When clockOffset_ was last measured.
+    DegradePolicy degrade_;
+    bool deferred_ = false; //!< Whether frame_'s conversion was skipped by degradation, leaving its source in deferredSource_.
+    AlignedBuffer deferredSource_; //!< Copy of the source of a deferred frame_, so that the driver gets its buffer back.
+    long deferredWidth_ = 0;
+    long deferredHeight_ = 0;
+    long deferredRowBytes_ = 0;
+    BMDPixelFormat deferredFormat_ = bmdFormat8BitYUV;
+    bool frameHalved_ = false; //!< Whether frame_ was last converted at half size.
+    NoSignalPolicy noSignal_ = NoSignal_Hold;
+    uint32_t slateColor_ = 0; //!< 0xRRGGBB
+    bool signal_ = true; //!< Whether the last frame had an input signal.
+    uint32_t heldIndex_ = 0; //!< Index of the last frame with a signal, with NoSignal_Hold. 0 if there is no picture to hold.
+    OutputVideoFrame heldFrame_; //!< Copy of the picture of heldIndex_, taken when the signal is lost.
+    uint32_t signalLosses_ = 0;
+    uint32_t noSignalFrames_ = 0;
+    int64_t signalLostTime_ = 0; //!< When the signal was last lost, in microseconds.
+    int64_t lastOutage_ = 0; //!< Microseconds the signal was gone for the last time it came back.
+    int64_t maxOutage_ = 0;
+    bool rgbSignal_ = false; //!< Whether the card last detected an RGB signal rather than YUV.
+    uint32_t formatCost_ = 0; //!< Relative host cost of getting the output from pixelFormat_, or 0 if unknown.
+    bool formatDirect_ = false; //!< Whether the card delivers the output format itself.
+    string formatReason_; //!< Why pixelFormat_ was chosen.
+    Options captureOptions_;
+    ThreadPolicy callbackPolicy_;
+    ThreadState callbackState_;
     bool init();
+    //! startCapture, minus the lock and the handling of memory being refused. Caller holds lock_.
+    bool beginCapture( BMDDisplayMode displayMode, const Options& options, bool standby, int64_t startTime );
+    //! Frees the frame buffers, for when a capture couldn't get all it needed. Caller holds lock_.
+    void freeBuffers();
+    //! The frame callback proper. Returns the index of the frame made available, or 0 if none was.
+    //! Sets out_signalEvent to the DeviceEvent of the input signal coming or going, if it did.
+    uint32_t receiveFrame( IDeckLinkVideoInputFrame* videoFrame, uint32_t& out_signalEvent );
+    void updateTiles( IDeckLinkVideoInputFrame* source, bool duplicate, bool accumulate );
+    //! Converts source into frame_, gathering luma statistics on the way when possible.
+    //! With halve, converts at half size where that saves work, and returns whether it did.
+    bool convertFrame( IDeckLinkVideoFrame* source, bool halve = false );
+    //! Converts the frame whose conversion was put off into frame_. Caller holds lock_.
+    void convertDeferred();
+    void releaseDeferred();
+    //! Fills frame_ in for a frame without an input signal, as noSignal_ says. Caller holds lock_.
+    void takeHeldPicture();
+    void showNoSignal( IDeckLinkVideoInputFrame* source );
+    void releaseHeld();
+    //! Picks the format for the card to capture mode in, with the least work left for us to get the output
+    //! format from it, among those the card supports and that lose nothing. Caller holds lock_.
+    BMDPixelFormat negotiateFormat( BMDDisplayMode mode, bool rgb );
+    //! Converts source into frame_ when the output format is not BGRA.
+    void convertHighDepth( IDeckLinkVideoFrame* source );
+    //! Fills in the non-luma parts of frame_'s analysis, and returns the resulting FrameFlags.
+    uint32_t analyzeFrame();
+    //! Drops the oldest queued frame, carrying its sticky flags and changed tiles over to the next one.
+    void dropQueuedFrame();
+    //! Moves frame_ to the back of the queue, dropping the oldest queued frame if it is full.
+    void enqueueFrame();
+    //! Measures clockOffset_ against the card's reference clock. Caller holds lock_.
+    void syncReferenceClock();
+    //! Works out the host time frame was captured at. Caller holds lock_.
+    int64_t referenceTimeOf( IDeckLinkVideoInputFrame* frame );
+    //! Moves frame_ into the oldest slot of the fan-out ring that no consumer is holding.
+    void publishFrame();
+    //! Finds the oldest frame in the fan-out ring newer than index. Caller holds lock_.
+    SharedFrame* nextShared( uint32_t index );
+    Consumer* findConsumer( uint32_t id );
+    //! Allocates a frame for the export pool, sized for the largest mode. Caller holds poolLock_.
+    unique_ptr<ExportedFrame> createExport();
+    //! Whether frames are being delivered to consumers. Caller holds lock_.
+    inline bool live() const { return ( capturing_ && !standby_ ); }
   protected:
-    // IUnknown
-    virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID* ppv );
-    virtual ULONG STDMETHODCALLTYPE AddRef();
-    virtual ULONG STDMETHODCALLTYPE Release();
     LONG refCount_;
     // IDeckLinkDeviceNotificationCallback
     virtual HRESULT STDMETHODCALLTYPE VideoInputFormatChanged(
@@ -188,18 +635,77 @@ namespace minibm {
       IDeckLinkVideoInputFrame* videoFrame,
       IDeckLinkAudioInputPacket* audioPacket );
   public:
+    // IUnknown
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface( REFIID iid, LPVOID* ppv );
+    virtual ULONG STDMETHODCALLTYPE AddRef();
+    virtual ULONG STDMETHODCALLTYPE Release();
+    //! Reads the persistent identity of a DeckLink device without probing it fully.
+    //! Falls back to the topological ID on devices that have no persistent ID,
+    //! and to a hash of the device handle on devices that have neither.
+    static int64_t queryIdentity( IDeckLink* decklink );
     string name_;
     int64_t id_ = 0;
     bool usable_ = false;
     bool hasInput_ = false;
     bool hasFormatDetection_ = false;
-    bool capturing_ = false;
+    atomic<bool> capturing_ = false;
     BMDPixelFormat pixelFormat_ = bmdFormat8BitYUV;
     DisplayMode displayMode_;
     DisplayModeVector displayModes_;
     DecklinkDevice( DecklinkCapture* owner, IDeckLink* dl );
-    bool startCapture( BMDDisplayMode displayMode );
-    bool getFrameBlocking( BGRA32VideoFrame** out_frame, uint32_t& out_index );
+    //! Starts capturing. In standby, the input runs and buffers are set up and touched,
+    //! but frames are discarded until goLive is called. Fails with the last error set
+    //! if the buffers for it can't be had within the memory budget.
+    bool startCapture( BMDDisplayMode displayMode, const Options& options, bool standby = false );
+    //! Starts delivering frames from standby, without touching the input.
+    void goLive();
+    //! Stops delivering frames and keeps the input running, as if started in standby.
+    void enterStandby();
+    inline bool inStandby() const { return standby_; }
+    //! Re-resolves thread policies after library-wide options have changed.
+    void refreshThreadPolicies();
+    void writeStats( JsonWriter& json );
+    inline SnapshotPtr getSnapshot() { return snapshots_.latest(); }
+    //! Converts the frame with index from the history into buffer if length allows, and returns the size
+    //! it takes, or 0 if the frame isn't in the history or can't be converted.
+    uint32_t getHistoryFrame( uint32_t index, uint8_t* buffer, uint32_t length, FrameInfo* out_frame );
+    inline bool findHistoryFrame( int64_t timestamp, int64_t timescale, uint32_t& out_index )
+    {
+      return history_.find( timestamp, timescale, out_index );
+    }
+    inline bool pinHistoryFrame( uint32_t index, bool pin ) { return ( pin ? history_.pin( index ) : history_.unpin( index ) ); }
+    //! With a nonzero maxPixels, a frame larger than that is left where it is, and false returned.
+    bool getFrameBlocking( OutputVideoFrame** out_frame, uint32_t timeout, uint64_t maxPixels = 0 );
+    //! Takes up to max of the oldest queued frames of the same size, after waiting up to timeout for max
+    //! frames to be queued. With a nonzero tensorPixelBytes, stops at the number of frames that fit in
+    //! tensorLength. Without a queue, works like getFrameBlocking. Returns the number of frames.
+    size_t getFramesBatch( size_t max, uint32_t timeout, size_t tensorPixelBytes, uint64_t tensorLength,
+      OutputVideoFrame** out_frames );
+    //! Opens a consumer of the fan-out ring that starts from the next frame, and returns its ID,
+    //! or 0 if the capture has no fan-out ring. Options can give the consumer a rate of its own.
+    uint32_t openConsumer( const Options& options );
+    //! Gets the next frame for consumer, releasing the one it got before. Frames it didn't
+    //! keep up with are counted as dropped. maxPixels works like with getFrameBlocking.
+    bool getConsumerFrame( uint32_t id, OutputVideoFrame** out_frame, uint32_t timeout, uint64_t maxPixels = 0 );
+    void closeConsumer( uint32_t id );
+    //! Gets a frame like getFrameBlocking, and moves it into a pooled frame that stays valid until it is
+    //! released. If every pooled frame is handed out, waits for one within the same timeout.
+    //! Returns null if no frame arrived in time.
+    ExportedFrame* exportFrame( uint32_t timeout );
+    //! Returns an exported frame to the pool. Called by the tensor deleter and when a lease is released.
+    void releaseExport( ExportedFrame* exported );
+    inline PixelFormat outputFormat() const { return outputFormat_; }
+    //! Turns reference timing on or off for captures started after this.
+    inline void setReferenceTiming( bool enable ) { referenceTiming_ = enable; }
+    inline bool hasHardwareClock() const { return hardwareClock_; }
+    inline HANDLE frameEvent() const { return newFrameEvent_.get(); }
+    int64_t frameDurationMicroseconds();
+    //! Gets the reference time of the newest queued frame. Returns false if none are queued.
+    bool newestQueuedTime( int64_t& out_time );
+    //! Takes the queued frame with the reference time nearest to time, within tolerance microseconds either
+    //! way, dropping every frame queued before it. With none in range, only drops frames too old to ever be.
+    //! The frame stays valid until the next frame is taken.
+    bool takeQueuedFrame( int64_t time, int64_t tolerance, OutputVideoFrame** out_frame, int64_t& out_skew );
     void stopCapture();
     ~DecklinkDevice();
   };
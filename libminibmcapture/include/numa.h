@@ -0,0 +1,31 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+
+namespace minibm {
+
+  namespace numa {
+
+    //! Looks up the NUMA node of the PCIe device behind a DeckLink device handle string,
+    //! by finding the PCI device instance it names. Returns -1 if that can't be determined,
+    //! which is also what single node systems and firmware that doesn't report it give.
+    int deviceNode( const string& handle );
+
+    //! Gets the processors of node. Nodes larger than a processor group only give their first group.
+    bool nodeAffinity( int node, GROUP_AFFINITY& out_affinity );
+
+    //! Returns the node of the processor the calling thread is running on right now, or -1.
+    int currentNode();
+
+    //! Samples which node the resident pages of a buffer are on, adding the counts to out_local
+    //! and out_remote. Pages that haven't been touched yet count as neither.
+    void pagePlacement( const void* data, size_t size, int node, uint64_t& out_local, uint64_t& out_remote );
+
+  }
+
+}
@@ -0,0 +1,42 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+
+namespace minibm {
+
+  //! Parsed options string.
+  //! The format is a list of key=value pairs separated by semicolons or whitespace,
+  //! for example "callback.priority=highest; callback.affinity=0x0f".
+  //! A key without a value is treated as a boolean flag that is set.
+  class Options {
+  public:
+    using ValueMap = std::map<string, string>;
+  private:
+    ValueMap values_;
+  public:
+    Options() {}
+    explicit Options( const char* str ) { parse( str ); }
+    //! Parses str and merges its values into this set, overriding existing keys.
+    void parse( const char* str );
+    //! Merges other into this set, overriding existing keys.
+    void merge( const Options& other );
+    inline bool has( const string& key ) const { return values_.find( key ) != values_.end(); }
+    inline bool empty() const { return values_.empty(); }
+    inline const ValueMap& values() const { return values_; }
+    string getString( const string& key, const string& defaultValue = string() ) const;
+    //! Accepts decimal and 0x-prefixed hexadecimal values.
+    int64_t getInt( const string& key, int64_t defaultValue = 0 ) const;
+    uint64_t getUnsigned( const string& key, uint64_t defaultValue = 0 ) const;
+    double getFloat( const string& key, double defaultValue = 0.0 ) const;
+    //! Accepts 1/0, true/false, yes/no and on/off.
+    bool getBool( const string& key, bool defaultValue = false ) const;
+    //! Splits a comma-separated value into lowercase items, skipping empty ones.
+    vector<string> getList( const string& key ) const;
+  };
+
+}
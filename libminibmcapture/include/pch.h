@@ -44,6 +44,8 @@
 #include <cstdint>
 #include <algorithm>
 #include <atomic>
+#include <deque>
+#include <functional>
 
 namespace minibm {
 
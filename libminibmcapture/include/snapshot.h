@@ -0,0 +1,73 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+#include "utils.h"
+#include "options.h"
+#include "threads.h"
+#include "codecs.h"
+#include "libminibmcapture.h"
+
+namespace minibm {
+
+  class OutputVideoFrame;
+  class JsonWriter;
+
+  //! Encoded snapshot of a captured frame.
+  struct Snapshot {
+    SnapshotFormat format_ = Snapshot_None;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t index_ = 0;
+    int64_t timestamp_ = 0;
+    int64_t timescale_ = 0;
+    vector<uint8_t> data_;
+  };
+
+  using SnapshotPtr = shared_ptr<const Snapshot>;
+
+  //! Periodically takes a copy of the captured frame and encodes it on the worker pool.
+  //! Only one snapshot is in the works at a time. If encoding can't keep up with the
+  //! interval, snapshots are skipped rather than queued.
+  class SnapshotStage {
+  private:
+    SnapshotFormat format_ = Snapshot_None;
+    int64_t interval_ = 0; //!< Microseconds
+    long width_ = 0; //!< Output width, or 0 for the frame width.
+    WorkerPool* pool_ = nullptr;
+    codecs::JpegEncoder jpeg_;
+    int64_t lastTaken_ = 0;
+    atomic<bool> busy_ = false;
+    Event idle_;
+    AlignedBuffer source_; //!< Copy of the frame being encoded.
+    long sourceWidth_ = 0;
+    long sourceHeight_ = 0;
+    AlignedBuffer scaled_;
+    Snapshot pending_; //!< Metadata of the snapshot being encoded.
+    SnapshotPtr latest_;
+    RWLock lock_;
+    uint32_t encoded_ = 0;
+    uint32_t skipped_ = 0;
+    int64_t lastEncodeTime_ = 0;
+    int64_t maxEncodeTime_ = 0;
+    void encode();
+  public:
+    SnapshotStage(): idle_( true ) {}
+    //! Reads the snapshot options. Stops any snapshot in the works first.
+    void configure( const Options& options, WorkerPool* pool );
+    inline bool enabled() const { return ( format_ != Snapshot_None ); }
+    //! Called from the capture callback with every converted frame. Only BGRA frames are taken.
+    void offer( OutputVideoFrame& frame );
+    //! Returns the most recent snapshot, or null if there is none yet.
+    SnapshotPtr latest();
+    //! Waits for the snapshot in the works, if any, to finish.
+    void stop();
+    void writeStats( JsonWriter& json );
+    ~SnapshotStage() { stop(); }
+  };
+
+}
@@ -0,0 +1,100 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+#include "options.h"
+#include "utils.h"
+
+namespace minibm {
+
+  class JsonWriter;
+
+  //! Threads whose scheduling the library controls.
+  enum ThreadRole {
+    ThreadRole_Callback = 0, //!< DeckLink input callback thread, which also converts frames.
+    ThreadRole_Worker,       //!< Worker pool threads, which do deferred work such as encoding snapshots.
+    ThreadRole_Count
+  };
+
+  const char* threadRoleName( ThreadRole role );
+
+  //! Requested scheduling for a thread role.
+  //! Read from "<role>.affinity", "<role>.priority" and "<role>.mmcss" options.
+  struct ThreadPolicy {
+    uint64_t affinity_ = 0; //!< Processor mask, or 0 to leave as is.
+    int numaNode_ = -1; //!< Keeps the thread on the processors of this NUMA node if affinity_ is 0, or -1 to leave as is.
+    int priority_ = THREAD_PRIORITY_ERROR_RETURN; //!< Win32 thread priority, or THREAD_PRIORITY_ERROR_RETURN to leave as is.
+    string mmcssTask_; //!< MMCSS task name, such as "Capture" or "Pro Audio". Empty for none.
+    uint32_t version_ = 0; //!< Bumped on every change so threads know to reapply.
+    //! Returns base with any overrides for role found in options applied.
+    static ThreadPolicy fromOptions( const Options& options, ThreadRole role, const ThreadPolicy& base );
+    void writeStats( JsonWriter& json ) const;
+  };
+
+  //! Effective scheduling of the thread that last applied a policy.
+  //! Written by that thread only, readable from anywhere for stats.
+  struct ThreadState {
+    atomic<uint32_t> threadId_ = 0;
+    atomic<uint32_t> version_ = 0;
+    atomic<uint64_t> affinity_ = 0;
+    atomic<uint16_t> group_ = 0;
+    atomic<int> priority_ = THREAD_PRIORITY_NORMAL;
+    atomic<uint32_t> mmcssTaskIndex_ = 0;
+    atomic<uint32_t> lastError_ = 0;
+    HANDLE mmcssHandle_ = nullptr;
+    GROUP_AFFINITY savedAffinity_ = { 0 }; //!< Affinity the thread had before we first touched it.
+    int savedPriority_ = THREAD_PRIORITY_ERROR_RETURN; //!< Priority the thread had before we first touched it.
+    bool saved_ = false; //!< Whether savedAffinity_ is valid.
+    void writeStats( JsonWriter& json ) const;
+  };
+
+  //! Applies policy to the calling thread, unless it already has this version applied.
+  //! Cheap enough to call for every frame.
+  void applyThreadPolicy( const ThreadPolicy& policy, ThreadState& state );
+
+  //! Puts the thread that last applied a policy to state back to the affinity and priority
+  //! it had before, and ends its MMCSS registration. For threads we don't own, such as the
+  //! driver's callback thread, once we stop using them. Must not race with applyThreadPolicy.
+  void restoreThreadPolicy( ThreadState& state );
+
+  //! Fixed set of threads running queued tasks, for work that shouldn't hold up capture.
+  class WorkerPool {
+  public:
+    using Task = std::function<void()>;
+  private:
+    struct Worker {
+      WorkerPool* pool_ = nullptr;
+      HANDLE thread_ = nullptr;
+      ThreadState state_;
+      atomic<uint64_t> tasks_ = 0;
+    };
+    vector<unique_ptr<Worker>> workers_;
+    std::deque<Task> queue_;
+    RWLock lock_;
+    ConditionVariable wake_;
+    ThreadPolicy policy_;
+    bool stopping_ = false;
+    static DWORD WINAPI threadProc( LPVOID param );
+    void run( Worker& worker );
+    void stop();
+  public:
+    ~WorkerPool();
+    //! Restarts the pool with count threads, or stops it if count is 0.
+    //! Tasks queued before the call still get run. Must not be called from a worker.
+    void resize( size_t count );
+    size_t size();
+    void setPolicy( const ThreadPolicy& policy );
+    //! Queues task to be run on a worker, or runs it right away if the pool has no threads.
+    void submit( Task task );
+    //! Calls fn for every index below count, spread over the pool with the calling thread
+    //! doing its share too, so that this is safe to call from a worker. Returns once all
+    //! of the calls have finished.
+    void parallelFor( size_t count, const std::function<void( size_t )>& fn );
+    void writeStats( JsonWriter& json );
+  };
+
+}
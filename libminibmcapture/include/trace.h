@@ -0,0 +1,71 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#pragma once
+
+#include "pch.h"
+
+namespace minibm {
+
+  class Options;
+
+  namespace trace {
+
+    //! Trace event phases, as Chrome's trace event format names them.
+    enum Phase: char {
+      Phase_Begin = 'B',
+      Phase_End = 'E',
+      Phase_Instant = 'i'
+    };
+
+    extern atomic<bool> g_enabled;
+
+    //! Whether tracing is on. This is all that tracing costs while it is off.
+    inline bool enabled() { return g_enabled.load( std::memory_order_relaxed ); }
+
+    //! Records an event into the calling thread's ring. name must be a string literal.
+    //! frame is the capture frame index the event is about, or 0 for none.
+    void record( Phase phase, const char* name, uint32_t frame );
+
+    inline void instant( const char* name, uint32_t frame = 0 )
+    {
+      if ( enabled() )
+        record( Phase_Instant, name, frame );
+    }
+
+    //! Records a span covering its own lifetime.
+    class Span {
+    private:
+      const char* name_;
+      uint32_t frame_;
+      bool recording_;
+    public:
+      Span( const char* name, uint32_t frame = 0 ): name_( name ), frame_( frame ), recording_( enabled() )
+      {
+        if ( recording_ )
+          record( Phase_Begin, name_, frame_ );
+      }
+      Span( const Span& ) = delete;
+      Span& operator=( const Span& ) = delete;
+      //! Ends the span early.
+      inline void end()
+      {
+        if ( recording_ )
+          record( Phase_End, name_, frame_ );
+        recording_ = false;
+      }
+      ~Span() { end(); }
+    };
+
+    //! Reads the trace and trace.size library options. Turning tracing on drops what was recorded before.
+    void configure( const Options& options );
+
+    //! Writes everything still in the rings as a Chrome trace event JSON document, loadable
+    //! in chrome://tracing and Perfetto. Doesn't stop the threads recording meanwhile.
+    void writeJson( string& out );
+
+  }
+
+}
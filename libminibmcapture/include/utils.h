@@ -6,6 +6,7 @@
 #pragma once
 
 #include "pch.h"
+#include "budget.h"
 
 namespace minibm {
 
@@ -18,6 +19,7 @@ namespace minibm {
     inline void unlock() { ReleaseSRWLockExclusive( &lock_ ); }
     inline void lockShared() { AcquireSRWLockShared( &lock_ ); }
     inline void unlockShared() { ReleaseSRWLockShared( &lock_ ); }
+    inline SRWLOCK* native() { return &lock_; }
   };
 
   class ScopedRWLock {
@@ -73,6 +75,147 @@ namespace minibm {
     }
   };
 
+  //! Condition variable to be waited on with an RWLock held exclusively.
+  class ConditionVariable {
+  private:
+    CONDITION_VARIABLE cv_;
+  public:
+    ConditionVariable() { InitializeConditionVariable( &cv_ ); }
+    inline bool wait( RWLock& lock, uint32_t milliseconds = INFINITE )
+    {
+      return ( SleepConditionVariableSRW( &cv_, lock.native(), milliseconds, 0 ) != FALSE );
+    }
+    inline void wakeOne() { WakeConditionVariable( &cv_ ); }
+    inline void wakeAll() { WakeAllConditionVariable( &cv_ ); }
+  };
+
+  //! Cache line aligned byte buffer that can be preallocated,
+  //! and does not initialize its contents when it grows.
+  //! Its capacity is charged to the memory budget, and growing throws std::bad_alloc when refused.
+  class AlignedBuffer {
+  public:
+    static const size_t c_alignment = 64;
+  private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    int node_ = -1; //!< Preferred NUMA node for new allocations, or -1 for any.
+    int allocatedNode_ = -1; //!< NUMA node data_ was allocated on, or -1 if it came from the heap.
+    MemoryCategory category_ = Memory_Output;
+    static inline void freeData( uint8_t* data, int allocatedNode )
+    {
+      if ( data && allocatedNode >= 0 )
+        VirtualFree( data, 0, MEM_RELEASE );
+      else if ( data )
+        _aligned_free( data );
+    }
+    inline void release()
+    {
+      if ( capacity_ )
+        budget::refund( category_, capacity_ );
+      freeData( data_, allocatedNode_ );
+      data_ = nullptr;
+      size_ = capacity_ = 0;
+      allocatedNode_ = -1;
+    }
+  public:
+    AlignedBuffer() {}
+    AlignedBuffer( const AlignedBuffer& ) = delete;
+    AlignedBuffer& operator=( const AlignedBuffer& ) = delete;
+    //! Makes sure at least bytes are available without reallocating.
+    //! Existing contents are not preserved if the buffer has to grow,
+    //! but the buffer is left as it was if growing is refused.
+    inline void reserve( size_t bytes )
+    {
+      if ( bytes <= capacity_ )
+        return;
+      // Only the growth is charged, and the old allocation stays until the new one is in hand
+      auto growth = bytes - capacity_;
+      if ( !budget::charge( category_, growth ) )
+        throw std::bad_alloc();
+      uint8_t* data = nullptr;
+      int allocatedNode = -1;
+      // Page granular allocations are aligned well beyond what we need
+      if ( node_ >= 0 )
+      {
+        data = static_cast<uint8_t*>( VirtualAllocExNuma( GetCurrentProcess(), nullptr, bytes,
+          MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, static_cast<DWORD>( node_ ) ) );
+        if ( data )
+          allocatedNode = node_;
+      }
+      if ( !data )
+        data = static_cast<uint8_t*>( _aligned_malloc( bytes, c_alignment ) );
+      if ( !data )
+      {
+        budget::allocationFailed( category_, growth );
+        throw std::bad_alloc();
+      }
+      freeData( data_, allocatedNode_ );
+      data_ = data;
+      allocatedNode_ = allocatedNode;
+      size_ = 0;
+      capacity_ = bytes;
+    }
+    inline void resize( size_t bytes )
+    {
+      reserve( bytes );
+      size_ = bytes;
+    }
+    //! Sets the NUMA node to allocate on, or -1 for any. Drops the current
+    //! allocation if it isn't on that node, so the next reserve moves it there.
+    inline void setNode( int node )
+    {
+      if ( node != allocatedNode_ )
+        release();
+      node_ = node;
+    }
+    inline int node() const { return allocatedNode_; }
+    //! Sets what the buffer is accounted as.
+    inline void setCategory( MemoryCategory category )
+    {
+      budget::transfer( category_, category, capacity_ );
+      category_ = category;
+    }
+    //! Frees the allocation, for when the buffer won't be needed for a while.
+    inline void clear() { release(); }
+    //! Touches every page of the allocation, so that the first real write doesn't take the page faults.
+    inline void prefault()
+    {
+      for ( size_t offset = 0; offset < capacity_; offset += 4096 )
+        data_[offset] = 0;
+    }
+    inline void swap( AlignedBuffer& other )
+    {
+      // The bytes stay accounted to whichever category holds them
+      budget::transfer( category_, other.category_, capacity_ );
+      budget::transfer( other.category_, category_, other.capacity_ );
+      std::swap( data_, other.data_ );
+      std::swap( size_, other.size_ );
+      std::swap( capacity_, other.capacity_ );
+      std::swap( allocatedNode_, other.allocatedNode_ );
+    }
+    inline uint8_t* data() const { return data_; }
+    inline size_t size() const { return size_; }
+    inline size_t capacity() const { return capacity_; }
+    ~AlignedBuffer()
+    {
+      release();
+    }
+  };
+
+  //! Monotonic high resolution time in microseconds.
+  inline int64_t timeMicroseconds()
+  {
+    static const int64_t frequency = []() {
+      LARGE_INTEGER value;
+      QueryPerformanceFrequency( &value );
+      return value.QuadPart;
+    }();
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter( &counter );
+    return ( counter.QuadPart / frequency ) * 1000000 + ( counter.QuadPart % frequency ) * 1000000 / frequency;
+  }
+
   inline string bstrToString( BSTR bstr )
   {
     auto widelen = SysStringLen( bstr );
@@ -0,0 +1,147 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "budget.h"
+#include "options.h"
+#include "utils.h"
+#include "json.h"
+
+namespace minibm {
+
+  static thread_local string t_lastError;
+
+  void setLastError( const string& reason )
+  {
+    t_lastError = reason;
+  }
+
+  const string& lastError()
+  {
+    return t_lastError;
+  }
+
+  namespace budget {
+
+    static const char* c_categoryNames[Memory_Count] = { "input", "output", "history", "encoder" };
+
+    static atomic<uint64_t> g_limit = 0; //!< Bytes, or 0 for no limit.
+    static atomic<uint64_t> g_used = 0;
+    static atomic<uint64_t> g_peak = 0;
+    static atomic<uint64_t> g_categoryUsed[Memory_Count] = {};
+    static atomic<uint64_t> g_categoryPeak[Memory_Count] = {};
+    static atomic<uint32_t> g_refusals = 0;
+    static atomic<uint32_t> g_failures = 0;
+    static RWLock g_refusalLock;
+    static string g_lastRefusal;
+
+    static inline void raisePeak( atomic<uint64_t>& peak, uint64_t value )
+    {
+      auto current = peak.load( std::memory_order_relaxed );
+      while ( value > current && !peak.compare_exchange_weak( current, value, std::memory_order_relaxed ) );
+    }
+
+    static void refuse( const string& reason )
+    {
+      setLastError( reason );
+      ScopedRWLock lock( &g_refusalLock );
+      g_lastRefusal = reason;
+    }
+
+    static inline uint64_t megabytes( uint64_t bytes )
+    {
+      return ( bytes + 1024 * 1024 - 1 ) / ( 1024 * 1024 );
+    }
+
+    bool charge( MemoryCategory category, size_t bytes )
+    {
+      // Only the total is checked against the limit, the categories just follow it
+      auto limit = g_limit.load( std::memory_order_relaxed );
+      auto used = g_used.load( std::memory_order_relaxed );
+      do
+      {
+        if ( limit && used + bytes > limit )
+        {
+          g_refusals++;
+          char reason[256];
+          sprintf_s( reason, sizeof( reason ),
+            "Memory budget of %llu MB exceeded: %llu MB more for %s buffers, with %llu MB in use",
+            megabytes( limit ), megabytes( bytes ), c_categoryNames[category], megabytes( used ) );
+          refuse( reason );
+          return false;
+        }
+      } while ( !g_used.compare_exchange_weak( used, used + bytes ) );
+
+      raisePeak( g_peak, used + bytes );
+      raisePeak( g_categoryPeak[category], g_categoryUsed[category].fetch_add( bytes ) + bytes );
+      return true;
+    }
+
+    void refund( MemoryCategory category, size_t bytes )
+    {
+      g_used.fetch_sub( bytes );
+      g_categoryUsed[category].fetch_sub( bytes );
+    }
+
+    void transfer( MemoryCategory from, MemoryCategory to, size_t bytes )
+    {
+      if ( from == to || !bytes )
+        return;
+      g_categoryUsed[from].fetch_sub( bytes );
+      raisePeak( g_categoryPeak[to], g_categoryUsed[to].fetch_add( bytes ) + bytes );
+    }
+
+    void allocationFailed( MemoryCategory category, size_t bytes )
+    {
+      refund( category, bytes );
+      g_failures++;
+      char reason[256];
+      sprintf_s( reason, sizeof( reason ), "Out of memory allocating %llu MB for %s buffers",
+        megabytes( bytes ), c_categoryNames[category] );
+      refuse( reason );
+    }
+
+    uint32_t refusals()
+    {
+      return g_refusals.load() + g_failures.load();
+    }
+
+    string lastRefusal()
+    {
+      ScopedRWLock lock( &g_refusalLock, false );
+      return g_lastRefusal;
+    }
+
+    void configure( const Options& options )
+    {
+      // Lowering the budget below what is in use only refuses further growth
+      if ( options.has( "memory.budget" ) )
+        g_limit = options.getUnsigned( "memory.budget" ) * 1024 * 1024;
+    }
+
+    void writeStats( JsonWriter& json )
+    {
+      json.beginObject();
+      json.member( "budgetBytes", g_limit.load() );
+      json.member( "usedBytes", g_used.load() );
+      json.member( "peakBytes", g_peak.load() );
+      json.member( "refusals", g_refusals.load() );
+      json.member( "failures", g_failures.load() );
+      json.member( "lastRefusal", lastRefusal() );
+      json.key( "categories" ).beginObject();
+      for ( int i = 0; i < Memory_Count; ++i )
+      {
+        json.key( c_categoryNames[i] ).beginObject();
+        json.member( "usedBytes", g_categoryUsed[i].load() );
+        json.member( "peakBytes", g_categoryPeak[i].load() );
+        json.endObject();
+      }
+      json.endObject();
+      json.endObject();
+    }
+
+  }
+
+}
@@ -0,0 +1,94 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "cadence.h"
+#include "json.h"
+
+namespace minibm {
+
+  void CadenceSelector::configure( const Options& options )
+  {
+    num_ = 0;
+    den_ = 1;
+    auto rate = options.getString( "rate" );
+    auto slash = rate.find( '/' );
+    if ( slash != string::npos )
+    {
+      num_ = strtoll( rate.substr( 0, slash ).c_str(), nullptr, 10 );
+      den_ = strtoll( rate.substr( slash + 1 ).c_str(), nullptr, 10 );
+    }
+    else if ( !rate.empty() )
+    {
+      // Millihertz are plenty for the likes of 29.97
+      num_ = llround( options.getFloat( "rate", 0.0 ) * 1000.0 );
+      den_ = 1000;
+    }
+    if ( num_ <= 0 || den_ <= 0 )
+      num_ = 0;
+
+    start_ = -1;
+    tick_ = 0;
+    lastTime_ = 0;
+    spanFrames_ = 0;
+    selected_ = skipped_ = mergedTicks_ = 0;
+    errorSum_ = maxError_ = 0;
+  }
+
+  bool CadenceSelector::select( int64_t time, int64_t duration, int64_t scale )
+  {
+    if ( !enabled() || scale <= 0 )
+      return true;
+
+    if ( start_ < 0 || scale != scale_ )
+    {
+      start_ = time;
+      scale_ = scale;
+      tick_ = 0;
+      spanFrames_ = 0;
+    }
+
+    // A tick belongs to this frame if it is closer to it than to the next one
+    auto boundary = time + std::max<int64_t>( duration, 1 ) / 2;
+    auto tick = tickTime( tick_ );
+    if ( tick >= boundary )
+    {
+      skipped_++;
+      return false;
+    }
+
+    int64_t covered = 0;
+    while ( tickTime( tick_ ) < boundary )
+    {
+      tick_++;
+      covered++;
+    }
+    mergedTicks_ += static_cast<uint32_t>( covered - 1 );
+
+    auto error = std::abs( time - tick ) * 1000000 / scale_;
+    errorSum_ += error;
+    maxError_ = std::max( maxError_, error );
+    lastTime_ = time;
+    spanFrames_++;
+    selected_++;
+    return true;
+  }
+
+  void CadenceSelector::writeStats( JsonWriter& json ) const
+  {
+    json.beginObject();
+    json.member( "target", enabled() ? static_cast<double>( num_ ) / den_ : 0.0 );
+    json.member( "selected", selected_ );
+    json.member( "skipped", skipped_ );
+    json.member( "mergedTicks", mergedTicks_ );
+    json.member( "meanErrorUs", selected_ ? errorSum_ / selected_ : 0 );
+    json.member( "maxErrorUs", maxError_ );
+    // Frames over the time between the first and last of them since tick 0
+    auto elapsed = ( scale_ > 0 ? static_cast<double>( lastTime_ - start_ ) / scale_ : 0.0 );
+    json.member( "realized", spanFrames_ > 1 && elapsed > 0.0 ? ( spanFrames_ - 1 ) / elapsed : 0.0 );
+    json.endObject();
+  }
+
+}
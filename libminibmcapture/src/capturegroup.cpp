@@ -0,0 +1,174 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "capturegroup.h"
+#include "minibmcap.h"
+#include "json.h"
+
+namespace minibm {
+
+  bool CaptureGroup::start( const vector<DecklinkDevice*>& devices, BMDDisplayMode displayMode, const Options& options )
+  {
+    if ( devices.empty() || devices.size() > MAXIMUM_WAIT_OBJECTS )
+      return false;
+
+    // Sets are matched from each device's queue, which the fan-out ring would take the place of
+    Options memberOptions( options );
+    memberOptions.parse( "fanout=0" );
+    if ( !options.has( "queue" ) )
+      memberOptions.parse( "queue=4" );
+
+    for ( auto device : devices )
+    {
+      device->setReferenceTiming( true );
+      if ( !device->startCapture( displayMode, memberOptions, true ) )
+      {
+        device->setReferenceTiming( false );
+        stop();
+        return false;
+      }
+      device->AddRef();
+      GroupMember member;
+      member.device_ = device;
+      members_.push_back( member );
+      events_.push_back( device->frameEvent() );
+    }
+
+    // Going live is only a flip, so the devices start within microseconds of each other
+    for ( auto& member : members_ )
+      member.device_->goLive();
+
+    // Half a frame keeps neighbouring frames from matching
+    tolerance_ = std::max<int64_t>( options.getInt( "group.tolerance",
+      members_.front().device_->frameDurationMicroseconds() / 2 ), 0 );
+    incomplete_ = ( options.getString( "group.incomplete" ) == "partial" ? Incomplete_Partial : Incomplete_Drop );
+
+    return true;
+  }
+
+  size_t CaptureGroup::getFrameSet( vector<OutputVideoFrame*>& out_frames, uint32_t timeout )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    out_frames.assign( members_.size(), nullptr );
+    auto deadline = ( timeout == INFINITE ? 0 : GetTickCount64() + timeout );
+    while ( !stopped_.load() )
+    {
+      for ( auto event : events_ )
+        ResetEvent( event );
+
+      // The set's time is the latest one that every device has caught up to
+      int64_t time = INT64_MAX;
+      size_t ready = 0;
+      for ( auto& member : members_ )
+      {
+        int64_t newest;
+        if ( member.device_->newestQueuedTime( newest ) )
+        {
+          time = std::min( time, newest );
+          ready++;
+        }
+      }
+
+      auto now = GetTickCount64();
+      bool expired = ( deadline && now >= deadline );
+      if ( ready == members_.size() || ( ready && expired && incomplete_ == Incomplete_Partial ) )
+      {
+        ScopedRWLock statsLock( &statsLock_ );
+        size_t count = 0;
+        for ( size_t i = 0; i < members_.size(); ++i )
+        {
+          auto& member = members_[i];
+          if ( member.device_->takeQueuedFrame( time, tolerance_, &out_frames[i], member.setSkew_ ) )
+            count++;
+          else
+            member.missed_++;
+        }
+        if ( count == members_.size() || incomplete_ == Incomplete_Partial )
+        {
+          // Only frames that are actually handed out count as matched
+          for ( size_t i = 0; i < members_.size(); ++i )
+          {
+            auto& member = members_[i];
+            if ( !out_frames[i] )
+              continue;
+            member.matched_++;
+            member.lastSkew_ = member.setSkew_;
+            member.maxSkew_ = std::max( member.maxSkew_, std::abs( member.setSkew_ ) );
+            member.skewSum_ += std::abs( member.setSkew_ );
+          }
+          sets_++;
+          if ( count < members_.size() )
+            incompleteSets_++;
+          return count;
+        }
+        // Whatever did match was taken, so the next round moves on past this time
+        droppedSets_++;
+        out_frames.assign( members_.size(), nullptr );
+        continue;
+      }
+
+      if ( expired )
+        return 0;
+      uint32_t wait = 1000;
+      if ( deadline )
+        wait = static_cast<uint32_t>( std::min<ULONGLONG>( deadline - now, 1000 ) );
+      WaitForMultipleObjects( static_cast<DWORD>( events_.size() ), events_.data(), FALSE, wait );
+    }
+
+    return 0;
+  }
+
+  void CaptureGroup::stop()
+  {
+    // Stopping the devices sets their events, which gets a waiting getFrameSet out of the way
+    stopped_ = true;
+    for ( auto& member : members_ )
+      member.device_->stopCapture();
+
+    ScopedRWLock lock( &lock_ );
+    for ( auto& member : members_ )
+    {
+      member.device_->setReferenceTiming( false );
+      member.device_->Release();
+    }
+    members_.clear();
+    events_.clear();
+  }
+
+  void CaptureGroup::writeStats( JsonWriter& json )
+  {
+    ScopedRWLock lock( &statsLock_, false );
+
+    json.beginObject();
+    json.member( "toleranceUs", tolerance_ );
+    json.member( "incomplete", incomplete_ == Incomplete_Partial ? "partial" : "drop" );
+    json.member( "sets", sets_ );
+    json.member( "incompleteSets", incompleteSets_ );
+    json.member( "droppedSets", droppedSets_ );
+    json.key( "devices" ).beginArray();
+    for ( auto& member : members_ )
+    {
+      json.beginObject();
+      json.member( "id", member.device_->id_ );
+      json.member( "matched", member.matched_ );
+      json.member( "missed", member.missed_ );
+      json.member( "lastSkewUs", member.lastSkew_ );
+      json.member( "maxSkewUs", member.maxSkew_ );
+      json.member( "meanSkewUs", member.matched_ ? member.skewSum_ / member.matched_ : 0 );
+      json.member( "hardwareClock", member.device_->hasHardwareClock() );
+      json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+  }
+
+  CaptureGroup::~CaptureGroup()
+  {
+    stop();
+  }
+
+}
@@ -0,0 +1,508 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "codecs.h"
+
+namespace minibm {
+
+  namespace codecs {
+
+    void scaleBGRA( const uint8_t* source, size_t sourceRowBytes, long sourceWidth, long sourceHeight,
+      uint8_t* destination, long width, long height )
+    {
+      vector<long> columns( width + 1 );
+      for ( long x = 0; x <= width; ++x )
+        columns[x] = static_cast<long>( static_cast<int64_t>( x ) * sourceWidth / width );
+
+      for ( long y = 0; y < height; ++y )
+      {
+        auto y0 = static_cast<long>( static_cast<int64_t>( y ) * sourceHeight / height );
+        auto y1 = std::max( y0 + 1, static_cast<long>( static_cast<int64_t>( y + 1 ) * sourceHeight / height ) );
+        auto out = destination + static_cast<size_t>( y ) * width * 4;
+        for ( long x = 0; x < width; ++x )
+        {
+          auto x0 = columns[x];
+          auto x1 = std::max( x0 + 1, columns[x + 1] );
+          uint32_t sum[4] = { 0 };
+          for ( long sy = y0; sy < y1; ++sy )
+          {
+            auto in = source + sy * sourceRowBytes + x0 * 4;
+            for ( long sx = x0; sx < x1; ++sx, in += 4 )
+            {
+              sum[0] += in[0];
+              sum[1] += in[1];
+              sum[2] += in[2];
+              sum[3] += in[3];
+            }
+          }
+          auto area = static_cast<uint32_t>( ( x1 - x0 ) * ( y1 - y0 ) );
+          for ( int c = 0; c < 4; ++c )
+            out[x * 4 + c] = static_cast<uint8_t>( ( sum[c] + area / 2 ) / area );
+        }
+      }
+    }
+
+    // QOI, see https://qoiformat.org/qoi-specification.pdf
+
+    static const uint8_t c_qoiIndex = 0x00;
+    static const uint8_t c_qoiDiff = 0x40;
+    static const uint8_t c_qoiLuma = 0x80;
+    static const uint8_t c_qoiRun = 0xC0;
+    static const uint8_t c_qoiRGB = 0xFE;
+
+    inline void putBigEndian32( vector<uint8_t>& out, uint32_t value )
+    {
+      out.push_back( static_cast<uint8_t>( value >> 24 ) );
+      out.push_back( static_cast<uint8_t>( value >> 16 ) );
+      out.push_back( static_cast<uint8_t>( value >> 8 ) );
+      out.push_back( static_cast<uint8_t>( value ) );
+    }
+
+    void encodeQOI( const uint8_t* bgra, size_t rowBytes, long width, long height, vector<uint8_t>& out )
+    {
+      out.reserve( out.size() + 22 + static_cast<size_t>( width ) * height * 4 );
+      out.insert( out.end(), { 'q', 'o', 'i', 'f' } );
+      putBigEndian32( out, static_cast<uint32_t>( width ) );
+      putBigEndian32( out, static_cast<uint32_t>( height ) );
+      out.push_back( 3 ); // RGB
+      out.push_back( 0 ); // sRGB
+
+      // Alpha stays at 255 throughout, so only RGB needs tracking
+      uint32_t index[64] = { 0 };
+      uint8_t pr = 0, pg = 0, pb = 0;
+      uint32_t run = 0;
+
+      for ( long y = 0; y < height; ++y )
+      {
+        auto in = bgra + y * rowBytes;
+        for ( long x = 0; x < width; ++x, in += 4 )
+        {
+          uint8_t b = in[0], g = in[1], r = in[2];
+          if ( r == pr && g == pg && b == pb )
+          {
+            if ( ++run == 62 )
+            {
+              out.push_back( static_cast<uint8_t>( c_qoiRun | ( run - 1 ) ) );
+              run = 0;
+            }
+            continue;
+          }
+          if ( run )
+          {
+            out.push_back( static_cast<uint8_t>( c_qoiRun | ( run - 1 ) ) );
+            run = 0;
+          }
+
+          uint32_t pixel = ( static_cast<uint32_t>( r ) << 16 ) | ( g << 8 ) | b | 0xFF000000;
+          auto slot = ( r * 3 + g * 5 + b * 7 + 255 * 11 ) % 64;
+          if ( index[slot] == pixel )
+            out.push_back( static_cast<uint8_t>( c_qoiIndex | slot ) );
+          else
+          {
+            index[slot] = pixel;
+            int dr = static_cast<int8_t>( r - pr );
+            int dg = static_cast<int8_t>( g - pg );
+            int db = static_cast<int8_t>( b - pb );
+            int drg = dr - dg;
+            int dbg = db - dg;
+            if ( dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1 )
+              out.push_back( static_cast<uint8_t>( c_qoiDiff | ( ( dr + 2 ) << 4 ) | ( ( dg + 2 ) << 2 ) | ( db + 2 ) ) );
+            else if ( dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7 )
+            {
+              out.push_back( static_cast<uint8_t>( c_qoiLuma | ( dg + 32 ) ) );
+              out.push_back( static_cast<uint8_t>( ( ( drg + 8 ) << 4 ) | ( dbg + 8 ) ) );
+            }
+            else
+              out.insert( out.end(), { c_qoiRGB, r, g, b } );
+          }
+          pr = r;
+          pg = g;
+          pb = b;
+        }
+      }
+      if ( run )
+        out.push_back( static_cast<uint8_t>( c_qoiRun | ( run - 1 ) ) );
+
+      out.insert( out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 } );
+    }
+
+    // JPEG, see ITU T.81. Tables are the example ones from Annex K.
+
+    //! Natural order index of each zigzag position.
+    static const uint8_t c_zigzag[64] = {
+      0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+      12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+      35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+      58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+    };
+
+    static const uint8_t c_lumaQuant[64] = {
+      16, 11, 10, 16, 24, 40, 51, 61,
+      12, 12, 14, 19, 26, 58, 60, 55,
+      14, 13, 16, 24, 40, 57, 69, 56,
+      14, 17, 22, 29, 51, 87, 80, 62,
+      18, 22, 37, 56, 68, 109, 103, 77,
+      24, 35, 55, 64, 81, 104, 113, 92,
+      49, 64, 78, 87, 103, 121, 120, 101,
+      72, 92, 95, 98, 112, 100, 103, 99
+    };
+
+    static const uint8_t c_chromaQuant[64] = {
+      17, 18, 24, 47, 99, 99, 99, 99,
+      18, 21, 26, 66, 99, 99, 99, 99,
+      24, 26, 56, 99, 99, 99, 99, 99,
+      47, 66, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99
+    };
+
+    static const uint8_t c_dcLumaBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+    static const uint8_t c_dcChromaBits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+    static const uint8_t c_dcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+    static const uint8_t c_acLumaBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D };
+    static const uint8_t c_acLumaValues[162] = {
+      0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+      0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+      0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+      0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+      0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+      0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+      0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+      0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+      0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+      0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+      0xF9, 0xFA
+    };
+
+    static const uint8_t c_acChromaBits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+    static const uint8_t c_acChromaValues[162] = {
+      0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+      0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+      0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+      0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+      0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+      0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+      0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+      0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+      0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+      0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+      0xF9, 0xFA
+    };
+
+    //! AAN DCT output scale factors, times sqrt(8) to fold in the DCT normalization.
+    static const float c_aanScale[8] = {
+      1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
+      1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f
+    };
+
+    struct HuffmanCode {
+      uint16_t code_;
+      uint8_t length_;
+    };
+
+    struct HuffmanTable {
+      HuffmanCode codes_[256] = {};
+      HuffmanTable( const uint8_t* bits, const uint8_t* values )
+      {
+        uint16_t code = 0;
+        size_t k = 0;
+        for ( uint8_t length = 1; length <= 16; ++length )
+        {
+          for ( uint8_t i = 0; i < bits[length - 1]; ++i )
+            codes_[values[k++]] = { code++, length };
+          code <<= 1;
+        }
+      }
+    };
+
+    struct HuffmanTables {
+      HuffmanTable dcLuma_ = HuffmanTable( c_dcLumaBits, c_dcValues );
+      HuffmanTable dcChroma_ = HuffmanTable( c_dcChromaBits, c_dcValues );
+      HuffmanTable acLuma_ = HuffmanTable( c_acLumaBits, c_acLumaValues );
+      HuffmanTable acChroma_ = HuffmanTable( c_acChromaBits, c_acChromaValues );
+    };
+
+    static const HuffmanTables& huffmanTables()
+    {
+      static const HuffmanTables tables;
+      return tables;
+    }
+
+    //! Entropy coded segment writer, with 0xFF byte stuffing.
+    class BitWriter {
+    private:
+      vector<uint8_t>& out_;
+      uint32_t buffer_ = 0;
+      int count_ = 0;
+    public:
+      explicit BitWriter( vector<uint8_t>& out ): out_( out ) {}
+      inline void put( uint32_t bits, int length )
+      {
+        buffer_ = ( buffer_ << length ) | ( bits & ( ( 1u << length ) - 1 ) );
+        count_ += length;
+        while ( count_ >= 8 )
+        {
+          auto byte = static_cast<uint8_t>( buffer_ >> ( count_ - 8 ) );
+          out_.push_back( byte );
+          if ( byte == 0xFF )
+            out_.push_back( 0 );
+          count_ -= 8;
+        }
+      }
+      inline void put( const HuffmanCode& code ) { put( code.code_, code.length_ ); }
+      //! Pads the last byte with one bits.
+      inline void flush()
+      {
+        if ( count_ )
+          put( 0x7F, 7 );
+        count_ = 0;
+      }
+    };
+
+    inline void dct8( float* d, size_t stride )
+    {
+      auto tmp0 = d[0] + d[stride * 7];
+      auto tmp7 = d[0] - d[stride * 7];
+      auto tmp1 = d[stride] + d[stride * 6];
+      auto tmp6 = d[stride] - d[stride * 6];
+      auto tmp2 = d[stride * 2] + d[stride * 5];
+      auto tmp5 = d[stride * 2] - d[stride * 5];
+      auto tmp3 = d[stride * 3] + d[stride * 4];
+      auto tmp4 = d[stride * 3] - d[stride * 4];
+
+      auto tmp10 = tmp0 + tmp3;
+      auto tmp13 = tmp0 - tmp3;
+      auto tmp11 = tmp1 + tmp2;
+      auto tmp12 = tmp1 - tmp2;
+      d[0] = tmp10 + tmp11;
+      d[stride * 4] = tmp10 - tmp11;
+      auto z1 = ( tmp12 + tmp13 ) * 0.707106781f;
+      d[stride * 2] = tmp13 + z1;
+      d[stride * 6] = tmp13 - z1;
+
+      tmp10 = tmp4 + tmp5;
+      tmp11 = tmp5 + tmp6;
+      tmp12 = tmp6 + tmp7;
+      auto z5 = ( tmp10 - tmp12 ) * 0.382683433f;
+      auto z2 = tmp10 * 0.541196100f + z5;
+      auto z4 = tmp12 * 1.306562965f + z5;
+      auto z3 = tmp11 * 0.707106781f;
+      auto z11 = tmp7 + z3;
+      auto z13 = tmp7 - z3;
+      d[stride * 5] = z13 + z2;
+      d[stride * 3] = z13 - z2;
+      d[stride] = z11 + z4;
+      d[stride * 7] = z11 - z4;
+    }
+
+    inline void putValue( BitWriter& writer, const HuffmanTable& table, int symbolBase, int value )
+    {
+      auto magnitude = ( value < 0 ? -value : value );
+      int length = 0;
+      while ( magnitude )
+      {
+        length++;
+        magnitude >>= 1;
+      }
+      writer.put( table.codes_[symbolBase | length] );
+      if ( length )
+        writer.put( static_cast<uint32_t>( value < 0 ? value - 1 : value ), length );
+    }
+
+    //! Transforms, quantizes and writes one level shifted 8x8 block. Returns its DC value.
+    static int encodeBlock( BitWriter& writer, float* block, const float* scale, int previousDC,
+      const HuffmanTable& dc, const HuffmanTable& ac )
+    {
+      for ( size_t row = 0; row < 8; ++row )
+        dct8( block + row * 8, 1 );
+      for ( size_t column = 0; column < 8; ++column )
+        dct8( block + column, 8 );
+
+      // Baseline Huffman tables stop at category 10 for AC coefficients, and DC
+      // differences stay within category 11 this way. Rounding at quality 100 can
+      // otherwise go just past that.
+      int values[64];
+      for ( size_t i = 0; i < 64; ++i )
+      {
+        auto k = c_zigzag[i];
+        values[i] = std::clamp( static_cast<int>( lrintf( block[k] * scale[k] ) ), -1023, 1023 );
+      }
+
+      putValue( writer, dc, 0, values[0] - previousDC );
+
+      int last = 63;
+      while ( last > 0 && !values[last] )
+        last--;
+      int zeroes = 0;
+      for ( int i = 1; i <= last; ++i )
+      {
+        if ( !values[i] )
+        {
+          zeroes++;
+          continue;
+        }
+        while ( zeroes >= 16 )
+        {
+          writer.put( ac.codes_[0xF0] );
+          zeroes -= 16;
+        }
+        putValue( writer, ac, zeroes << 4, values[i] );
+        zeroes = 0;
+      }
+      if ( last < 63 )
+        writer.put( ac.codes_[0x00] );
+
+      return values[0];
+    }
+
+    void JpegEncoder::setQuality( int quality )
+    {
+      quality = std::clamp( quality, 1, 100 );
+      if ( quality == quality_ )
+        return;
+      quality_ = quality;
+
+      auto factor = ( quality < 50 ? 5000 / quality : 200 - quality * 2 );
+      for ( size_t i = 0; i < 64; ++i )
+      {
+        lumaQuant_[i] = static_cast<uint8_t>( std::clamp( ( c_lumaQuant[i] * factor + 50 ) / 100, 1, 255 ) );
+        chromaQuant_[i] = static_cast<uint8_t>( std::clamp( ( c_chromaQuant[i] * factor + 50 ) / 100, 1, 255 ) );
+        auto aan = c_aanScale[i / 8] * c_aanScale[i % 8];
+        lumaScale_[i] = 1.0f / ( lumaQuant_[i] * aan );
+        chromaScale_[i] = 1.0f / ( chromaQuant_[i] * aan );
+      }
+    }
+
+    void JpegEncoder::encodeBand( const uint8_t* bgra, size_t rowBytes, long width, long height,
+      long firstRow, long lastRow, vector<uint8_t>& out ) const
+    {
+      auto& tables = huffmanTables();
+      BitWriter writer( out );
+      int dcY = 0, dcCb = 0, dcCr = 0;
+
+      float y[4][64], cb[64], cr[64];
+      for ( long mcuY = firstRow; mcuY < lastRow; ++mcuY )
+      {
+        for ( long mcuX = 0; mcuX < ( width + 15 ) / 16; ++mcuX )
+        {
+          memset( cb, 0, sizeof( cb ) );
+          memset( cr, 0, sizeof( cr ) );
+          for ( long py = 0; py < 16; ++py )
+          {
+            // Edges are padded by repeating the last row and column
+            auto sy = std::min( mcuY * 16 + py, height - 1 );
+            auto row = bgra + sy * rowBytes;
+            for ( long px = 0; px < 16; ++px )
+            {
+              auto sx = std::min( mcuX * 16 + px, width - 1 );
+              auto pixel = row + sx * 4;
+              float b = pixel[0], g = pixel[1], r = pixel[2];
+              y[( py / 8 ) * 2 + px / 8][( py % 8 ) * 8 + px % 8] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+              auto c = ( py / 2 ) * 8 + px / 2;
+              cb[c] += 0.25f * ( -0.168736f * r - 0.331264f * g + 0.5f * b );
+              cr[c] += 0.25f * ( 0.5f * r - 0.418688f * g - 0.081312f * b );
+            }
+          }
+          for ( auto& block : y )
+            dcY = encodeBlock( writer, block, lumaScale_, dcY, tables.dcLuma_, tables.acLuma_ );
+          dcCb = encodeBlock( writer, cb, chromaScale_, dcCb, tables.dcChroma_, tables.acChroma_ );
+          dcCr = encodeBlock( writer, cr, chromaScale_, dcCr, tables.dcChroma_, tables.acChroma_ );
+        }
+      }
+      writer.flush();
+    }
+
+    inline void putMarker( vector<uint8_t>& out, uint8_t marker, uint16_t length )
+    {
+      out.insert( out.end(), { 0xFF, marker } );
+      if ( length )
+        out.insert( out.end(), { static_cast<uint8_t>( length >> 8 ), static_cast<uint8_t>( length ) } );
+    }
+
+    inline void putHuffmanTable( vector<uint8_t>& out, uint8_t id, const uint8_t* bits, const uint8_t* values, size_t count )
+    {
+      out.push_back( id );
+      out.insert( out.end(), bits, bits + 16 );
+      out.insert( out.end(), values, values + count );
+    }
+
+    void JpegEncoder::encode( const uint8_t* bgra, size_t rowBytes, long width, long height,
+      vector<uint8_t>& out, WorkerPool* pool ) const
+    {
+      const long mcuColumns = ( width + 15 ) / 16;
+      const long mcuRows = ( height + 15 ) / 16;
+
+      // A couple of bands per worker evens out differences in how well they compress,
+      // while the restart interval has to fit in 16 bits
+      long bands = ( pool ? static_cast<long>( pool->size() ) * 2 : 1 );
+      bands = std::clamp( bands, 1L, mcuRows );
+      auto rowsPerBand = ( mcuRows + bands - 1 ) / bands;
+      while ( mcuColumns * rowsPerBand > 0xFFFF && rowsPerBand > 1 )
+        rowsPerBand--;
+      bands = ( mcuRows + rowsPerBand - 1 ) / rowsPerBand;
+
+      putMarker( out, 0xD8, 0 );
+      putMarker( out, 0xE0, 16 );
+      out.insert( out.end(), { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 } );
+
+      putMarker( out, 0xDB, 2 + 65 * 2 );
+      out.push_back( 0 );
+      for ( auto k : c_zigzag )
+        out.push_back( lumaQuant_[k] );
+      out.push_back( 1 );
+      for ( auto k : c_zigzag )
+        out.push_back( chromaQuant_[k] );
+
+      putMarker( out, 0xC0, 17 );
+      out.insert( out.end(), { 8,
+        static_cast<uint8_t>( height >> 8 ), static_cast<uint8_t>( height ),
+        static_cast<uint8_t>( width >> 8 ), static_cast<uint8_t>( width ),
+        3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1 } );
+
+      putMarker( out, 0xC4, 2 + ( 17 + 12 ) * 2 + ( 17 + 162 ) * 2 );
+      putHuffmanTable( out, 0x00, c_dcLumaBits, c_dcValues, 12 );
+      putHuffmanTable( out, 0x10, c_acLumaBits, c_acLumaValues, 162 );
+      putHuffmanTable( out, 0x01, c_dcChromaBits, c_dcValues, 12 );
+      putHuffmanTable( out, 0x11, c_acChromaBits, c_acChromaValues, 162 );
+
+      if ( bands > 1 )
+      {
+        auto interval = static_cast<uint16_t>( mcuColumns * rowsPerBand );
+        putMarker( out, 0xDD, 4 );
+        out.insert( out.end(), { static_cast<uint8_t>( interval >> 8 ), static_cast<uint8_t>( interval ) } );
+      }
+
+      putMarker( out, 0xDA, 12 );
+      out.insert( out.end(), { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 } );
+
+      vector<vector<uint8_t>> segments( bands );
+      auto encodeSegment = [&]( size_t band ) {
+        auto first = static_cast<long>( band ) * rowsPerBand;
+        segments[band].reserve( static_cast<size_t>( mcuColumns ) * rowsPerBand * 256 );
+        encodeBand( bgra, rowBytes, width, height, first, std::min( first + rowsPerBand, mcuRows ), segments[band] );
+      };
+      if ( pool && bands > 1 )
+        pool->parallelFor( bands, encodeSegment );
+      else
+        for ( long band = 0; band < bands; ++band )
+          encodeSegment( band );
+
+      for ( long band = 0; band < bands; ++band )
+      {
+        out.insert( out.end(), segments[band].begin(), segments[band].end() );
+        if ( band + 1 < bands )
+          putMarker( out, static_cast<uint8_t>( 0xD0 + band % 8 ), 0 );
+      }
+
+      putMarker( out, 0xD9, 0 );
+    }
+
+  }
+
+}
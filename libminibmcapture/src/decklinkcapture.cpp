@@ -5,6 +5,8 @@
 
 #include "pch.h"
 #include "minibmcap.h"
+#include "json.h"
+#include "trace.h"
 
 namespace minibm {
 
@@ -51,7 +53,7 @@ namespace minibm {
     return ( SUCCEEDED( converter_->ConvertFrame( source, destination ) ) );
   }
 
-  DecklinkCapture::DecklinkCapture()
+  DecklinkCapture::DecklinkCapture(): generation_( 0 )
   {
     auto ret = CoCreateInstance( CLSID_CDeckLinkVideoConversion, NULL, CLSCTX_ALL,
       IID_IDeckLinkVideoConversion, reinterpret_cast<void**>( &converter_ ) );
@@ -61,11 +63,12 @@ namespace minibm {
 
   DecklinkCapture::~DecklinkCapture()
   {
+    shutdown();
     if ( converter_ )
       converter_->Release();
   }
 
-  bool DecklinkCapture::startCaptureSingle( DecklinkDevice* device, BMDDisplayMode displayMode )
+  bool DecklinkCapture::startCaptureSingle( DecklinkDevice* device, BMDDisplayMode displayMode, const Options& options )
   {
     ScopedRWLock lock( &lock_ );
 
@@ -75,7 +78,22 @@ namespace minibm {
     if ( std::find( devices_.begin(), devices_.end(), device ) == devices_.end() )
       return false;
 
-    if ( device->startCapture( displayMode ) )
+    // A prepared device only has to start delivering, and its reference moves over
+    auto standby = std::find( standbyDevices_.begin(), standbyDevices_.end(), device );
+    if ( standby != standbyDevices_.end() )
+    {
+      standbyDevices_.erase( standby );
+      if ( device->requestedMode_ == displayMode )
+      {
+        device->goLive();
+        currentCaptureDevice_ = device;
+        return true;
+      }
+      device->stopCapture();
+      device->Release();
+    }
+
+    if ( device->startCapture( displayMode, options ) )
     {
       currentCaptureDevice_ = device;
       currentCaptureDevice_->AddRef();
@@ -85,14 +103,195 @@ namespace minibm {
     return false;
   }
 
-  bool DecklinkCapture::getFrameBlocking( BGRA32VideoFrame** out_frame, uint32_t& out_index )
+  bool DecklinkCapture::prepareCapture( DecklinkDevice* device, BMDDisplayMode displayMode, const Options& options )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    if ( std::find( devices_.begin(), devices_.end(), device ) == devices_.end() )
+      return false;
+
+    if ( device == currentCaptureDevice_ && device->requestedMode_ == displayMode )
+    {
+      device->enterStandby();
+      standbyDevices_.push_back( device );
+      currentCaptureDevice_ = nullptr;
+      return true;
+    }
+
+    // Anything else means starting over in standby
+    if ( device == currentCaptureDevice_ )
+    {
+      device->stopCapture();
+      device->Release();
+      currentCaptureDevice_ = nullptr;
+    }
+    auto standby = std::find( standbyDevices_.begin(), standbyDevices_.end(), device );
+    if ( standby != standbyDevices_.end() )
+    {
+      standbyDevices_.erase( standby );
+      device->stopCapture();
+      device->Release();
+    }
+
+    if ( device->startCapture( displayMode, options, true ) )
+    {
+      device->AddRef();
+      standbyDevices_.push_back( device );
+      return true;
+    }
+
+    return false;
+  }
+
+  bool DecklinkCapture::releaseStandby( DecklinkDevice* device )
   {
     ScopedRWLock lock( &lock_ );
 
+    auto standby = std::find( standbyDevices_.begin(), standbyDevices_.end(), device );
+    if ( standby == standbyDevices_.end() )
+      return false;
+
+    standbyDevices_.erase( standby );
+    device->stopCapture();
+    device->Release();
+
+    return true;
+  }
+
+  bool DecklinkCapture::getFrameBlocking( OutputVideoFrame** out_frame, uint32_t timeout, bool bgraOnly )
+  {
+    // Don't hold the capture lock while waiting for a frame,
+    // or device removal and stopping would have to wait for us.
+    ScopedRWLock lock( &lock_, false );
+
+    auto device = currentCaptureDevice_;
+    if ( !device || ( bgraOnly && device->outputFormat() != Pixel_BGRA ) )
+      return false;
+
+    device->AddRef();
+    lock.unlock();
+
+    auto ret = device->getFrameBlocking( out_frame, timeout );
+    device->Release();
+
+    return ret;
+  }
+
+  ExportedFrame* DecklinkCapture::exportFrame( uint32_t timeout )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    auto device = currentCaptureDevice_;
+    if ( !device )
+      return nullptr;
+
+    device->AddRef();
+    lock.unlock();
+
+    auto ret = device->exportFrame( timeout );
+    device->Release();
+
+    return ret;
+  }
+
+  uint64_t DecklinkCapture::acquireLease( uint32_t timeout, ExportedFrame** out_frame )
+  {
+    auto exported = exportFrame( timeout );
+    if ( !exported )
+      return 0;
+
+    ScopedRWLock lock( &leasesLock_ );
+
+    auto lease = nextLease_++;
+    leases_[lease] = exported;
+    *out_frame = exported;
+    return lease;
+  }
+
+  bool DecklinkCapture::releaseLease( uint64_t lease )
+  {
+    ScopedRWLock lock( &leasesLock_ );
+
+    auto it = leases_.find( lease );
+    if ( it == leases_.end() )
+      return false;
+
+    auto exported = it->second;
+    leases_.erase( it );
+    lock.unlock();
+
+    exported->device_->releaseExport( exported );
+    return true;
+  }
+
+  uint32_t DecklinkCapture::openConsumer( const Options& options )
+  {
+    ScopedRWLock lock( &lock_, false );
+
     if ( !currentCaptureDevice_ )
+      return 0;
+
+    return currentCaptureDevice_->openConsumer( options );
+  }
+
+  bool DecklinkCapture::getConsumerFrame( uint32_t id, OutputVideoFrame** out_frame, uint32_t timeout )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    auto device = currentCaptureDevice_;
+    if ( !device )
       return false;
 
-    return currentCaptureDevice_->getFrameBlocking( out_frame, out_index );
+    device->AddRef();
+    lock.unlock();
+
+    auto ret = device->getConsumerFrame( id, out_frame, timeout );
+    device->Release();
+
+    return ret;
+  }
+
+  void DecklinkCapture::closeConsumer( uint32_t id )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    if ( currentCaptureDevice_ )
+      currentCaptureDevice_->closeConsumer( id );
+  }
+
+  size_t DecklinkCapture::getFramesBatch( size_t max, uint32_t timeout, const kernels::TensorFormat* tensor,
+    uint8_t* tensorOut, uint64_t tensorLength, OutputVideoFrame** out_frames )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    auto device = currentCaptureDevice_;
+    if ( !device || ( tensor && device->outputFormat() != Pixel_BGRA ) )
+      return 0;
+
+    device->AddRef();
+    lock.unlock();
+
+    auto pixelBytes = ( tensor ? kernels::tensorPixelBytes( *tensor ) : 0 );
+    auto count = device->getFramesBatch( max, timeout, pixelBytes, tensorLength, out_frames );
+
+    // Frames are independent, so the pool can take one each
+    if ( tensor && count )
+    {
+      auto frameBytes = static_cast<size_t>( out_frames[0]->GetWidth() ) * out_frames[0]->GetHeight() * pixelBytes;
+      auto convert = [&]( size_t i ) {
+        kernels::bgraToTensor( out_frames[i]->data(), out_frames[i]->GetRowBytes(), tensorOut + i * frameBytes,
+          out_frames[i]->GetWidth(), out_frames[i]->GetHeight(), *tensor );
+      };
+      if ( count > 1 && workers_.size() )
+        workers_.parallelFor( count, convert );
+      else
+        for ( size_t i = 0; i < count; ++i )
+          convert( i );
+    }
+
+    device->Release();
+
+    return count;
   }
 
   void DecklinkCapture::stopCaptureSingle()
@@ -107,15 +306,396 @@ namespace minibm {
     }
   }
 
-  void DecklinkCapture::iterateDevices()
+  bool DecklinkCapture::startCaptureGroup( const DecklinkDeviceVector& devices, BMDDisplayMode displayMode, const Options& options )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    if ( group_ )
+      return false;
+
+    for ( auto device : devices )
+      if ( std::find( devices_.begin(), devices_.end(), device ) == devices_.end() )
+        return false;
+
+    auto group = std::make_shared<CaptureGroup>();
+    if ( !group->start( devices, displayMode, options ) )
+      return false;
+
+    group_ = move( group );
+    return true;
+  }
+
+  size_t DecklinkCapture::getFrameSet( vector<OutputVideoFrame*>& out_frames, uint32_t timeout )
+  {
+    // The group keeps itself alive for as long as we wait on it
+    ScopedRWLock lock( &lock_, false );
+
+    auto group = group_;
+    if ( !group )
+      return 0;
+
+    lock.unlock();
+
+    return group->getFrameSet( out_frames, timeout );
+  }
+
+  void DecklinkCapture::stopCaptureGroup()
+  {
+    ScopedRWLock lock( &lock_ );
+
+    if ( group_ )
+    {
+      group_->stop();
+      group_.reset();
+    }
+  }
+
+  uint32_t DecklinkCapture::getDevices( DecklinkDeviceVector& out_devices )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    out_devices = devices_;
+    for ( auto device : out_devices )
+      device->AddRef();
+
+    return generation_.load();
+  }
+
+  CapabilitiesPtr DecklinkCapture::getCapabilities()
+  {
+    {
+      ScopedRWLock lock( &capabilitiesLock_, false );
+      if ( capabilities_ && capabilities_->generation_ == generation_.load() )
+        return capabilities_;
+    }
+
+    auto document = std::make_shared<CapabilitiesDocument>();
+    {
+      ScopedRWLock lock( &lock_, false );
+
+      document->generation_ = generation_.load();
+
+      size_t modeCount = 0;
+      for ( auto device : devices_ )
+        modeCount += device->displayModes_.size();
+      document->json_.reserve( 256 * devices_.size() + 320 * modeCount );
+
+      JsonWriter json( document->json_ );
+      json.beginArray();
+      for ( size_t i = 0; i < devices_.size(); ++i )
+      {
+        auto device = devices_[i];
+        uint32_t flags = 0;
+        if ( device->hasFormatDetection_ )
+          flags |= Device_CanAutodetectDisplayMode;
+        json.beginObject();
+        json.member( "id", i );
+        json.member( "name", device->name_ );
+        json.member( "bmId", device->id_ );
+        json.member( "bmFlags", std::to_string( flags ) );
+        json.key( "caps" ).beginArray();
+        for ( size_t j = 0; j < device->displayModes_.size(); ++j )
+        {
+          auto& mode = device->displayModes_[j];
+          double fps = (double)mode.timeScale_ / (double)mode.frameDuration_;
+          int interval = (int)( 10000000 / fps );
+          json.beginObject();
+          json.member( "id", j );
+          json.member( "minCX", mode.width_ );
+          json.member( "minCY", mode.height_ );
+          json.member( "maxCX", mode.width_ );
+          json.member( "maxCY", mode.height_ );
+          json.member( "granularityCX", 1 );
+          json.member( "granularityCY", 1 );
+          json.member( "minInterval", interval );
+          json.member( "maxInterval", interval );
+          json.member( "bmTimescale", static_cast<uint32_t>( mode.timeScale_ ) );
+          json.member( "bmFrameduration", static_cast<uint32_t>( mode.frameDuration_ ) );
+          json.member( "bmModecode", static_cast<uint32_t>( mode.value_ ) );
+          json.member( "rating", 1 );
+          json.member( "format", 100 );
+          json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+      }
+      json.endArray();
+    }
+
+    ScopedRWLock lock( &capabilitiesLock_ );
+
+    // Somebody else might have raced us to build a newer one
+    if ( !capabilities_ || capabilities_->generation_ < document->generation_ )
+      capabilities_ = move( document );
+
+    return capabilities_;
+  }
+
+  void DecklinkCapture::setOptions( const char* options )
+  {
+    size_t resizeWorkers = 0;
+    {
+      ScopedRWLock lock( &optionsLock_ );
+
+      Options changes( options );
+      options_.merge( changes );
+      for ( int i = 0; i < ThreadRole_Count; ++i )
+        threadPolicies_[i] = ThreadPolicy::fromOptions( options_, static_cast<ThreadRole>( i ), ThreadPolicy() );
+
+      workers_.setPolicy( threadPolicies_[ThreadRole_Worker] );
+      if ( changes.has( "workers" ) )
+        resizeWorkers = workerCount();
+      trace::configure( changes );
+      budget::configure( changes );
+      kernels::configure( changes );
+    }
+
+    // Resizing waits for the queued tasks, which may well need optionsLock_ themselves
+    if ( resizeWorkers )
+    {
+      ScopedRWLock lock( &workersLock_ );
+      if ( workers_.size() )
+        workers_.resize( resizeWorkers );
+    }
+
+    ScopedRWLock lock( &lock_, false );
+
+    if ( currentCaptureDevice_ )
+      currentCaptureDevice_->refreshThreadPolicies();
+  }
+
+  ThreadPolicy DecklinkCapture::getThreadPolicy( ThreadRole role, const Options& overrides )
+  {
+    ScopedRWLock lock( &optionsLock_, false );
+
+    return ThreadPolicy::fromOptions( overrides, role, threadPolicies_[role] );
+  }
+
+  size_t DecklinkCapture::workerCount() const
+  {
+    auto fallback = std::clamp<uint64_t>( GetActiveProcessorCount( ALL_PROCESSOR_GROUPS ) / 2, 1, 4 );
+    return static_cast<size_t>( std::clamp<uint64_t>( options_.getUnsigned( "workers", fallback ), 1, 64 ) );
+  }
+
+  WorkerPool* DecklinkCapture::getWorkerPool()
+  {
+    ThreadPolicy policy;
+    size_t count;
+    {
+      ScopedRWLock lock( &optionsLock_, false );
+      policy = threadPolicies_[ThreadRole_Worker];
+      count = workerCount();
+    }
+
+    ScopedRWLock lock( &workersLock_ );
+
+    if ( !workers_.size() )
+    {
+      workers_.setPolicy( policy );
+      workers_.resize( count );
+    }
+    return &workers_;
+  }
+
+  SnapshotPtr DecklinkCapture::getSnapshot()
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    return ( currentCaptureDevice_ ? currentCaptureDevice_->getSnapshot() : SnapshotPtr() );
+  }
+
+  uint32_t DecklinkCapture::getHistoryFrame( uint32_t index, uint8_t* buffer, uint32_t length, FrameInfo* out_frame )
+  {
+    // Conversion can take a while, so don't hold the capture lock for it
+    ScopedRWLock lock( &lock_, false );
+
+    auto device = currentCaptureDevice_;
+    if ( !device )
+      return 0;
+
+    device->AddRef();
+    lock.unlock();
+
+    auto ret = device->getHistoryFrame( index, buffer, length, out_frame );
+    device->Release();
+
+    return ret;
+  }
+
+  bool DecklinkCapture::findHistoryFrame( int64_t timestamp, int64_t timescale, uint32_t& out_index )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    return ( currentCaptureDevice_ ? currentCaptureDevice_->findHistoryFrame( timestamp, timescale, out_index ) : false );
+  }
+
+  bool DecklinkCapture::pinHistoryFrame( uint32_t index, bool pin )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    return ( currentCaptureDevice_ ? currentCaptureDevice_->pinHistoryFrame( index, pin ) : false );
+  }
+
+  void DecklinkCapture::getStats( string& out )
+  {
+    JsonWriter json( out );
+    json.beginObject();
+    json.member( "version", getVersion() );
+    json.member( "generation", generation_.load() );
+    {
+      ScopedRWLock lock( &optionsLock_, false );
+      json.key( "threads" ).beginObject();
+      for ( int i = 0; i < ThreadRole_Count; ++i )
+      {
+        json.key( threadRoleName( static_cast<ThreadRole>( i ) ) );
+        threadPolicies_[i].writeStats( json );
+      }
+      json.endObject();
+    }
+    json.key( "workers" );
+    workers_.writeStats( json );
+    json.key( "memory" );
+    budget::writeStats( json );
+    json.key( "kernels" );
+    kernels::writeStats( json );
+    {
+      ScopedRWLock lock( &lock_, false );
+      json.key( "devices" ).beginArray();
+      for ( auto device : devices_ )
+        device->writeStats( json );
+      json.endArray();
+      if ( group_ )
+      {
+        json.key( "group" );
+        group_->writeStats( json );
+      }
+    }
+    json.endObject();
+  }
+
+  void DecklinkCapture::setNotifyCallback( fn_device_notify callback, void* userdata )
+  {
+    ScopedRWLock lock( &notifyLock_ );
+
+    notifyCallback_ = callback;
+    notifyUserdata_ = userdata;
+  }
+
+  void DecklinkCapture::notify( DeviceEvent event, int64_t id )
   {
+    // Called outside the lock, so that the callback can set a new callback
+    fn_device_notify callback;
+    void* userdata;
+    {
+      ScopedRWLock lock( &notifyLock_, false );
+      callback = notifyCallback_;
+      userdata = notifyUserdata_;
+    }
+
+    if ( callback )
+      callback( event, id, generation_.load(), userdata );
+  }
+
+  void DecklinkCapture::setFrameCallback( fn_frame_notify callback, void* userdata )
+  {
+    // Once we have the lock, no call to the previous callback can be in progress
+    ScopedRWLock lock( &frameNotifyLock_ );
+
+    frameCallback_ = callback;
+    frameUserdata_ = userdata;
+  }
+
+  void DecklinkCapture::notifyFrame( uint32_t index )
+  {
+    ScopedRWLock lock( &frameNotifyLock_, false );
+
+    if ( frameCallback_ )
+      frameCallback_( index, frameUserdata_ );
+  }
+
+  bool DecklinkCapture::addDevice( IDeckLink* decklink, int64_t& out_id )
+  {
+    // Discovery reports every device that is already present when notifications
+    // are installed, and those have usually been picked up by iterateDevices already.
+    // Check the identity first so known devices don't get probed all over again.
+    out_id = DecklinkDevice::queryIdentity( decklink );
+    {
+      ScopedRWLock lock( &lock_, false );
+      for ( auto device : devices_ )
+        if ( device->decklink_ == decklink || ( out_id && device->id_ == out_id ) )
+          return false;
+    }
+
+    // Probing attributes and display modes is slow, so do it outside the lock
+    auto instance = new DecklinkDevice( this, decklink );
+    if ( !instance->usable_ || !instance->hasInput_ )
+    {
+      instance->Release();
+      return false;
+    }
+
+    ScopedRWLock lock( &lock_ );
+
     for ( auto device : devices_ )
+      if ( device->decklink_ == decklink || ( out_id && device->id_ == out_id ) )
+      {
+        lock.unlock();
+        instance->Release();
+        return false;
+      }
+
+    devices_.push_back( instance );
+    generation_.fetch_add( 1 );
+
+    return true;
+  }
+
+  bool DecklinkCapture::removeDevice( IDeckLink* decklink, int64_t& out_id )
+  {
+    out_id = DecklinkDevice::queryIdentity( decklink );
+
+    ScopedRWLock lock( &lock_ );
+
+    auto it = std::find_if( devices_.begin(), devices_.end(), [decklink, out_id]( DecklinkDevice* device ) {
+      return ( device->decklink_ == decklink || ( out_id && device->id_ == out_id ) );
+    } );
+
+    if ( it == devices_.end() )
+      return false;
+
+    auto device = *it;
+    devices_.erase( it );
+    generation_.fetch_add( 1 );
+
+    if ( device == currentCaptureDevice_ )
     {
+      currentCaptureDevice_->stopCapture();
+      currentCaptureDevice_->Release();
+      currentCaptureDevice_ = nullptr;
+    }
+
+    auto standby = std::find( standbyDevices_.begin(), standbyDevices_.end(), device );
+    if ( standby != standbyDevices_.end() )
+    {
+      standbyDevices_.erase( standby );
+      device->stopCapture();
       device->Release();
     }
 
-    devices_.clear();
+    if ( group_ && group_->contains( device ) )
+    {
+      group_->stop();
+      group_.reset();
+    }
+
+    out_id = device->id_;
+    device->Release();
 
+    return true;
+  }
+
+  void DecklinkCapture::iterateDevices()
+  {
     IDeckLinkIterator* iterator = nullptr;
     auto result = CoCreateInstance( CLSID_CDeckLinkIterator, NULL, CLSCTX_ALL,
       IID_IDeckLinkIterator, reinterpret_cast<void**>( &iterator ) );
@@ -126,11 +706,9 @@ namespace minibm {
     IDeckLink* device;
     while ( iterator->Next( &device ) == S_OK )
     {
-      auto instance = new DecklinkDevice( this, device );
-      if ( instance->usable_ && instance->hasInput_ )
-        devices_.push_back( move( instance ) );
-      else
-        instance->Release();
+      int64_t id;
+      addDevice( device, id );
+      device->Release();
     }
 
     iterator->Release();
@@ -138,25 +716,134 @@ namespace minibm {
 
   bool DecklinkCapture::initialize()
   {
-    ScopedRWLock lock( &lock_ );
-
     if ( !g_globals.comInitialized_ && !g_globals.initialize() )
       return false;
 
+    if ( discovery_ )
+      return true;
+
+    // Populate the initial table synchronously, so that callers see
+    // the devices right away instead of waiting for discovery to catch up.
     iterateDevices();
+
+    // Discovery notifications may be delivered during installation,
+    // so this must happen without holding the lock.
+    auto result = CoCreateInstance( CLSID_CDeckLinkDiscovery, NULL, CLSCTX_ALL,
+      IID_IDeckLinkDiscovery, reinterpret_cast<void**>( &discovery_ ) );
+
+    if ( FAILED( result ) || !discovery_ )
+    {
+      discovery_ = nullptr;
+      return true;
+    }
+
+    if ( discovery_->InstallDeviceNotifications( this ) != S_OK )
+    {
+      discovery_->Release();
+      discovery_ = nullptr;
+    }
+
     return true;
   }
 
   void DecklinkCapture::shutdown()
   {
+    if ( discovery_ )
+    {
+      discovery_->UninstallDeviceNotifications();
+      discovery_->Release();
+      discovery_ = nullptr;
+    }
+
     ScopedRWLock lock( &lock_ );
 
+    if ( currentCaptureDevice_ )
+    {
+      currentCaptureDevice_->stopCapture();
+      currentCaptureDevice_->Release();
+      currentCaptureDevice_ = nullptr;
+    }
+
+    for ( auto device : standbyDevices_ )
+    {
+      device->stopCapture();
+      device->Release();
+    }
+
+    standbyDevices_.clear();
+
+    if ( group_ )
+    {
+      group_->stop();
+      group_.reset();
+    }
+
     for ( auto device : devices_ )
     {
       device->Release();
     }
 
     devices_.clear();
+    generation_.fetch_add( 1 );
+
+    lock.unlock();
+    workers_.resize( 0 );
+
+    // Leases hold on to their devices, so let go of any that were never released
+    std::map<uint64_t, ExportedFrame*> leases;
+    {
+      ScopedRWLock leasesLock( &leasesLock_ );
+      leases.swap( leases_ );
+    }
+    for ( auto& lease : leases )
+      lease.second->device_->releaseExport( lease.second );
+  }
+
+  HRESULT DecklinkCapture::DeckLinkDeviceArrived( IDeckLink* decklink )
+  {
+    int64_t id;
+    if ( addDevice( decklink, id ) )
+      notify( DeviceEvent_Arrived, id );
+
+    return S_OK;
+  }
+
+  HRESULT DecklinkCapture::DeckLinkDeviceRemoved( IDeckLink* decklink )
+  {
+    int64_t id;
+    if ( removeDevice( decklink, id ) )
+      notify( DeviceEvent_Removed, id );
+
+    return S_OK;
+  }
+
+  HRESULT STDMETHODCALLTYPE DecklinkCapture::QueryInterface( REFIID iid, LPVOID* ppv )
+  {
+    if ( ppv == NULL )
+      return E_INVALIDARG;
+
+    *ppv = NULL;
+
+    if ( iid == IID_IUnknown || iid == IID_IDeckLinkDeviceNotificationCallback )
+    {
+      *ppv = (IDeckLinkDeviceNotificationCallback*)this;
+      AddRef();
+      return S_OK;
+    }
+
+    return E_NOINTERFACE;
+  }
+
+  // The capture object's lifetime is owned by the library, not by the discovery API,
+  // which is guaranteed to let go of us in UninstallDeviceNotifications.
+  ULONG STDMETHODCALLTYPE DecklinkCapture::AddRef( void )
+  {
+    return 1;
+  }
+
+  ULONG STDMETHODCALLTYPE DecklinkCapture::Release( void )
+  {
+    return 1;
   }
 
 }
\ No newline at end of file
@@ -6,6 +6,9 @@
 #include "pch.h"
 #include "minibmcap.h"
 #include "utils.h"
+#include "json.h"
+#include "numa.h"
+#include "trace.h"
 
 namespace minibm {
 
@@ -17,72 +20,1450 @@ namespace minibm {
     usable_ = init();
   }
 
+  //! Analysis that only our 8-bit YUV kernel can gather.
+  static const uint32_t c_lumaAnalysis = ( Analysis_Histogram | Analysis_Black | Analysis_Clipping );
+
+  //! Picks the format to capture a YUV or RGB signal in, so that the output format loses nothing.
+  //! P010 output stays in YUV, and lets the hardware convert RGB signals. BGRA output only takes
+  //! YUV in 8 bits when luma statistics are wanted, since that is what our kernel reads.
+  //! Used when the card can't tell us which formats it supports.
+  static BMDPixelFormat captureFormat( PixelFormat output, bool rgb, bool luma )
+  {
+    if ( output == Pixel_BGRA )
+      return ( rgb ? bmdFormat10BitRGB : luma ? bmdFormat8BitYUV : bmdFormat10BitYUV );
+    return ( rgb && output != Pixel_P010 ? bmdFormat10BitRGB : bmdFormat10BitYUV );
+  }
+
+  static const char* pixelFormatName( BMDPixelFormat format )
+  {
+    switch ( format )
+    {
+      case bmdFormat8BitYUV: return "2vuy";
+      case bmdFormat10BitYUV: return "v210";
+      case bmdFormat8BitBGRA: return "BGRA";
+      case bmdFormat10BitRGB: return "r210";
+      default: return "other";
+    }
+  }
+
+  //! A format the card can be asked to capture in, and what it takes us to get the output format from it.
+  struct FormatCandidate {
+    BMDPixelFormat format_;
+    uint32_t cost_; //!< Rough host work per pixel, relative to a plain copy.
+    bool yuv_; //!< 4:2:2 YUV, which would lose chroma of an RGB signal.
+  };
+
+  // Our own kernels cost little more than a copy, while going through the SDK costs several times that.
+  // 8-bit YUV only takes our kernel when luma statistics are wanted, see c_sdkYuvCost.
+  static const FormatCandidate c_bgraCandidates[] = {
+    { bmdFormat8BitBGRA, 1, false },
+    { bmdFormat8BitYUV, 2, true },
+    { bmdFormat10BitYUV, 8, true },
+    { bmdFormat10BitRGB, 8, false }
+  };
+
+  //! Cost of 8-bit YUV to BGRA through the SDK, just above 10-bit YUV since it also drops two bits of a 10-bit signal.
+  static const uint32_t c_sdkYuvCost = 9;
+  static const FormatCandidate c_highDepthCandidates[] = {
+    { bmdFormat10BitYUV, 3, true },
+    { bmdFormat10BitRGB, 3, false }
+  };
+  static const FormatCandidate c_p010Candidates[] = {
+    { bmdFormat10BitYUV, 2, true },
+    { bmdFormat10BitRGB, 10, false }
+  };
+
+  BMDPixelFormat DecklinkDevice::negotiateFormat( BMDDisplayMode mode, bool rgb )
+  {
+    const FormatCandidate* candidates = c_bgraCandidates;
+    size_t count = std::size( c_bgraCandidates );
+    if ( outputFormat_ == Pixel_P010 )
+    {
+      candidates = c_p010Candidates;
+      count = std::size( c_p010Candidates );
+    }
+    else if ( outputFormat_ != Pixel_BGRA )
+    {
+      candidates = c_highDepthCandidates;
+      count = std::size( c_highDepthCandidates );
+    }
+
+    // Luma statistics are gathered by the 8-bit YUV kernel, so a card that converts for us leaves none
+    bool needLuma = ( ( analysisFlags_ & c_lumaAnalysis ) != 0 );
+
+    const FormatCandidate* best = nullptr;
+    uint32_t bestCost = 0;
+    string passed;
+    for ( size_t i = 0; i < count; ++i )
+    {
+      auto& candidate = candidates[i];
+      auto cost = candidate.cost_;
+      if ( candidate.format_ == bmdFormat8BitYUV && outputFormat_ == Pixel_BGRA && !needLuma )
+        cost = c_sdkYuvCost;
+      const char* why = nullptr;
+      BOOL supported = FALSE;
+      BMDDisplayMode actualMode = bmdModeUnknown;
+      if ( candidate.yuv_ && rgb && outputFormat_ != Pixel_P010 )
+        why = "would lose RGB chroma";
+      else if ( candidate.format_ == bmdFormat8BitBGRA && needLuma )
+        why = "has no luma statistics";
+      else if ( input_->DoesSupportVideoMode( bmdVideoConnectionUnspecified, mode, candidate.format_,
+        bmdNoVideoInputConversion, bmdSupportedVideoModeDefault, &actualMode, &supported ) != S_OK )
+      {
+        formatCost_ = 0;
+        formatDirect_ = false;
+        formatReason_ = "the card can't tell which formats it supports";
+        return captureFormat( outputFormat_, rgb, needLuma );
+      }
+      else if ( !supported )
+        why = "is not supported by the card";
+
+      // Equal costs go to the format the signal comes in, so that the card doesn't convert for nothing
+      bool native = ( candidate.yuv_ != rgb );
+      if ( !why && ( !best || cost < bestCost || ( cost == bestCost && native && best->yuv_ == rgb ) ) )
+      {
+        best = &candidate;
+        bestCost = cost;
+      }
+      else if ( why && ( !best || cost < bestCost ) )
+        passed += string( passed.empty() ? "" : ", " ) + pixelFormatName( candidate.format_ ) + " " + why;
+    }
+
+    if ( !best )
+    {
+      formatCost_ = 0;
+      formatDirect_ = false;
+      formatReason_ = "no candidate is supported by the card";
+      return captureFormat( outputFormat_, rgb, needLuma );
+    }
+
+    formatCost_ = bestCost;
+    formatDirect_ = ( best->format_ == bmdFormat8BitBGRA );
+    formatReason_ = ( formatDirect_ ? "the card delivers the output format" : "cheapest conversion" );
+    if ( !passed.empty() )
+      formatReason_ += ", as " + passed;
+    return best->format_;
+  }
+
   HRESULT DecklinkDevice::VideoInputFormatChanged(
     BMDVideoInputFormatChangedEvents notificationEvents,
     IDeckLinkDisplayMode* newDisplayMode,
     BMDDetectedVideoInputFormatFlags detectedSignalFlags )
+  {
+    BMDDisplayMode mode;
+    BMDPixelFormat format;
+    bool restart = false;
+    {
+      ScopedRWLock lock( &lock_ );
+
+      auto previousMode = displayMode_.value_;
+      auto previousFormat = pixelFormat_;
+
+      if ( notificationEvents & bmdVideoInputColorspaceChanged )
+      {
+        if ( detectedSignalFlags & bmdDetectedVideoInputYCbCr422 )
+          rgbSignal_ = false;
+        else if ( detectedSignalFlags & bmdDetectedVideoInputRGB444 )
+          rgbSignal_ = true;
+      }
+
+      if ( notificationEvents & bmdVideoInputDisplayModeChanged )
+      {
+        displayMode_ = DisplayMode( newDisplayMode );
+      }
+
+      // What the card supports can change with either
+      if ( notificationEvents & ( bmdVideoInputColorspaceChanged | bmdVideoInputDisplayModeChanged ) )
+        pixelFormat_ = negotiateFormat( displayMode_.value_, rgbSignal_ );
+
+      mode = displayMode_.value_;
+      format = pixelFormat_;
+      restart = ( applyDetectedMode_ && capturing_ && ( mode != previousMode || format != previousFormat ) );
+
+      if ( restart )
+      {
+        formatChanges_++;
+        formatChangeTime_ = timeMicroseconds();
+        pendingFlags_ |= Frame_FormatChanged;
+      }
+    }
+
+    // Restart outside the lock so consumers aren't stalled meanwhile.
+    // Pausing and flushing keeps the driver's buffers, unlike a full stop.
+    // stopCapture clears capturing_ under restartLock_ before stopping the
+    // streams, so a stop either waits for us or makes us skip the restart.
+    if ( restart )
+    {
+      ScopedRWLock restartLock( &restartLock_ );
+      if ( !capturing_ )
+        return S_OK;
+      input_->PauseStreams();
+      input_->EnableVideoInput( mode, format, bmdVideoInputEnableFormatDetection );
+      input_->FlushStreams();
+      input_->StartStreams();
+    }
+
+    return S_OK;
+  }
+
+  //! Gets the smallest run of whole pixels that a row in format can be split at.
+  //! Unknown formats are treated as one indivisible run per row.
+  static void pixelGroup( BMDPixelFormat format, long width, long rowBytes, long& out_pixels, long& out_bytes )
+  {
+    switch ( format )
+    {
+      case bmdFormat8BitYUV: out_pixels = 2; out_bytes = 4; break;
+      case bmdFormat10BitYUV: out_pixels = 6; out_bytes = 16; break;
+      case bmdFormat8BitARGB:
+      case bmdFormat8BitBGRA:
+      case bmdFormat10BitRGB:
+      case bmdFormat10BitRGBXLE:
+      case bmdFormat10BitRGBX: out_pixels = 1; out_bytes = 4; break;
+      case bmdFormat12BitRGB:
+      case bmdFormat12BitRGBLE: out_pixels = 8; out_bytes = 36; break;
+      default: out_pixels = std::max( width, 1L ); out_bytes = rowBytes; break;
+    }
+  }
+
+  void DecklinkDevice::updateTiles( IDeckLinkVideoInputFrame* source, bool duplicate, bool accumulate )
+  {
+    void* bytes = nullptr;
+    if ( source->GetBytes( &bytes ) != S_OK || !bytes )
+      return;
+
+    auto width = source->GetWidth();
+    auto height = source->GetHeight();
+    auto rowBytes = source->GetRowBytes();
+    auto format = source->GetPixelFormat();
+    auto columns = static_cast<uint32_t>( ( width + tileSize_ - 1 ) / tileSize_ );
+    auto rows = static_cast<uint32_t>( ( height + tileSize_ - 1 ) / tileSize_ );
+
+    // Anything we have nothing to compare against counts as fully changed
+    bool reset = ( width != previousWidth_ || height != previousHeight_
+      || rowBytes != previousRowBytes_ || format != previousFormat_ );
+    if ( reset )
+    {
+      long groupPixels, groupBytes;
+      pixelGroup( format, width, rowBytes, groupPixels, groupBytes );
+      tileSpans_.resize( columns );
+      for ( uint32_t x = 0; x < columns; ++x )
+      {
+        auto x0 = static_cast<long>( x ) * tileSize_;
+        auto x1 = std::min( x0 + tileSize_, width );
+        tileSpans_[x].begin_ = static_cast<uint32_t>( ( x0 / groupPixels ) * groupBytes );
+        tileSpans_[x].end_ = static_cast<uint32_t>( std::min(
+          ( ( x1 + groupPixels - 1 ) / groupPixels ) * groupBytes, rowBytes ) );
+      }
+      previousFrame_.resize( static_cast<size_t>( rowBytes ) * height );
+      memcpy( previousFrame_.data(), bytes, previousFrame_.size() );
+      previousWidth_ = width;
+      previousHeight_ = height;
+      previousRowBytes_ = rowBytes;
+      previousFormat_ = format;
+    }
+
+    tileMarks_.assign( static_cast<size_t>( columns ) * rows, reset ? 1 : 0 );
+    if ( !reset && !duplicate )
+      kernels::tileDiff( static_cast<const uint8_t*>( bytes ), previousFrame_.data(), rowBytes, height,
+        tileSpans_.data(), columns, tileSize_, tileMarks_.data() );
+
+    // Changes on a frame that nobody picked up are merged into the next one
+    if ( !accumulate || frame_.tileColumns_ != columns || frame_.tileRows_ != rows
+      || frame_.tileSize_ != static_cast<uint32_t>( tileSize_ ) )
+    {
+      frame_.tiles_.assign( ( tileMarks_.size() + 7 ) / 8, 0 );
+      frame_.tileSize_ = static_cast<uint32_t>( tileSize_ );
+      frame_.tileColumns_ = columns;
+      frame_.tileRows_ = rows;
+    }
+    uint64_t changed = 0;
+    for ( size_t i = 0; i < tileMarks_.size(); ++i )
+      if ( tileMarks_[i] )
+      {
+        frame_.tiles_[i >> 3] |= static_cast<uint8_t>( 1 << ( i & 7 ) );
+        changed++;
+      }
+    changedTiles_ += changed;
+    totalTiles_ += tileMarks_.size();
+  }
+
+  void DecklinkDevice::convertHighDepth( IDeckLinkVideoFrame* source )
+  {
+    auto width = frame_.GetWidth();
+    auto height = frame_.GetHeight();
+    auto format = source->GetPixelFormat();
+    auto rowBytes = static_cast<size_t>( source->GetRowBytes() );
+    void* bytes = nullptr;
+    if ( source->GetBytes( &bytes ) != S_OK )
+      bytes = nullptr;
+
+    // Anything our kernels don't take goes through the SDK into v210 first
+    if ( bytes && format == bmdFormat10BitRGB && frame_.format() == Pixel_P010 )
+      bytes = nullptr;
+    if ( !bytes || ( format != bmdFormat10BitYUV && format != bmdFormat10BitRGB ) )
+    {
+      rowBytes = static_cast<size_t>( ( width + 47 ) / 48 ) * 128;
+      intermediate_.resize( rowBytes * height );
+      VideoFrameView destination( width, height, static_cast<long>( rowBytes ), bmdFormat10BitYUV, intermediate_.data() );
+      if ( !owner_->convertFrame( source, &destination ) )
+        return;
+      bytes = intermediate_.data();
+      format = bmdFormat10BitYUV;
+    }
+
+    auto src = static_cast<const uint8_t*>( bytes );
+    if ( frame_.format() == Pixel_P010 )
+      kernels::v210ToP010( src, rowBytes, frame_.data(), frame_.GetRowBytes(), width, height );
+    else
+    {
+      auto layout = ( frame_.format() == Pixel_RGBA64 ? kernels::Rgb_A64 : kernels::Rgb_10A2 );
+      if ( format == bmdFormat10BitRGB )
+        kernels::r210ToRGB( src, rowBytes, frame_.data(), frame_.GetRowBytes(), width, height, layout );
+      else
+        kernels::v210ToRGB( src, rowBytes, frame_.data(), frame_.GetRowBytes(), width, height, height > 576, layout );
+    }
+  }
+
+  bool DecklinkDevice::convertFrame( IDeckLinkVideoFrame* source, bool halve )
+  {
+    // BGRA that the card converted for us only needs copying. 8-bit YUV goes through our
+    // own kernel when luma statistics are wanted, since it gathers them while at it, or when
+    // degrading to half size, which it does without converting the skipped rows. Otherwise
+    // it's left to the SDK, whose output is the reference.
+    void* bytes = nullptr;
+    auto sourceFormat = source->GetPixelFormat();
+    bool ownKernel = ( frame_.format() == Pixel_BGRA
+      && ( sourceFormat == bmdFormat8BitBGRA
+        || ( sourceFormat == bmdFormat8BitYUV && ( halve || ( analysisFlags_ & c_lumaAnalysis ) ) ) )
+      && source->GetBytes( &bytes ) == S_OK && bytes );
+
+    // Halving is only worth it where it saves us from converting every row
+    halve = ( halve && ownKernel && source->GetHeight() >= 2 );
+    if ( halve )
+    {
+      // Grown before frame_ changes size, so that a refusal leaves frame_ as it was
+      if ( sourceFormat == bmdFormat8BitYUV )
+        intermediate_.resize( static_cast<size_t>( source->GetWidth() ) * 4 * ( source->GetHeight() / 2 ) );
+      frame_.resize( source->GetWidth() / 2, source->GetHeight() / 2 );
+    }
+    else
+      frame_.match( source );
+    frameHalved_ = halve;
+    frame_.analysis_.flags = 0;
+
+    if ( frame_.format() != Pixel_BGRA )
+    {
+      convertHighDepth( source );
+      return false;
+    }
+
+    if ( !ownKernel )
+    {
+      owner_->convertFrame( source, &frame_ );
+      return false;
+    }
+
+    if ( sourceFormat == bmdFormat8BitBGRA )
+    {
+      auto src = static_cast<const uint8_t*>( bytes );
+      size_t sourceRowBytes = source->GetRowBytes();
+      size_t destinationRowBytes = frame_.GetRowBytes();
+      if ( halve )
+        codecs::scaleBGRA( src, sourceRowBytes, source->GetWidth(), source->GetHeight(),
+          frame_.data(), frame_.GetWidth(), frame_.GetHeight() );
+      else if ( sourceRowBytes == destinationRowBytes )
+        memcpy( frame_.data(), src, destinationRowBytes * frame_.GetHeight() );
+      else
+        for ( long y = 0; y < frame_.GetHeight(); ++y )
+          memcpy( frame_.data() + y * destinationRowBytes, src + y * sourceRowBytes, destinationRowBytes );
+      return halve;
+    }
+
+    uint32_t statsFlags = 0;
+    if ( analysisFlags_ & Analysis_Histogram )
+      statsFlags = kernels::LumaStats_Histogram;
+    else if ( analysisFlags_ & ( Analysis_Black | Analysis_Clipping ) )
+      statsFlags = kernels::LumaStats_Levels;
+
+    auto width = source->GetWidth();
+    auto rows = source->GetHeight();
+    size_t sourceRowBytes = source->GetRowBytes();
+    auto destination = frame_.data();
+    size_t destinationRowBytes = frame_.GetRowBytes();
+    if ( halve )
+    {
+      // Every other row at full width, box filtered across afterwards
+      rows /= 2;
+      sourceRowBytes *= 2;
+      destinationRowBytes = static_cast<size_t>( width ) * 4;
+      destination = intermediate_.data();
+    }
+
+    // SD is BT.601, everything else BT.709
+    kernels::uyvyToBGRA( static_cast<const uint8_t*>( bytes ), sourceRowBytes,
+      destination, destinationRowBytes, width, rows,
+      source->GetHeight() > 576, statsFlags, lumaThresholds_, lumaStats_ );
+
+    if ( halve )
+      codecs::scaleBGRA( destination, destinationRowBytes, width, rows,
+        frame_.data(), frame_.GetWidth(), frame_.GetHeight() );
+
+    if ( !statsFlags )
+      return halve;
+
+    auto& analysis = frame_.analysis_;
+    analysis.flags = ( analysisFlags_ & c_lumaAnalysis );
+    analysis.pixels = static_cast<uint32_t>( width * rows );
+    analysis.black = lumaStats_.black_;
+    analysis.clippedlow = lumaStats_.clippedLow_;
+    analysis.clippedhigh = lumaStats_.clippedHigh_;
+    if ( analysis.flags & Analysis_Histogram )
+      memcpy( analysis.histogram, lumaStats_.histogram_, sizeof( analysis.histogram ) );
+    return halve;
+  }
+
+  void DecklinkDevice::convertDeferred()
+  {
+    trace::Span converting( "convert", frame_.index_ );
+    try
+    {
+      VideoFrameView source( deferredWidth_, deferredHeight_, deferredRowBytes_, deferredFormat_, deferredSource_.data() );
+      if ( convertFrame( &source, degrade_.active( Degrade_Downscale ) ) )
+      {
+        frame_.frameFlags_ |= Frame_Downscaled;
+        degrade_.noteDownscaled();
+      }
+      if ( analysisFlags_ )
+        frame_.frameFlags_ |= analyzeFrame();
+      frame_.sourceIndex_ = frame_.index_;
+    }
+    catch ( std::bad_alloc& )
+    {
+      // The previous contents are all there is to hand out
+      memoryDrops_++;
+    }
+    releaseDeferred();
+  }
+
+  void DecklinkDevice::releaseDeferred()
+  {
+    deferred_ = false;
+  }
+
+  //! Fills frame with color, given as 0xRRGGBB, in whatever format it is in.
+  static void fillSlate( OutputVideoFrame& frame, uint32_t color )
+  {
+    auto r = ( color >> 16 ) & 0xFF;
+    auto g = ( color >> 8 ) & 0xFF;
+    auto b = color & 0xFF;
+    auto pixels = static_cast<size_t>( frame.GetWidth() ) * frame.GetHeight();
+    switch ( frame.format() )
+    {
+      case Pixel_BGRA:
+      {
+        uint32_t pixel = 0xFF000000u | ( r << 16 ) | ( g << 8 ) | b;
+        std::fill_n( reinterpret_cast<uint32_t*>( frame.data() ), pixels, pixel );
+        break;
+      }
+      case Pixel_RGB10A2:
+      {
+        uint32_t pixel = 0xC0000000u | ( ( b * 1023 / 255 ) << 20 ) | ( ( g * 1023 / 255 ) << 10 ) | ( r * 1023 / 255 );
+        std::fill_n( reinterpret_cast<uint32_t*>( frame.data() ), pixels, pixel );
+        break;
+      }
+      case Pixel_RGBA64:
+      {
+        auto words = reinterpret_cast<uint16_t*>( frame.data() );
+        for ( size_t i = 0; i < pixels; ++i, words += 4 )
+        {
+          words[0] = static_cast<uint16_t>( r * 257 );
+          words[1] = static_cast<uint16_t>( g * 257 );
+          words[2] = static_cast<uint16_t>( b * 257 );
+          words[3] = 0xFFFF;
+        }
+        break;
+      }
+      case Pixel_P010:
+      {
+        // Limited range BT.709, in the high 10 bits
+        auto y = ( 0.2126 * r + 0.7152 * g + 0.0722 * b ) / 255.0;
+        auto cb = ( b / 255.0 - y ) / 1.8556;
+        auto cr = ( r / 255.0 - y ) / 1.5748;
+        auto luma = static_cast<uint16_t>( std::lround( 64.0 + 876.0 * y ) << 6 );
+        auto blue = static_cast<uint16_t>( std::lround( 512.0 + 896.0 * cb ) << 6 );
+        auto red = static_cast<uint16_t>( std::lround( 512.0 + 896.0 * cr ) << 6 );
+        auto rowWords = static_cast<size_t>( frame.GetRowBytes() ) / 2;
+        auto words = reinterpret_cast<uint16_t*>( frame.data() );
+        std::fill_n( words, rowWords * frame.GetHeight(), luma );
+        auto chroma = words + rowWords * frame.GetHeight();
+        auto chromaWords = rowWords * ( ( frame.GetHeight() + 1 ) / 2 );
+        for ( size_t i = 0; i + 1 < chromaWords; i += 2 )
+        {
+          chroma[i] = blue;
+          chroma[i + 1] = red;
+        }
+        break;
+      }
+    }
+  }
+
+  void DecklinkDevice::takeHeldPicture()
+  {
+    // Nobody picked the last one up, but it's still the picture to hold
+    if ( deferred_ )
+      convertDeferred();
+
+    // By now the converted picture has moved on to wherever frames go after being delivered.
+    // If it was exported, it's no longer ours to copy, and the slate has to do.
+    const OutputVideoFrame* source = nullptr;
+    if ( frame_.sourceIndex_ == heldIndex_ )
+      source = &frame_;
+    else if ( storedFrame_.sourceIndex_ == heldIndex_ )
+      source = &storedFrame_;
+    for ( auto& frame : queue_ )
+      if ( !source && frame->sourceIndex_ == heldIndex_ )
+        source = frame.get();
+    for ( auto& slot : shared_ )
+      if ( !source && slot->frame_.sourceIndex_ == heldIndex_ )
+        source = &slot->frame_;
+    if ( !source )
+    {
+      releaseHeld();
+      return;
+    }
+
+    try
+    {
+      heldFrame_.copyFrom( *source );
+    }
+    catch ( std::bad_alloc& )
+    {
+      memoryDrops_++;
+      releaseHeld();
+    }
+  }
+
+  void DecklinkDevice::showNoSignal( IDeckLinkVideoInputFrame* source )
+  {
+    if ( noSignal_ == NoSignal_Hold && heldIndex_ )
+    {
+      // Each buffer takes one copy, after which it keeps the picture for as long as the signal is gone
+      if ( frame_.sourceIndex_ != heldIndex_ )
+        frame_.copyFrom( heldFrame_ );
+    }
+    else if ( noSignal_ != NoSignal_Status )
+    {
+      if ( frame_.sourceIndex_ != OutputVideoFrame::c_slateIndex
+        || frame_.GetWidth() != source->GetWidth() || frame_.GetHeight() != source->GetHeight() )
+      {
+        frame_.match( source );
+        fillSlate( frame_, slateColor_ );
+        frame_.sourceIndex_ = OutputVideoFrame::c_slateIndex;
+      }
+      frameHalved_ = false;
+    }
+    else
+    {
+      // Keeps the allocation for when the signal comes back
+      frame_.resize( 0, 0 );
+      frame_.sourceIndex_ = 0;
+      frameHalved_ = false;
+    }
+    frame_.fingerprint_ = 0;
+    frame_.analysis_.flags = 0;
+
+    // Whatever the picture was, the next one with a signal is all new
+    if ( tileSize_ )
+    {
+      previousWidth_ = 0;
+      frame_.tiles_.assign( ( static_cast<size_t>( frame_.tileColumns_ ) * frame_.tileRows_ + 7 ) / 8, 0xFF );
+    }
+  }
+
+  void DecklinkDevice::releaseHeld()
+  {
+    heldIndex_ = 0;
+    heldFrame_.sourceIndex_ = 0;
+  }
+
+  uint32_t DecklinkDevice::analyzeFrame()
+  {
+    auto& analysis = frame_.analysis_;
+    uint32_t flags = 0;
+
+    if ( analysisFlags_ & Analysis_Freeze )
+    {
+      analysis.flags |= Analysis_Freeze;
+      analysis.frozen = frozenCount_;
+      if ( frozenCount_ >= freezeFrames_ )
+      {
+        flags |= Frame_Frozen;
+        frozenFrames_++;
+      }
+    }
+
+    if ( ( analysis.flags & Analysis_Black ) && analysis.black >= blackRatio_ * analysis.pixels )
+    {
+      flags |= Frame_Black;
+      blackFrames_++;
+    }
+
+    if ( ( analysis.flags & Analysis_Clipping )
+      && analysis.clippedlow + analysis.clippedhigh > clipRatio_ * analysis.pixels )
+    {
+      flags |= Frame_Clipped;
+      clippedFrames_++;
+    }
+
+    return flags;
+  }
+
+  void DecklinkDevice::dropQueuedFrame()
+  {
+    auto& dropped = *queue_[queueHead_];
+    queueHead_ = ( queueHead_ + 1 ) % queue_.size();
+    queueCount_--;
+    queueDrops_++;
+    auto& next = ( queueCount_ ? *queue_[queueHead_] : frame_ );
+    next.frameFlags_ |= ( dropped.frameFlags_ & c_stickyFrameFlags );
+    if ( dropped.tileSize_ == next.tileSize_ && dropped.tiles_.size() == next.tiles_.size() )
+      for ( size_t i = 0; i < next.tiles_.size(); ++i )
+        next.tiles_[i] |= dropped.tiles_[i];
+  }
+
+  void DecklinkDevice::enqueueFrame()
+  {
+    // Dropping the oldest frame keeps latency bounded
+    if ( queueCount_ == queue_.size() )
+      dropQueuedFrame();
+    queue_[( queueHead_ + queueCount_ ) % queue_.size()]->swap( frame_ );
+    queueCount_++;
+  }
+
+  bool DecklinkDevice::newestQueuedTime( int64_t& out_time )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    if ( !live() || !queueCount_ )
+      return false;
+
+    out_time = queue_[( queueHead_ + queueCount_ - 1 ) % queue_.size()]->referenceTime_;
+    return true;
+  }
+
+  bool DecklinkDevice::takeQueuedFrame( int64_t time, int64_t tolerance, OutputVideoFrame** out_frame, int64_t& out_skew )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    // Frames older than the range can't match this time or any later one
+    size_t stale = 0, best = queueCount_;
+    for ( size_t i = 0; i < queueCount_; ++i )
+    {
+      auto skew = queue_[( queueHead_ + i ) % queue_.size()]->referenceTime_ - time;
+      if ( skew < -tolerance )
+        stale = i + 1;
+      else if ( skew > tolerance )
+        break;
+      else if ( best == queueCount_ || std::abs( skew ) < std::abs( out_skew ) )
+      {
+        best = i;
+        out_skew = skew;
+      }
+    }
+
+    auto drops = ( best < queueCount_ ? best : stale );
+    while ( drops-- )
+      dropQueuedFrame();
+    if ( best == queueCount_ )
+      return false;
+
+    storedFrame_.swap( *queue_[queueHead_] );
+    queueHead_ = ( queueHead_ + 1 ) % queue_.size();
+    queueCount_--;
+    lastReturnedFrameIndex_ = storedFrame_.index_;
+    trace::instant( "acquire", storedFrame_.index_ );
+    *out_frame = &storedFrame_;
+    return true;
+  }
+
+  int64_t DecklinkDevice::frameDurationMicroseconds()
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    if ( !displayMode_.timeScale_ )
+      return 0;
+    return ( displayMode_.frameDuration_ * 1000000 / displayMode_.timeScale_ );
+  }
+
+  void DecklinkDevice::syncReferenceClock()
+  {
+    // Splitting the difference of the host times around the read cancels out most of its latency
+    BMDTimeValue hardwareTime, timeInFrame, ticksPerFrame;
+    auto before = timeMicroseconds();
+    hardwareClock_ = ( input_->GetHardwareReferenceClock( 1000000, &hardwareTime, &timeInFrame, &ticksPerFrame ) == S_OK );
+    auto after = timeMicroseconds();
+    if ( hardwareClock_ )
+      clockOffset_ = hardwareTime - ( before + after ) / 2;
+    clockSyncTime_ = after;
+  }
+
+  int64_t DecklinkDevice::referenceTimeOf( IDeckLinkVideoInputFrame* frame )
+  {
+    // The card's clock drifts against ours, so the offset is kept fresh
+    auto now = timeMicroseconds();
+    if ( now - clockSyncTime_ >= 1000000 )
+      syncReferenceClock();
+
+    BMDTimeValue frameTime, frameDuration;
+    if ( hardwareClock_ && frame->GetHardwareReferenceTimestamp( 1000000, &frameTime, &frameDuration ) == S_OK )
+      return ( frameTime - clockOffset_ );
+    return now;
+  }
+
+  void DecklinkDevice::publishFrame()
+  {
+    SharedFrame* target = nullptr;
+    for ( auto& slot : shared_ )
+      if ( !slot->refs_ && ( !target || slot->frame_.index_ < target->frame_.index_ ) )
+        target = slot.get();
+    if ( !target )
+    {
+      sharedOverruns_++;
+      return;
+    }
+    target->frame_.swap( frame_ );
+    consumerWake_.wakeAll();
+  }
+
+  SharedFrame* DecklinkDevice::nextShared( uint32_t index )
+  {
+    SharedFrame* next = nullptr;
+    for ( auto& slot : shared_ )
+      if ( slot->frame_.index_ > index && ( !next || slot->frame_.index_ < next->frame_.index_ ) )
+        next = slot.get();
+    return next;
+  }
+
+  Consumer* DecklinkDevice::findConsumer( uint32_t id )
+  {
+    for ( auto& consumer : consumers_ )
+      if ( consumer->id_ == id )
+        return consumer.get();
+    return nullptr;
+  }
+
+  uint32_t DecklinkDevice::openConsumer( const Options& options )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    if ( !live() || shared_.empty() )
+      return 0;
+
+    auto consumer = std::make_unique<Consumer>();
+    consumer->id_ = nextConsumerId_++;
+    consumer->cursor_ = frameIndex_.load();
+    consumer->cadence_.configure( options );
+    consumers_.push_back( move( consumer ) );
+    return consumers_.back()->id_;
+  }
+
+  bool DecklinkDevice::getConsumerFrame( uint32_t id, OutputVideoFrame** out_frame, uint32_t timeout, uint64_t maxPixels )
+  {
+    auto deadline = ( timeout == INFINITE ? 0 : GetTickCount64() + timeout );
+
+    ScopedRWLock lock( &lock_ );
+
+    auto consumer = findConsumer( id );
+    if ( !consumer )
+      return false;
+    if ( consumer->held_ )
+    {
+      trace::instant( "release", consumer->held_->frame_.index_ );
+      consumer->held_->refs_--;
+      consumer->held_ = nullptr;
+    }
+
+    while ( live() )
+    {
+      auto next = nextShared( consumer->cursor_ );
+      while ( next )
+      {
+        auto& frame = next->frame_;
+        if ( maxPixels && static_cast<uint64_t>( frame.GetWidth() ) * frame.GetHeight() > maxPixels )
+          return false;
+        consumer->dropped_ += frame.index_ - consumer->cursor_ - 1;
+        consumer->cursor_ = frame.index_;
+        if ( !consumer->cadence_.enabled() || !frame.timeScale_
+          || consumer->cadence_.select( frame.streamTime_, frame.streamDuration_, frame.timeScale_ ) )
+          break;
+        consumer->skipped_++;
+        next = nextShared( consumer->cursor_ );
+      }
+      if ( next )
+      {
+        next->refs_++;
+        consumer->held_ = next;
+        consumer->delivered_++;
+        consumer->lag_ = frameIndex_.load() - next->frame_.index_;
+        consumer->maxLag_ = std::max( consumer->maxLag_, consumer->lag_ );
+        trace::instant( "acquire", next->frame_.index_ );
+        *out_frame = &next->frame_;
+        return true;
+      }
+
+      uint32_t wait = 1000;
+      if ( deadline )
+      {
+        auto now = GetTickCount64();
+        if ( now >= deadline )
+          return false;
+        wait = static_cast<uint32_t>( std::min<ULONGLONG>( deadline - now, 1000 ) );
+      }
+      consumerWake_.wait( lock_, wait );
+
+      // Might have been closed meanwhile
+      consumer = findConsumer( id );
+      if ( !consumer )
+        return false;
+    }
+
+    return false;
+  }
+
+  void DecklinkDevice::closeConsumer( uint32_t id )
   {
     ScopedRWLock lock( &lock_ );
 
-    if ( notificationEvents & bmdVideoInputColorspaceChanged )
+    for ( auto it = consumers_.begin(); it != consumers_.end(); ++it )
     {
-      if ( detectedSignalFlags & bmdDetectedVideoInputYCbCr422 )
-        pixelFormat_ = bmdFormat10BitYUV;
-      else if ( detectedSignalFlags & bmdDetectedVideoInputRGB444 )
-        pixelFormat_ = bmdFormat10BitRGB;
+      auto& consumer = *it;
+      if ( consumer->id_ != id )
+        continue;
+      if ( consumer->held_ )
+        consumer->held_->refs_--;
+      consumers_.erase( it );
+      consumerWake_.wakeAll();
+      return;
     }
+  }
 
-    if ( notificationEvents & bmdVideoInputDisplayModeChanged )
+  uint32_t DecklinkDevice::receiveFrame( IDeckLinkVideoInputFrame* videoFrame, uint32_t& out_signalEvent )
+  {
+    auto arrival = timeMicroseconds();
+    trace::instant( "arrival", frameIndex_.load() + 1 );
+    trace::Span lockWait( "lock" );
+    ScopedRWLock lock( &lock_ );
+    lockWait.end();
+    applyThreadPolicy( callbackPolicy_, callbackState_ );
+
+    // The card keeps sending frames of its own when the input goes away, which are told apart by a flag
+    bool noSignal = ( ( videoFrame->GetFlags() & bmdFrameHasNoInputSource ) != 0 );
+    if ( signal_ != !noSignal )
     {
-      displayMode_ = DisplayMode( newDisplayMode );
+      signal_ = !noSignal;
+      if ( noSignal )
+      {
+        signalLosses_++;
+        signalLostTime_ = arrival;
+        out_signalEvent = DeviceEvent_SignalLost;
+      }
+      else
+      {
+        lastOutage_ = arrival - signalLostTime_;
+        maxOutage_ = std::max( maxOutage_, lastOutage_ );
+        out_signalEvent = DeviceEvent_SignalRestored;
+      }
     }
 
-    if ( applyDetectedMode_ )
+    // Standby only keeps the output frame matched to the signal, converting
+    // the first frame and the first after a format change, and discards the rest
+    if ( standby_ )
     {
-      input_->StopStreams();
-      input_->EnableVideoInput( displayMode_.value_, pixelFormat_, bmdVideoInputEnableFormatDetection );
-      input_->StartStreams();
+      standbyFrames_++;
+      if ( ( !frame_.GetWidth() || ( pendingFlags_ & Frame_FormatChanged ) ) && !noSignal )
+      {
+        convertFrame( videoFrame );
+        frame_.sourceIndex_ = 0;
+      }
+      pendingFlags_ = 0;
+      formatChangeTime_ = 0;
+      return 0;
     }
 
-    return S_OK;
+    DegradePolicy::Timer degradeTimer( degrade_, arrival );
+
+    // Flags on a frame that is about to be overwritten unseen carry over
+    uint32_t flags = pendingFlags_;
+    bool overwritingUnread = ( queue_.empty() && shared_.empty() && frameIndex_.load() > lastReturnedFrameIndex_ );
+    if ( overwritingUnread )
+      flags |= ( frame_.frameFlags_ & c_stickyFrameFlags );
+    degradeTimer.unread_ = overwritingUnread;
+    pendingFlags_ = 0;
+
+    if ( formatChangeTime_ )
+    {
+      lastFormatChangeLatency_ = timeMicroseconds() - formatChangeTime_;
+      maxFormatChangeLatency_ = std::max( maxFormatChangeLatency_, lastFormatChangeLatency_ );
+      formatChangeTime_ = 0;
+    }
+
+    auto referenceTime = ( referenceTiming_ ? referenceTimeOf( videoFrame ) : 0 );
+
+    auto timeScale = displayMode_.timeScale_;
+    BMDTimeValue streamTime = 0, streamDuration = 0;
+    bool timed = ( videoFrame->GetStreamTime( &streamTime, &streamDuration, timeScale ) == S_OK );
+    if ( !timed )
+      streamTime = streamDuration = 0;
+
+    if ( degrade_.enabled() && timed )
+    {
+      uint32_t degradeFlags = 0;
+      if ( !degrade_.admit( streamTime, streamDuration, timeScale, degradeFlags ) )
+      {
+        pendingFlags_ = flags;
+        return 0;
+      }
+      flags |= degradeFlags;
+    }
+
+    // Frames off the target cadence are dropped before anything else is spent on them
+    if ( cadence_.enabled() && timed )
+    {
+      if ( flags & Frame_FormatChanged )
+        cadence_.restart();
+      if ( !cadence_.select( streamTime, streamDuration, timeScale ) )
+      {
+        pendingFlags_ = flags;
+        return 0;
+      }
+    }
+
+    // Nothing below applies to a picture that isn't there, and the next one compares against none
+    if ( noSignal )
+    {
+      noSignalFrames_++;
+      lastFingerprint_ = lastSampledFingerprint_ = 0;
+      frozenCount_ = 0;
+      flags |= Frame_NoSignal;
+    }
+
+    bool duplicate = false;
+    uint64_t fingerprint = 0;
+    if ( !noSignal && ( dedupeMode_ != Dedupe_Off || ( analysisFlags_ & Analysis_Freeze ) ) )
+    {
+      void* bytes = nullptr;
+      if ( videoFrame->GetBytes( &bytes ) == S_OK && bytes )
+      {
+        auto data = static_cast<const uint8_t*>( bytes );
+        auto rowBytes = videoFrame->GetRowBytes();
+        auto height = videoFrame->GetHeight();
+        fingerprint = kernels::fingerprint( data, rowBytes, height, dedupeRowStep_ );
+        if ( dedupeRowStep_ > 1 )
+        {
+          // Matching sampled rows only make this a candidate repeat. Nothing is flagged,
+          // dropped or left unconverted on them alone, since the skipped rows might differ:
+          // candidates get the full hash, and anything else counts as never seen before.
+          auto sampled = fingerprint;
+          fingerprint = ( sampled && sampled == lastSampledFingerprint_
+            ? kernels::fingerprint( data, rowBytes, height, 1 ) : 0 );
+          lastSampledFingerprint_ = sampled;
+        }
+      }
+      duplicate = ( fingerprint && fingerprint == lastFingerprint_ && !( flags & Frame_FormatChanged ) );
+      lastFingerprint_ = fingerprint;
+      frozenCount_ = ( duplicate ? frozenCount_ + 1 : 0 );
+      if ( duplicate && dedupeMode_ != Dedupe_Off )
+      {
+        duplicateFrames_++;
+        if ( dedupeMode_ == Dedupe_Drop )
+        {
+          suppressedFrames_++;
+          pendingFlags_ = flags;
+          return 0;
+        }
+        flags |= Frame_Duplicate;
+      }
+    }
+
+    // This stays a pass of its own rather than being fused into conversion: it has to see
+    // every frame, including ones that are deferred or reused and never get converted, it
+    // compares the source format, which survives format negotiation and halving unchanged,
+    // and several conversion paths run inside the SDK where there is nothing to fuse into.
+    // A tile is skipped once it is known to have changed, so it costs at most one read.
+    if ( tileSize_ && !noSignal )
+      updateTiles( videoFrame, duplicate, overwritingUnread );
+
+    bool deferring = ( overwritingUnread && degrade_.active( Degrade_Skip ) && !noSignal );
+    bool halve = degrade_.active( Degrade_Downscale );
+    if ( noSignal )
+    {
+      // The picture is copied out once, when the signal goes, rather than kept around for every frame
+      if ( noSignal_ == NoSignal_Hold && heldIndex_ && heldFrame_.sourceIndex_ != heldIndex_ )
+        takeHeldPicture();
+      releaseDeferred();
+      showNoSignal( videoFrame );
+    }
+    else if ( deferring )
+    {
+      // Nobody read the last one either, so conversion waits until someone picks this one up.
+      // The source is copied rather than kept, which would keep a driver buffer out indefinitely.
+      void* bytes = nullptr;
+      releaseDeferred();
+      if ( videoFrame->GetBytes( &bytes ) == S_OK && bytes )
+      {
+        deferredWidth_ = videoFrame->GetWidth();
+        deferredHeight_ = videoFrame->GetHeight();
+        deferredRowBytes_ = videoFrame->GetRowBytes();
+        deferredFormat_ = videoFrame->GetPixelFormat();
+        deferredSource_.resize( static_cast<size_t>( deferredRowBytes_ ) * deferredHeight_ );
+        memcpy( deferredSource_.data(), bytes, deferredSource_.size() );
+        deferred_ = true;
+      }
+      frame_.fingerprint_ = 0;
+      flags |= Frame_Deferred;
+      degrade_.noteDeferred();
+    }
+    // The pending frame might still hold these exact contents if nobody took it
+    else if ( deferred_ || !fingerprint || frame_.fingerprint_ != fingerprint || frameHalved_ != halve )
+    {
+      releaseDeferred();
+      trace::Span converting( "convert", frameIndex_.load() + 1 );
+      if ( convertFrame( videoFrame, halve ) )
+        degrade_.noteDownscaled();
+      frame_.fingerprint_ = fingerprint;
+      if ( numaNode_ >= 0 )
+      {
+        // The scheduler can still move us if pinning failed or was overridden
+        if ( numa::currentNode() == numaNode_ )
+          localConversions_++;
+        else
+        {
+          remoteConversions_++;
+          remoteBytes_ += static_cast<uint64_t>( videoFrame->GetRowBytes() ) * videoFrame->GetHeight() + frame_.buffer().size();
+        }
+      }
+    }
+    if ( analysisFlags_ && !deferring && !noSignal )
+      flags |= analyzeFrame();
+    if ( frameHalved_ && !deferring && !noSignal )
+      flags |= Frame_Downscaled;
+    frame_.frameFlags_ = flags;
+    frame_.timeScale_ = timeScale;
+    frame_.streamTime_ = streamTime;
+    frame_.streamDuration_ = streamDuration;
+    frame_.referenceTime_ = referenceTime;
+    frame_.index_ = frameIndex_.load() + 1;
+    frameIndex_.store( frame_.index_ );
+    if ( !deferring && !noSignal )
+      frame_.sourceIndex_ = frame_.index_;
+    if ( noSignal_ == NoSignal_Hold && !noSignal )
+      heldIndex_ = frame_.index_;
+    if ( history_.enabled() && !noSignal )
+      history_.store( videoFrame, frame_.index_, flags, frame_.streamTime_, frame_.streamDuration_, frame_.timeScale_ );
+    if ( !deferring && !noSignal )
+      snapshots_.offer( frame_ );
+    if ( !shared_.empty() )
+      publishFrame();
+    else if ( !queue_.empty() )
+      enqueueFrame();
+    // Don't wake up a batch consumer for every single frame
+    if ( queue_.empty() || queueCount_ >= batchWanted_.load() )
+      newFrameEvent_.set();
+    auto readyIndex = frameIndex_.load();
+    trace::instant( "publish", readyIndex );
+    if ( startTime_ )
+    {
+      lastStartLatency_ = timeMicroseconds() - startTime_;
+      maxStartLatency_ = std::max( maxStartLatency_, lastStartLatency_ );
+      startTime_ = 0;
+    }
+    return readyIndex;
   }
 
   HRESULT DecklinkDevice::VideoInputFrameArrived(
     IDeckLinkVideoInputFrame* videoFrame,
     IDeckLinkAudioInputPacket* audioPacket )
   {
+    uint32_t readyIndex = 0;
+    uint32_t signalEvent = 0;
     if ( videoFrame )
     {
-      ScopedRWLock lock( &lock_ );
-      frame_.match( videoFrame );
-      owner_->convertFrame( videoFrame, &frame_ );
-      frameIndex_.fetch_add( 1 );
-      newFrameEvent_.set();
+      // Growing a buffer mid-capture can be refused, which costs the frame but not the capture
+      try
+      {
+        readyIndex = receiveFrame( videoFrame, signalEvent );
+      }
+      catch ( std::bad_alloc& )
+      {
+        memoryDrops_++;
+        ScopedRWLock lock( &lock_ );
+        frame_.fingerprint_ = 0;
+        frame_.sourceIndex_ = 0;
+      }
     }
 
+    // Outside the lock, so that callbacks can't hold up consumers
+    if ( signalEvent )
+      owner_->notify( static_cast<DeviceEvent>( signalEvent ), id_ );
+    if ( readyIndex )
+      owner_->notifyFrame( readyIndex );
+
     return S_OK;
   }
 
-  bool DecklinkDevice::getFrameBlocking( BGRA32VideoFrame** out_frame, uint32_t& out_index )
+  uint32_t DecklinkDevice::getHistoryFrame( uint32_t index, uint8_t* buffer, uint32_t length, FrameInfo* out_frame )
+  {
+    auto slot = history_.acquire( index );
+    if ( !slot )
+      return 0;
+
+    auto rowBytes = slot->width_ * 4;
+    auto size = static_cast<uint32_t>( rowBytes * slot->height_ );
+    bool converted = false;
+    if ( buffer && length >= size )
+    {
+      if ( slot->pixelFormat_ == bmdFormat8BitYUV )
+      {
+        kernels::LumaStats stats;
+        kernels::uyvyToBGRA( slot->buffer_.data(), slot->rowBytes_, buffer, rowBytes,
+          slot->width_, slot->height_, slot->height_ > 576, 0, kernels::LumaThresholds(), stats );
+        converted = true;
+      }
+      else if ( slot->pixelFormat_ == bmdFormat8BitBGRA )
+      {
+        for ( long y = 0; y < slot->height_; ++y )
+          memcpy( buffer + y * rowBytes, slot->buffer_.data() + y * slot->rowBytes_, rowBytes );
+        converted = true;
+      }
+      else
+      {
+        VideoFrameView source( slot->width_, slot->height_, slot->rowBytes_, slot->pixelFormat_, slot->buffer_.data() );
+        VideoFrameView destination( slot->width_, slot->height_, rowBytes, bmdFormat8BitBGRA, buffer );
+        converted = owner_->convertFrame( &source, &destination );
+      }
+      if ( !converted )
+        size = 0;
+    }
+
+    if ( out_frame )
+    {
+      *out_frame = {};
+      out_frame->width = slot->width_;
+      out_frame->height = slot->height_;
+      out_frame->rowbytes = rowBytes;
+      out_frame->pixelformat = bmdFormat8BitBGRA;
+      out_frame->index = slot->index_;
+      out_frame->flags = slot->flags_;
+      out_frame->buffer = ( converted ? buffer : nullptr );
+      out_frame->timestamp = slot->streamTime_;
+      out_frame->duration = slot->streamDuration_;
+      out_frame->timescale = slot->timeScale_;
+    }
+
+    history_.release( slot );
+    return size;
+  }
+
+  bool DecklinkDevice::getFrameBlocking( OutputVideoFrame** out_frame, uint32_t timeout, uint64_t maxPixels )
   {
-    if ( !capturing_ )
+    if ( !shared_.empty() )
+      return getConsumerFrame( 0, out_frame, timeout, maxPixels );
+    if ( !queue_.empty() )
+      return ( getFramesBatch( 1, timeout, 0, 0, out_frame ) == 1 );
+    if ( !live() )
       return false;
+    auto deadline = ( timeout == INFINITE ? 0 : GetTickCount64() + timeout );
     while ( frameIndex_.load() <= lastReturnedFrameIndex_ )
     {
       newFrameEvent_.reset();
-      newFrameEvent_.wait( 1000 );
+      if ( frameIndex_.load() > lastReturnedFrameIndex_ )
+        break;
+      uint32_t wait = 1000;
+      if ( deadline )
+      {
+        auto now = GetTickCount64();
+        if ( now >= deadline )
+          return false;
+        wait = static_cast<uint32_t>( std::min<ULONGLONG>( deadline - now, 1000 ) );
+      }
+      newFrameEvent_.wait( wait );
+      if ( !live() )
+        return false;
     }
     {
       lock_.lock();
-      lastReturnedFrameIndex_ = frameIndex_.load();
+      if ( deferred_ )
+        convertDeferred();
+      if ( maxPixels && static_cast<uint64_t>( frame_.GetWidth() ) * frame_.GetHeight() > maxPixels )
+      {
+        lock_.unlock();
+        return false;
+      }
       storedFrame_.swap( frame_ );
+      lastReturnedFrameIndex_ = storedFrame_.index_;
       lock_.unlock();
     }
+    trace::instant( "acquire", storedFrame_.index_ );
     *out_frame = &storedFrame_;
-    out_index = lastReturnedFrameIndex_;
     return true;
   }
 
+  static void deleteExportedTensor( DLManagedTensor* self )
+  {
+    auto exported = static_cast<ExportedFrame*>( self->manager_ctx );
+    exported->device_->releaseExport( exported );
+  }
+
+  //! Describes the frame in exported as a tensor of its natural element type.
+  static void describeTensor( ExportedFrame& exported )
+  {
+    auto& frame = exported.frame_;
+    auto& tensor = exported.tensor_.dl_tensor;
+    int64_t width = frame.GetWidth();
+    int64_t height = frame.GetHeight();
+    tensor.data = frame.data();
+    tensor.device = { kDLCPU, 0 };
+    tensor.shape = exported.shape_;
+    tensor.strides = exported.strides_;
+    tensor.byte_offset = 0;
+    switch ( frame.format() )
+    {
+      case Pixel_RGB10A2:
+        tensor.ndim = 2;
+        tensor.dtype = { kDLUInt, 32, 1 };
+        exported.shape_[0] = height;
+        exported.shape_[1] = width;
+        exported.strides_[0] = frame.GetRowBytes() / 4;
+        exported.strides_[1] = 1;
+        break;
+      case Pixel_P010:
+        // Luma rows followed by the interleaved chroma rows, all of the same stride
+        tensor.ndim = 2;
+        tensor.dtype = { kDLUInt, 16, 1 };
+        exported.shape_[0] = height + ( height + 1 ) / 2;
+        exported.shape_[1] = width;
+        exported.strides_[0] = frame.GetRowBytes() / 2;
+        exported.strides_[1] = 1;
+        break;
+      default:
+        tensor.ndim = 3;
+        tensor.dtype = { kDLUInt, static_cast<uint8_t>( frame.format() == Pixel_RGBA64 ? 16 : 8 ), 1 };
+        exported.shape_[0] = height;
+        exported.shape_[1] = width;
+        exported.shape_[2] = 4;
+        exported.strides_[0] = width * 4;
+        exported.strides_[1] = 4;
+        exported.strides_[2] = 1;
+        break;
+    }
+    exported.tensor_.manager_ctx = &exported;
+    exported.tensor_.deleter = deleteExportedTensor;
+  }
+
+  ExportedFrame* DecklinkDevice::exportFrame( uint32_t timeout )
+  {
+    auto deadline = ( timeout == INFINITE ? 0 : GetTickCount64() + timeout );
+
+    // Take a pooled frame first, so that we don't consume a frame we can't hand out
+    unique_ptr<ExportedFrame> exported;
+    {
+      ScopedRWLock lock( &poolLock_ );
+      if ( pool_.empty() && poolAllocated_ < poolSize_ )
+      {
+        try
+        {
+          pool_.push_back( createExport() );
+        }
+        catch ( std::bad_alloc& )
+        {
+          memoryDrops_++;
+          return nullptr;
+        }
+      }
+      if ( pool_.empty() && poolSize_ )
+      {
+        // Consumers holding on to every frame get slowed down to the pace they release them at
+        poolExhausted_++;
+        auto start = timeMicroseconds();
+        while ( pool_.empty() && live() )
+        {
+          uint32_t wait = 1000;
+          if ( deadline )
+          {
+            auto now = GetTickCount64();
+            if ( now >= deadline )
+              break;
+            wait = static_cast<uint32_t>( std::min<ULONGLONG>( deadline - now, 1000 ) );
+          }
+          poolWake_.wait( poolLock_, wait );
+        }
+        poolWaitTime_ += timeMicroseconds() - start;
+        if ( pool_.empty() )
+          poolTimeouts_++;
+      }
+      if ( pool_.empty() )
+        return nullptr;
+      exported = move( pool_.back() );
+      pool_.pop_back();
+      poolOutstanding_++;
+      poolPeak_ = std::max( poolPeak_, poolOutstanding_ );
+    }
+
+    if ( deadline )
+      timeout = static_cast<uint32_t>( deadline - std::min( deadline, GetTickCount64() ) );
+
+    OutputVideoFrame* frame = nullptr;
+    if ( !getFrameBlocking( &frame, timeout ) )
+    {
+      ScopedRWLock lock( &poolLock_ );
+      pool_.push_back( move( exported ) );
+      poolOutstanding_--;
+      poolWake_.wakeAll();
+      return nullptr;
+    }
+
+    // The pooled frame's buffer takes the place of the one we hand out,
+    // except for shared frames that other consumers might still be reading.
+    // The capture callback can copy the frame out for holding on to while the signal is gone.
+    {
+      ScopedRWLock lock( &lock_, shared_.empty() );
+      if ( shared_.empty() )
+        exported->frame_.swap( *frame );
+      else
+        exported->frame_.copyFrom( *frame );
+    }
+    exported->device_ = this;
+    describeTensor( *exported );
+    AddRef();
+
+    return exported.release();
+  }
+
+  unique_ptr<ExportedFrame> DecklinkDevice::createExport()
+  {
+    auto exported = std::make_unique<ExportedFrame>();
+    exported->generation_ = poolGeneration_;
+    exported->frame_.setFormat( outputFormat_ );
+    exported->frame_.setNode( numaNode_ );
+    exported->frame_.reserve( poolWidth_, poolHeight_ );
+    exported->frame_.tiles_.reserve( poolTileBytes_ );
+    poolAllocated_++;
+    return exported;
+  }
+
+  void DecklinkDevice::releaseExport( ExportedFrame* exported )
+  {
+    trace::instant( "release", exported->frame_.index_ );
+    {
+      ScopedRWLock lock( &poolLock_ );
+      poolOutstanding_--;
+      if ( exported->generation_ == poolGeneration_ )
+        pool_.emplace_back( exported );
+      else
+        delete exported;
+      poolWake_.wakeAll();
+    }
+
+    // Might be the last reference to us
+    Release();
+  }
+
+  size_t DecklinkDevice::getFramesBatch( size_t max, uint32_t timeout, size_t tensorPixelBytes, uint64_t tensorLength,
+    OutputVideoFrame** out_frames )
+  {
+    auto fits = [&]( size_t count, OutputVideoFrame* frame ) {
+      return ( !tensorPixelBytes
+        || count * frame->GetWidth() * frame->GetHeight() * tensorPixelBytes <= tensorLength );
+    };
+
+    // The frame has to be checked before it is taken, or it would be gone without being returned
+    if ( queue_.empty() )
+    {
+      auto maxPixels = ( tensorPixelBytes ? std::max<uint64_t>( tensorLength / tensorPixelBytes, 1 ) : 0 );
+      return ( max && getFrameBlocking( out_frames, timeout, maxPixels ) ? 1 : 0 );
+    }
+
+    max = std::min( max, queue_.size() );
+    if ( !live() || !max )
+      return 0;
+
+    auto queued = [this]() {
+      ScopedRWLock lock( &lock_, false );
+      return queueCount_;
+    };
+
+    auto deadline = ( timeout == INFINITE ? 0 : GetTickCount64() + timeout );
+    batchWanted_ = max;
+    while ( queued() < max )
+    {
+      newFrameEvent_.reset();
+      if ( queued() >= max )
+        break;
+      uint32_t wait = 1000;
+      if ( deadline )
+      {
+        auto now = GetTickCount64();
+        if ( now >= deadline )
+          break;
+        wait = static_cast<uint32_t>( std::min<ULONGLONG>( deadline - now, 1000 ) );
+      }
+      newFrameEvent_.wait( wait );
+      if ( !live() )
+        break;
+    }
+    batchWanted_ = 1;
+
+    ScopedRWLock lock( &lock_ );
+
+    // Previously handed out frames go back to the queue in exchange
+    size_t count = 0;
+    while ( count < max && queueCount_ && live() )
+    {
+      auto& next = queue_[queueHead_];
+      if ( count && ( next->GetWidth() != batch_[0]->GetWidth() || next->GetHeight() != batch_[0]->GetHeight() ) )
+        break;
+      if ( !fits( count + 1, next.get() ) )
+        break;
+      batch_[count].swap( next );
+      out_frames[count] = batch_[count].get();
+      trace::instant( "acquire", out_frames[count]->index_ );
+      queueHead_ = ( queueHead_ + 1 ) % queue_.size();
+      queueCount_--;
+      count++;
+    }
+    if ( count )
+      lastReturnedFrameIndex_ = batch_[count - 1]->index_;
+
+    return count;
+  }
+
+  int64_t DecklinkDevice::queryIdentity( IDeckLink* decklink )
+  {
+    IDeckLinkProfileAttributes* attributes = nullptr;
+    if ( decklink->QueryInterface( IID_IDeckLinkProfileAttributes,
+      reinterpret_cast<void**>( &attributes ) ) != S_OK )
+      return 0;
+
+    int64_t id = 0;
+    if ( attributes->GetInt( BMDDeckLinkPersistentID, &id ) != S_OK
+      && attributes->GetInt( BMDDeckLinkTopologicalID, &id ) != S_OK )
+      id = 0;
+
+    // Without either, the device handle still tells one device from another across discovery passes
+    BSTR handle;
+    if ( !id && attributes->GetString( BMDDeckLinkDeviceHandle, &handle ) == S_OK )
+    {
+      uint64_t hash = 14695981039346656037ull;
+      for ( auto c : bstrToString( handle ) )
+        hash = ( hash ^ static_cast<uint8_t>( c ) ) * 1099511628211ull;
+      id = static_cast<int64_t>( hash & 0x7FFFFFFFFFFFFFFFull );
+      SysFreeString( handle );
+    }
+
+    attributes->Release();
+    return id;
+  }
+
   bool DecklinkDevice::init()
   {
     ScopedRWLock lock( &lock_ );
@@ -109,13 +1490,27 @@ namespace minibm {
       fmtDetect = FALSE;
     hasFormatDetection_ = ( fmtDetect );
 
-    if ( attributes_->GetInt( BMDDeckLinkPersistentID, &id_ ) != S_OK )
-      id_ = 0;
+    id_ = queryIdentity( decklink_ );
+
+    // The SDK doesn't tell which node the card is on, but its handle names the PCI device
+    if ( attributes_->GetString( BMDDeckLinkDeviceHandle, &tmpStr ) == S_OK )
+    {
+      deviceNode_ = numa::deviceNode( bstrToString( tmpStr ) );
+      SysFreeString( tmpStr );
+    }
 
     if ( decklink_->QueryInterface( IID_IDeckLinkInput,
       reinterpret_cast<void**>( &input_ ) ) != S_OK )
       return false;
 
+    // Input frames come out of the memory budget too, if the driver lets us allocate them
+    allocator_ = new InputAllocator();
+    if ( input_->SetVideoInputFrameMemoryAllocator( allocator_ ) != S_OK )
+    {
+      allocator_->Release();
+      allocator_ = nullptr;
+    }
+
     displayModes_.clear();
 
     IDeckLinkDisplayModeIterator* dmIterator;
@@ -139,10 +1534,64 @@ namespace minibm {
     return true;
   }
 
-  bool DecklinkDevice::startCapture( BMDDisplayMode displayMode )
+  bool DecklinkDevice::startCapture( BMDDisplayMode displayMode, const Options& options, bool standby )
   {
+    auto startTime = timeMicroseconds();
+
     ScopedRWLock lock( &lock_ );
 
+    // Capturing with some of the buffers missing isn't an option, so it's all or nothing
+    setLastError( string() );
+    auto refusals = budget::refusals();
+    bool started = false;
+    try
+    {
+      started = beginCapture( displayMode, options, standby, startTime );
+    }
+    catch ( std::bad_alloc& )
+    {
+      if ( input_ )
+        input_->SetCallback( nullptr );
+      freeBuffers();
+      if ( budget::refusals() == refusals )
+        setLastError( "Out of memory starting the capture" );
+      return false;
+    }
+
+    // The driver allocates its input frames on threads of its own
+    if ( !started && budget::refusals() != refusals )
+      setLastError( budget::lastRefusal() );
+
+    return started;
+  }
+
+  void DecklinkDevice::freeBuffers()
+  {
+    releaseDeferred();
+    releaseHeld();
+    for ( auto frame : { &frame_, &storedFrame_, &heldFrame_ } )
+      frame->freeBuffer();
+    intermediate_.clear();
+    previousFrame_.clear();
+    deferredSource_.clear();
+    queue_.clear();
+    batch_.clear();
+    queueHead_ = queueCount_ = 0;
+    consumers_.clear();
+    shared_.clear();
+    {
+      ScopedRWLock poolLock( &poolLock_ );
+      pool_.clear();
+      poolWake_.wakeAll();
+    }
+    history_.configure( 0, 0, -1 );
+    snapshots_.configure( Options(), nullptr );
+    frameIndex_.store( 0 );
+    lastReturnedFrameIndex_ = 0;
+  }
+
+  bool DecklinkDevice::beginCapture( BMDDisplayMode displayMode, const Options& options, bool standby, int64_t startTime )
+  {
     bool modeValid = false;
     for ( auto& mode : displayModes_ )
     {
@@ -156,7 +1605,198 @@ namespace minibm {
     if ( !modeValid || capturing_ )
       return false;
 
+    requestedMode_ = displayMode;
+    clockSyncTime_ = 0;
+    hardwareClock_ = false;
     frameIndex_.store( 0 );
+    lastReturnedFrameIndex_ = 0;
+    pendingFlags_ = 0;
+    formatChangeTime_ = 0;
+
+    auto dedupe = options.getString( "dedupe", "off" );
+    dedupeMode_ = ( dedupe == "flag" ? Dedupe_Flag : dedupe == "drop" ? Dedupe_Drop : Dedupe_Off );
+    dedupeRowStep_ = static_cast<long>( std::max<int64_t>( options.getInt( "dedupe.rowstep", 1 ), 1 ) );
+    lastFingerprint_ = lastSampledFingerprint_ = 0;
+    duplicateFrames_ = 0;
+    suppressedFrames_ = 0;
+    frame_.fingerprint_ = 0;
+    storedFrame_.fingerprint_ = 0;
+
+    degrade_.configure( options );
+    releaseDeferred();
+    frameHalved_ = false;
+
+    auto noSignal = options.getString( "nosignal", "hold" );
+    noSignal_ = ( noSignal == "slate" ? NoSignal_Slate : noSignal == "status" ? NoSignal_Status : NoSignal_Hold );
+    slateColor_ = static_cast<uint32_t>( options.getInt( "nosignal.color", 0 ) & 0xFFFFFF );
+    releaseHeld();
+    signal_ = true;
+    signalLosses_ = noSignalFrames_ = 0;
+    signalLostTime_ = lastOutage_ = maxOutage_ = 0;
+    frame_.sourceIndex_ = storedFrame_.sourceIndex_ = 0;
+
+    auto output = options.getString( "output", "bgra" );
+    outputFormat_ = ( output == "rgb10" ? Pixel_RGB10A2 : output == "rgba64" ? Pixel_RGBA64
+      : output == "p010" ? Pixel_P010 : Pixel_BGRA );
+    frame_.setFormat( outputFormat_ );
+    storedFrame_.setFormat( outputFormat_ );
+
+    numaNode_ = ( options.getString( "numa" ) == "off" ? -1
+      : static_cast<int>( std::max<int64_t>( options.getInt( "numa", deviceNode_ ), -1 ) ) );
+    // The callback thread is the driver's, so it's only kept on the node when asked for
+    pinToNode_ = options.has( "numa" );
+    localConversions_ = remoteConversions_ = 0;
+    remoteBytes_ = 0;
+    frame_.setNode( numaNode_ );
+    storedFrame_.setNode( numaNode_ );
+    heldFrame_.setNode( numaNode_ );
+    intermediate_.setNode( numaNode_ );
+    previousFrame_.setNode( numaNode_ );
+    deferredSource_.setNode( numaNode_ );
+    intermediate_.setCategory( Memory_Input );
+    previousFrame_.setCategory( Memory_Input );
+    deferredSource_.setCategory( Memory_Input );
+
+    cadence_.configure( options );
+
+    tileSize_ = static_cast<long>( std::max<int64_t>( options.getInt( "tiles", 0 ), 0 ) );
+    previousWidth_ = previousHeight_ = previousRowBytes_ = 0;
+    previousFormat_ = static_cast<BMDPixelFormat>( 0 );
+    changedTiles_ = totalTiles_ = 0;
+    frame_.tileSize_ = storedFrame_.tileSize_ = 0;
+
+    analysisFlags_ = 0;
+    for ( auto& item : options.getList( "analysis" ) )
+    {
+      if ( item == "histogram" )
+        analysisFlags_ |= Analysis_Histogram;
+      else if ( item == "black" )
+        analysisFlags_ |= Analysis_Black;
+      else if ( item == "clipping" )
+        analysisFlags_ |= Analysis_Clipping;
+      else if ( item == "freeze" )
+        analysisFlags_ |= Analysis_Freeze;
+      else if ( item == "all" || item == "1" )
+        analysisFlags_ |= ( Analysis_Histogram | Analysis_Black | Analysis_Clipping | Analysis_Freeze );
+    }
+    lumaThresholds_.black_ = static_cast<uint8_t>( std::clamp<int64_t>( options.getInt( "analysis.blacklevel", 32 ), 0, 255 ) );
+    blackRatio_ = options.getFloat( "analysis.blackratio", 0.98 );
+    clipRatio_ = options.getFloat( "analysis.clipratio", 0.01 );
+    freezeFrames_ = static_cast<uint32_t>( options.getUnsigned( "analysis.freezeframes", 5 ) );
+    frozenCount_ = 0;
+    blackFrames_ = clippedFrames_ = frozenFrames_ = 0;
+    frame_.analysis_.flags = storedFrame_.analysis_.flags = 0;
+
+    // Preallocate for the largest mode the device has, so that
+    // a format change later on won't need to reallocate mid-stream
+    long maxWidth = 0, maxHeight = 0;
+    for ( auto& mode : displayModes_ )
+      if ( mode.width_ * mode.height_ > maxWidth * maxHeight )
+      {
+        maxWidth = mode.width_;
+        maxHeight = mode.height_;
+      }
+    frame_.reserve( maxWidth, maxHeight );
+    storedFrame_.reserve( maxWidth, maxHeight );
+    if ( tileSize_ )
+    {
+      previousFrame_.reserve( static_cast<size_t>( maxWidth ) * maxHeight * 4 );
+      tileMarks_.reserve( static_cast<size_t>( ( maxWidth + tileSize_ - 1 ) / tileSize_ ) * ( ( maxHeight + tileSize_ - 1 ) / tileSize_ ) );
+      frame_.tiles_.reserve( tileMarks_.capacity() / 8 + 1 );
+      storedFrame_.tiles_.reserve( tileMarks_.capacity() / 8 + 1 );
+    }
+
+    // The fan-out ring takes the place of the queue
+    auto sharedSize = static_cast<size_t>( options.getUnsigned( "fanout", 0 ) );
+    auto queueSize = ( sharedSize ? 0 : static_cast<size_t>( options.getUnsigned( "queue", 0 ) ) );
+    for ( auto frames : { &queue_, &batch_ } )
+    {
+      frames->resize( queueSize );
+      for ( auto& frame : *frames )
+      {
+        if ( !frame )
+          frame = std::make_unique<OutputVideoFrame>();
+        frame->setFormat( outputFormat_ );
+        frame->setNode( numaNode_ );
+        frame->reserve( maxWidth, maxHeight );
+        frame->fingerprint_ = 0;
+        frame->sourceIndex_ = 0;
+        frame->tileSize_ = 0;
+        frame->analysis_.flags = 0;
+      }
+    }
+    queueHead_ = queueCount_ = 0;
+    queueDrops_ = 0;
+
+    // Consumers of a previous capture are closed, along with their holds
+    consumers_.clear();
+    shared_.resize( sharedSize );
+    for ( auto& slot : shared_ )
+    {
+      if ( !slot )
+        slot = std::make_unique<SharedFrame>();
+      slot->refs_ = 0;
+      auto& frame = slot->frame_;
+      frame.setFormat( outputFormat_ );
+      frame.setNode( numaNode_ );
+      frame.reserve( maxWidth, maxHeight );
+      frame.index_ = 0;
+      frame.fingerprint_ = 0;
+      frame.sourceIndex_ = 0;
+      frame.tileSize_ = 0;
+      frame.analysis_.flags = 0;
+    }
+    sharedOverruns_ = 0;
+    if ( sharedSize )
+      consumers_.push_back( std::make_unique<Consumer>() );
+
+    {
+      // Most captures never export a frame, so unless asked for up front,
+      // the pool is only filled as exportFrame needs it
+      ScopedRWLock poolLock( &poolLock_ );
+      poolGeneration_++;
+      auto preallocate = static_cast<uint32_t>( options.getUnsigned( "pool", 0 ) );
+      poolSize_ = ( preallocate ? preallocate : c_defaultPoolSize );
+      poolAllocated_ = 0;
+      poolWidth_ = maxWidth;
+      poolHeight_ = maxHeight;
+      poolTileBytes_ = ( tileSize_ ? tileMarks_.capacity() / 8 + 1 : 0 );
+      poolPeak_ = poolOutstanding_;
+      poolExhausted_ = poolTimeouts_ = 0;
+      poolWaitTime_ = 0;
+      pool_.clear();
+      for ( uint32_t i = 0; i < preallocate; ++i )
+        pool_.push_back( createExport() );
+      poolWake_.wakeAll();
+    }
+
+    captureOptions_ = options;
+    callbackPolicy_ = owner_->getThreadPolicy( ThreadRole_Callback, captureOptions_ );
+    callbackPolicy_.numaNode_ = ( pinToNode_ ? numaNode_ : -1 );
+
+    // Room for the largest mode in the widest format we might capture in
+    history_.configure( static_cast<size_t>( options.getUnsigned( "history", 0 ) ),
+      static_cast<size_t>( maxWidth ) * maxHeight * 4, numaNode_ );
+
+    snapshots_.configure( options, options.has( "snapshot" ) ? owner_->getWorkerPool() : nullptr );
+
+    // Page faults on the first frames would eat into going live
+    standby_ = standby;
+    standbyFrames_ = 0;
+    if ( standby )
+    {
+      for ( auto frame : { &frame_, &storedFrame_ } )
+        frame->prefault();
+      for ( auto& frame : queue_ )
+        frame->prefault();
+      for ( auto& slot : shared_ )
+        slot->frame_.prefault();
+      ScopedRWLock poolLock( &poolLock_ );
+      for ( auto& exported : pool_ )
+        exported->frame_.prefault();
+    }
+    warmStart_ = false;
+    startTime_ = ( standby ? 0 : startTime );
 
     input_->SetCallback( this );
 
@@ -168,7 +1808,8 @@ namespace minibm {
     } else
       applyDetectedMode_ = false;
 
-    pixelFormat_ = bmdFormat8BitARGB;
+    rgbSignal_ = false;
+    pixelFormat_ = negotiateFormat( displayMode, rgbSignal_ );
 
     if ( input_->EnableVideoInput( displayMode, pixelFormat_, inputFlags ) != S_OK )
     {
@@ -187,17 +1828,203 @@ namespace minibm {
     return true;
   }
 
+  void DecklinkDevice::goLive()
+  {
+    ScopedRWLock lock( &lock_ );
+
+    if ( !capturing_ || !standby_ )
+      return;
+
+    // Nothing that was compared or selected against before standby still applies
+    pendingFlags_ = 0;
+    formatChangeTime_ = 0;
+    lastFingerprint_ = 0;
+    frozenCount_ = 0;
+    frame_.fingerprint_ = 0;
+    previousWidth_ = previousHeight_ = previousRowBytes_ = 0;
+    cadence_.restart();
+    releaseHeld();
+
+    standby_ = false;
+    warmStart_ = true;
+    startTime_ = timeMicroseconds();
+  }
+
+  void DecklinkDevice::enterStandby()
+  {
+    ScopedRWLock lock( &lock_ );
+
+    if ( !live() )
+      return;
+
+    standby_ = true;
+    startTime_ = 0;
+    newFrameEvent_.set();
+    consumerWake_.wakeAll();
+    poolWake_.wakeAll();
+    owner_->notifyFrame( 0 );
+  }
+
   void DecklinkDevice::stopCapture()
   {
     ScopedRWLock lock( &lock_ );
 
+    // A device in standby had nobody to tell
+    bool wasLive = live();
+
+    // Keeps a pending format change restart from starting the streams again
+    {
+      ScopedRWLock restartLock( &restartLock_ );
+      capturing_ = false;
+    }
+
     if ( input_ )
     {
       input_->StopStreams();
       input_->SetCallback( nullptr );
     }
 
-    capturing_ = false;
+    // The callback thread belongs to the driver, so don't leave our scheduling on it
+    restoreThreadPolicy( callbackState_ );
+
+    standby_ = false;
+    newFrameEvent_.set();
+    consumerWake_.wakeAll();
+    poolWake_.wakeAll();
+    snapshots_.stop();
+    releaseDeferred();
+    releaseHeld();
+    if ( wasLive )
+      owner_->notifyFrame( 0 );
+  }
+
+  void DecklinkDevice::refreshThreadPolicies()
+  {
+    ScopedRWLock lock( &lock_ );
+
+    if ( capturing_ )
+    {
+      callbackPolicy_ = owner_->getThreadPolicy( ThreadRole_Callback, captureOptions_ );
+      callbackPolicy_.numaNode_ = ( pinToNode_ ? numaNode_ : -1 );
+    }
+  }
+
+  void DecklinkDevice::writeStats( JsonWriter& json )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    json.beginObject();
+    json.member( "id", id_ );
+    json.member( "name", name_ );
+    json.member( "capturing", capturing_.load() );
+    json.key( "startup" ).beginObject();
+    json.member( "standby", standby_ );
+    json.member( "standbyFrames", standbyFrames_ );
+    json.member( "warm", warmStart_ );
+    json.member( "lastTimeToFirstFrameUs", lastStartLatency_ );
+    json.member( "maxTimeToFirstFrameUs", maxStartLatency_ );
+    json.endObject();
+    json.key( "degrade" );
+    degrade_.writeStats( json );
+    json.key( "signal" ).beginObject();
+    json.member( "present", signal_ );
+    json.member( "policy", noSignal_ == NoSignal_Slate ? "slate" : noSignal_ == NoSignal_Status ? "status" : "hold" );
+    json.member( "losses", signalLosses_ );
+    json.member( "noSignalFrames", noSignalFrames_ );
+    json.member( "outageUs", signal_ ? 0 : timeMicroseconds() - signalLostTime_ );
+    json.member( "lastOutageUs", lastOutage_ );
+    json.member( "maxOutageUs", maxOutage_ );
+    json.endObject();
+    json.member( "framesReceived", frameIndex_.load() );
+    json.member( "formatChanges", formatChanges_ );
+    json.member( "lastFormatChangeLatencyUs", lastFormatChangeLatency_ );
+    json.member( "maxFormatChangeLatencyUs", maxFormatChangeLatency_ );
+    json.member( "duplicateFrames", duplicateFrames_ );
+    json.member( "suppressedFrames", suppressedFrames_ );
+    json.member( "memoryDrops", memoryDrops_.load() );
+    if ( allocator_ )
+    {
+      json.key( "inputBuffers" );
+      allocator_->writeStats( json );
+    }
+    json.key( "cadence" );
+    cadence_.writeStats( json );
+    json.member( "output", outputFormat_ == Pixel_RGB10A2 ? "rgb10" : outputFormat_ == Pixel_RGBA64 ? "rgba64"
+      : outputFormat_ == Pixel_P010 ? "p010" : "bgra" );
+    json.key( "inputFormat" ).beginObject();
+    json.member( "format", pixelFormatName( pixelFormat_ ) );
+    json.member( "signal", rgbSignal_ ? "rgb" : "yuv" );
+    json.member( "cost", formatCost_ );
+    json.member( "direct", formatDirect_ );
+    json.member( "reason", formatReason_ );
+    json.endObject();
+    json.member( "queueSize", queue_.size() );
+    json.member( "queuedFrames", queueCount_ );
+    json.member( "queueDrops", queueDrops_ );
+    json.member( "fanoutSize", shared_.size() );
+    json.member( "fanoutOverruns", sharedOverruns_ );
+    json.key( "consumers" ).beginArray();
+    for ( auto& consumer : consumers_ )
+    {
+      json.beginObject();
+      json.member( "id", consumer->id_ );
+      json.member( "delivered", consumer->delivered_ );
+      json.member( "dropped", consumer->dropped_ );
+      json.member( "skipped", consumer->skipped_ );
+      json.member( "lag", consumer->lag_ );
+      json.member( "maxLag", consumer->maxLag_ );
+      json.endObject();
+    }
+    json.endArray();
+    {
+      ScopedRWLock poolLock( &poolLock_, false );
+      json.key( "pool" ).beginObject();
+      json.member( "size", poolSize_ );
+      json.member( "allocated", poolAllocated_ );
+      json.member( "outstanding", poolOutstanding_ );
+      json.member( "peak", poolPeak_ );
+      json.member( "exhausted", poolExhausted_ );
+      json.member( "timeouts", poolTimeouts_ );
+      json.member( "waitTimeUs", poolWaitTime_ );
+      json.endObject();
+    }
+    json.member( "tileSize", tileSize_ );
+    json.member( "changedTiles", changedTiles_ );
+    json.member( "comparedTiles", totalTiles_ );
+    json.member( "blackFrames", blackFrames_ );
+    json.member( "clippedFrames", clippedFrames_ );
+    json.member( "frozenFrames", frozenFrames_ );
+    json.key( "snapshots" );
+    snapshots_.writeStats( json );
+    json.key( "history" );
+    history_.writeStats( json );
+    uint64_t localPages = 0, remotePages = 0;
+    if ( numaNode_ >= 0 )
+    {
+      for ( auto frame : { &frame_, &storedFrame_ } )
+        numa::pagePlacement( frame->data(), frame->buffer().capacity(), numaNode_, localPages, remotePages );
+      for ( auto& frame : queue_ )
+        numa::pagePlacement( frame->data(), frame->buffer().capacity(), numaNode_, localPages, remotePages );
+    }
+    json.key( "numa" ).beginObject();
+    json.member( "deviceNode", deviceNode_ );
+    json.member( "node", numaNode_ );
+    json.member( "bufferNode", frame_.buffer().node() );
+    json.member( "localPages", localPages );
+    json.member( "remotePages", remotePages );
+    json.member( "localConversions", localConversions_ );
+    json.member( "remoteConversions", remoteConversions_ );
+    json.member( "remoteBytes", remoteBytes_ );
+    json.endObject();
+    json.key( "threads" ).beginObject();
+    json.key( threadRoleName( ThreadRole_Callback ) ).beginObject();
+    json.key( "requested" );
+    callbackPolicy_.writeStats( json );
+    json.key( "effective" );
+    callbackState_.writeStats( json );
+    json.endObject();
+    json.endObject();
+    json.endObject();
   }
 
   DecklinkDevice::~DecklinkDevice()
@@ -206,6 +2033,8 @@ namespace minibm {
 
     if ( input_ )
       input_->Release();
+    if ( allocator_ )
+      allocator_->Release();
     if ( config_ )
       config_->Release();
     if ( attributes_ )
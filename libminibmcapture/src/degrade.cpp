@@ -0,0 +1,163 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "degrade.h"
+#include "json.h"
+#include "libminibmcapture.h"
+
+namespace minibm {
+
+  static const size_t c_maxDecisions = 16;
+
+  static const char* stepName( DegradeStep step )
+  {
+    switch ( step )
+    {
+      case Degrade_Skip: return "skip";
+      case Degrade_Downscale: return "downscale";
+      default: return "decimate";
+    }
+  }
+
+  void DegradePolicy::configure( const Options& options )
+  {
+    steps_.clear();
+    for ( auto& item : options.getList( "degrade" ) )
+    {
+      DegradeStep step;
+      if ( item == "skip" )
+        step = Degrade_Skip;
+      else if ( item == "downscale" )
+        step = Degrade_Downscale;
+      else if ( item == "decimate" )
+        step = Degrade_Decimate;
+      else
+        continue;
+      if ( std::find( steps_.begin(), steps_.end(), step ) == steps_.end() )
+        steps_.push_back( step );
+    }
+
+    high_ = options.getFloat( "degrade.high", 0.85 );
+    low_ = std::min( options.getFloat( "degrade.low", 0.5 ), high_ );
+    window_ = static_cast<uint32_t>( std::max<uint64_t>( options.getUnsigned( "degrade.window", 30 ), 1 ) );
+    hold_ = static_cast<uint32_t>( std::max<uint64_t>( options.getUnsigned( "degrade.hold", 4 ), 1 ) );
+
+    level_ = 0;
+    frames_ = driverDrops_ = unread_ = calmWindows_ = 0;
+    busy_ = period_ = 0;
+    lastTime_ = -1;
+    lastScale_ = 0;
+    phase_ = 0;
+    decimated_ = false;
+    lastLoad_ = 0.0;
+    escalations_ = recoveries_ = totalDriverDrops_ = 0;
+    deferredFrames_ = downscaledFrames_ = decimatedFrames_ = 0;
+    decisions_.clear();
+  }
+
+  void DegradePolicy::change( size_t level, const char* reason )
+  {
+    ( level > level_ ? escalations_ : recoveries_ )++;
+    decisions_.push_back( { timeMicroseconds(), level_, level, reason, lastLoad_ } );
+    if ( decisions_.size() > c_maxDecisions )
+      decisions_.pop_front();
+    level_ = level;
+    calmWindows_ = 0;
+    phase_ = 0;
+  }
+
+  bool DegradePolicy::admit( int64_t time, int64_t duration, int64_t scale, uint32_t& out_flags )
+  {
+    out_flags = 0;
+    if ( !enabled() || scale <= 0 )
+      return true;
+
+    // Stream time skipping ahead by more than half a frame means the driver had to drop frames
+    if ( lastTime_ >= 0 && scale == lastScale_ && duration > 0 && time - lastTime_ > duration * 3 / 2 )
+    {
+      auto dropped = static_cast<uint32_t>( ( time - lastTime_ + duration / 2 ) / duration - 1 );
+      driverDrops_ += dropped;
+      totalDriverDrops_ += dropped;
+    }
+    lastTime_ = time;
+    lastScale_ = scale;
+    period_ = duration * 1000000 / scale;
+
+    if ( active( Degrade_Decimate ) && ( phase_++ & 1 ) )
+    {
+      decimatedFrames_++;
+      decimated_ = true;
+      return false;
+    }
+    if ( decimated_ )
+      out_flags |= Frame_Decimated;
+    decimated_ = false;
+    return true;
+  }
+
+  void DegradePolicy::account( int64_t busy, bool overwroteUnread )
+  {
+    frames_++;
+    busy_ += busy;
+    if ( overwroteUnread )
+      unread_++;
+    if ( frames_ < window_ )
+      return;
+
+    lastLoad_ = ( period_ > 0 ? static_cast<double>( busy_ ) / ( static_cast<double>( period_ ) * frames_ ) : 0.0 );
+    // Consumers leaving most frames unread are only relieved by skipping their conversion
+    bool unreadMostly = ( unread_ * 2 > frames_ );
+    bool next = ( level_ < steps_.size() );
+    if ( next && lastLoad_ > high_ )
+      change( level_ + 1, "load" );
+    else if ( next && driverDrops_ )
+      change( level_ + 1, "driver drops" );
+    else if ( next && unreadMostly && steps_[level_] == Degrade_Skip )
+      change( level_ + 1, "unread" );
+    else if ( lastLoad_ < low_ && !driverDrops_ && !( unreadMostly && active( Degrade_Skip ) ) )
+    {
+      // Stepping back up only after a while of calm keeps us from flapping between levels
+      if ( ++calmWindows_ >= hold_ && level_ > 0 )
+        change( level_ - 1, "recovered" );
+    }
+    else
+      calmWindows_ = 0;
+
+    frames_ = driverDrops_ = unread_ = 0;
+    busy_ = 0;
+  }
+
+  void DegradePolicy::writeStats( JsonWriter& json ) const
+  {
+    json.beginObject();
+    json.key( "steps" ).beginArray();
+    for ( auto step : steps_ )
+      json.value( stepName( step ) );
+    json.endArray();
+    json.member( "level", level_ );
+    json.member( "load", lastLoad_ );
+    json.member( "escalations", escalations_ );
+    json.member( "recoveries", recoveries_ );
+    json.member( "driverDrops", totalDriverDrops_ );
+    json.member( "deferredFrames", deferredFrames_ );
+    json.member( "downscaledFrames", downscaledFrames_ );
+    json.member( "decimatedFrames", decimatedFrames_ );
+    json.key( "decisions" ).beginArray();
+    for ( auto& decision : decisions_ )
+    {
+      json.beginObject();
+      json.member( "timeUs", decision.time_ );
+      json.member( "from", decision.from_ );
+      json.member( "to", decision.to_ );
+      json.member( "reason", decision.reason_ );
+      json.member( "load", decision.load_ );
+      json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+  }
+
+}
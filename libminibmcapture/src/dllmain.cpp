@@ -5,14 +5,16 @@
 
 #include "pch.h"
 #include "minibmcap.h"
-
-#include <sstream>
-#include <iomanip>
+#include "trace.h"
 
 using namespace std;
 
 static minibm::DecklinkCapture* g_cap = nullptr;
+// Our copy of the device table, which index arguments refer to. Any thread can refresh it,
+// so it is only touched under g_devicesLock, and devices are referenced for use outside it.
+static minibm::RWLock g_devicesLock;
 static minibm::DecklinkDeviceVector g_devices;
+static uint32_t g_devicesGeneration = 0;
 
 inline minibm::DecklinkCapture& getCap()
 {
@@ -24,33 +26,74 @@ inline minibm::DecklinkCapture& getCap()
   return *g_cap;
 }
 
+inline void releaseDevices()
+{
+  for ( auto device : g_devices )
+    device->Release();
+  g_devices.clear();
+}
+
+// Caller holds g_devicesLock exclusively.
+inline void refreshDevices( minibm::DecklinkCapture& cap )
+{
+  releaseDevices();
+  g_devicesGeneration = cap.getDevices( g_devices );
+}
+
+// Returns the device at index with a reference for the caller to release, or null.
+inline minibm::DecklinkDevice* acquireDevice( uint32_t index )
+{
+  minibm::ScopedRWLock lock( &g_devicesLock, false );
+  if ( index >= g_devices.size() )
+    return nullptr;
+  g_devices[index]->AddRef();
+  return g_devices[index];
+}
+
 inline void resetCap()
 {
+  releaseDevices();
   if ( g_cap )
     delete g_cap;
   g_cap = nullptr;
 }
 
-string escape(string str) {
-    std::ostringstream o;
-    for (auto c = str.cbegin(); c != str.cend(); c++) {
-        if (*c == '"' || *c == '\\' || ('\x00' <= *c && *c <= '\x1f')) {
-            o << "\\u"
-                << std::hex << std::setw(4) << std::setfill('0') << (int)*c;
-        }
-        else {
-            o << *c;
-        }
-    }
-    return o.str();
+inline void fillFrameInfo( minibm::OutputVideoFrame* frame, minibm::FrameInfo* out_frame )
+{
+  out_frame->width = frame->GetWidth();
+  out_frame->height = frame->GetHeight();
+  out_frame->rowbytes = frame->GetRowBytes();
+  out_frame->pixelformat = frame->GetPixelFormat();
+  out_frame->index = frame->index_;
+  out_frame->flags = frame->frameFlags_;
+  out_frame->buffer = ( frame->GetWidth() ? frame->data() : nullptr );
+  out_frame->timestamp = frame->streamTime_;
+  out_frame->duration = frame->streamDuration_;
+  out_frame->timescale = frame->timeScale_;
+  out_frame->tilesize = frame->tileSize_;
+  out_frame->tilecolumns = frame->tileColumns_;
+  out_frame->tilerows = frame->tileRows_;
+  out_frame->tiles = ( frame->tileSize_ ? frame->tiles_.data() : nullptr );
+  out_frame->analysis = ( frame->analysis_.flags ? &frame->analysis_ : nullptr );
 }
 
-static string json_buffer;
+// Scratch list of the frames returned by the last get_frames_batch call on this thread.
+static thread_local vector<minibm::OutputVideoFrame*> t_batch;
+
+// The capabilities snapshot handed out by the last get_json_length call on this thread.
+// get_json serves from it, so that the length and contents always match.
+static thread_local minibm::CapabilitiesPtr t_jsonSnapshot;
+
+// The trace measured by the last get_trace call on this thread that didn't get to copy it.
+static thread_local string t_trace;
+
+// The snapshot measured by the last get_snapshot call on this thread that didn't get to copy it.
+static thread_local minibm::SnapshotPtr t_snapshot;
 
 extern "C" {
 
   // Could be used to figure out API/ABI compatibility stuff later, if the library evolves
-  const uint32_t c_myVersion = 4;
+  const uint32_t c_myVersion = 23;
 
   void MINIBM_EXPORT get_version( char* out_version, uint32_t versionlen, uint32_t* out_minibmver )
   {
@@ -61,17 +104,37 @@ extern "C" {
 
   uint32_t MINIBM_EXPORT get_devices()
   {
-    g_devices = getCap().getDevices();
+    // Only refresh our copy of the device table if it has actually changed
+    auto& cap = getCap();
+    minibm::ScopedRWLock lock( &g_devicesLock );
+    if ( g_devices.empty() || cap.getGeneration() != g_devicesGeneration )
+      refreshDevices( cap );
     return static_cast<uint32_t>( g_devices.size() );
   }
 
+  uint32_t MINIBM_EXPORT get_device_generation()
+  {
+    return getCap().getGeneration();
+  }
+
+  void MINIBM_EXPORT set_device_notify( minibm::fn_device_notify callback, void* userdata )
+  {
+    getCap().setNotifyCallback( callback, userdata );
+  }
+
+  void MINIBM_EXPORT set_frame_notify( minibm::fn_frame_notify callback, void* userdata )
+  {
+    getCap().setFrameCallback( callback, userdata );
+  }
+
   void MINIBM_EXPORT set_options( const char* library_options )
   {
-    // Todo
+    getCap().setOptions( library_options );
   }
 
   bool MINIBM_EXPORT get_device( uint32_t index, char* out_name, uint32_t namelen, int64_t* out_id, uint32_t* out_displaymodecount, uint32_t* out_flags )
   {
+    minibm::ScopedRWLock lock( &g_devicesLock, false );
     if ( g_devices.empty() || index >= g_devices.size() )
       return false;
 
@@ -90,6 +153,7 @@ extern "C" {
 
   bool MINIBM_EXPORT get_device_displaymode( uint32_t device, uint32_t displaymode, uint32_t* out_width, uint32_t* out_height, uint32_t* out_timescale, uint32_t* out_frameduration, uint32_t* out_modecode )
   {
+    minibm::ScopedRWLock lock( &g_devicesLock, false );
     if ( g_devices.empty() || device >= g_devices.size() )
       return false;
 
@@ -108,27 +172,131 @@ extern "C" {
 
   bool MINIBM_EXPORT start_capture_single( uint32_t index, uint32_t modecode, const char* capture_options )
   {
-    if ( g_devices.empty() || index >= g_devices.size() )
+    auto device = acquireDevice( index );
+    if ( !device )
+      return false;
+
+    minibm::Options options( capture_options );
+    auto ret = getCap().startCaptureSingle( device, static_cast<BMDDisplayMode>( modecode ), options );
+    device->Release();
+    return ret;
+  }
+
+  bool MINIBM_EXPORT prepare_capture( uint32_t index, uint32_t modecode, const char* capture_options )
+  {
+    auto device = acquireDevice( index );
+    if ( !device )
       return false;
 
-    return getCap().startCaptureSingle( g_devices[index], static_cast<BMDDisplayMode>( modecode ) );
+    minibm::Options options( capture_options );
+    auto ret = getCap().prepareCapture( device, static_cast<BMDDisplayMode>( modecode ), options );
+    device->Release();
+    return ret;
+  }
+
+  bool MINIBM_EXPORT release_standby( uint32_t index )
+  {
+    auto device = acquireDevice( index );
+    if ( !device )
+      return false;
+
+    auto ret = getCap().releaseStandby( device );
+    device->Release();
+    return ret;
   }
 
   bool MINIBM_EXPORT get_frame_bgra32_blocking( uint32_t* out_width, uint32_t* out_height, uint8_t** out_buffer, uint32_t* out_index )
   {
-    minibm::BGRA32VideoFrame* frame;
-    uint32_t index;
-    auto ret = getCap().getFrameBlocking( &frame, index );
-    if ( !ret )
+    minibm::OutputVideoFrame* frame;
+    // Checked before taking the frame too, so that a frame in another format isn't lost
+    auto ret = getCap().getFrameBlocking( &frame, INFINITE, true );
+    if ( !ret || frame->format() != minibm::Pixel_BGRA )
       return false;
 
     *out_width = frame->GetWidth();
     *out_height = frame->GetHeight();
-    *out_buffer = const_cast<uint8_t*>( frame->buffer().data() );
-    *out_index = index;
+    *out_buffer = frame->data();
+    *out_index = frame->index_;
+    return true;
+  }
+
+  bool MINIBM_EXPORT get_frame_blocking( minibm::FrameInfo* out_frame, uint32_t timeout_ms )
+  {
+    minibm::OutputVideoFrame* frame;
+    if ( !out_frame || !getCap().getFrameBlocking( &frame, timeout_ms ) )
+      return false;
+
+    fillFrameInfo( frame, out_frame );
     return true;
   }
 
+  uint32_t MINIBM_EXPORT get_frames_batch( uint32_t max_frames, uint32_t timeout_ms, minibm::FrameInfo* out_frames,
+    uint32_t tensor_layout, void* out_tensor, uint64_t tensor_length )
+  {
+    if ( !out_frames || !max_frames || tensor_layout > minibm::Tensor_BGRF32 )
+      return 0;
+
+    minibm::kernels::TensorFormat tensor;
+    tensor.channels_ = ( tensor_layout == minibm::Tensor_RGBA8 || tensor_layout == minibm::Tensor_BGRA8 ? 4 : 3 );
+    tensor.rgb_ = ( tensor_layout == minibm::Tensor_RGB8 || tensor_layout == minibm::Tensor_RGBA8 || tensor_layout == minibm::Tensor_RGBF32 );
+    tensor.float_ = ( tensor_layout == minibm::Tensor_RGBF32 || tensor_layout == minibm::Tensor_BGRF32 );
+    bool useTensor = ( out_tensor && tensor_layout != minibm::Tensor_None );
+
+    t_batch.resize( max_frames );
+    auto count = getCap().getFramesBatch( max_frames, timeout_ms, useTensor ? &tensor : nullptr,
+      static_cast<uint8_t*>( out_tensor ), tensor_length, t_batch.data() );
+    for ( size_t i = 0; i < count; ++i )
+      fillFrameInfo( t_batch[i], &out_frames[i] );
+    return static_cast<uint32_t>( count );
+  }
+
+  uint64_t MINIBM_EXPORT acquire_frame( minibm::FrameInfo* out_frame, uint32_t timeout_ms )
+  {
+    minibm::ExportedFrame* exported;
+    auto lease = getCap().acquireLease( timeout_ms, &exported );
+    if ( lease && out_frame )
+      fillFrameInfo( &exported->frame_, out_frame );
+    return lease;
+  }
+
+  bool MINIBM_EXPORT release_frame( uint64_t lease )
+  {
+    return getCap().releaseLease( lease );
+  }
+
+  uint32_t MINIBM_EXPORT open_consumer( const char* consumer_options )
+  {
+    minibm::Options options( consumer_options );
+    return getCap().openConsumer( options );
+  }
+
+  bool MINIBM_EXPORT get_consumer_frame( uint32_t consumer, minibm::FrameInfo* out_frame, uint32_t timeout_ms )
+  {
+    minibm::OutputVideoFrame* frame;
+    if ( !consumer || !out_frame || !getCap().getConsumerFrame( consumer, &frame, timeout_ms ) )
+      return false;
+
+    fillFrameInfo( frame, out_frame );
+    return true;
+  }
+
+  void MINIBM_EXPORT close_consumer( uint32_t consumer )
+  {
+    if ( consumer )
+      getCap().closeConsumer( consumer );
+  }
+
+  minibm::DLManagedTensor* MINIBM_EXPORT get_frame_dlpack( minibm::FrameInfo* out_frame, uint32_t timeout_ms )
+  {
+    auto exported = getCap().exportFrame( timeout_ms );
+    if ( !exported )
+      return nullptr;
+
+    if ( out_frame )
+      fillFrameInfo( &exported->frame_, out_frame );
+    return &exported->tensor_;
+  }
+
   bool MINIBM_EXPORT read_frame_bgra32_blocking(uint8_t *buffer, uint32_t len) {
       uint32_t width;
       uint32_t height;
@@ -151,64 +319,184 @@ extern "C" {
     getCap().stopCaptureSingle();
   }
 
-  int MINIBM_EXPORT get_json_length() {
-      char dev_name[2048];
-      ostringstream ss;
-      int n = get_devices();
-      ss << "[";
-      for (int dev = 0; dev < n; dev++) {
-          if (dev > 0)
-              ss << ",";
-          int64_t bm_id;
-          uint32_t mode_count;
-          uint32_t bm_flags;
-          if (!get_device(dev, dev_name, 2048, &bm_id, &mode_count, &bm_flags))
-              break;
-          ss << "{\"id\": " << dev << ",";
-          ss << "\"name\": \"" << escape(string(dev_name)) << "\",";
-          ss << "\"bmId\": " << bm_id << ",";
-          ss << "\"bmFlags\": \"" << bm_flags << "\",";
-          ss << "\"caps\": [";
-          for (uint32_t dcap = 0; dcap < mode_count; dcap++) {
-              uint32_t width;
-              uint32_t height;
-              uint32_t timescale;
-              uint32_t frameduration;
-              uint32_t modecode;
-              if (!get_device_displaymode(dev, dcap, &width, &height, &timescale, &frameduration, &modecode))
-                  break;
-
-              double fps = (double)timescale / (double)frameduration;
-              int interval = (int)(10000000 / fps);
-
-              if (dcap > 0)
-                  ss << ",";
-              ss << "{";
-              ss << "\"id\": " << dcap << ",";
-              ss << "\"minCX\": " << width << ",";
-              ss << "\"minCY\": " << height << ",";
-              ss << "\"maxCX\": " << width << ",";
-              ss << "\"maxCY\": " << height << ",";
-              ss << "\"granularityCX\": " << 1 << ",";
-              ss << "\"granularityCY\": " << 1 << ",";
-              ss << "\"minInterval\": " << interval << ",";
-              ss << "\"maxInterval\": " << interval << ",";
-              ss << "\"bmTimescale\": " << timescale << ",";
-              ss << "\"bmFrameduration\": " << frameduration << ",";
-              ss << "\"bmModecode\": " << modecode << ",";
-              ss << "\"rating\": 1,";
-              ss << "\"format\": 100";
-              ss << "}";
-          }
-          ss << "]}";
-      }
-      ss << "]";
-      json_buffer = ss.str();
-      return (int)json_buffer.length() + 1;
-  }
-
-  void MINIBM_EXPORT get_json(char *out_buffer, uint32_t buffer_length) {
-      strncpy(out_buffer, json_buffer.c_str(), buffer_length);
+  bool MINIBM_EXPORT start_capture_group( const uint32_t* indices, uint32_t count, uint32_t modecode, const char* capture_options )
+  {
+    if ( !indices || !count )
+      return false;
+
+    minibm::DecklinkDeviceVector devices;
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+      auto device = acquireDevice( indices[i] );
+      if ( !device )
+        break;
+      devices.push_back( device );
+    }
+
+    bool ret = false;
+    if ( devices.size() == count )
+    {
+      minibm::Options options( capture_options );
+      ret = getCap().startCaptureGroup( devices, static_cast<BMDDisplayMode>( modecode ), options );
+    }
+    for ( auto device : devices )
+      device->Release();
+    return ret;
+  }
+
+  uint32_t MINIBM_EXPORT get_frame_set( minibm::FrameInfo* out_frames, uint32_t count, uint32_t timeout_ms )
+  {
+    if ( !out_frames || !count )
+      return 0;
+
+    vector<minibm::OutputVideoFrame*> frames;
+    auto matched = getCap().getFrameSet( frames, timeout_ms );
+    for ( size_t i = 0; i < count; ++i )
+    {
+      out_frames[i] = {};
+      if ( matched && i < frames.size() && frames[i] )
+        fillFrameInfo( frames[i], &out_frames[i] );
+    }
+    return static_cast<uint32_t>( matched );
+  }
+
+  void MINIBM_EXPORT stop_capture_group()
+  {
+    getCap().stopCaptureGroup();
+  }
+
+  uint32_t MINIBM_EXPORT get_stats( char* out_buffer, uint32_t buffer_length )
+  {
+    string stats;
+    getCap().getStats( stats );
+
+    if ( out_buffer && buffer_length )
+    {
+      auto length = std::min( static_cast<size_t>( buffer_length - 1 ), stats.length() );
+      memcpy( out_buffer, stats.data(), length );
+      out_buffer[length] = '\0';
+    }
+
+    return static_cast<uint32_t>( stats.length() + 1 );
+  }
+
+  uint32_t MINIBM_EXPORT get_trace( char* out_buffer, uint32_t buffer_length )
+  {
+    // A trace grows between calls, so the one measured is kept for the call that follows
+    string trace = move( t_trace );
+    t_trace.clear();
+    if ( trace.empty() )
+      minibm::trace::writeJson( trace );
+
+    if ( out_buffer && buffer_length )
+    {
+      auto length = std::min( static_cast<size_t>( buffer_length - 1 ), trace.length() );
+      memcpy( out_buffer, trace.data(), length );
+      out_buffer[length] = '\0';
+    }
+    auto length = static_cast<uint32_t>( trace.length() + 1 );
+    if ( !out_buffer || buffer_length < length )
+      t_trace = move( trace );
+
+    return length;
+  }
+
+  uint32_t MINIBM_EXPORT get_last_error( char* out_buffer, uint32_t buffer_length )
+  {
+    auto& error = minibm::lastError();
+
+    if ( out_buffer && buffer_length )
+    {
+      auto length = std::min( static_cast<size_t>( buffer_length - 1 ), error.length() );
+      memcpy( out_buffer, error.data(), length );
+      out_buffer[length] = '\0';
+    }
+
+    return static_cast<uint32_t>( error.length() + 1 );
+  }
+
+  uint32_t MINIBM_EXPORT check_kernels()
+  {
+    return minibm::kernels::selfTest();
+  }
+
+  uint32_t MINIBM_EXPORT get_snapshot( uint8_t* out_buffer, uint32_t buffer_length, minibm::SnapshotInfo* out_info )
+  {
+    auto snapshot = t_snapshot ? move( t_snapshot ) : getCap().getSnapshot();
+    t_snapshot.reset();
+    if ( !snapshot )
+      return 0;
+
+    auto size = static_cast<uint32_t>( snapshot->data_.size() );
+    if ( out_info )
+    {
+      out_info->format = snapshot->format_;
+      out_info->width = snapshot->width_;
+      out_info->height = snapshot->height_;
+      out_info->index = snapshot->index_;
+      out_info->timestamp = snapshot->timestamp_;
+      out_info->timescale = snapshot->timescale_;
+      out_info->size = size;
+    }
+
+    if ( !out_buffer || buffer_length < size )
+    {
+      t_snapshot = move( snapshot );
+      return size;
+    }
+
+    memcpy( out_buffer, snapshot->data_.data(), size );
+    return size;
+  }
+
+  uint32_t MINIBM_EXPORT get_history_frame( uint32_t index, uint8_t* out_buffer, uint32_t buffer_length, minibm::FrameInfo* out_frame )
+  {
+    return getCap().getHistoryFrame( index, out_buffer, buffer_length, out_frame );
+  }
+
+  bool MINIBM_EXPORT find_history_frame( int64_t timestamp, int64_t timescale, uint32_t* out_index )
+  {
+    return ( out_index && getCap().findHistoryFrame( timestamp, timescale, *out_index ) );
+  }
+
+  bool MINIBM_EXPORT pin_history_frame( uint32_t index )
+  {
+    return getCap().pinHistoryFrame( index, true );
+  }
+
+  bool MINIBM_EXPORT unpin_history_frame( uint32_t index )
+  {
+    return getCap().pinHistoryFrame( index, false );
+  }
+
+  int MINIBM_EXPORT get_json_length()
+  {
+    // The "id" values in the document index our device table, so bring the table
+    // to the same generation; retry if the devices change in between.
+    auto& cap = getCap();
+    t_jsonSnapshot = cap.getCapabilities();
+    minibm::ScopedRWLock lock( &g_devicesLock );
+    while ( g_devices.empty() || t_jsonSnapshot->generation_ != g_devicesGeneration )
+    {
+      refreshDevices( cap );
+      if ( g_devicesGeneration == t_jsonSnapshot->generation_ )
+        break;
+      t_jsonSnapshot = cap.getCapabilities();
+    }
+    return static_cast<int>( t_jsonSnapshot->json_.length() + 1 );
+  }
+
+  void MINIBM_EXPORT get_json( char* out_buffer, uint32_t buffer_length )
+  {
+    if ( !out_buffer || !buffer_length )
+      return;
+
+    auto snapshot = t_jsonSnapshot ? move( t_jsonSnapshot ) : getCap().getCapabilities();
+    t_jsonSnapshot.reset();
+
+    auto length = std::min( static_cast<size_t>( buffer_length - 1 ), snapshot->json_.length() );
+    memcpy( out_buffer, snapshot->json_.data(), length );
+    out_buffer[length] = '\0';
   }
 }
 
@@ -220,7 +508,10 @@ BOOL APIENTRY DllMain( HMODULE hModule, DWORD  ul_reason_for_call, LPVOID lpRese
       minibm::g_globals.initialize();
       break;
     case DLL_PROCESS_DETACH:
-      resetCap();
+      // On process termination other threads are already gone,
+      // so don't try to tear down discovery and capture.
+      if ( !lpReserved )
+        resetCap();
       //minibm::g_globals.shutdown();
       break;
   }
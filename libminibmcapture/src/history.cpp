@@ -0,0 +1,193 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "history.h"
+#include "json.h"
+
+namespace minibm {
+
+  void FrameHistory::configure( size_t count, size_t reserveBytes, int node )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    // Readers and the writer copy outside the lock, so the slots can't move or go away
+    // under them. New readers are turned away until we're done.
+    configuring_ = true;
+    while ( true )
+    {
+      bool busy = false;
+      for ( auto& slot : slots_ )
+        busy = ( busy || slot->readers_ || slot->writing_ );
+      if ( !busy )
+        break;
+      released_.wait( lock_ );
+    }
+
+    slots_.resize( count );
+    for ( auto& slot : slots_ )
+    {
+      if ( !slot )
+        slot = std::make_unique<HistorySlot>();
+      slot->buffer_.setCategory( Memory_History );
+      slot->buffer_.setNode( node );
+      slot->buffer_.reserve( reserveBytes );
+      slot->index_ = 0;
+      slot->pins_ = 0;
+    }
+    next_ = 0;
+    stored_ = 0;
+    overruns_ = 0;
+    configuring_ = false;
+  }
+
+  HistorySlot* FrameHistory::findSlot( uint32_t index )
+  {
+    if ( !index )
+      return nullptr;
+    for ( auto& slot : slots_ )
+      if ( slot->index_ == index && !slot->writing_ )
+        return slot.get();
+    return nullptr;
+  }
+
+  void FrameHistory::store( IDeckLinkVideoInputFrame* frame, uint32_t index, uint32_t flags,
+    BMDTimeValue streamTime, BMDTimeValue streamDuration, BMDTimeScale timeScale )
+  {
+    void* bytes = nullptr;
+    if ( frame->GetBytes( &bytes ) != S_OK || !bytes )
+      return;
+
+    HistorySlot* slot = nullptr;
+    {
+      ScopedRWLock lock( &lock_ );
+      for ( size_t i = 0; i < slots_.size() && !slot; ++i )
+      {
+        auto& candidate = slots_[( next_ + i ) % slots_.size()];
+        if ( !candidate->pins_ && !candidate->readers_ )
+        {
+          slot = candidate.get();
+          next_ = ( next_ + i + 1 ) % slots_.size();
+        }
+      }
+      if ( !slot )
+      {
+        overruns_++;
+        return;
+      }
+      slot->writing_ = true;
+      slot->index_ = 0;
+    }
+
+    slot->width_ = frame->GetWidth();
+    slot->height_ = frame->GetHeight();
+    slot->rowBytes_ = frame->GetRowBytes();
+    slot->pixelFormat_ = frame->GetPixelFormat();
+    slot->buffer_.resize( static_cast<size_t>( slot->rowBytes_ ) * slot->height_ );
+    memcpy( slot->buffer_.data(), bytes, slot->buffer_.size() );
+    slot->flags_ = flags;
+    slot->streamTime_ = streamTime;
+    slot->streamDuration_ = streamDuration;
+    slot->timeScale_ = timeScale;
+
+    ScopedRWLock lock( &lock_ );
+    slot->index_ = index;
+    slot->writing_ = false;
+    stored_++;
+    if ( configuring_ )
+      released_.wakeAll();
+  }
+
+  bool FrameHistory::find( int64_t timestamp, int64_t timescale, uint32_t& out_index )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    if ( timescale <= 0 )
+      return false;
+
+    // Slots can have different time scales across a format change, so compare in seconds
+    auto target = static_cast<double>( timestamp ) / timescale;
+    double best = 0.0;
+    bool found = false;
+    for ( auto& slot : slots_ )
+    {
+      if ( !slot->index_ || slot->writing_ || slot->timeScale_ <= 0 )
+        continue;
+      auto distance = fabs( static_cast<double>( slot->streamTime_ ) / slot->timeScale_ - target );
+      if ( !found || distance < best )
+      {
+        best = distance;
+        out_index = slot->index_;
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  const HistorySlot* FrameHistory::acquire( uint32_t index )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    auto slot = ( configuring_ ? nullptr : findSlot( index ) );
+    if ( slot )
+      slot->readers_++;
+    return slot;
+  }
+
+  void FrameHistory::release( const HistorySlot* slot )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    if ( !--const_cast<HistorySlot*>( slot )->readers_ && configuring_ )
+      released_.wakeAll();
+  }
+
+  bool FrameHistory::pin( uint32_t index )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    auto slot = findSlot( index );
+    if ( slot )
+      slot->pins_++;
+    return ( slot != nullptr );
+  }
+
+  bool FrameHistory::unpin( uint32_t index )
+  {
+    ScopedRWLock lock( &lock_ );
+
+    auto slot = findSlot( index );
+    if ( !slot || !slot->pins_ )
+      return false;
+    slot->pins_--;
+    return true;
+  }
+
+  void FrameHistory::writeStats( JsonWriter& json )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    uint32_t pinned = 0;
+    uint32_t oldest = 0, newest = 0;
+    for ( auto& slot : slots_ )
+    {
+      if ( slot->pins_ )
+        pinned++;
+      if ( slot->index_ && ( !oldest || slot->index_ < oldest ) )
+        oldest = slot->index_;
+      newest = std::max( newest, slot->index_ );
+    }
+
+    json.beginObject();
+    json.member( "size", slots_.size() );
+    json.member( "stored", stored_ );
+    json.member( "overruns", overruns_ );
+    json.member( "pinned", pinned );
+    json.member( "oldestIndex", oldest );
+    json.member( "newestIndex", newest );
+    json.endObject();
+  }
+
+}
@@ -0,0 +1,149 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "minibmcap.h"
+#include "json.h"
+
+namespace minibm {
+
+  // Room for the block's size in front of the buffer, without losing alignment
+  static const size_t c_blockHeader = AlignedBuffer::c_alignment;
+
+  static inline size_t blockSize( uint8_t* block )
+  {
+    return *reinterpret_cast<size_t*>( block );
+  }
+
+  void InputAllocator::freeBlock( uint8_t* block )
+  {
+    budget::refund( Memory_Input, blockSize( block ) );
+    _aligned_free( block );
+  }
+
+  HRESULT STDMETHODCALLTYPE InputAllocator::AllocateBuffer( unsigned int bufferSize, void** allocatedBuffer )
+  {
+    if ( !allocatedBuffer )
+      return E_INVALIDARG;
+
+    ScopedRWLock lock( &lock_ );
+
+    // The driver asks for buffers of the same size over and over
+    uint8_t* block = nullptr;
+    for ( auto it = free_.begin(); it != free_.end(); ++it )
+      if ( blockSize( *it ) == bufferSize )
+      {
+        block = *it;
+        free_.erase( it );
+        break;
+      }
+
+    if ( !block )
+    {
+      if ( !budget::charge( Memory_Input, bufferSize ) )
+      {
+        refused_++;
+        return E_OUTOFMEMORY;
+      }
+      block = static_cast<uint8_t*>( _aligned_malloc( bufferSize + c_blockHeader, AlignedBuffer::c_alignment ) );
+      if ( !block )
+      {
+        budget::allocationFailed( Memory_Input, bufferSize );
+        refused_++;
+        return E_OUTOFMEMORY;
+      }
+      *reinterpret_cast<size_t*>( block ) = bufferSize;
+    }
+
+    allocated_++;
+    *allocatedBuffer = block + c_blockHeader;
+    return S_OK;
+  }
+
+  HRESULT STDMETHODCALLTYPE InputAllocator::ReleaseBuffer( void* buffer )
+  {
+    if ( !buffer )
+      return E_INVALIDARG;
+
+    ScopedRWLock lock( &lock_ );
+
+    auto block = static_cast<uint8_t*>( buffer ) - c_blockHeader;
+    allocated_--;
+    if ( committed_ )
+      free_.push_back( block );
+    else
+      freeBlock( block );
+    return S_OK;
+  }
+
+  HRESULT STDMETHODCALLTYPE InputAllocator::Commit()
+  {
+    ScopedRWLock lock( &lock_ );
+
+    committed_ = true;
+    return S_OK;
+  }
+
+  HRESULT STDMETHODCALLTYPE InputAllocator::Decommit()
+  {
+    ScopedRWLock lock( &lock_ );
+
+    // Buffers still out are freed as they come back
+    committed_ = false;
+    for ( auto block : free_ )
+      freeBlock( block );
+    free_.clear();
+    return S_OK;
+  }
+
+  void InputAllocator::writeStats( JsonWriter& json )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    json.beginObject();
+    json.member( "buffers", allocated_ );
+    json.member( "cached", free_.size() );
+    json.member( "refused", refused_ );
+    json.endObject();
+  }
+
+  InputAllocator::~InputAllocator()
+  {
+    for ( auto block : free_ )
+      freeBlock( block );
+  }
+
+  HRESULT STDMETHODCALLTYPE InputAllocator::QueryInterface( REFIID iid, LPVOID* ppv )
+  {
+    if ( !ppv )
+      return E_INVALIDARG;
+
+    *ppv = nullptr;
+    if ( iid == IID_IUnknown || iid == IID_IDeckLinkMemoryAllocator )
+    {
+      *ppv = static_cast<IDeckLinkMemoryAllocator*>( this );
+      AddRef();
+      return S_OK;
+    }
+    return E_NOINTERFACE;
+  }
+
+  ULONG STDMETHODCALLTYPE InputAllocator::AddRef()
+  {
+    return InterlockedIncrement( &refCount_ );
+  }
+
+  ULONG STDMETHODCALLTYPE InputAllocator::Release()
+  {
+    auto newRefValue = InterlockedDecrement( &refCount_ );
+    if ( newRefValue == 0 )
+    {
+      delete this;
+      return 0;
+    }
+    return newRefValue;
+  }
+
+}
@@ -0,0 +1,1097 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "kernels.h"
+#include "kernelparts.h"
+#include "options.h"
+#include "utils.h"
+#include "json.h"
+
+namespace minibm {
+
+  namespace kernels {
+
+    static const float c_byteToUnit = 1.0f / 255.0f;
+
+    //! Swaps the R and B bytes of a BGRA pixel.
+    inline uint32_t swapRB( uint32_t pixel )
+    {
+      return ( pixel & 0xFF00FF00u ) | ( ( pixel & 0xFF ) << 16 ) | ( ( pixel >> 16 ) & 0xFF );
+    }
+
+    template <typename T>
+    inline void storeTensorPixel( uint32_t pixel, uint32_t channels, T* out )
+    {
+      for ( uint32_t i = 0; i < channels; ++i )
+      {
+        auto value = static_cast<uint8_t>( pixel >> ( i * 8 ) );
+        if constexpr ( std::is_same_v<T, float> )
+          out[i] = value * c_byteToUnit;
+        else
+          out[i] = value;
+      }
+    }
+
+    //! Converts pixels [first, width) of each row, one at a time.
+    inline void bgraToTensorPixels( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      long width, long height, const TensorFormat& format, long first )
+    {
+      const auto pixelBytes = tensorPixelBytes( format );
+      for ( long y = 0; y < height; ++y )
+      {
+        auto src = source + y * sourceRowBytes;
+        auto dst = destination + y * width * pixelBytes;
+        for ( long x = first; x < width; ++x )
+        {
+          uint32_t pixel;
+          memcpy( &pixel, src + x * 4, 4 );
+          if ( format.rgb_ )
+            pixel = swapRB( pixel );
+          if ( format.float_ )
+            storeTensorPixel( pixel, format.channels_, reinterpret_cast<float*>( dst + x * pixelBytes ) );
+          else
+            storeTensorPixel( pixel, format.channels_, dst + x * pixelBytes );
+        }
+      }
+    }
+
+    inline uint32_t loadBigEndian32( const uint8_t* p )
+    {
+      return ( static_cast<uint32_t>( p[0] ) << 24 ) | ( static_cast<uint32_t>( p[1] ) << 16 )
+        | ( static_cast<uint32_t>( p[2] ) << 8 ) | p[3];
+    }
+
+    namespace scalar {
+
+      template <uint32_t Flags>
+      struct UyvyKernel {
+        static void run( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+          size_t destinationRowBytes, long width, long height, const YuvCoefficients& c,
+          const LumaThresholds& thresholds, LumaStats& stats )
+        {
+          uint32_t black = 0, low = 0, high = 0;
+          if constexpr ( ( Flags & LumaStats_Histogram ) != 0 )
+            memset( stats.histogram_, 0, sizeof( stats.histogram_ ) );
+          for ( long y = 0; y < height; ++y )
+          {
+            auto src = source + y * sourceRowBytes;
+            auto dst = destination + y * destinationRowBytes;
+            for ( long x = 0; x < width; ++x )
+            {
+              auto pair = src + ( x >> 1 ) * 4;
+              auto luma = pair[1 + ( x & 1 ) * 2];
+              yuvToBGRA( luma, pair[0], pair[2], c, dst + x * 4 );
+              if constexpr ( ( Flags & LumaStats_Histogram ) != 0 )
+                stats.histogram_[luma]++;
+              if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+              {
+                black += ( luma <= thresholds.black_ );
+                low += ( luma <= thresholds.clipLow_ );
+                high += ( luma >= thresholds.clipHigh_ );
+              }
+            }
+          }
+          if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+          {
+            stats.black_ = black;
+            stats.clippedLow_ = low;
+            stats.clippedHigh_ = high;
+          }
+        }
+      };
+
+      void uyvyToBGRA( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709,
+        uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats )
+      {
+        dispatchLumaStats<UyvyKernel>( source, sourceRowBytes, destination, destinationRowBytes,
+          width, height, rec709, statsFlags, thresholds, stats );
+      }
+
+      template <RgbLayout Layout>
+      void v210ToRGBRows( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, const Yuv10Coefficients& c )
+      {
+        for ( long row = 0; row < height; ++row )
+        {
+          auto dst = destination + row * destinationRowBytes;
+          forV210Chunks( source + row * sourceRowBytes, width,
+            [&]( long x0, long count, const int16_t* y, const int16_t* u, const int16_t* v ) {
+            for ( long x = 0; x < count; ++x )
+            {
+              uint16_t rgb[3];
+              yuv10ToRGB16( y[x], u[x >> 1], v[x >> 1], c, rgb );
+              storeRGB16<Layout>( rgb, dst + ( x0 + x ) * rgbPixelBytes( Layout ) );
+            }
+          } );
+        }
+      }
+
+      void v210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709, RgbLayout layout )
+      {
+        auto& c = ( rec709 ? c_rec709x10 : c_rec601x10 );
+        if ( layout == Rgb_A64 )
+          v210ToRGBRows<Rgb_A64>( source, sourceRowBytes, destination, destinationRowBytes, width, height, c );
+        else
+          v210ToRGBRows<Rgb_10A2>( source, sourceRowBytes, destination, destinationRowBytes, width, height, c );
+      }
+
+      template <RgbLayout Layout>
+      void r210ToRGBRows( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height )
+      {
+        for ( long y = 0; y < height; ++y )
+        {
+          auto src = source + y * sourceRowBytes;
+          auto dst = destination + y * destinationRowBytes;
+          for ( long x = 0; x < width; ++x )
+          {
+            auto word = loadBigEndian32( src + x * 4 );
+            const uint16_t rgb[3] = {
+              expand10( ( word >> 20 ) & 0x3FF ),
+              expand10( ( word >> 10 ) & 0x3FF ),
+              expand10( word & 0x3FF )
+            };
+            storeRGB16<Layout>( rgb, dst + x * rgbPixelBytes( Layout ) );
+          }
+        }
+      }
+
+      void r210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, RgbLayout layout )
+      {
+        if ( layout == Rgb_A64 )
+          r210ToRGBRows<Rgb_A64>( source, sourceRowBytes, destination, destinationRowBytes, width, height );
+        else
+          r210ToRGBRows<Rgb_10A2>( source, sourceRowBytes, destination, destinationRowBytes, width, height );
+      }
+
+      void v210ToP010( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height )
+      {
+        alignas( 16 ) int16_t y[2][c_v210Chunk];
+        alignas( 16 ) int16_t u[2][c_v210Chunk / 2];
+        alignas( 16 ) int16_t v[2][c_v210Chunk / 2];
+        auto chroma = destination + height * destinationRowBytes;
+        for ( long row = 0; row < height; row += 2 )
+        {
+          // An odd last row is paired with itself
+          const long rows = std::min( height - row, 2L );
+          auto uv = reinterpret_cast<uint16_t*>( chroma + ( row >> 1 ) * destinationRowBytes );
+          for ( long x0 = 0; x0 < width; x0 += c_v210Chunk )
+          {
+            auto count = std::min( width - x0, c_v210Chunk );
+            for ( long i = 0; i < 2; ++i )
+              unpackV210( source + ( row + std::min( i, rows - 1 ) ) * sourceRowBytes + ( x0 / 6 ) * 16,
+                ( count + 5 ) / 6, y[i], u[i], v[i] );
+            for ( long i = 0; i < rows; ++i )
+            {
+              auto luma = reinterpret_cast<uint16_t*>( destination + ( row + i ) * destinationRowBytes ) + x0;
+              for ( long x = 0; x < count; ++x )
+                luma[x] = static_cast<uint16_t>( y[i][x] << 6 );
+            }
+            for ( long x = 0; x < ( count + 1 ) >> 1; ++x )
+            {
+              uv[x0 + x * 2] = static_cast<uint16_t>( ( ( u[0][x] + u[1][x] + 1 ) >> 1 ) << 6 );
+              uv[x0 + x * 2 + 1] = static_cast<uint16_t>( ( ( v[0][x] + v[1][x] + 1 ) >> 1 ) << 6 );
+            }
+          }
+        }
+      }
+
+      void bgraToTensor( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        long width, long height, const TensorFormat& format )
+      {
+        bgraToTensorPixels( source, sourceRowBytes, destination, width, height, format, 0 );
+      }
+
+      inline bool equal( const uint8_t* a, const uint8_t* b, size_t length )
+      {
+        return ( memcmp( a, b, length ) == 0 );
+      }
+
+      void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+        const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks )
+      {
+        tileDiffRows<equal>( current, previous, rowBytes, height, spans, columns, tileHeight, marks );
+      }
+
+      uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep )
+      {
+        alignas( 64 ) uint64_t acc[c_fpLanes];
+        alignas( 64 ) uint64_t key[c_fpLanes];
+        fpInit( acc );
+        rowStep = std::max( rowStep, 1L );
+        const auto stripes = rowBytes / c_fpStripe;
+        for ( long y = 0; y < height; y += rowStep )
+        {
+          auto row = data + y * rowBytes;
+          memcpy( key, c_fpKeys, sizeof( key ) );
+          for ( size_t s = 0; s < stripes; ++s )
+            fpStripe( acc, key, row + s * c_fpStripe );
+          fpRowEnd( acc, key, row, rowBytes );
+        }
+        return fpFinish( acc, rowBytes, height, rowStep );
+      }
+
+    }
+
+    namespace sse2 {
+
+      inline bool equal( const uint8_t* a, const uint8_t* b, size_t length )
+      {
+        size_t i = 0;
+        for ( ; i + 64 <= length; i += 64 )
+        {
+          auto pa = reinterpret_cast<const __m128i*>( a + i );
+          auto pb = reinterpret_cast<const __m128i*>( b + i );
+          auto d0 = _mm_xor_si128( _mm_loadu_si128( pa ), _mm_loadu_si128( pb ) );
+          auto d1 = _mm_xor_si128( _mm_loadu_si128( pa + 1 ), _mm_loadu_si128( pb + 1 ) );
+          auto d2 = _mm_xor_si128( _mm_loadu_si128( pa + 2 ), _mm_loadu_si128( pb + 2 ) );
+          auto d3 = _mm_xor_si128( _mm_loadu_si128( pa + 3 ), _mm_loadu_si128( pb + 3 ) );
+          auto any = _mm_or_si128( _mm_or_si128( d0, d1 ), _mm_or_si128( d2, d3 ) );
+          if ( _mm_movemask_epi8( _mm_cmpeq_epi8( any, _mm_setzero_si128() ) ) != 0xFFFF )
+            return false;
+        }
+        for ( ; i + 16 <= length; i += 16 )
+        {
+          auto d = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( a + i ) ),
+            _mm_loadu_si128( reinterpret_cast<const __m128i*>( b + i ) ) );
+          if ( _mm_movemask_epi8( _mm_cmpeq_epi8( d, _mm_setzero_si128() ) ) != 0xFFFF )
+            return false;
+        }
+        return ( i == length || memcmp( a + i, b + i, length - i ) == 0 );
+      }
+
+      void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+        const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks )
+      {
+        tileDiffRows<equal>( current, previous, rowBytes, height, spans, columns, tileHeight, marks );
+      }
+
+      inline uint32_t horizontalSum16( __m128i counts )
+      {
+        auto sums = _mm_madd_epi16( counts, _mm_set1_epi16( 1 ) );
+        sums = _mm_add_epi32( sums, _mm_shuffle_epi32( sums, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+        sums = _mm_add_epi32( sums, _mm_shuffle_epi32( sums, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+        return static_cast<uint32_t>( _mm_cvtsi128_si32( sums ) );
+      }
+
+      template <uint32_t Flags>
+      struct UyvyKernel {
+        static void run( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+          size_t destinationRowBytes, long width, long height, const YuvCoefficients& c,
+          const LumaThresholds& thresholds, LumaStats& stats )
+        {
+          const auto cy = _mm_set1_epi16( c.y_ );
+          const auto crv = _mm_set1_epi16( c.rv_ );
+          const auto cgu = _mm_set1_epi16( c.gu_ );
+          const auto cgv = _mm_set1_epi16( c.gv_ );
+          const auto cbu = _mm_set1_epi16( c.bu_ );
+          const auto rounding = _mm_set1_epi16( c_yuvRounding );
+          const auto lumaOffset = _mm_set1_epi16( 16 );
+          const auto chromaOffset = _mm_set1_epi16( 128 );
+          const auto lowBytes = _mm_set1_epi16( 0x00FF );
+          const auto lowWords = _mm_set1_epi32( 0x0000FFFF );
+          const auto alpha = _mm_set1_epi8( -1 );
+          const auto blackLimit = _mm_set1_epi16( static_cast<int16_t>( thresholds.black_ + 1 ) );
+          const auto lowLimit = _mm_set1_epi16( static_cast<int16_t>( thresholds.clipLow_ + 1 ) );
+          const auto highLimit = _mm_set1_epi16( static_cast<int16_t>( thresholds.clipHigh_ - 1 ) );
+
+          SplitHistogram histogram;
+          uint32_t black = 0, low = 0, high = 0;
+
+          const long vectorWidth = width & ~7L;
+          for ( long y = 0; y < height; ++y )
+          {
+            auto src = source + y * sourceRowBytes;
+            auto dst = destination + y * destinationRowBytes;
+            // 16-bit lanes can count up to 32767 times, which is more pixels than fit in a row
+            auto blackCount = _mm_setzero_si128();
+            auto lowCount = _mm_setzero_si128();
+            auto highCount = _mm_setzero_si128();
+            for ( long x = 0; x < vectorWidth; x += 8 )
+            {
+              auto pixels = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + x * 2 ) );
+              auto luma = _mm_srli_epi16( pixels, 8 );
+              auto chroma = _mm_and_si128( pixels, lowBytes );
+              auto u = _mm_and_si128( chroma, lowWords );
+              auto v = _mm_srli_epi32( chroma, 16 );
+              u = _mm_or_si128( u, _mm_slli_epi32( u, 16 ) );
+              v = _mm_or_si128( v, _mm_slli_epi32( v, 16 ) );
+
+              auto ys = _mm_add_epi16( _mm_mulhi_epi16( _mm_slli_epi16( _mm_sub_epi16( luma, lumaOffset ), 7 ), cy ), rounding );
+              auto u7 = _mm_slli_epi16( _mm_sub_epi16( u, chromaOffset ), 7 );
+              auto v7 = _mm_slli_epi16( _mm_sub_epi16( v, chromaOffset ), 7 );
+              auto b = _mm_add_epi16( ys, _mm_mulhi_epi16( u7, cbu ) );
+              auto g = _mm_add_epi16( ys, _mm_add_epi16( _mm_mulhi_epi16( u7, cgu ), _mm_mulhi_epi16( v7, cgv ) ) );
+              auto r = _mm_add_epi16( ys, _mm_mulhi_epi16( v7, crv ) );
+
+              auto bg = _mm_unpacklo_epi8( _mm_packus_epi16( b, b ), _mm_packus_epi16( g, g ) );
+              auto ra = _mm_unpacklo_epi8( _mm_packus_epi16( r, r ), alpha );
+              _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + x * 4 ), _mm_unpacklo_epi16( bg, ra ) );
+              _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + x * 4 + 16 ), _mm_unpackhi_epi16( bg, ra ) );
+
+              if constexpr ( ( Flags & LumaStats_Histogram ) != 0 )
+              {
+                histogram.add( src + x * 2 );
+                histogram.add( src + x * 2 + 8 );
+              }
+              if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+              {
+                blackCount = _mm_sub_epi16( blackCount, _mm_cmplt_epi16( luma, blackLimit ) );
+                lowCount = _mm_sub_epi16( lowCount, _mm_cmplt_epi16( luma, lowLimit ) );
+                highCount = _mm_sub_epi16( highCount, _mm_cmpgt_epi16( luma, highLimit ) );
+              }
+            }
+            for ( long x = vectorWidth; x < width; ++x )
+            {
+              auto pair = src + ( x >> 1 ) * 4;
+              auto luma = pair[1 + ( x & 1 ) * 2];
+              yuvToBGRA( luma, pair[0], pair[2], c, dst + x * 4 );
+              if constexpr ( ( Flags & LumaStats_Histogram ) != 0 )
+                histogram.tables_[0][luma]++;
+              if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+              {
+                black += ( luma <= thresholds.black_ );
+                low += ( luma <= thresholds.clipLow_ );
+                high += ( luma >= thresholds.clipHigh_ );
+              }
+            }
+            if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+            {
+              black += horizontalSum16( blackCount );
+              low += horizontalSum16( lowCount );
+              high += horizontalSum16( highCount );
+            }
+          }
+
+          if constexpr ( ( Flags & LumaStats_Histogram ) != 0 )
+            histogram.collect( stats.histogram_ );
+          if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+          {
+            stats.black_ = black;
+            stats.clippedLow_ = low;
+            stats.clippedHigh_ = high;
+          }
+        }
+      };
+
+      void uyvyToBGRA( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709,
+        uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats )
+      {
+        dispatchLumaStats<UyvyKernel>( source, sourceRowBytes, destination, destinationRowBytes,
+          width, height, rec709, statsFlags, thresholds, stats );
+      }
+
+      inline __m128i pair16( int low, int high )
+      {
+        return _mm_set1_epi32( static_cast<int>( static_cast<uint16_t>( low ) | ( static_cast<uint32_t>( static_cast<uint16_t>( high ) ) << 16 ) ) );
+      }
+
+      //! Clamps two vectors of 32-bit values into one of 16-bit unsigned ones.
+      inline __m128i clampPack16( __m128i low, __m128i high )
+      {
+        const auto bias = _mm_set1_epi32( 32768 );
+        return _mm_xor_si128( _mm_packs_epi32( _mm_sub_epi32( low, bias ), _mm_sub_epi32( high, bias ) ),
+          _mm_set1_epi16( static_cast<int16_t>( 0x8000 ) ) );
+      }
+
+      //! Stores eight pixels of 16-bit R, G and B.
+      template <RgbLayout Layout>
+      inline void storeRGB16x8( __m128i r, __m128i g, __m128i b, uint8_t* out )
+      {
+        if constexpr ( Layout == Rgb_A64 )
+        {
+          const auto alpha = _mm_set1_epi16( -1 );
+          auto rgLow = _mm_unpacklo_epi16( r, g );
+          auto rgHigh = _mm_unpackhi_epi16( r, g );
+          auto baLow = _mm_unpacklo_epi16( b, alpha );
+          auto baHigh = _mm_unpackhi_epi16( b, alpha );
+          _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), _mm_unpacklo_epi32( rgLow, baLow ) );
+          _mm_storeu_si128( reinterpret_cast<__m128i*>( out + 16 ), _mm_unpackhi_epi32( rgLow, baLow ) );
+          _mm_storeu_si128( reinterpret_cast<__m128i*>( out + 32 ), _mm_unpacklo_epi32( rgHigh, baHigh ) );
+          _mm_storeu_si128( reinterpret_cast<__m128i*>( out + 48 ), _mm_unpackhi_epi32( rgHigh, baHigh ) );
+        }
+        else
+        {
+          const auto half = _mm_set1_epi16( 32 );
+          const auto zero = _mm_setzero_si128();
+          const auto alpha = _mm_set1_epi32( static_cast<int>( 0xC0000000u ) );
+          r = _mm_srli_epi16( _mm_adds_epu16( r, half ), 6 );
+          g = _mm_srli_epi16( _mm_adds_epu16( g, half ), 6 );
+          b = _mm_srli_epi16( _mm_adds_epu16( b, half ), 6 );
+          auto low = _mm_or_si128( _mm_or_si128( _mm_unpacklo_epi16( r, zero ), alpha ),
+            _mm_or_si128( _mm_slli_epi32( _mm_unpacklo_epi16( g, zero ), 10 ), _mm_slli_epi32( _mm_unpacklo_epi16( b, zero ), 20 ) ) );
+          auto high = _mm_or_si128( _mm_or_si128( _mm_unpackhi_epi16( r, zero ), alpha ),
+            _mm_or_si128( _mm_slli_epi32( _mm_unpackhi_epi16( g, zero ), 10 ), _mm_slli_epi32( _mm_unpackhi_epi16( b, zero ), 20 ) ) );
+          _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), low );
+          _mm_storeu_si128( reinterpret_cast<__m128i*>( out + 16 ), high );
+        }
+      }
+
+      template <RgbLayout Layout>
+      void v210ToRGBRows( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, const Yuv10Coefficients& c )
+      {
+        const auto lumaOffset = _mm_set1_epi16( 64 );
+        const auto chromaOffset = _mm_set1_epi16( 512 );
+        const auto ones = _mm_set1_epi16( 1 );
+        const auto rounding = _mm_set1_epi32( c_yuv10Rounding );
+        const auto yrv = pair16( c.y_, c.rv_ );
+        const auto ygu = pair16( c.y_, c.gu_ );
+        const auto ybu = pair16( c.y_, c.bu_ );
+        const auto gvr = pair16( c.gv_, c_yuv10Rounding );
+
+        for ( long row = 0; row < height; ++row )
+        {
+          auto dst = destination + row * destinationRowBytes;
+          forV210Chunks( source + row * sourceRowBytes, width,
+            [&]( long x0, long count, const int16_t* y, const int16_t* u, const int16_t* v ) {
+            const long vectorCount = count & ~7L;
+            for ( long x = 0; x < vectorCount; x += 8 )
+            {
+              auto ys = _mm_sub_epi16( _mm_load_si128( reinterpret_cast<const __m128i*>( y + x ) ), lumaOffset );
+              auto us = _mm_sub_epi16( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( u + ( x >> 1 ) ) ), chromaOffset );
+              auto vs = _mm_sub_epi16( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( v + ( x >> 1 ) ) ), chromaOffset );
+              us = _mm_unpacklo_epi16( us, us );
+              vs = _mm_unpacklo_epi16( vs, vs );
+
+              __m128i r[2], g[2], b[2];
+              for ( int half = 0; half < 2; ++half )
+              {
+                auto yu = ( half ? _mm_unpackhi_epi16( ys, us ) : _mm_unpacklo_epi16( ys, us ) );
+                auto yv = ( half ? _mm_unpackhi_epi16( ys, vs ) : _mm_unpacklo_epi16( ys, vs ) );
+                auto v1 = ( half ? _mm_unpackhi_epi16( vs, ones ) : _mm_unpacklo_epi16( vs, ones ) );
+                r[half] = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yv, yrv ), rounding ), 7 );
+                g[half] = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yu, ygu ), _mm_madd_epi16( v1, gvr ) ), 7 );
+                b[half] = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yu, ybu ), rounding ), 7 );
+              }
+              storeRGB16x8<Layout>( clampPack16( r[0], r[1] ), clampPack16( g[0], g[1] ), clampPack16( b[0], b[1] ),
+                dst + ( x0 + x ) * rgbPixelBytes( Layout ) );
+            }
+            for ( long x = vectorCount; x < count; ++x )
+            {
+              uint16_t rgb[3];
+              yuv10ToRGB16( y[x], u[x >> 1], v[x >> 1], c, rgb );
+              storeRGB16<Layout>( rgb, dst + ( x0 + x ) * rgbPixelBytes( Layout ) );
+            }
+          } );
+        }
+      }
+
+      void v210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709, RgbLayout layout )
+      {
+        auto& c = ( rec709 ? c_rec709x10 : c_rec601x10 );
+        if ( layout == Rgb_A64 )
+          v210ToRGBRows<Rgb_A64>( source, sourceRowBytes, destination, destinationRowBytes, width, height, c );
+        else
+          v210ToRGBRows<Rgb_10A2>( source, sourceRowBytes, destination, destinationRowBytes, width, height, c );
+      }
+
+      //! Byte swaps each 32-bit lane.
+      inline __m128i byteSwap32( __m128i x )
+      {
+        const auto mask = _mm_set1_epi32( 0x0000FF00 );
+        return _mm_or_si128( _mm_or_si128( _mm_slli_epi32( x, 24 ), _mm_srli_epi32( x, 24 ) ),
+          _mm_or_si128( _mm_and_si128( _mm_srli_epi32( x, 8 ), mask ), _mm_slli_epi32( _mm_and_si128( x, mask ), 8 ) ) );
+      }
+
+      inline __m128i expand10x8( __m128i values )
+      {
+        const auto scale = pair16( c_rec709x10.y_, c_yuv10Rounding );
+        const auto ones = _mm_set1_epi16( 1 );
+        values = _mm_sub_epi16( values, _mm_set1_epi16( 64 ) );
+        auto low = _mm_srai_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( values, ones ), scale ), 7 );
+        auto high = _mm_srai_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( values, ones ), scale ), 7 );
+        return clampPack16( low, high );
+      }
+
+      template <RgbLayout Layout>
+      void r210ToRGBRows( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height )
+      {
+        const auto mask = _mm_set1_epi32( 0x3FF );
+        const long vectorWidth = width & ~7L;
+        for ( long y = 0; y < height; ++y )
+        {
+          auto src = source + y * sourceRowBytes;
+          auto dst = destination + y * destinationRowBytes;
+          for ( long x = 0; x < vectorWidth; x += 8 )
+          {
+            auto low = byteSwap32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + x * 4 ) ) );
+            auto high = byteSwap32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + x * 4 + 16 ) ) );
+            auto r = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( low, 20 ), mask ), _mm_and_si128( _mm_srli_epi32( high, 20 ), mask ) );
+            auto g = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( low, 10 ), mask ), _mm_and_si128( _mm_srli_epi32( high, 10 ), mask ) );
+            auto b = _mm_packs_epi32( _mm_and_si128( low, mask ), _mm_and_si128( high, mask ) );
+            storeRGB16x8<Layout>( expand10x8( r ), expand10x8( g ), expand10x8( b ), dst + x * rgbPixelBytes( Layout ) );
+          }
+          for ( long x = vectorWidth; x < width; ++x )
+          {
+            auto word = loadBigEndian32( src + x * 4 );
+            const uint16_t rgb[3] = {
+              expand10( ( word >> 20 ) & 0x3FF ),
+              expand10( ( word >> 10 ) & 0x3FF ),
+              expand10( word & 0x3FF )
+            };
+            storeRGB16<Layout>( rgb, dst + x * rgbPixelBytes( Layout ) );
+          }
+        }
+      }
+
+      void r210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, RgbLayout layout )
+      {
+        if ( layout == Rgb_A64 )
+          r210ToRGBRows<Rgb_A64>( source, sourceRowBytes, destination, destinationRowBytes, width, height );
+        else
+          r210ToRGBRows<Rgb_10A2>( source, sourceRowBytes, destination, destinationRowBytes, width, height );
+      }
+
+      void v210ToP010( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height )
+      {
+        alignas( 16 ) int16_t y[2][c_v210Chunk];
+        alignas( 16 ) int16_t u[2][c_v210Chunk / 2];
+        alignas( 16 ) int16_t v[2][c_v210Chunk / 2];
+        auto chroma = destination + height * destinationRowBytes;
+        for ( long row = 0; row < height; row += 2 )
+        {
+          const long rows = std::min( height - row, 2L );
+          auto uv = reinterpret_cast<uint16_t*>( chroma + ( row >> 1 ) * destinationRowBytes );
+          for ( long x0 = 0; x0 < width; x0 += c_v210Chunk )
+          {
+            auto count = std::min( width - x0, c_v210Chunk );
+            const long vectorCount = count & ~7L;
+            for ( long i = 0; i < 2; ++i )
+              unpackV210( source + ( row + std::min( i, rows - 1 ) ) * sourceRowBytes + ( x0 / 6 ) * 16,
+                ( count + 5 ) / 6, y[i], u[i], v[i] );
+            for ( long i = 0; i < rows; ++i )
+            {
+              auto luma = reinterpret_cast<uint16_t*>( destination + ( row + i ) * destinationRowBytes ) + x0;
+              for ( long x = 0; x < vectorCount; x += 8 )
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( luma + x ),
+                  _mm_slli_epi16( _mm_load_si128( reinterpret_cast<const __m128i*>( y[i] + x ) ), 6 ) );
+              for ( long x = vectorCount; x < count; ++x )
+                luma[x] = static_cast<uint16_t>( y[i][x] << 6 );
+            }
+            for ( long x = 0; x < vectorCount; x += 8 )
+            {
+              auto cb = _mm_avg_epu16( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( u[0] + ( x >> 1 ) ) ),
+                _mm_loadl_epi64( reinterpret_cast<const __m128i*>( u[1] + ( x >> 1 ) ) ) );
+              auto cr = _mm_avg_epu16( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( v[0] + ( x >> 1 ) ) ),
+                _mm_loadl_epi64( reinterpret_cast<const __m128i*>( v[1] + ( x >> 1 ) ) ) );
+              _mm_storeu_si128( reinterpret_cast<__m128i*>( uv + x0 + x ), _mm_slli_epi16( _mm_unpacklo_epi16( cb, cr ), 6 ) );
+            }
+            for ( long x = vectorCount >> 1; x < ( count + 1 ) >> 1; ++x )
+            {
+              uv[x0 + x * 2] = static_cast<uint16_t>( ( ( u[0][x] + u[1][x] + 1 ) >> 1 ) << 6 );
+              uv[x0 + x * 2 + 1] = static_cast<uint16_t>( ( ( v[0][x] + v[1][x] + 1 ) >> 1 ) << 6 );
+            }
+          }
+        }
+      }
+
+      inline __m128i swapRBx4( __m128i pixels )
+      {
+        const auto greenAlpha = _mm_set1_epi32( static_cast<int>( 0xFF00FF00u ) );
+        const auto low = _mm_set1_epi32( 0xFF );
+        return _mm_or_si128( _mm_and_si128( pixels, greenAlpha ),
+          _mm_or_si128( _mm_slli_epi32( _mm_and_si128( pixels, low ), 16 ), _mm_and_si128( _mm_srli_epi32( pixels, 16 ), low ) ) );
+      }
+
+      void bgraToTensor( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        long width, long height, const TensorFormat& format )
+      {
+        const auto pixelBytes = tensorPixelBytes( format );
+        const auto scale = _mm_set1_ps( c_byteToUnit );
+        const auto zero = _mm_setzero_si128();
+        // Three channel stores write a little past the pixel and rely on the next one to fix it up,
+        // so the last pixels of each row are left for the scalar loop.
+        const long vectorWidth = ( format.channels_ == 4 ? width & ~3L : std::max( width - 3, 0L ) & ~3L );
+        for ( long y = 0; y < height; ++y )
+        {
+          auto src = source + y * sourceRowBytes;
+          auto dst = destination + y * width * pixelBytes;
+          for ( long x = 0; x < vectorWidth; x += 4 )
+          {
+            auto pixels = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + x * 4 ) );
+            if ( format.rgb_ )
+              pixels = swapRBx4( pixels );
+            auto out = dst + x * pixelBytes;
+            if ( format.float_ )
+            {
+              auto words = _mm_unpacklo_epi8( pixels, zero );
+              __m128 values[4] = {
+                _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( words, zero ) ), scale ),
+                _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( words, zero ) ), scale ),
+                _mm_setzero_ps(), _mm_setzero_ps()
+              };
+              words = _mm_unpackhi_epi8( pixels, zero );
+              values[2] = _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( words, zero ) ), scale );
+              values[3] = _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( words, zero ) ), scale );
+              for ( int i = 0; i < 4; ++i )
+                _mm_storeu_ps( reinterpret_cast<float*>( out + i * pixelBytes ), values[i] );
+            }
+            else if ( format.channels_ == 4 )
+              _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), pixels );
+            else
+            {
+              alignas( 16 ) uint32_t words[4];
+              _mm_store_si128( reinterpret_cast<__m128i*>( words ), pixels );
+              for ( int i = 0; i < 4; ++i )
+                memcpy( out + i * 3, &words[i], 4 );
+            }
+          }
+        }
+        bgraToTensorPixels( source, sourceRowBytes, destination, width, height, format, vectorWidth );
+      }
+
+      inline __m128i fpLane( __m128i acc, __m128i w, __m128i key )
+      {
+        auto k = _mm_xor_si128( w, key );
+        auto product = _mm_mul_epu32( k, _mm_srli_epi64( k, 32 ) );
+        return _mm_add_epi64( acc, _mm_add_epi64( product, w ) );
+      }
+
+      uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep )
+      {
+        alignas( 64 ) uint64_t acc[c_fpLanes];
+        alignas( 64 ) uint64_t key[c_fpLanes];
+        fpInit( acc );
+        rowStep = std::max( rowStep, 1L );
+        const auto stripes = rowBytes / c_fpStripe;
+        const __m128i step[4] = {
+          _mm_load_si128( reinterpret_cast<const __m128i*>( c_fpSteps ) + 0 ),
+          _mm_load_si128( reinterpret_cast<const __m128i*>( c_fpSteps ) + 1 ),
+          _mm_load_si128( reinterpret_cast<const __m128i*>( c_fpSteps ) + 2 ),
+          _mm_load_si128( reinterpret_cast<const __m128i*>( c_fpSteps ) + 3 )
+        };
+        for ( long y = 0; y < height; y += rowStep )
+        {
+          auto row = data + y * rowBytes;
+          __m128i a[4], k[4];
+          for ( int i = 0; i < 4; ++i )
+          {
+            a[i] = _mm_load_si128( reinterpret_cast<const __m128i*>( acc ) + i );
+            k[i] = _mm_load_si128( reinterpret_cast<const __m128i*>( c_fpKeys ) + i );
+          }
+          for ( size_t s = 0; s < stripes; ++s )
+          {
+            auto p = reinterpret_cast<const __m128i*>( row + s * c_fpStripe );
+            for ( int i = 0; i < 4; ++i )
+            {
+              a[i] = fpLane( a[i], _mm_loadu_si128( p + i ), k[i] );
+              k[i] = _mm_add_epi64( k[i], step[i] );
+            }
+          }
+          for ( int i = 0; i < 4; ++i )
+          {
+            _mm_store_si128( reinterpret_cast<__m128i*>( acc ) + i, a[i] );
+            _mm_store_si128( reinterpret_cast<__m128i*>( key ) + i, k[i] );
+          }
+          fpRowEnd( acc, key, row, rowBytes );
+        }
+        return fpFinish( acc, rowBytes, height, rowStep );
+      }
+
+    }
+
+    // Dispatch: each kernel has a variant per level where one was written, and the public
+    // functions call the best one within the cap. Picking is done once when the library is
+    // loaded, and again whenever the kernels option changes.
+
+    static const char* c_levelNames[Level_Count] = { "scalar", "sse2", "avx2", "avx512" };
+
+    template <typename Fn>
+    struct Kernel {
+      const char* name_;
+      Fn variants_[Level_Count]; //!< Null where there is no variant for a level.
+      atomic<Fn> selected_;
+      atomic<int> level_;
+      void select( int cap )
+      {
+        for ( int level = cap; level >= Level_Scalar; --level )
+          if ( variants_[level] )
+          {
+            selected_ = variants_[level];
+            level_ = level;
+            return;
+          }
+      }
+    };
+
+    static Kernel<decltype( &scalar::fingerprint )> g_fingerprint = { "fingerprint",
+      { scalar::fingerprint, sse2::fingerprint, avx2::fingerprint, avx512::fingerprint },
+      sse2::fingerprint, Level_SSE2 };
+    static Kernel<decltype( &scalar::tileDiff )> g_tileDiff = { "tileDiff",
+      { scalar::tileDiff, sse2::tileDiff, avx2::tileDiff, avx512::tileDiff },
+      sse2::tileDiff, Level_SSE2 };
+    static Kernel<decltype( &scalar::uyvyToBGRA )> g_uyvyToBGRA = { "uyvyToBGRA",
+      { scalar::uyvyToBGRA, sse2::uyvyToBGRA, avx2::uyvyToBGRA }, sse2::uyvyToBGRA, Level_SSE2 };
+    static Kernel<decltype( &scalar::v210ToRGB )> g_v210ToRGB = { "v210ToRGB",
+      { scalar::v210ToRGB, sse2::v210ToRGB, avx2::v210ToRGB }, sse2::v210ToRGB, Level_SSE2 };
+    static Kernel<decltype( &scalar::r210ToRGB )> g_r210ToRGB = { "r210ToRGB",
+      { scalar::r210ToRGB, sse2::r210ToRGB }, sse2::r210ToRGB, Level_SSE2 };
+    static Kernel<decltype( &scalar::v210ToP010 )> g_v210ToP010 = { "v210ToP010",
+      { scalar::v210ToP010, sse2::v210ToP010 }, sse2::v210ToP010, Level_SSE2 };
+    static Kernel<decltype( &scalar::bgraToTensor )> g_bgraToTensor = { "bgraToTensor",
+      { scalar::bgraToTensor, sse2::bgraToTensor }, sse2::bgraToTensor, Level_SSE2 };
+
+    template <typename Visitor>
+    static void forEachKernel( Visitor visit )
+    {
+      visit( g_fingerprint );
+      visit( g_tileDiff );
+      visit( g_uyvyToBGRA );
+      visit( g_v210ToRGB );
+      visit( g_r210ToRGB );
+      visit( g_v210ToP010 );
+      visit( g_bgraToTensor );
+    }
+
+    static KernelLevel detectLevel()
+    {
+      int info[4];
+      __cpuid( info, 0 );
+      auto maxLeaf = info[0];
+      __cpuid( info, 1 );
+      bool osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+      bool avx = ( info[2] & ( 1 << 28 ) ) != 0;
+      if ( maxLeaf < 7 || !osxsave || !avx )
+        return Level_SSE2;
+
+      // The OS has to save the wider registers across context switches too
+      auto xcr0 = _xgetbv( 0 );
+      if ( ( xcr0 & 0x6 ) != 0x6 )
+        return Level_SSE2;
+
+      __cpuidex( info, 7, 0 );
+      bool avx2 = ( info[1] & ( 1 << 5 ) ) != 0;
+      bool avx512f = ( info[1] & ( 1 << 16 ) ) != 0;
+      bool avx512bw = ( info[1] & ( 1 << 30 ) ) != 0;
+      if ( avx2 && avx512f && avx512bw && ( xcr0 & 0xE6 ) == 0xE6 )
+        return Level_AVX512;
+      return ( avx2 ? Level_AVX2 : Level_SSE2 );
+    }
+
+    KernelLevel supportedLevel()
+    {
+      static const KernelLevel level = detectLevel();
+      return level;
+    }
+
+    static atomic<int> g_cap = Level_Count;
+
+    static void selectAll( int cap )
+    {
+      cap = std::min( cap, static_cast<int>( supportedLevel() ) );
+      g_cap = cap;
+      forEachKernel( [cap]( auto& kernel ) { kernel.select( cap ); } );
+    }
+
+    static const struct AutoSelect {
+      AutoSelect() { selectAll( supportedLevel() ); }
+    } g_autoSelect;
+
+    void configure( const Options& options )
+    {
+      if ( !options.has( "kernels" ) )
+        return;
+
+      // Anything unknown, such as auto, means no cap
+      auto name = options.getString( "kernels" );
+      int cap = Level_Count;
+      for ( int level = Level_Scalar; level < Level_Count; ++level )
+        if ( name == c_levelNames[level] )
+          cap = level;
+      selectAll( cap );
+    }
+
+    // Self test: every variant is run on the same generated input as the scalar reference,
+    // into outputs prefilled alike, and the outputs must come out identical.
+
+    static RWLock g_selfTestLock;
+    static bool g_selfTested = false;
+    static uint32_t g_variantsTested = 0;
+    static vector<string> g_mismatches;
+
+    static void fillRandom( vector<uint8_t>& buffer, uint32_t seed )
+    {
+      uint32_t state = seed * 2654435761u + 1;
+      for ( auto& byte : buffer )
+      {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = static_cast<uint8_t>( state >> 8 );
+      }
+    }
+
+    static bool testFingerprint( decltype( &scalar::fingerprint ) fn, decltype( &scalar::fingerprint ) reference )
+    {
+      const size_t rowBytes = 1000;
+      const long height = 17;
+      vector<uint8_t> data( rowBytes * height );
+      fillRandom( data, 1 );
+      for ( long rowStep : { 1L, 3L } )
+        if ( fn( data.data(), rowBytes, height, rowStep ) != reference( data.data(), rowBytes, height, rowStep ) )
+          return false;
+      return true;
+    }
+
+    static bool testTileDiff( decltype( &scalar::tileDiff ) fn, decltype( &scalar::tileDiff ) reference )
+    {
+      const size_t rowBytes = 1000;
+      const long height = 40;
+      const long tileHeight = 16;
+      const uint32_t spanBytes = 96;
+      const auto columns = static_cast<uint32_t>( ( rowBytes + spanBytes - 1 ) / spanBytes );
+      vector<TileSpan> spans( columns );
+      for ( uint32_t x = 0; x < columns; ++x )
+        spans[x] = { x * spanBytes, std::min( ( x + 1 ) * spanBytes, static_cast<uint32_t>( rowBytes ) ) };
+
+      vector<uint8_t> current( rowBytes * height );
+      fillRandom( current, 2 );
+      vector<uint8_t> previous( current );
+      for ( size_t i = 0; i < previous.size(); i += 997 )
+        previous[i] ^= 0x5A;
+      previous.back() ^= 0x01;
+
+      auto tileRows = static_cast<size_t>( ( height + tileHeight - 1 ) / tileHeight );
+      vector<uint8_t> marks[2] = { vector<uint8_t>( columns * tileRows ), vector<uint8_t>( columns * tileRows ) };
+      vector<uint8_t> updated[2] = { previous, previous };
+      // A tile already marked must be left alone
+      marks[0][1] = marks[1][1] = 1;
+      fn( current.data(), updated[0].data(), rowBytes, height, spans.data(), columns, tileHeight, marks[0].data() );
+      reference( current.data(), updated[1].data(), rowBytes, height, spans.data(), columns, tileHeight, marks[1].data() );
+      return ( marks[0] == marks[1] && updated[0] == updated[1] );
+    }
+
+    static bool testUyvyToBGRA( decltype( &scalar::uyvyToBGRA ) fn, decltype( &scalar::uyvyToBGRA ) reference )
+    {
+      const long width = 198;
+      const long height = 5;
+      const size_t sourceRowBytes = width * 2 + 16;
+      const size_t destinationRowBytes = width * 4;
+      vector<uint8_t> source( sourceRowBytes * height );
+      fillRandom( source, 3 );
+      LumaThresholds thresholds;
+      for ( bool rec709 : { false, true } )
+        for ( uint32_t statsFlags : { 0u, static_cast<uint32_t>( LumaStats_Histogram ), static_cast<uint32_t>( LumaStats_Levels ) } )
+        {
+          vector<uint8_t> destination[2] = { vector<uint8_t>( destinationRowBytes * height, 0xCD ), vector<uint8_t>( destinationRowBytes * height, 0xCD ) };
+          LumaStats stats[2] = {};
+          fn( source.data(), sourceRowBytes, destination[0].data(), destinationRowBytes, width, height, rec709, statsFlags, thresholds, stats[0] );
+          reference( source.data(), sourceRowBytes, destination[1].data(), destinationRowBytes, width, height, rec709, statsFlags, thresholds, stats[1] );
+          if ( destination[0] != destination[1] || memcmp( &stats[0], &stats[1], sizeof( LumaStats ) ) != 0 )
+            return false;
+        }
+      return true;
+    }
+
+    //! Clears the two bits on top of each 32-bit word, which 10-bit packed formats leave unused.
+    static void clearPadding( vector<uint8_t>& buffer, bool bigEndian )
+    {
+      for ( size_t i = 0; i + 4 <= buffer.size(); i += 4 )
+        buffer[bigEndian ? i : i + 3] &= 0x3F;
+    }
+
+    static bool testV210ToRGB( decltype( &scalar::v210ToRGB ) fn, decltype( &scalar::v210ToRGB ) reference )
+    {
+      // Ends in a partial chunk of 40 pixels, so each variant's vector steps and its tail run within one
+      const long width = 232;
+      const long height = 3;
+      const size_t sourceRowBytes = ( ( width + 47 ) / 48 ) * 128;
+      vector<uint8_t> source( sourceRowBytes * height );
+      fillRandom( source, 4 );
+      clearPadding( source, false );
+      for ( auto layout : { Rgb_10A2, Rgb_A64 } )
+        for ( bool rec709 : { false, true } )
+        {
+          size_t destinationRowBytes = width * ( layout == Rgb_A64 ? 8 : 4 );
+          vector<uint8_t> destination[2] = { vector<uint8_t>( destinationRowBytes * height, 0xCD ), vector<uint8_t>( destinationRowBytes * height, 0xCD ) };
+          fn( source.data(), sourceRowBytes, destination[0].data(), destinationRowBytes, width, height, rec709, layout );
+          reference( source.data(), sourceRowBytes, destination[1].data(), destinationRowBytes, width, height, rec709, layout );
+          if ( destination[0] != destination[1] )
+            return false;
+        }
+      return true;
+    }
+
+    static bool testR210ToRGB( decltype( &scalar::r210ToRGB ) fn, decltype( &scalar::r210ToRGB ) reference )
+    {
+      const long width = 200;
+      const long height = 3;
+      const size_t sourceRowBytes = ( ( width + 63 ) / 64 ) * 256;
+      vector<uint8_t> source( sourceRowBytes * height );
+      fillRandom( source, 5 );
+      clearPadding( source, true );
+      for ( auto layout : { Rgb_10A2, Rgb_A64 } )
+      {
+        size_t destinationRowBytes = width * ( layout == Rgb_A64 ? 8 : 4 );
+        vector<uint8_t> destination[2] = { vector<uint8_t>( destinationRowBytes * height, 0xCD ), vector<uint8_t>( destinationRowBytes * height, 0xCD ) };
+        fn( source.data(), sourceRowBytes, destination[0].data(), destinationRowBytes, width, height, layout );
+        reference( source.data(), sourceRowBytes, destination[1].data(), destinationRowBytes, width, height, layout );
+        if ( destination[0] != destination[1] )
+          return false;
+      }
+      return true;
+    }
+
+    static bool testV210ToP010( decltype( &scalar::v210ToP010 ) fn, decltype( &scalar::v210ToP010 ) reference )
+    {
+      const long width = 200;
+      const size_t sourceRowBytes = ( ( width + 47 ) / 48 ) * 128;
+      const size_t destinationRowBytes = width * 2;
+      for ( long height : { 6L, 5L } )
+      {
+        vector<uint8_t> source( sourceRowBytes * height );
+        fillRandom( source, 6 );
+        clearPadding( source, false );
+        auto size = destinationRowBytes * ( height + ( height + 1 ) / 2 );
+        vector<uint8_t> destination[2] = { vector<uint8_t>( size, 0xCD ), vector<uint8_t>( size, 0xCD ) };
+        fn( source.data(), sourceRowBytes, destination[0].data(), destinationRowBytes, width, height );
+        reference( source.data(), sourceRowBytes, destination[1].data(), destinationRowBytes, width, height );
+        if ( destination[0] != destination[1] )
+          return false;
+      }
+      return true;
+    }
+
+    static bool testBgraToTensor( decltype( &scalar::bgraToTensor ) fn, decltype( &scalar::bgraToTensor ) reference )
+    {
+      const long width = 37;
+      const long height = 3;
+      const size_t sourceRowBytes = width * 4 + 12;
+      vector<uint8_t> source( sourceRowBytes * height );
+      fillRandom( source, 7 );
+      for ( uint32_t channels : { 3u, 4u } )
+        for ( bool rgb : { false, true } )
+          for ( bool asFloat : { false, true } )
+          {
+            TensorFormat format;
+            format.channels_ = channels;
+            format.rgb_ = rgb;
+            format.float_ = asFloat;
+            auto size = tensorPixelBytes( format ) * width * height;
+            vector<uint8_t> destination[2] = { vector<uint8_t>( size, 0xCD ), vector<uint8_t>( size, 0xCD ) };
+            fn( source.data(), sourceRowBytes, destination[0].data(), width, height, format );
+            reference( source.data(), sourceRowBytes, destination[1].data(), width, height, format );
+            if ( destination[0] != destination[1] )
+              return false;
+          }
+      return true;
+    }
+
+    template <typename Fn, typename Test>
+    static uint32_t testVariants( Kernel<Fn>& kernel, Test test )
+    {
+      uint32_t mismatches = 0;
+      for ( int level = Level_Scalar + 1; level <= supportedLevel(); ++level )
+      {
+        auto variant = kernel.variants_[level];
+        if ( !variant )
+          continue;
+        g_variantsTested++;
+        if ( !test( variant, kernel.variants_[Level_Scalar] ) )
+        {
+          g_mismatches.push_back( string( kernel.name_ ) + "/" + c_levelNames[level] );
+          mismatches++;
+        }
+      }
+      return mismatches;
+    }
+
+    uint32_t selfTest()
+    {
+      ScopedRWLock lock( &g_selfTestLock );
+
+      g_variantsTested = 0;
+      g_mismatches.clear();
+      uint32_t mismatches = 0;
+      mismatches += testVariants( g_fingerprint, testFingerprint );
+      mismatches += testVariants( g_tileDiff, testTileDiff );
+      mismatches += testVariants( g_uyvyToBGRA, testUyvyToBGRA );
+      mismatches += testVariants( g_v210ToRGB, testV210ToRGB );
+      mismatches += testVariants( g_r210ToRGB, testR210ToRGB );
+      mismatches += testVariants( g_v210ToP010, testV210ToP010 );
+      mismatches += testVariants( g_bgraToTensor, testBgraToTensor );
+      g_selfTested = true;
+      return mismatches;
+    }
+
+    void writeStats( JsonWriter& json )
+    {
+      json.beginObject();
+      json.member( "supported", c_levelNames[supportedLevel()] );
+      json.member( "cap", c_levelNames[g_cap.load()] );
+      json.key( "selected" ).beginObject();
+      forEachKernel( [&json]( auto& kernel ) { json.member( kernel.name_, c_levelNames[kernel.level_.load()] ); } );
+      json.endObject();
+      {
+        ScopedRWLock lock( &g_selfTestLock, false );
+        json.key( "selfTest" ).beginObject();
+        json.member( "run", g_selfTested );
+        json.member( "variants", g_variantsTested );
+        json.key( "mismatches" ).beginArray();
+        for ( auto& mismatch : g_mismatches )
+          json.value( mismatch );
+        json.endArray();
+        json.endObject();
+      }
+      json.endObject();
+    }
+
+    uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep )
+    {
+      return g_fingerprint.selected_.load( std::memory_order_relaxed )( data, rowBytes, height, rowStep );
+    }
+
+    void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+      const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks )
+    {
+      g_tileDiff.selected_.load( std::memory_order_relaxed )( current, previous, rowBytes, height, spans, columns, tileHeight, marks );
+    }
+
+    void uyvyToBGRA( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height, bool rec709,
+      uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats )
+    {
+      g_uyvyToBGRA.selected_.load( std::memory_order_relaxed )( source, sourceRowBytes, destination, destinationRowBytes,
+        width, height, rec709, statsFlags, thresholds, stats );
+    }
+
+    void v210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height, bool rec709, RgbLayout layout )
+    {
+      g_v210ToRGB.selected_.load( std::memory_order_relaxed )( source, sourceRowBytes, destination, destinationRowBytes, width, height, rec709, layout );
+    }
+
+    void r210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height, RgbLayout layout )
+    {
+      g_r210ToRGB.selected_.load( std::memory_order_relaxed )( source, sourceRowBytes, destination, destinationRowBytes, width, height, layout );
+    }
+
+    void v210ToP010( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      size_t destinationRowBytes, long width, long height )
+    {
+      g_v210ToP010.selected_.load( std::memory_order_relaxed )( source, sourceRowBytes, destination, destinationRowBytes, width, height );
+    }
+
+    void bgraToTensor( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+      long width, long height, const TensorFormat& format )
+    {
+      g_bgraToTensor.selected_.load( std::memory_order_relaxed )( source, sourceRowBytes, destination, width, height, format );
+    }
+
+  }
+
+}
@@ -0,0 +1,325 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "kernelparts.h"
+
+// Built with AVX2 enabled, and only called into when the processor has it
+
+namespace minibm {
+
+  namespace kernels {
+
+    namespace avx2 {
+
+      static inline bool equal( const uint8_t* a, const uint8_t* b, size_t length )
+      {
+        size_t i = 0;
+        for ( ; i + 64 <= length; i += 64 )
+        {
+          auto pa = reinterpret_cast<const __m256i*>( a + i );
+          auto pb = reinterpret_cast<const __m256i*>( b + i );
+          auto d0 = _mm256_xor_si256( _mm256_loadu_si256( pa ), _mm256_loadu_si256( pb ) );
+          auto d1 = _mm256_xor_si256( _mm256_loadu_si256( pa + 1 ), _mm256_loadu_si256( pb + 1 ) );
+          if ( !_mm256_testz_si256( _mm256_or_si256( d0, d1 ), _mm256_or_si256( d0, d1 ) ) )
+            return false;
+        }
+        for ( ; i + 32 <= length; i += 32 )
+        {
+          auto d = _mm256_xor_si256( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( a + i ) ),
+            _mm256_loadu_si256( reinterpret_cast<const __m256i*>( b + i ) ) );
+          if ( !_mm256_testz_si256( d, d ) )
+            return false;
+        }
+        return ( i == length || memcmp( a + i, b + i, length - i ) == 0 );
+      }
+
+      void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+        const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks )
+      {
+        tileDiffRows<equal>( current, previous, rowBytes, height, spans, columns, tileHeight, marks );
+      }
+
+      static inline __m256i fpLane( __m256i acc, __m256i w, __m256i key )
+      {
+        auto k = _mm256_xor_si256( w, key );
+        auto product = _mm256_mul_epu32( k, _mm256_srli_epi64( k, 32 ) );
+        return _mm256_add_epi64( acc, _mm256_add_epi64( product, w ) );
+      }
+
+      uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep )
+      {
+        alignas( 64 ) uint64_t acc[c_fpLanes];
+        alignas( 64 ) uint64_t key[c_fpLanes];
+        fpInit( acc );
+        rowStep = ( rowStep > 1 ? rowStep : 1 );
+        const auto stripes = rowBytes / c_fpStripe;
+        const auto step0 = _mm256_load_si256( reinterpret_cast<const __m256i*>( c_fpSteps ) );
+        const auto step1 = _mm256_load_si256( reinterpret_cast<const __m256i*>( c_fpSteps ) + 1 );
+        for ( long y = 0; y < height; y += rowStep )
+        {
+          auto row = data + y * rowBytes;
+          auto a0 = _mm256_load_si256( reinterpret_cast<const __m256i*>( acc ) );
+          auto a1 = _mm256_load_si256( reinterpret_cast<const __m256i*>( acc ) + 1 );
+          auto k0 = _mm256_load_si256( reinterpret_cast<const __m256i*>( c_fpKeys ) );
+          auto k1 = _mm256_load_si256( reinterpret_cast<const __m256i*>( c_fpKeys ) + 1 );
+          for ( size_t s = 0; s < stripes; ++s )
+          {
+            auto p = reinterpret_cast<const __m256i*>( row + s * c_fpStripe );
+            a0 = fpLane( a0, _mm256_loadu_si256( p ), k0 );
+            a1 = fpLane( a1, _mm256_loadu_si256( p + 1 ), k1 );
+            k0 = _mm256_add_epi64( k0, step0 );
+            k1 = _mm256_add_epi64( k1, step1 );
+          }
+          _mm256_store_si256( reinterpret_cast<__m256i*>( acc ), a0 );
+          _mm256_store_si256( reinterpret_cast<__m256i*>( acc ) + 1, a1 );
+          _mm256_store_si256( reinterpret_cast<__m256i*>( key ), k0 );
+          _mm256_store_si256( reinterpret_cast<__m256i*>( key ) + 1, k1 );
+          fpRowEnd( acc, key, row, rowBytes );
+        }
+        return fpFinish( acc, rowBytes, height, rowStep );
+      }
+
+      static inline uint32_t horizontalSum16( __m256i counts )
+      {
+        auto wide = _mm256_madd_epi16( counts, _mm256_set1_epi16( 1 ) );
+        auto sums = _mm_add_epi32( _mm256_castsi256_si128( wide ), _mm256_extracti128_si256( wide, 1 ) );
+        sums = _mm_add_epi32( sums, _mm_shuffle_epi32( sums, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+        sums = _mm_add_epi32( sums, _mm_shuffle_epi32( sums, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+        return static_cast<uint32_t>( _mm_cvtsi128_si32( sums ) );
+      }
+
+      //! Same steps as the SSE2 kernel on 16 pixels at a time. Packs and unpacks stay within
+      //! 128-bit lanes, so each lane holds eight pixels until the halves are put in order to store.
+      template <uint32_t Flags>
+      struct UyvyKernel {
+        static void run( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+          size_t destinationRowBytes, long width, long height, const YuvCoefficients& c,
+          const LumaThresholds& thresholds, LumaStats& stats )
+        {
+          const auto cy = _mm256_set1_epi16( c.y_ );
+          const auto crv = _mm256_set1_epi16( c.rv_ );
+          const auto cgu = _mm256_set1_epi16( c.gu_ );
+          const auto cgv = _mm256_set1_epi16( c.gv_ );
+          const auto cbu = _mm256_set1_epi16( c.bu_ );
+          const auto rounding = _mm256_set1_epi16( c_yuvRounding );
+          const auto lumaOffset = _mm256_set1_epi16( 16 );
+          const auto chromaOffset = _mm256_set1_epi16( 128 );
+          const auto lowBytes = _mm256_set1_epi16( 0x00FF );
+          const auto lowWords = _mm256_set1_epi32( 0x0000FFFF );
+          const auto alpha = _mm256_set1_epi8( -1 );
+          const auto blackLimit = _mm256_set1_epi16( static_cast<int16_t>( thresholds.black_ + 1 ) );
+          const auto lowLimit = _mm256_set1_epi16( static_cast<int16_t>( thresholds.clipLow_ + 1 ) );
+          const auto highLimit = _mm256_set1_epi16( static_cast<int16_t>( thresholds.clipHigh_ - 1 ) );
+
+          SplitHistogram histogram;
+          uint32_t black = 0, low = 0, high = 0;
+
+          const long vectorWidth = width & ~15L;
+          for ( long y = 0; y < height; ++y )
+          {
+            auto src = source + y * sourceRowBytes;
+            auto dst = destination + y * destinationRowBytes;
+            auto blackCount = _mm256_setzero_si256();
+            auto lowCount = _mm256_setzero_si256();
+            auto highCount = _mm256_setzero_si256();
+            for ( long x = 0; x < vectorWidth; x += 16 )
+            {
+              auto pixels = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( src + x * 2 ) );
+              auto luma = _mm256_srli_epi16( pixels, 8 );
+              auto chroma = _mm256_and_si256( pixels, lowBytes );
+              auto u = _mm256_and_si256( chroma, lowWords );
+              auto v = _mm256_srli_epi32( chroma, 16 );
+              u = _mm256_or_si256( u, _mm256_slli_epi32( u, 16 ) );
+              v = _mm256_or_si256( v, _mm256_slli_epi32( v, 16 ) );
+
+              auto ys = _mm256_add_epi16( _mm256_mulhi_epi16( _mm256_slli_epi16( _mm256_sub_epi16( luma, lumaOffset ), 7 ), cy ), rounding );
+              auto u7 = _mm256_slli_epi16( _mm256_sub_epi16( u, chromaOffset ), 7 );
+              auto v7 = _mm256_slli_epi16( _mm256_sub_epi16( v, chromaOffset ), 7 );
+              auto b = _mm256_add_epi16( ys, _mm256_mulhi_epi16( u7, cbu ) );
+              auto g = _mm256_add_epi16( ys, _mm256_add_epi16( _mm256_mulhi_epi16( u7, cgu ), _mm256_mulhi_epi16( v7, cgv ) ) );
+              auto r = _mm256_add_epi16( ys, _mm256_mulhi_epi16( v7, crv ) );
+
+              auto bg = _mm256_unpacklo_epi8( _mm256_packus_epi16( b, b ), _mm256_packus_epi16( g, g ) );
+              auto ra = _mm256_unpacklo_epi8( _mm256_packus_epi16( r, r ), alpha );
+              auto first = _mm256_unpacklo_epi16( bg, ra );
+              auto second = _mm256_unpackhi_epi16( bg, ra );
+              _mm256_storeu_si256( reinterpret_cast<__m256i*>( dst + x * 4 ), _mm256_permute2x128_si256( first, second, 0x20 ) );
+              _mm256_storeu_si256( reinterpret_cast<__m256i*>( dst + x * 4 + 32 ), _mm256_permute2x128_si256( first, second, 0x31 ) );
+
+              if constexpr ( ( Flags & LumaStats_Histogram ) != 0 )
+              {
+                histogram.add( src + x * 2 );
+                histogram.add( src + x * 2 + 8 );
+                histogram.add( src + x * 2 + 16 );
+                histogram.add( src + x * 2 + 24 );
+              }
+              if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+              {
+                blackCount = _mm256_sub_epi16( blackCount, _mm256_cmpgt_epi16( blackLimit, luma ) );
+                lowCount = _mm256_sub_epi16( lowCount, _mm256_cmpgt_epi16( lowLimit, luma ) );
+                highCount = _mm256_sub_epi16( highCount, _mm256_cmpgt_epi16( luma, highLimit ) );
+              }
+            }
+            for ( long x = vectorWidth; x < width; ++x )
+            {
+              auto pair = src + ( x >> 1 ) * 4;
+              auto luma = pair[1 + ( x & 1 ) * 2];
+              yuvToBGRA( luma, pair[0], pair[2], c, dst + x * 4 );
+              if constexpr ( ( Flags & LumaStats_Histogram ) != 0 )
+                histogram.tables_[0][luma]++;
+              if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+              {
+                black += ( luma <= thresholds.black_ );
+                low += ( luma <= thresholds.clipLow_ );
+                high += ( luma >= thresholds.clipHigh_ );
+              }
+            }
+            if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+            {
+              black += horizontalSum16( blackCount );
+              low += horizontalSum16( lowCount );
+              high += horizontalSum16( highCount );
+            }
+          }
+
+          if constexpr ( ( Flags & LumaStats_Histogram ) != 0 )
+            histogram.collect( stats.histogram_ );
+          if constexpr ( ( Flags & LumaStats_Levels ) != 0 )
+          {
+            stats.black_ = black;
+            stats.clippedLow_ = low;
+            stats.clippedHigh_ = high;
+          }
+        }
+      };
+
+      void uyvyToBGRA( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709,
+        uint32_t statsFlags, const LumaThresholds& thresholds, LumaStats& stats )
+      {
+        dispatchLumaStats<UyvyKernel>( source, sourceRowBytes, destination, destinationRowBytes,
+          width, height, rec709, statsFlags, thresholds, stats );
+      }
+
+      static inline __m256i pair16( int low, int high )
+      {
+        return _mm256_set1_epi32( static_cast<int>( static_cast<uint16_t>( low ) | ( static_cast<uint32_t>( static_cast<uint16_t>( high ) ) << 16 ) ) );
+      }
+
+      static inline __m256i clampPack16( __m256i low, __m256i high )
+      {
+        const auto bias = _mm256_set1_epi32( 32768 );
+        return _mm256_xor_si256( _mm256_packs_epi32( _mm256_sub_epi32( low, bias ), _mm256_sub_epi32( high, bias ) ),
+          _mm256_set1_epi16( static_cast<int16_t>( 0x8000 ) ) );
+      }
+
+      //! Stores sixteen pixels of 16-bit R, G and B, pixels 0-7 in the low lane and 8-15 in the high one.
+      template <RgbLayout Layout>
+      static inline void storeRGB16x16( __m256i r, __m256i g, __m256i b, uint8_t* out )
+      {
+        if constexpr ( Layout == Rgb_A64 )
+        {
+          const auto alpha = _mm256_set1_epi16( -1 );
+          auto rgLow = _mm256_unpacklo_epi16( r, g );
+          auto rgHigh = _mm256_unpackhi_epi16( r, g );
+          auto baLow = _mm256_unpacklo_epi16( b, alpha );
+          auto baHigh = _mm256_unpackhi_epi16( b, alpha );
+          auto p0 = _mm256_unpacklo_epi32( rgLow, baLow );
+          auto p1 = _mm256_unpackhi_epi32( rgLow, baLow );
+          auto p2 = _mm256_unpacklo_epi32( rgHigh, baHigh );
+          auto p3 = _mm256_unpackhi_epi32( rgHigh, baHigh );
+          _mm256_storeu_si256( reinterpret_cast<__m256i*>( out ), _mm256_permute2x128_si256( p0, p1, 0x20 ) );
+          _mm256_storeu_si256( reinterpret_cast<__m256i*>( out + 32 ), _mm256_permute2x128_si256( p2, p3, 0x20 ) );
+          _mm256_storeu_si256( reinterpret_cast<__m256i*>( out + 64 ), _mm256_permute2x128_si256( p0, p1, 0x31 ) );
+          _mm256_storeu_si256( reinterpret_cast<__m256i*>( out + 96 ), _mm256_permute2x128_si256( p2, p3, 0x31 ) );
+        }
+        else
+        {
+          const auto half = _mm256_set1_epi16( 32 );
+          const auto zero = _mm256_setzero_si256();
+          const auto alpha = _mm256_set1_epi32( static_cast<int>( 0xC0000000u ) );
+          r = _mm256_srli_epi16( _mm256_adds_epu16( r, half ), 6 );
+          g = _mm256_srli_epi16( _mm256_adds_epu16( g, half ), 6 );
+          b = _mm256_srli_epi16( _mm256_adds_epu16( b, half ), 6 );
+          auto low = _mm256_or_si256( _mm256_or_si256( _mm256_unpacklo_epi16( r, zero ), alpha ),
+            _mm256_or_si256( _mm256_slli_epi32( _mm256_unpacklo_epi16( g, zero ), 10 ), _mm256_slli_epi32( _mm256_unpacklo_epi16( b, zero ), 20 ) ) );
+          auto high = _mm256_or_si256( _mm256_or_si256( _mm256_unpackhi_epi16( r, zero ), alpha ),
+            _mm256_or_si256( _mm256_slli_epi32( _mm256_unpackhi_epi16( g, zero ), 10 ), _mm256_slli_epi32( _mm256_unpackhi_epi16( b, zero ), 20 ) ) );
+          _mm256_storeu_si256( reinterpret_cast<__m256i*>( out ), _mm256_permute2x128_si256( low, high, 0x20 ) );
+          _mm256_storeu_si256( reinterpret_cast<__m256i*>( out + 32 ), _mm256_permute2x128_si256( low, high, 0x31 ) );
+        }
+      }
+
+      //! Widens eight 4:2:2 chroma samples to one per pixel, in the lanes of the pixels they belong to.
+      static inline __m256i loadChroma16( const int16_t* chroma )
+      {
+        auto samples = _mm_loadu_si128( reinterpret_cast<const __m128i*>( chroma ) );
+        return _mm256_inserti128_si256( _mm256_castsi128_si256( _mm_unpacklo_epi16( samples, samples ) ),
+          _mm_unpackhi_epi16( samples, samples ), 1 );
+      }
+
+      template <RgbLayout Layout>
+      static void v210ToRGBRows( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, const Yuv10Coefficients& c )
+      {
+        const auto lumaOffset = _mm256_set1_epi16( 64 );
+        const auto chromaOffset = _mm256_set1_epi16( 512 );
+        const auto ones = _mm256_set1_epi16( 1 );
+        const auto rounding = _mm256_set1_epi32( c_yuv10Rounding );
+        const auto yrv = pair16( c.y_, c.rv_ );
+        const auto ygu = pair16( c.y_, c.gu_ );
+        const auto ybu = pair16( c.y_, c.bu_ );
+        const auto gvr = pair16( c.gv_, c_yuv10Rounding );
+
+        for ( long row = 0; row < height; ++row )
+        {
+          auto dst = destination + row * destinationRowBytes;
+          forV210Chunks( source + row * sourceRowBytes, width,
+            [&]( long x0, long count, const int16_t* y, const int16_t* u, const int16_t* v ) {
+            const long vectorCount = count & ~15L;
+            for ( long x = 0; x < vectorCount; x += 16 )
+            {
+              auto ys = _mm256_sub_epi16( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( y + x ) ), lumaOffset );
+              auto us = _mm256_sub_epi16( loadChroma16( u + ( x >> 1 ) ), chromaOffset );
+              auto vs = _mm256_sub_epi16( loadChroma16( v + ( x >> 1 ) ), chromaOffset );
+
+              __m256i r[2], g[2], b[2];
+              for ( int half = 0; half < 2; ++half )
+              {
+                auto yu = ( half ? _mm256_unpackhi_epi16( ys, us ) : _mm256_unpacklo_epi16( ys, us ) );
+                auto yv = ( half ? _mm256_unpackhi_epi16( ys, vs ) : _mm256_unpacklo_epi16( ys, vs ) );
+                auto v1 = ( half ? _mm256_unpackhi_epi16( vs, ones ) : _mm256_unpacklo_epi16( vs, ones ) );
+                r[half] = _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( yv, yrv ), rounding ), 7 );
+                g[half] = _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( yu, ygu ), _mm256_madd_epi16( v1, gvr ) ), 7 );
+                b[half] = _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( yu, ybu ), rounding ), 7 );
+              }
+              storeRGB16x16<Layout>( clampPack16( r[0], r[1] ), clampPack16( g[0], g[1] ), clampPack16( b[0], b[1] ),
+                dst + ( x0 + x ) * rgbPixelBytes( Layout ) );
+            }
+            for ( long x = vectorCount; x < count; ++x )
+            {
+              uint16_t rgb[3];
+              yuv10ToRGB16( y[x], u[x >> 1], v[x >> 1], c, rgb );
+              storeRGB16<Layout>( rgb, dst + ( x0 + x ) * rgbPixelBytes( Layout ) );
+            }
+          } );
+        }
+      }
+
+      void v210ToRGB( const uint8_t* source, size_t sourceRowBytes, uint8_t* destination,
+        size_t destinationRowBytes, long width, long height, bool rec709, RgbLayout layout )
+      {
+        auto& c = ( rec709 ? c_rec709x10 : c_rec601x10 );
+        if ( layout == Rgb_A64 )
+          v210ToRGBRows<Rgb_A64>( source, sourceRowBytes, destination, destinationRowBytes, width, height, c );
+        else
+          v210ToRGBRows<Rgb_10A2>( source, sourceRowBytes, destination, destinationRowBytes, width, height, c );
+      }
+
+    }
+
+  }
+
+}
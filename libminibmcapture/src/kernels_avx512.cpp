@@ -0,0 +1,86 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "kernelparts.h"
+
+// Built with AVX-512 enabled, and only called into when the processor has AVX-512F and BW
+
+namespace minibm {
+
+  namespace kernels {
+
+    namespace avx512 {
+
+      static inline bool equal( const uint8_t* a, const uint8_t* b, size_t length )
+      {
+        size_t i = 0;
+        for ( ; i + 128 <= length; i += 128 )
+        {
+          auto d0 = _mm512_xor_si512( _mm512_loadu_si512( a + i ), _mm512_loadu_si512( b + i ) );
+          auto d1 = _mm512_xor_si512( _mm512_loadu_si512( a + i + 64 ), _mm512_loadu_si512( b + i + 64 ) );
+          auto any = _mm512_or_si512( d0, d1 );
+          if ( _mm512_test_epi64_mask( any, any ) )
+            return false;
+        }
+        for ( ; i + 64 <= length; i += 64 )
+        {
+          auto d = _mm512_xor_si512( _mm512_loadu_si512( a + i ), _mm512_loadu_si512( b + i ) );
+          if ( _mm512_test_epi64_mask( d, d ) )
+            return false;
+        }
+        // Masked loads don't touch the bytes past the end
+        if ( i < length )
+        {
+          auto mask = ( 1ull << ( length - i ) ) - 1;
+          if ( _mm512_mask_cmpneq_epu8_mask( mask, _mm512_maskz_loadu_epi8( mask, a + i ), _mm512_maskz_loadu_epi8( mask, b + i ) ) )
+            return false;
+        }
+        return true;
+      }
+
+      void tileDiff( const uint8_t* current, uint8_t* previous, size_t rowBytes, long height,
+        const TileSpan* spans, uint32_t columns, long tileHeight, uint8_t* marks )
+      {
+        tileDiffRows<equal>( current, previous, rowBytes, height, spans, columns, tileHeight, marks );
+      }
+
+      static inline __m512i fpLane( __m512i acc, __m512i w, __m512i key )
+      {
+        auto k = _mm512_xor_si512( w, key );
+        auto product = _mm512_mul_epu32( k, _mm512_srli_epi64( k, 32 ) );
+        return _mm512_add_epi64( acc, _mm512_add_epi64( product, w ) );
+      }
+
+      uint64_t fingerprint( const uint8_t* data, size_t rowBytes, long height, long rowStep )
+      {
+        // All eight lanes fit in one register
+        alignas( 64 ) uint64_t acc[c_fpLanes];
+        alignas( 64 ) uint64_t key[c_fpLanes];
+        fpInit( acc );
+        rowStep = ( rowStep > 1 ? rowStep : 1 );
+        const auto stripes = rowBytes / c_fpStripe;
+        const auto step = _mm512_load_si512( c_fpSteps );
+        for ( long y = 0; y < height; y += rowStep )
+        {
+          auto row = data + y * rowBytes;
+          auto a = _mm512_load_si512( acc );
+          auto k = _mm512_load_si512( c_fpKeys );
+          for ( size_t s = 0; s < stripes; ++s )
+          {
+            a = fpLane( a, _mm512_loadu_si512( row + s * c_fpStripe ), k );
+            k = _mm512_add_epi64( k, step );
+          }
+          _mm512_store_si512( acc, a );
+          _mm512_store_si512( key, k );
+          fpRowEnd( acc, key, row, rowBytes );
+        }
+        return fpFinish( acc, rowBytes, height, rowStep );
+      }
+
+    }
+
+  }
+
+}
@@ -0,0 +1,111 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "numa.h"
+
+#include <setupapi.h>
+#include <devpkey.h>
+#include <psapi.h>
+
+#pragma comment( lib, "setupapi.lib" )
+
+namespace minibm {
+
+  namespace numa {
+
+    //! Uppercases and turns interface path separators into instance ID ones, so that
+    //! "\\?\PCI#VEN_BDBD&..." and "PCI\VEN_BDBD&..." can be matched against each other.
+    static string normalize( string value )
+    {
+      for ( auto& c : value )
+        c = ( c == '#' ? '\\' : static_cast<char>( toupper( static_cast<unsigned char>( c ) ) ) );
+      return value;
+    }
+
+    int deviceNode( const string& handle )
+    {
+      if ( handle.empty() )
+        return -1;
+
+      auto devices = SetupDiGetClassDevsA( nullptr, "PCI", nullptr, DIGCF_ALLCLASSES | DIGCF_PRESENT );
+      if ( devices == INVALID_HANDLE_VALUE )
+        return -1;
+
+      auto target = normalize( handle );
+      int node = -1;
+      SP_DEVINFO_DATA info = { 0 };
+      info.cbSize = sizeof( info );
+      for ( DWORD i = 0; SetupDiEnumDeviceInfo( devices, i, &info ); ++i )
+      {
+        char instance[MAX_DEVICE_ID_LEN] = { 0 };
+        if ( !SetupDiGetDeviceInstanceIdA( devices, &info, instance, MAX_DEVICE_ID_LEN, nullptr ) )
+          continue;
+        if ( target.find( normalize( instance ) ) == string::npos )
+          continue;
+
+        DEVPROPTYPE type = 0;
+        int32_t value = -1;
+        if ( SetupDiGetDevicePropertyW( devices, &info, &DEVPKEY_Device_Numa_Node, &type,
+          reinterpret_cast<PBYTE>( &value ), sizeof( value ), nullptr, 0 )
+          && ( type == DEVPROP_TYPE_INT32 || type == DEVPROP_TYPE_UINT32 ) )
+          node = value;
+        break;
+      }
+
+      SetupDiDestroyDeviceInfoList( devices );
+      return node;
+    }
+
+    bool nodeAffinity( int node, GROUP_AFFINITY& out_affinity )
+    {
+      out_affinity = { 0 };
+      return ( node >= 0 && GetNumaNodeProcessorMaskEx( static_cast<USHORT>( node ), &out_affinity )
+        && out_affinity.Mask );
+    }
+
+    int currentNode()
+    {
+      PROCESSOR_NUMBER processor;
+      GetCurrentProcessorNumberEx( &processor );
+      USHORT node = 0;
+      if ( !GetNumaProcessorNodeEx( &processor, &node ) || node == MAXUSHORT )
+        return -1;
+      return node;
+    }
+
+    void pagePlacement( const void* data, size_t size, int node, uint64_t& out_local, uint64_t& out_remote )
+    {
+      static const size_t c_pageSize = 4096;
+      static const size_t c_samples = 64;
+
+      if ( !data || !size )
+        return;
+
+      // Looking at every page of a 4K frame would be far too slow for a stats call
+      auto pages = ( size + c_pageSize - 1 ) / c_pageSize;
+      auto step = std::max<size_t>( pages / c_samples, 1 );
+      PSAPI_WORKING_SET_EX_INFORMATION info[c_samples];
+      DWORD count = 0;
+      for ( size_t page = 0; page < pages && count < c_samples; page += step )
+        info[count++].VirtualAddress = const_cast<uint8_t*>( static_cast<const uint8_t*>( data ) ) + page * c_pageSize;
+
+      if ( !QueryWorkingSetEx( GetCurrentProcess(), info, count * sizeof( PSAPI_WORKING_SET_EX_INFORMATION ) ) )
+        return;
+
+      for ( DWORD i = 0; i < count; ++i )
+      {
+        if ( !info[i].VirtualAttributes.Valid )
+          continue;
+        if ( static_cast<int>( info[i].VirtualAttributes.Node ) == node )
+          out_local++;
+        else
+          out_remote++;
+      }
+    }
+
+  }
+
+}
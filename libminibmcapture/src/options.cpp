@@ -0,0 +1,129 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "options.h"
+
+namespace minibm {
+
+  inline bool isSeparator( char c )
+  {
+    return ( c == ';' || c == ' ' || c == '\t' || c == '\r' || c == '\n' );
+  }
+
+  inline string lowercase( string str )
+  {
+    for ( auto& c : str )
+      c = static_cast<char>( tolower( static_cast<unsigned char>( c ) ) );
+    return str;
+  }
+
+  void Options::parse( const char* str )
+  {
+    if ( !str )
+      return;
+
+    while ( *str )
+    {
+      while ( *str && isSeparator( *str ) )
+        str++;
+      auto start = str;
+      while ( *str && !isSeparator( *str ) )
+        str++;
+      if ( str == start )
+        continue;
+
+      string pair( start, str );
+      auto eq = pair.find( '=' );
+      if ( eq == 0 )
+        continue;
+      if ( eq == string::npos )
+        values_[lowercase( pair )] = "1";
+      else
+        values_[lowercase( pair.substr( 0, eq ) )] = pair.substr( eq + 1 );
+    }
+  }
+
+  void Options::merge( const Options& other )
+  {
+    for ( auto& it : other.values_ )
+      values_[it.first] = it.second;
+  }
+
+  string Options::getString( const string& key, const string& defaultValue ) const
+  {
+    auto it = values_.find( key );
+    return ( it != values_.end() ? it->second : defaultValue );
+  }
+
+  int64_t Options::getInt( const string& key, int64_t defaultValue ) const
+  {
+    auto it = values_.find( key );
+    if ( it == values_.end() || it->second.empty() )
+      return defaultValue;
+
+    char* end = nullptr;
+    auto value = strtoll( it->second.c_str(), &end, 0 );
+    return ( end && *end == '\0' ? value : defaultValue );
+  }
+
+  uint64_t Options::getUnsigned( const string& key, uint64_t defaultValue ) const
+  {
+    auto it = values_.find( key );
+    if ( it == values_.end() || it->second.empty() )
+      return defaultValue;
+
+    char* end = nullptr;
+    auto value = strtoull( it->second.c_str(), &end, 0 );
+    return ( end && *end == '\0' ? value : defaultValue );
+  }
+
+  double Options::getFloat( const string& key, double defaultValue ) const
+  {
+    auto it = values_.find( key );
+    if ( it == values_.end() || it->second.empty() )
+      return defaultValue;
+
+    char* end = nullptr;
+    auto value = strtod( it->second.c_str(), &end );
+    return ( end && *end == '\0' ? value : defaultValue );
+  }
+
+  bool Options::getBool( const string& key, bool defaultValue ) const
+  {
+    auto it = values_.find( key );
+    if ( it == values_.end() )
+      return defaultValue;
+
+    auto value = lowercase( it->second );
+    if ( value == "1" || value == "true" || value == "yes" || value == "on" )
+      return true;
+    if ( value == "0" || value == "false" || value == "no" || value == "off" )
+      return false;
+
+    return defaultValue;
+  }
+
+  vector<string> Options::getList( const string& key ) const
+  {
+    vector<string> items;
+    auto it = values_.find( key );
+    if ( it == values_.end() )
+      return items;
+
+    size_t start = 0;
+    while ( start <= it->second.size() )
+    {
+      auto end = it->second.find( ',', start );
+      if ( end == string::npos )
+        end = it->second.size();
+      if ( end > start )
+        items.push_back( lowercase( it->second.substr( start, end - start ) ) );
+      start = end + 1;
+    }
+    return items;
+  }
+
+}
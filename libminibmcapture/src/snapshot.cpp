@@ -0,0 +1,154 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "snapshot.h"
+#include "minibmcap.h"
+#include "json.h"
+
+namespace minibm {
+
+  void SnapshotStage::configure( const Options& options, WorkerPool* pool )
+  {
+    stop();
+
+    auto format = options.getString( "snapshot" );
+    format_ = ( format == "jpeg" || format == "jpg" ? Snapshot_JPEG : format == "qoi" ? Snapshot_QOI : Snapshot_None );
+    if ( !pool )
+      format_ = Snapshot_None;
+    interval_ = std::max<int64_t>( options.getInt( "snapshot.interval", 1000 ), 0 ) * 1000;
+    width_ = static_cast<long>( std::max<int64_t>( options.getInt( "snapshot.width", 0 ), 0 ) );
+    jpeg_.setQuality( static_cast<int>( options.getInt( "snapshot.quality", 75 ) ) );
+    pool_ = pool;
+    lastTaken_ = 0;
+    source_.setCategory( Memory_Encoder );
+    scaled_.setCategory( Memory_Encoder );
+    if ( !enabled() )
+    {
+      source_.clear();
+      scaled_.clear();
+    }
+
+    ScopedRWLock lock( &lock_ );
+    latest_.reset();
+    encoded_ = skipped_ = 0;
+    lastEncodeTime_ = maxEncodeTime_ = 0;
+  }
+
+  void SnapshotStage::offer( OutputVideoFrame& frame )
+  {
+    if ( !enabled() || !frame.GetWidth() || !frame.GetHeight() || frame.format() != Pixel_BGRA )
+      return;
+
+    auto now = timeMicroseconds();
+    if ( lastTaken_ && now - lastTaken_ < interval_ )
+      return;
+    lastTaken_ = now;
+
+    if ( busy_.load() )
+    {
+      ScopedRWLock lock( &lock_ );
+      skipped_++;
+      return;
+    }
+
+    // Copying is cheaper than anything else we could do on the callback thread
+    sourceWidth_ = frame.GetWidth();
+    sourceHeight_ = frame.GetHeight();
+    try
+    {
+      source_.resize( static_cast<size_t>( frame.GetRowBytes() ) * sourceHeight_ );
+    }
+    catch ( std::bad_alloc& )
+    {
+      ScopedRWLock lock( &lock_ );
+      skipped_++;
+      return;
+    }
+    memcpy( source_.data(), frame.data(), source_.size() );
+    pending_.format_ = format_;
+    pending_.index_ = frame.index_;
+    pending_.timestamp_ = frame.streamTime_;
+    pending_.timescale_ = frame.timeScale_;
+
+    busy_ = true;
+    idle_.reset();
+    pool_->submit( [this]() {
+      // A refused scaling buffer only costs this snapshot
+      try
+      {
+        encode();
+      }
+      catch ( std::bad_alloc& )
+      {
+        ScopedRWLock lock( &lock_ );
+        skipped_++;
+      }
+      busy_ = false;
+      idle_.set();
+    } );
+  }
+
+  void SnapshotStage::encode()
+  {
+    auto start = timeMicroseconds();
+
+    auto pixels = source_.data();
+    auto rowBytes = static_cast<size_t>( sourceWidth_ ) * 4;
+    long width = sourceWidth_;
+    long height = sourceHeight_;
+    if ( width_ && width_ < sourceWidth_ )
+    {
+      width = width_;
+      height = std::max( 1L, static_cast<long>( static_cast<int64_t>( sourceHeight_ ) * width_ / sourceWidth_ ) );
+      scaled_.resize( static_cast<size_t>( width ) * height * 4 );
+      codecs::scaleBGRA( source_.data(), rowBytes, sourceWidth_, sourceHeight_, scaled_.data(), width, height );
+      pixels = scaled_.data();
+      rowBytes = static_cast<size_t>( width ) * 4;
+    }
+
+    auto snapshot = std::make_shared<Snapshot>( pending_ );
+    snapshot->width_ = static_cast<uint32_t>( width );
+    snapshot->height_ = static_cast<uint32_t>( height );
+    if ( snapshot->format_ == Snapshot_JPEG )
+      jpeg_.encode( pixels, rowBytes, width, height, snapshot->data_, pool_ );
+    else
+      codecs::encodeQOI( pixels, rowBytes, width, height, snapshot->data_ );
+
+    auto elapsed = timeMicroseconds() - start;
+
+    ScopedRWLock lock( &lock_ );
+    latest_ = move( snapshot );
+    encoded_++;
+    lastEncodeTime_ = elapsed;
+    maxEncodeTime_ = std::max( maxEncodeTime_, elapsed );
+  }
+
+  SnapshotPtr SnapshotStage::latest()
+  {
+    ScopedRWLock lock( &lock_, false );
+    return latest_;
+  }
+
+  void SnapshotStage::stop()
+  {
+    idle_.wait();
+  }
+
+  void SnapshotStage::writeStats( JsonWriter& json )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    json.beginObject();
+    json.member( "format", format_ == Snapshot_JPEG ? "jpeg" : format_ == Snapshot_QOI ? "qoi" : "off" );
+    json.member( "encoded", encoded_ );
+    json.member( "skipped", skipped_ );
+    json.member( "lastEncodeTimeUs", lastEncodeTime_ );
+    json.member( "maxEncodeTimeUs", maxEncodeTime_ );
+    json.member( "lastSize", latest_ ? latest_->data_.size() : 0 );
+    json.endObject();
+  }
+
+}
@@ -0,0 +1,346 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "threads.h"
+#include "json.h"
+#include "numa.h"
+
+#include <avrt.h>
+
+#pragma comment( lib, "avrt.lib" )
+
+namespace minibm {
+
+  static atomic<uint32_t> g_policyVersion = 0;
+
+  struct PriorityName {
+    const char* name_;
+    int value_;
+  };
+
+  static const PriorityName c_priorityNames[] = {
+    { "idle", THREAD_PRIORITY_IDLE },
+    { "lowest", THREAD_PRIORITY_LOWEST },
+    { "below", THREAD_PRIORITY_BELOW_NORMAL },
+    { "normal", THREAD_PRIORITY_NORMAL },
+    { "above", THREAD_PRIORITY_ABOVE_NORMAL },
+    { "highest", THREAD_PRIORITY_HIGHEST },
+    { "critical", THREAD_PRIORITY_TIME_CRITICAL }
+  };
+
+  const char* threadRoleName( ThreadRole role )
+  {
+    switch ( role )
+    {
+      case ThreadRole_Callback: return "callback";
+      case ThreadRole_Worker: return "worker";
+      default: return "unknown";
+    }
+  }
+
+  static const char* priorityName( int priority )
+  {
+    for ( auto& it : c_priorityNames )
+      if ( it.value_ == priority )
+        return it.name_;
+    return "unknown";
+  }
+
+  ThreadPolicy ThreadPolicy::fromOptions( const Options& options, ThreadRole role, const ThreadPolicy& base )
+  {
+    ThreadPolicy policy = base;
+    string prefix = threadRoleName( role );
+
+    if ( options.has( prefix + ".affinity" ) )
+      policy.affinity_ = options.getUnsigned( prefix + ".affinity", 0 );
+
+    if ( options.has( prefix + ".priority" ) )
+    {
+      auto value = options.getString( prefix + ".priority" );
+      policy.priority_ = THREAD_PRIORITY_ERROR_RETURN;
+      for ( auto& it : c_priorityNames )
+        if ( _stricmp( value.c_str(), it.name_ ) == 0 )
+          policy.priority_ = it.value_;
+    }
+
+    if ( options.has( prefix + ".mmcss" ) )
+      policy.mmcssTask_ = options.getString( prefix + ".mmcss" );
+
+    policy.version_ = g_policyVersion.fetch_add( 1 ) + 1;
+    return policy;
+  }
+
+  void ThreadPolicy::writeStats( JsonWriter& json ) const
+  {
+    json.beginObject();
+    json.member( "affinity", affinity_ );
+    json.member( "numaNode", numaNode_ );
+    json.member( "priority", priority_ == THREAD_PRIORITY_ERROR_RETURN ? "default" : priorityName( priority_ ) );
+    json.member( "mmcss", mmcssTask_ );
+    json.endObject();
+  }
+
+  void ThreadState::writeStats( JsonWriter& json ) const
+  {
+    json.beginObject();
+    json.member( "threadId", threadId_.load() );
+    json.member( "affinity", affinity_.load() );
+    json.member( "group", group_.load() );
+    json.member( "priority", priorityName( priority_.load() ) );
+    json.member( "mmcssTaskIndex", mmcssTaskIndex_.load() );
+    json.member( "lastError", lastError_.load() );
+    json.endObject();
+  }
+
+  void applyThreadPolicy( const ThreadPolicy& policy, ThreadState& state )
+  {
+    auto threadId = GetCurrentThreadId();
+    if ( state.threadId_.load( std::memory_order_relaxed ) == threadId
+      && state.version_.load( std::memory_order_relaxed ) == policy.version_ )
+      return;
+
+    auto thread = GetCurrentThread();
+    DWORD error = 0;
+
+    // A different thread (or one we restored) gets its own scheduling saved,
+    // so that restoreThreadPolicy can put it back the way we found it
+    if ( state.threadId_.load( std::memory_order_relaxed ) != threadId )
+    {
+      if ( state.mmcssHandle_ )
+        AvRevertMmThreadCharacteristics( state.mmcssHandle_ );
+      state.mmcssHandle_ = nullptr;
+      state.mmcssTaskIndex_ = 0;
+      state.saved_ = ( GetThreadGroupAffinity( thread, &state.savedAffinity_ ) != FALSE );
+      state.savedPriority_ = GetThreadPriority( thread );
+    }
+
+    if ( policy.affinity_ && !SetThreadAffinityMask( thread, static_cast<DWORD_PTR>( policy.affinity_ ) ) )
+      error = GetLastError();
+    else if ( !policy.affinity_ && policy.numaNode_ >= 0 )
+    {
+      GROUP_AFFINITY affinity;
+      if ( !numa::nodeAffinity( policy.numaNode_, affinity ) )
+        error = ERROR_INVALID_PARAMETER;
+      else if ( !SetThreadGroupAffinity( thread, &affinity, nullptr ) )
+        error = GetLastError();
+    }
+
+    if ( policy.priority_ != THREAD_PRIORITY_ERROR_RETURN && !SetThreadPriority( thread, policy.priority_ ) )
+      error = GetLastError();
+
+    if ( state.mmcssHandle_ )
+      AvRevertMmThreadCharacteristics( state.mmcssHandle_ );
+    state.mmcssHandle_ = nullptr;
+    state.mmcssTaskIndex_ = 0;
+
+    if ( !policy.mmcssTask_.empty() )
+    {
+      std::wstring task( policy.mmcssTask_.begin(), policy.mmcssTask_.end() );
+      DWORD taskIndex = 0;
+      state.mmcssHandle_ = AvSetMmThreadCharacteristicsW( task.c_str(), &taskIndex );
+      if ( state.mmcssHandle_ )
+        state.mmcssTaskIndex_ = taskIndex;
+      else
+        error = GetLastError();
+    }
+
+    GROUP_AFFINITY affinity = { 0 };
+    if ( GetThreadGroupAffinity( thread, &affinity ) )
+    {
+      state.affinity_ = affinity.Mask;
+      state.group_ = affinity.Group;
+    }
+
+    state.priority_ = GetThreadPriority( thread );
+    state.lastError_ = error;
+    state.threadId_ = threadId;
+    state.version_ = policy.version_;
+  }
+
+  void restoreThreadPolicy( ThreadState& state )
+  {
+    auto threadId = state.threadId_.load();
+    if ( !threadId )
+      return;
+
+    // The MMCSS handle names the registration, so it can be reverted from here
+    if ( state.mmcssHandle_ )
+      AvRevertMmThreadCharacteristics( state.mmcssHandle_ );
+    state.mmcssHandle_ = nullptr;
+    state.mmcssTaskIndex_ = 0;
+
+    bool current = ( threadId == GetCurrentThreadId() );
+    auto thread = current ? GetCurrentThread()
+      : OpenThread( THREAD_SET_INFORMATION | THREAD_QUERY_INFORMATION, FALSE, threadId );
+    if ( thread )
+    {
+      if ( state.saved_ )
+        SetThreadGroupAffinity( thread, &state.savedAffinity_, nullptr );
+      if ( state.savedPriority_ != THREAD_PRIORITY_ERROR_RETURN )
+        SetThreadPriority( thread, state.savedPriority_ );
+      if ( !current )
+        CloseHandle( thread );
+    }
+
+    state.saved_ = false;
+    state.savedPriority_ = THREAD_PRIORITY_ERROR_RETURN;
+    state.threadId_ = 0;
+    state.version_ = 0;
+  }
+
+  DWORD WINAPI WorkerPool::threadProc( LPVOID param )
+  {
+    auto worker = static_cast<Worker*>( param );
+    worker->pool_->run( *worker );
+    return 0;
+  }
+
+  void WorkerPool::run( Worker& worker )
+  {
+    lock_.lock();
+    while ( true )
+    {
+      while ( queue_.empty() && !stopping_ )
+        wake_.wait( lock_ );
+      // Stopping drains the queue first, so nobody is left waiting on a task
+      if ( queue_.empty() )
+        break;
+      auto task = move( queue_.front() );
+      queue_.pop_front();
+      applyThreadPolicy( policy_, worker.state_ );
+      lock_.unlock();
+      task();
+      worker.tasks_++;
+      lock_.lock();
+    }
+    lock_.unlock();
+  }
+
+  void WorkerPool::stop()
+  {
+    {
+      ScopedRWLock lock( &lock_ );
+      stopping_ = true;
+      wake_.wakeAll();
+    }
+    for ( auto& worker : workers_ )
+    {
+      WaitForSingleObject( worker->thread_, INFINITE );
+      CloseHandle( worker->thread_ );
+    }
+    ScopedRWLock lock( &lock_ );
+    workers_.clear();
+    stopping_ = false;
+  }
+
+  void WorkerPool::resize( size_t count )
+  {
+    if ( !workers_.empty() )
+      stop();
+
+    ScopedRWLock lock( &lock_ );
+    for ( size_t i = 0; i < count; ++i )
+    {
+      auto worker = std::make_unique<Worker>();
+      worker->pool_ = this;
+      worker->thread_ = CreateThread( nullptr, 0, threadProc, worker.get(), 0, nullptr );
+      if ( !worker->thread_ )
+        break;
+      workers_.push_back( move( worker ) );
+    }
+  }
+
+  size_t WorkerPool::size()
+  {
+    ScopedRWLock lock( &lock_, false );
+    return workers_.size();
+  }
+
+  void WorkerPool::setPolicy( const ThreadPolicy& policy )
+  {
+    ScopedRWLock lock( &lock_ );
+    policy_ = policy;
+  }
+
+  void WorkerPool::submit( Task task )
+  {
+    {
+      ScopedRWLock lock( &lock_ );
+      if ( !workers_.empty() )
+      {
+        queue_.push_back( move( task ) );
+        wake_.wakeOne();
+        return;
+      }
+    }
+    task();
+  }
+
+  void WorkerPool::parallelFor( size_t count, const std::function<void( size_t )>& fn )
+  {
+    // Helpers that only get to run after everything is done find no indices left,
+    // and never touch fn, which might be gone by then
+    struct Shared {
+      atomic<size_t> next_ = 0;
+      atomic<size_t> done_ = 0;
+      size_t count_ = 0;
+      const std::function<void( size_t )>* fn_ = nullptr;
+      Event finished_;
+      void work()
+      {
+        size_t index;
+        while ( ( index = next_.fetch_add( 1 ) ) < count_ )
+        {
+          ( *fn_ )( index );
+          if ( done_.fetch_add( 1 ) + 1 == count_ )
+            finished_.set();
+        }
+      }
+    };
+
+    if ( !count )
+      return;
+
+    auto shared = std::make_shared<Shared>();
+    shared->count_ = count;
+    shared->fn_ = &fn;
+
+    auto helpers = std::min( count - 1, size() );
+    for ( size_t i = 0; i < helpers; ++i )
+      submit( [shared]() { shared->work(); } );
+
+    shared->work();
+    shared->finished_.wait();
+  }
+
+  void WorkerPool::writeStats( JsonWriter& json )
+  {
+    ScopedRWLock lock( &lock_, false );
+
+    json.beginObject();
+    json.member( "queued", queue_.size() );
+    json.key( "requested" );
+    policy_.writeStats( json );
+    json.key( "workers" ).beginArray();
+    for ( auto& worker : workers_ )
+    {
+      json.beginObject();
+      json.member( "tasks", worker->tasks_.load() );
+      json.key( "effective" );
+      worker->state_.writeStats( json );
+      json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    if ( !workers_.empty() )
+      stop();
+  }
+
+}
@@ -0,0 +1,161 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+#include "pch.h"
+#include "trace.h"
+#include "options.h"
+#include "utils.h"
+#include "json.h"
+
+namespace minibm {
+
+  namespace trace {
+
+    atomic<bool> g_enabled = false;
+
+    struct Event {
+      int64_t time_; //!< Microseconds
+      const char* name_;
+      uint32_t frame_;
+      Phase phase_;
+    };
+
+    //! Events of one thread. Only that thread writes to it, so recording takes no locks.
+    //! Readers copy it out and then throw away whatever the writer might have lapped meanwhile.
+    struct Ring {
+      vector<Event> events_;
+      atomic<uint64_t> written_ = 0;
+      atomic<uint64_t> cleared_ = 0; //!< Events before this were dropped by turning tracing on again.
+      DWORD thread_ = 0;
+      atomic<bool> free_ = false; //!< Its thread has exited, and another one can take it over.
+    };
+
+    // Rings are never freed, as threads may still record into them while the library is torn down
+    static RWLock g_ringsLock;
+    static vector<Ring*> g_rings;
+    static atomic<size_t> g_ringSize = 4096;
+
+    //! Hands the ring back when its thread exits.
+    struct RingOwner {
+      Ring* ring_ = nullptr;
+      ~RingOwner()
+      {
+        if ( ring_ )
+          ring_->free_ = true;
+      }
+    };
+
+    static thread_local RingOwner t_ring;
+
+    static Ring* acquireRing()
+    {
+      ScopedRWLock lock( &g_ringsLock );
+
+      Ring* ring = nullptr;
+      for ( auto candidate : g_rings )
+        if ( candidate->free_.load() )
+        {
+          ring = candidate;
+          break;
+        }
+      if ( !ring )
+      {
+        ring = new Ring();
+        g_rings.push_back( ring );
+      }
+
+      // Resizing is safe here, as readers copy out under the same lock
+      ring->events_.resize( g_ringSize.load() );
+      ring->written_ = 0;
+      ring->cleared_ = 0;
+      ring->thread_ = GetCurrentThreadId();
+      ring->free_ = false;
+      return ring;
+    }
+
+    void record( Phase phase, const char* name, uint32_t frame )
+    {
+      auto ring = t_ring.ring_;
+      if ( !ring )
+        ring = t_ring.ring_ = acquireRing();
+
+      auto written = ring->written_.load( std::memory_order_relaxed );
+      auto& event = ring->events_[written % ring->events_.size()];
+      event.time_ = timeMicroseconds();
+      event.name_ = name;
+      event.frame_ = frame;
+      event.phase_ = phase;
+      ring->written_.store( written + 1, std::memory_order_release );
+    }
+
+    void configure( const Options& options )
+    {
+      if ( options.has( "trace.size" ) )
+        g_ringSize = static_cast<size_t>( std::max<uint64_t>( options.getUnsigned( "trace.size" ), 16 ) );
+      if ( !options.has( "trace" ) )
+        return;
+
+      bool enable = options.getBool( "trace" );
+      if ( enable && !g_enabled.load() )
+      {
+        ScopedRWLock lock( &g_ringsLock, false );
+        for ( auto ring : g_rings )
+          ring->cleared_ = ring->written_.load();
+      }
+      g_enabled = enable;
+    }
+
+    void writeJson( string& out )
+    {
+      JsonWriter json( out );
+      json.beginObject();
+      json.member( "displayTimeUnit", "ms" );
+      json.key( "traceEvents" ).beginArray();
+
+      auto process = GetCurrentProcessId();
+      vector<Event> events;
+      ScopedRWLock lock( &g_ringsLock, false );
+      for ( auto ring : g_rings )
+      {
+        auto size = ring->events_.size();
+        auto end = ring->written_.load( std::memory_order_acquire );
+        auto start = std::max( ring->cleared_.load(), end > size ? end - size : 0 );
+        events.clear();
+        for ( auto i = start; i < end; ++i )
+          events.push_back( ring->events_[i % size] );
+
+        // Anything the writer got around to overwriting while we copied, or is overwriting right now, is torn
+        auto lapped = ring->written_.load( std::memory_order_acquire ) + 1;
+        auto skip = ( lapped > start + size ? static_cast<size_t>( lapped - start - size ) : 0 );
+        // Spans that lost their beginning to the ring wrapping are left open-ended, which viewers handle
+        for ( size_t i = skip; i < events.size(); ++i )
+        {
+          auto& event = events[i];
+          json.beginObject();
+          json.member( "name", event.name_ );
+          json.member( "cat", "frame" );
+          json.key( "ph" ).value( string( 1, static_cast<char>( event.phase_ ) ) );
+          json.member( "ts", event.time_ );
+          json.member( "pid", process );
+          json.member( "tid", ring->thread_ );
+          if ( event.phase_ == Phase_Instant )
+            json.member( "s", "t" );
+          if ( event.frame_ )
+          {
+            json.key( "args" ).beginObject();
+            json.member( "frame", event.frame_ );
+            json.endObject();
+          }
+          json.endObject();
+        }
+      }
+
+      json.endArray();
+      json.endObject();
+    }
+
+  }
+
+}
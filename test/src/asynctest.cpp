@@ -0,0 +1,331 @@
+// libminibmcapture (c) 2020 noorus
+// This software is licensed under the zlib license.
+// See the LICENSE file which should be included with
+// this source distribution for details.
+
+// Drives FrameSource from libminibmcapture_async.h with a simulated capture,
+// so it runs without a device and without calling into the library at all.
+
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#undef MINIBM_STATIC
+#include "libminibmcapture_async.h"
+
+using namespace minibm;
+
+namespace {
+
+  //! Runs posted functions on a fixed set of threads.
+  class ThreadExecutor {
+  private:
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+    bool stopping_ = false;
+    static std::atomic<uint64_t> taskCounter_;
+    static thread_local uint64_t currentTask_;
+    void run()
+    {
+      for ( ;; )
+      {
+        std::function<void()> task;
+        {
+          std::unique_lock<std::mutex> lock( lock_ );
+          wake_.wait( lock, [this]() { return stopping_ || !tasks_.empty(); } );
+          if ( tasks_.empty() )
+            return;
+          task = std::move( tasks_.front() );
+          tasks_.pop_front();
+        }
+        currentTask_ = ++taskCounter_;
+        task();
+        currentTask_ = 0;
+      }
+    }
+  public:
+    explicit ThreadExecutor( size_t threads )
+    {
+      for ( size_t i = 0; i < threads; ++i )
+        threads_.emplace_back( [this]() { run(); } );
+    }
+    ~ThreadExecutor()
+    {
+      {
+        std::lock_guard<std::mutex> lock( lock_ );
+        stopping_ = true;
+      }
+      wake_.notify_all();
+      for ( auto& thread : threads_ )
+        thread.join();
+    }
+    template <typename Function>
+    void post( Function&& fn )
+    {
+      {
+        std::lock_guard<std::mutex> lock( lock_ );
+        tasks_.emplace_back( std::forward<Function>( fn ) );
+      }
+      wake_.notify_one();
+    }
+    //! Unique id of the posted function the calling thread is running, or 0 outside of one.
+    //! A coroutine that is still in the same task after co_await was never suspended.
+    static uint64_t currentTask() { return currentTask_; }
+  };
+
+  std::atomic<uint64_t> ThreadExecutor::taskCounter_ = 0;
+  thread_local uint64_t ThreadExecutor::currentTask_ = 0;
+
+  //! Only counts what it is given to run, so that a test can see whether a waiter was scheduled.
+  struct CountingExecutor {
+    uint32_t posts_ = 0;
+    template <typename Function>
+    void post( Function&& ) { posts_++; }
+  };
+
+  // The simulated capture. Like the library, it hands out only the latest frame, never the same one twice.
+  std::mutex g_notifyLock;
+  fn_frame_notify g_notify = nullptr;
+  void* g_notifyUserdata = nullptr;
+  std::atomic<uint32_t> g_latest = 0;
+  std::atomic<uint32_t> g_taken = 0;
+
+  void MINIBM_CALL fakeSetFrameNotify( fn_frame_notify callback, void* userdata )
+  {
+    std::lock_guard<std::mutex> lock( g_notifyLock );
+    g_notify = callback;
+    g_notifyUserdata = userdata;
+  }
+
+  bool MINIBM_CALL fakeGetFrameBlocking( FrameInfo* out_frame, uint32_t )
+  {
+    auto latest = g_latest.load();
+    if ( latest <= g_taken.load() )
+      return false;
+    g_taken = latest;
+    *out_frame = {};
+    out_frame->index = latest;
+    return true;
+  }
+
+  //! Delivers frame index, or a stopped capture with 0, like the capture callback thread does.
+  void publish( uint32_t index )
+  {
+    if ( index )
+      g_latest = index;
+    else
+      g_latest = g_taken = 0;
+    std::lock_guard<std::mutex> lock( g_notifyLock );
+    if ( g_notify )
+      g_notify( index, g_notifyUserdata );
+  }
+
+  struct StreamStats {
+    std::atomic<uint32_t> frames_ = 0;
+    std::atomic<uint32_t> cancelled_ = 0;
+    std::atomic<uint32_t> stopped_ = 0;
+    std::atomic<uint32_t> missed_ = 0;
+    std::atomic<uint32_t> outOfOrder_ = 0;
+    std::atomic<uint32_t> readyInline_ = 0; //!< Frames that arrived between registering and suspending.
+    std::atomic<uint32_t> finished_ = 0;
+    std::atomic<bool> stopping_ = false; //!< Set once the capture is being stopped, which can take announced frames away.
+    std::mutex lock_;
+    std::condition_variable done_;
+    bool waitFinished( uint32_t count, std::chrono::milliseconds timeout )
+    {
+      std::unique_lock<std::mutex> lock( lock_ );
+      return done_.wait_for( lock, timeout, [&]() { return finished_.load() >= count; } );
+    }
+  };
+
+  //! Coroutine that nobody waits on. It runs until its first suspension right away.
+  struct Detached {
+    struct promise_type {
+      Detached get_return_object() { return {}; }
+      std::suspend_never initial_suspend() { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  Detached runStream( async::FrameSource& source, ThreadExecutor& executor, std::stop_token stop, StreamStats& stats )
+  {
+    uint32_t last = 0;
+    for ( ;; )
+    {
+      auto task = ThreadExecutor::currentTask();
+      auto result = co_await source.next_frame( executor, stop );
+      if ( result )
+      {
+        if ( ThreadExecutor::currentTask() == task )
+          stats.readyInline_++;
+        if ( result.frame.index <= last )
+          stats.outOfOrder_++;
+        last = result.frame.index;
+        stats.frames_++;
+        continue;
+      }
+      if ( result.status == async::FrameStatus::Missed )
+      {
+        // Nothing else takes frames, so only a stop in between can explain it
+        if ( !stats.stopping_ )
+          stats.missed_++;
+        continue;
+      }
+      if ( result.status == async::FrameStatus::Cancelled )
+        stats.cancelled_++;
+      else
+        stats.stopped_++;
+      break;
+    }
+    // Notified under the lock, since stats go away as soon as the last stream is seen finishing
+    std::lock_guard<std::mutex> lock( stats.lock_ );
+    stats.finished_++;
+    stats.done_.notify_all();
+  }
+
+  //! Steps through the awaiter by hand, to pin down both orders of completing and suspending.
+  //! A waiter completed before it suspends must carry on without being scheduled, and one
+  //! completed after must be scheduled exactly once.
+  bool checkSuspendOrder()
+  {
+    CountingExecutor executor;
+    async::FrameSource source( &fakeSetFrameNotify, &fakeGetFrameBlocking );
+    bool ok = true;
+
+    // Cancelled between await_ready and await_suspend: the stop callback runs during registration
+    {
+      std::stop_source stopper;
+      auto awaiter = source.next_frame( executor, stopper.get_token() );
+      ok &= !awaiter.await_ready();
+      stopper.request_stop();
+      ok &= !awaiter.await_suspend( std::noop_coroutine() );
+      ok &= ( awaiter.await_resume().status == async::FrameStatus::Cancelled && !executor.posts_ );
+    }
+
+    // Cancelled while suspended
+    {
+      std::stop_source stopper;
+      auto awaiter = source.next_frame( executor, stopper.get_token() );
+      ok &= !awaiter.await_ready();
+      ok &= awaiter.await_suspend( std::noop_coroutine() );
+      stopper.request_stop();
+      ok &= ( executor.posts_ == 1 );
+      ok &= ( awaiter.await_resume().status == async::FrameStatus::Cancelled );
+    }
+
+    // A frame while suspended
+    {
+      auto awaiter = source.next_frame( executor );
+      ok &= awaiter.await_suspend( std::noop_coroutine() );
+      publish( 1 );
+      ok &= ( executor.posts_ == 2 );
+      auto result = awaiter.await_resume();
+      ok &= ( result && result.frame.index == 1 );
+    }
+
+    publish( 0 );
+    if ( !ok )
+      printf( "async: waiters completed around suspending weren't resumed exactly once\r\n" );
+    return ok;
+  }
+
+  const uint32_t c_rounds = 50;
+  const uint32_t c_streams = 256;
+  const uint32_t c_framesPerRound = 2000; //!< Frames the streams take in total before the capture is stopped.
+  const uint32_t c_cancelEvery = 4; //!< Every this many streams waits with a stop token that is triggered mid-round.
+
+  //! Runs one round of streams against a stream of frames. Returns false if anything was off.
+  bool runRound( ThreadExecutor& executor, uint32_t round, uint32_t& out_frames, uint32_t& out_readyInline )
+  {
+    StreamStats stats;
+    std::stop_source stopper;
+    uint32_t expectCancelled = 0;
+    bool finished = false;
+    {
+      async::FrameSource source( &fakeSetFrameNotify, &fakeGetFrameBlocking );
+
+      // A token that has already been triggered never waits at all
+      std::stop_source stopped;
+      stopped.request_stop();
+      runStream( source, executor, stopped.get_token(), stats );
+      if ( stats.finished_ != 1 || stats.cancelled_ != 1 )
+      {
+        printf( "async round %u: a stopped token didn't cancel right away\r\n", round );
+        return false;
+      }
+      expectCancelled++;
+
+      for ( uint32_t i = 0; i < c_streams; ++i )
+      {
+        bool cancellable = ( i % c_cancelEvery == 0 );
+        expectCancelled += ( cancellable ? 1 : 0 );
+        runStream( source, executor, cancellable ? stopper.get_token() : std::stop_token(), stats );
+      }
+
+      // No pauses, so that frames keep landing while the executor threads re-register
+      // and stops hit waiters in every state, including between registering and suspending
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+      uint32_t index = 0;
+      while ( stats.frames_ < c_framesPerRound && std::chrono::steady_clock::now() < deadline )
+      {
+        publish( ++index );
+        if ( stats.frames_ >= c_framesPerRound / 2 && !stopper.stop_requested() )
+          stopper.request_stop();
+      }
+
+      // Stopping the capture ends every wait, but streams that were busy with a
+      // frame register again afterwards, so it's repeated until all have noticed
+      stats.stopping_ = true;
+      deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+      while ( !finished && std::chrono::steady_clock::now() < deadline )
+      {
+        publish( 0 );
+        finished = stats.waitFinished( c_streams + 1, std::chrono::milliseconds( 1 ) );
+      }
+      if ( !finished )
+      {
+        // Anything still waiting would be resumed into a destroyed source
+        printf( "async round %u: only %u of %u streams finished\r\n", round, stats.finished_.load(), c_streams + 1 );
+        fflush( stdout );
+        std::terminate();
+      }
+    }
+
+    out_frames += stats.frames_;
+    out_readyInline += stats.readyInline_;
+    if ( stats.cancelled_ != expectCancelled || stats.stopped_ != c_streams + 1 - expectCancelled
+      || stats.missed_ || stats.outOfOrder_ || stats.frames_ < c_framesPerRound )
+    {
+      printf( "async round %u: %u cancelled (expected %u), %u stopped, %u missed, %u out of order, %u frames\r\n",
+        round, stats.cancelled_.load(), expectCancelled, stats.stopped_.load(), stats.missed_.load(),
+        stats.outOfOrder_.load(), stats.frames_.load() );
+      return false;
+    }
+    return true;
+  }
+
+}
+
+//! Runs many simulated streams of next_frame() on a two-thread executor, with cancellation
+//! through stop tokens and frames racing the waiters' suspension. Frames landing between
+//! registering and suspending depend on timing, so they are only counted, after the same
+//! case has been checked for cancellation step by step. Returns true if all went as expected.
+bool testFrameSource()
+{
+  ThreadExecutor executor( 2 );
+  uint32_t frames = 0, readyInline = 0;
+  bool ok = checkSuspendOrder();
+  for ( uint32_t round = 0; round < c_rounds && ok; ++round )
+    ok = runRound( executor, round, frames, readyInline );
+
+  printf( "async: %u rounds of %u streams, %u frames delivered, %u of them before the waiter suspended: %s\r\n",
+    c_rounds, c_streams, frames, readyInline, ok ? "ok" : "FAILED" );
+  return ok;
+}
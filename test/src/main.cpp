@@ -24,6 +24,7 @@ minibm::fn_get_frame_bgra32_blocking get_frame_bgra32_blocking = nullptr;
 minibm::fn_stop_capture_single stop_capture_single = nullptr;
 minibm::fn_get_json_length get_json_length = nullptr;
 minibm::fn_get_json get_json = nullptr;
+minibm::fn_check_kernels check_kernels = nullptr;
 
 HMODULE lib = 0;
 
@@ -42,10 +43,11 @@ bool loadDynamically()
   get_frame_bgra32_blocking = (minibm::fn_get_frame_bgra32_blocking)GetProcAddress( lib, "get_frame_bgra32_blocking" );
   get_json_length = (minibm::fn_get_json_length)GetProcAddress(lib, "get_json_length");
   get_json = (minibm::fn_get_json)GetProcAddress(lib, "get_json");
+  check_kernels = (minibm::fn_check_kernels)GetProcAddress( lib, "check_kernels" );
 
   return ( get_version && get_devices && get_device && get_device_displaymode
     && start_capture_single && stop_capture_single && get_frame_bgra32_blocking 
-    && get_json_length && get_json );
+    && get_json_length && get_json && check_kernels );
 }
 
 void unloadDynamically()
@@ -61,6 +63,9 @@ void unloadDynamically()
 
 using namespace minibm;
 
+// asynctest.cpp
+bool testFrameSource();
+
 int wmain( int argc, wchar_t** argv, wchar_t** env )
 {
   if ( FAILED( CoInitializeEx( nullptr, COINIT_MULTITHREADED ) ) )
@@ -96,6 +101,11 @@ int wmain( int argc, wchar_t** argv, wchar_t** env )
   get_version( verstr, 256, &minibmVer );
   printf( "get_version: %s / minibmcap API version %i\r\n", verstr, minibmVer );
 
+  uint32_t kernelMismatches = check_kernels();
+  printf( "check_kernels: %i variants differ from the reference\r\n", kernelMismatches );
+
+  bool asyncPassed = testFrameSource();
+
   int jsonLen = get_json_length();
   printf("get_json_len: %i\r\n", jsonLen);
 
@@ -172,5 +182,5 @@ int wmain( int argc, wchar_t** argv, wchar_t** env )
 
   CoUninitialize();
 
-  return 0;
+  return ( kernelMismatches || !asyncPassed ? 1 : 0 );
 }
\ No newline at end of file